@@ -0,0 +1,68 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "HttpAssetCacheWriter.h"
+
+#include "AssetCache.h"
+
+#include <Engine/IO/File.h>
+#include <Engine/IO/FileSystem.h>
+
+namespace Tundra
+{
+
+HttpAssetCacheWriter::HttpAssetCacheWriter(Urho3D::Context *context, const String &path, uint maxSkippedSize) :
+    context_(context),
+    path_(path),
+    maxSkippedSize_(maxSkippedSize),
+    hash_(AssetCache::HashContent(0, 0)),
+    size_(0),
+    complete_(false)
+{
+}
+
+HttpAssetCacheWriter::~HttpAssetCacheWriter()
+{
+    file_.Reset();
+    Urho3D::FileSystem *fileSystem = context_->GetSubsystem<Urho3D::FileSystem>();
+    if (fileSystem && fileSystem->FileExists(path_))
+        fileSystem->Delete(path_);
+}
+
+bool HttpAssetCacheWriter::BeginBody(int statusCode, uint contentLength)
+{
+    // @note Invoked in worker thread context
+    if (statusCode != 200 || (contentLength > 0 && contentLength <= maxSkippedSize_))
+        return false;
+
+    file_ = new Urho3D::File(context_, path_, Urho3D::FILE_WRITE);
+    if (!file_->IsOpen())
+    {
+        file_.Reset();
+        return false;
+    }
+    return true;
+}
+
+bool HttpAssetCacheWriter::ReceiveBody(const u8 *data, uint numBytes)
+{
+    // @note Invoked in worker thread context
+    if (file_->Write(data, numBytes) != numBytes)
+    {
+        file_.Reset();
+        return false;
+    }
+    hash_ = AssetCache::HashContent(data, numBytes, hash_);
+    size_ += numBytes;
+    return true;
+}
+
+void HttpAssetCacheWriter::EndBody(bool complete)
+{
+    // @note Invoked in worker thread context
+    file_->Close();
+    file_.Reset();
+    complete_ = complete && size_ > 0;
+}
+
+}
@@ -0,0 +1,60 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "HttpPluginApi.h"
+#include "IHttpBodyReceiver.h"
+
+#include <Engine/Container/Ptr.h>
+#include <Engine/Container/Str.h>
+
+namespace Urho3D
+{
+    class Context;
+    class File;
+}
+
+namespace Tundra
+{
+
+/// Writes the body of a '200 OK' asset response to a file in the asset cache as it is downloaded.
+/** The content hash of the body is computed along the way, so that the complete file can be moved into the asset cache
+    with AssetCache::StoreFile without reading or writing the data again in the main thread. The file is deleted when
+    the writer is destroyed, unless it was moved. */
+class TUNDRA_HTTP_API HttpAssetCacheWriter : public IHttpBodyReceiver
+{
+public:
+    /// @param path File to write to, see AssetCache::NewStreamFile.
+    /// @param maxSkippedSize Bodies of this size or less are not written, as the asset cache packs them. 0 to write all bodies.
+    HttpAssetCacheWriter(Urho3D::Context *context, const String &path, uint maxSkippedSize);
+    ~HttpAssetCacheWriter();
+
+    /// IHttpBodyReceiver override.
+    bool BeginBody(int statusCode, uint contentLength) override;
+    /// IHttpBodyReceiver override.
+    bool ReceiveBody(const u8 *data, uint numBytes) override;
+    /// IHttpBodyReceiver override.
+    void EndBody(bool complete) override;
+
+    /// Returns whether the whole body was written to the file.
+    /** @note Call only after the request has completed. */
+    bool IsComplete() const { return complete_; }
+
+    /// Returns the file the body was written to.
+    const String &Path() const { return path_; }
+    /// Returns the content hash of the written body.
+    unsigned long long Hash() const { return hash_; }
+    /// Returns the number of bytes written.
+    uint Size() const { return size_; }
+
+private:
+    Urho3D::Context *context_;
+    SharedPtr<Urho3D::File> file_;
+    String path_;
+    uint maxSkippedSize_;
+    unsigned long long hash_;
+    uint size_;
+    bool complete_;
+};
+
+}
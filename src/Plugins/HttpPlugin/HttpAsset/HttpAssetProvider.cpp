@@ -3,16 +3,21 @@
 #include "StableHeaders.h"
 #include "HttpClient.h"
 #include "HttpRequest.h"
+#include "HttpDefines.h"
 
 #include "HttpAssetProvider.h"
 #include "HttpAssetStorage.h"
 #include "HttpAssetTransfer.h"
+#include "HttpAssetCacheWriter.h"
 
 #include "AssetAPI.h"
 #include "AssetCache.h"
-#include "IAssetTransfer.h" /// @todo HttpAssetTransfer
+#include "IAsset.h"
 
 #include "Framework.h"
+#include "LoggingFunctions.h"
+
+#include <Engine/Core/Timer.h>
 
 namespace Tundra
 {
@@ -27,6 +32,10 @@ HttpAssetProvider::HttpAssetProvider(Framework *framework, const HttpClientPtr &
 HttpAssetProvider::~HttpAssetProvider()
 {
     httpStorages_.Clear();
+    cachedTransfers_.Clear();
+    for(HashMap<String, Revalidation>::Iterator iter = revalidations_.Begin(); iter != revalidations_.End(); ++iter)
+        iter->second_.request->Finished.Disconnect(this, &HttpAssetProvider::OnRevalidated);
+    revalidations_.Clear();
 }
 
 AssetStoragePtr HttpAssetProvider::StorageForBaseURL(const String &url) const
@@ -80,14 +89,161 @@ AssetTransferPtr HttpAssetProvider::RequestAsset(String assetRef, String assetTy
 {
     assetRef = assetRef.Trimmed();
 
-    HttpRequestPtr request = client_->Get(assetRef);
-    if (!request)
-        return AssetTransferPtr();
-    
-    AssetTransferPtr transfer(new HttpAssetTransfer(this, request, assetRef, assetType));
+    HttpAssetTransferPtr transfer(new HttpAssetTransfer(this, assetRef, assetType));
     transfer->provider = this;
 
-    return transfer;
+    /* Serve cached assets from the cache, unless the source requires them to be revalidated first. Stale ones are
+       revalidated in the background. The transfer completes on the next Update, as AssetAPI tracks it only after this returns. */
+    AssetCache *cache = framework_->Asset()->Cache();
+    if (cache && cache->Contains(assetRef) && !cache->MustRevalidate(assetRef))
+    {
+        if (cache->Expires(assetRef) <= Urho3D::Time::GetTimeSinceEpoch())
+            Revalidate(assetRef);
+        cachedTransfers_.Push(transfer);
+        return AssetTransferPtr(transfer.Get());
+    }
+
+    if (!transfer->Start())
+        return AssetTransferPtr();
+    return AssetTransferPtr(transfer.Get());
+}
+
+void HttpAssetProvider::Update(float /*frametime*/)
+{
+    if (cachedTransfers_.Empty())
+        return;
+
+    Vector<HttpAssetTransferPtr> transfers;
+    transfers.Swap(cachedTransfers_);
+    for(uint i = 0; i < transfers.Size(); ++i)
+    {
+        HttpAssetTransfer *transfer = transfers[i];
+        if (transfer->CompleteFromCache())
+            continue;
+        // The asset was evicted from the cache after it was requested
+        if (!transfer->Start())
+            framework_->Asset()->AssetTransferFailed(transfer, "Failed to create a HTTP request for " + transfer->source.ref);
+    }
+}
+
+SharedPtr<HttpAssetCacheWriter> HttpAssetProvider::PrepareRequest(const HttpRequestPtr &request, const String &assetRef)
+{
+    AssetCache *cache = framework_->Asset()->Cache();
+    if (!cache)
+        return SharedPtr<HttpAssetCacheWriter>();
+
+    // Validators for a '304 Not Modified' response from the asset cache index.
+    if (cache->Contains(assetRef))
+    {
+        uint lastModified = cache->LastModified(assetRef);
+        if (lastModified > 0)
+            request->SetHeader(Http::Header::IfModifiedSince, Http::LocalEpochToHttpDate(static_cast<time_t>(lastModified)));
+        String etag = cache->ETag(assetRef);
+        if (!etag.Empty())
+            request->SetHeader(Http::Header::IfNoneMatch, etag);
+    }
+
+    /* Write large bodies to the asset cache in the worker thread as they are downloaded, so that
+       storing the asset does not write it again in the main thread. The cache packs small assets itself. */
+    SharedPtr<HttpAssetCacheWriter> cacheWriter(new HttpAssetCacheWriter(framework_->GetContext(), cache->NewStreamFile(), cache->MaxPackedSize()));
+    request->SetBodyReceiver(HttpBodyReceiverPtr(cacheWriter.Get()));
+    return cacheWriter;
+}
+
+String HttpAssetProvider::StoreStreamedBody(HttpAssetCacheWriter *cacheWriter, uint bodySize, const String &assetRef)
+{
+    AssetCache *cache = framework_->Asset()->Cache();
+    if (!cache || !cacheWriter || !cacheWriter->IsComplete() || cacheWriter->Size() != bodySize)
+        return "";
+    return cache->StoreFile(cacheWriter->Path(), cacheWriter->Hash(), cacheWriter->Size(), assetRef);
+}
+
+void HttpAssetProvider::StoreCacheHeaders(const HttpRequestPtr &request, const String &assetRef)
+{
+    AssetCache *cache = framework_->Asset()->Cache();
+    if (!cache || !cache->Contains(assetRef))
+        return;
+
+    // A '304 Not Modified' response may omit the validators that did not change
+    const String lastModified = request->ResponseHeader(Http::Header::LastModified);
+    const String etag = request->ResponseHeader(Http::Header::ETag);
+    if (request->StatusCode() == 200 || !lastModified.Empty())
+    {
+        time_t epoch = (!lastModified.Empty() ? Http::HttpDateToUtcEpoch(lastModified) : 0);
+        cache->SetLastModified(assetRef, epoch > 0 ? static_cast<uint>(epoch) : 0);
+    }
+    if (request->StatusCode() == 200 || !etag.Empty())
+        cache->SetETag(assetRef, etag);
+
+    bool mustRevalidate = false;
+    time_t freshUntil = Http::FreshUntil(request->ResponseHeader(Http::Header::CacheControl), request->ResponseHeader(Http::Header::Expires),
+        request->ResponseHeader(Http::Header::Date), request->ResponseHeaderUInt(Http::Header::Age), static_cast<time_t>(Urho3D::Time::GetTimeSinceEpoch()),
+        mustRevalidate);
+    cache->SetFreshness(assetRef, freshUntil > 0 ? static_cast<uint>(freshUntil) : 0, mustRevalidate);
+}
+
+void HttpAssetProvider::Revalidate(const String &assetRef)
+{
+    if (revalidations_.Contains(assetRef))
+        return;
+
+    Revalidation revalidation;
+    revalidation.request = client_->Get(assetRef);
+    if (!revalidation.request)
+        return;
+    revalidation.cacheWriter = PrepareRequest(revalidation.request, assetRef);
+    revalidation.request->SetPriority(RevalidatePriority);
+    revalidation.request->Finished.Connect(this, &HttpAssetProvider::OnRevalidated);
+    revalidations_[assetRef] = revalidation;
+}
+
+void HttpAssetProvider::OnRevalidated(HttpRequestPtr &request, int status, const String &error)
+{
+    HashMap<String, Revalidation>::Iterator iter = revalidations_.Begin();
+    while(iter != revalidations_.End() && iter->second_.request != request)
+        ++iter;
+    if (iter == revalidations_.End())
+        return;
+    const String assetRef = iter->first_;
+    SharedPtr<HttpAssetCacheWriter> cacheWriter = iter->second_.cacheWriter;
+    revalidations_.Erase(iter);
+
+    AssetAPI *assetAPI = framework_->Asset();
+    AssetCache *cache = assetAPI->Cache();
+    if (!cache)
+        return;
+
+    if (status == 304 && error.Empty())
+        StoreCacheHeaders(request, assetRef);
+    else if (status == 200 && error.Empty())
+    {
+        Vector<u8> body;
+        request->TakeResponseBody(body);
+        if (body.Empty())
+            return;
+
+        AssetPtr asset = assetAPI->FindAsset(assetRef);
+        const unsigned long long previousHash = cache->ContentHash(assetRef);
+        String diskSource = StoreStreamedBody(cacheWriter, body.Size(), assetRef);
+        if (diskSource.Empty())
+            diskSource = cache->StoreAsset(&body[0], body.Size(), assetRef, !asset || !asset->RequiresDiskSource());
+        cacheWriter.Reset();
+        if (!cache->Contains(assetRef))
+            return;
+        StoreCacheHeaders(request, assetRef);
+
+        // Reload the asset from the new content, if it is in use
+        if (asset && cache->ContentHash(assetRef) != previousHash)
+        {
+            LogDebug("HttpAssetProvider: Cached asset " + assetRef + " has changed, reloading.");
+            asset->SetDiskSource(cache->IsPacked(assetRef) ? String() : diskSource);
+            if (asset->IsLoaded())
+                asset->LoadFromCache();
+        }
+    }
+    else
+        LogDebug("HttpAssetProvider: Revalidating cached asset " + assetRef + " failed: " +
+            (!error.Empty() ? error : Urho3D::ToString("%d %s", status, request->Status().CString())));
 }
 
 bool HttpAssetProvider::AbortTransfer(IAssetTransfer *transfer)
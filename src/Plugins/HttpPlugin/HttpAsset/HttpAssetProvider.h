@@ -10,7 +10,13 @@
 namespace Tundra
 {
 
+class HttpAssetCacheWriter;
+
 /// HTTP asset provider.
+/** Assets in the asset cache that their source reported fresh (Cache-Control max-age or Expires) are served from the cache
+    without a request. Stale cached assets are served from the cache as well, and revalidated with a conditional request in
+    the background; if the content has changed, the new content is stored to the cache and loaded assets are reloaded.
+    Only assets whose source requires it (Cache-Control no-cache or must-revalidate) are revalidated before they are used. */
 class TUNDRA_HTTP_API HttpAssetProvider : public IAssetProvider
 {
     OBJECT(HttpAssetProvider);
@@ -20,6 +26,10 @@ public:
     ~HttpAssetProvider();
 
     Framework *Fw() { return framework_; }
+    HttpClient *Client() { return client_.Get(); }
+
+    /// Priority of the background revalidation requests, lower than that of asset prefetching, see AssetPrefetch::RequestPriority.
+    static const int RevalidatePriority = -2;
 
     /// IAssetProvider override.
     String Name() const override;
@@ -27,6 +37,8 @@ public:
     bool IsValidRef(String assetRef, String assetType) const override;
     /// IAssetProvider override.
     AssetTransferPtr RequestAsset(String assetRef, String assetType) override;
+    /// IAssetProvider override. Completes the transfers served from the asset cache.
+    void Update(float frametime) override;
     /// IAssetProvider override.
     bool AbortTransfer(IAssetTransfer *transfer) override;
     /// IAssetProvider override.
@@ -44,6 +56,31 @@ public:
         AssetStoragePtr destination, const String &assetName) override;
 
 private:
+    friend class HttpAssetTransfer;
+
+    /// A background revalidation of a cached asset.
+    struct Revalidation
+    {
+        HttpRequestPtr request;
+        SharedPtr<HttpAssetCacheWriter> cacheWriter;
+    };
+
+    /// Sets the validators of the cached asset to a request, and a writer that streams the response body to the asset cache.
+    /// @return The writer, null if there is no asset cache.
+    SharedPtr<HttpAssetCacheWriter> PrepareRequest(const HttpRequestPtr &request, const String &assetRef);
+
+    /// Moves a response body, streamed to disk by @c cacheWriter, into the asset cache.
+    /// @return The disk source of the stored asset, or empty if the body was not completely streamed to disk.
+    String StoreStreamedBody(HttpAssetCacheWriter *cacheWriter, uint bodySize, const String &assetRef);
+
+    /// Stores the validators and the freshness of a '200 OK' or '304 Not Modified' response to the asset cache index.
+    void StoreCacheHeaders(const HttpRequestPtr &request, const String &assetRef);
+
+    /// Starts a background revalidation of the cached asset, unless one is already in progress.
+    void Revalidate(const String &assetRef);
+
+    void OnRevalidated(HttpRequestPtr &request, int status, const String &error);
+
     /// IAssetProvider override.
     AssetStoragePtr TryCreateStorage(HashMap<String, String> &storageParams, bool fromNetwork) override;
 
@@ -57,6 +94,11 @@ private:
     HttpClientPtr client_;
 
     Vector<AssetStoragePtr> httpStorages_;
+
+    /// Transfers to complete from the asset cache on the next Update.
+    Vector<HttpAssetTransferPtr> cachedTransfers_;
+    /// Background revalidations in progress, by asset ref.
+    HashMap<String, Revalidation> revalidations_;
 };
 
 }
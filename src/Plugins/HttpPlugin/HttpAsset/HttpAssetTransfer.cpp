@@ -3,10 +3,12 @@
 #include "StableHeaders.h"
 #include "HttpAssetTransfer.h"
 #include "HttpAssetProvider.h"
+#include "HttpAssetCacheWriter.h"
 #include "HttpRequest.h"
 
 #include "AssetAPI.h"
 #include "AssetCache.h"
+#include "AssetCachePack.h"
 
 #include "Framework.h"
 #include "LoggingFunctions.h"
@@ -14,7 +16,7 @@
 namespace Tundra
 {
 
-HttpAssetTransfer::HttpAssetTransfer(HttpAssetProvider *provider, HttpRequestPtr &request, const String &assetRef_, const String &assetType_) :
+HttpAssetTransfer::HttpAssetTransfer(HttpAssetProvider *provider, const String &assetRef_, const String &assetType_) :
     provider_(provider)
 {
     // Prepare IAssetTransfer
@@ -24,49 +26,83 @@ HttpAssetTransfer::HttpAssetTransfer(HttpAssetProvider *provider, HttpRequestPtr
     /* At this point we don't know if we can use the cached asset. 
        Once 304 response is detected, this will be changed to Cached. */
     diskSourceType = IAsset::Original; 
+}
 
-    // Cache destination path and source for 'If-Modified-Since' for a '304 Not Modified' response.
-    if (provider_->Fw()->Asset()->Cache())
-    {
-        String cacheFile = provider_->Fw()->Asset()->Cache()->DiskSourceByRef(source.ref);
-        request->SetCacheFile(cacheFile, true);
-        /* Indicated so AssetAPI that we will take care of writing the cache, but it can find
-           the source file from this path. */
-        SetCachingBehavior(false, cacheFile);
-    }
+HttpAssetTransfer::~HttpAssetTransfer()
+{
+}
 
-    // Connect to finished signal
+void HttpAssetTransfer::SetPriority(int priority)
+{
+    IAssetTransfer::SetPriority(priority);
+    if (request_)
+        request_->SetPriority(priority);
+}
+
+bool HttpAssetTransfer::Start()
+{
+    HttpRequestPtr request = provider_->Client()->Get(source.ref);
+    if (!request)
+        return false;
+
+    request_ = request;
+    cacheWriter_ = provider_->PrepareRequest(request, source.ref);
+    request->SetPriority(Priority());
     request->Finished.Connect(this, &HttpAssetTransfer::OnFinished);
+    return true;
 }
 
-HttpAssetTransfer::~HttpAssetTransfer()
+bool HttpAssetTransfer::CompleteFromCache()
 {
+    /* Load the data from a memory mapped view to the asset cache, and mark disk source as cached,
+       so that AssetAPI does not rewrite the cache file. Packed assets have no file of their own. */
+    AssetCache *cache = provider_->Fw()->Asset()->Cache();
+    cachedAssetData = (cache ? cache->View(source.ref) : AssetCacheViewPtr());
+    if (!cachedAssetData)
+        return false;
+    diskSourceType = IAsset::Cached;
+    SetCachingBehavior(false, cache->IsPacked(source.ref) ? String() : cache->DiskSourceByRef(source.ref));
+
+    provider_->Fw()->Asset()->AssetTransferCompleted(this);
+    return true;
 }
 
 void HttpAssetTransfer::OnFinished(HttpRequestPtr &request, int status, const String &error)
 {
+    AssetAPI *assetAPI = provider_->Fw()->Asset();
+    request_.Reset();
+
     // We can consider 200 and 304 as success. Other 3xx codes may represent redirects to the real location,
     // but these redirects are automatically detected and executed by HttpRequest.
-    if ((status == 200 || status == 304) && error.Empty())
+    if (status == 200 && error.Empty())
+    {
+        /* AssetAPI stores the data to the asset cache. The validators and freshness of the response are stored
+           to the cache index after that, for the 'If-Modified-Since' and 'If-None-Match' of the next request.
+           This transfer may be gone once AssetTransferCompleted returns, so copy what is needed. */
+        const String ref = source.ref;
+        HttpAssetProvider *provider = provider_;
+
+        request->TakeResponseBody(rawAssetData);
+        // If the body is already on disk, move it into the cache instead of having AssetAPI store it
+        String diskSource = provider_->StoreStreamedBody(cacheWriter_, rawAssetData.Size(), ref);
+        if (!diskSource.Empty())
+            SetCachingBehavior(false, diskSource);
+        cacheWriter_.Reset();
+
+        assetAPI->AssetTransferCompleted(this);
+
+        provider->StoreCacheHeaders(request, ref);
+    }
+    else if (status == 304 && error.Empty())
     {
-        /* 304 Not Modified
-           1) HttpRequest has already written file to asset cache file set with HttpRequest::SetCacheFile()
-           2) Mark disk source as cached. Previous SetCachingBehavior already marked so that AssetAPI wont
-              rewrite the disk file even if we provide rawAssetData.
-           3) If we do not load 'rawAssetData' with a valid disk source. AssetAPI will do the right thing and load
-              bytes from disk. This was desirable with Ogre as its threading mechanisms let us pass a filepath.
-              If it was a certain type of Ogre asset, the disk read was skipped and path was used. With Urho it is more efficient 
-              to do a memcpy here and not re-read from disk, which is slower as we already have the file in memory here.
-              @todo In other works for above: AssetAPI and its 'data shuffling' could be re-thinked with Urho. */
-        if (status == 304)
-            diskSourceType = IAsset::Cached;
-
-        request->CopyResponseBodyTo(rawAssetData);
-
-        provider_->Fw()->Asset()->AssetTransferCompleted(this);
+        // 304 Not Modified
+        cacheWriter_.Reset();
+        provider_->StoreCacheHeaders(request, source.ref);
+        if (!CompleteFromCache())
+            assetAPI->AssetTransferFailed(this, "304 Not Modified, but the asset is not in the asset cache");
     }
     else
-        provider_->Fw()->Asset()->AssetTransferFailed(this, (!error.Empty() ? error : Urho3D::ToString("%d %s", status, request->Status().CString())));
+        assetAPI->AssetTransferFailed(this, (!error.Empty() ? error : Urho3D::ToString("%d %s", status, request->Status().CString())));
 }
 
 }
@@ -10,17 +10,35 @@
 namespace Tundra
 {
 
+class HttpAssetCacheWriter;
+
 /// HTTP asset transfer
+/** Completes either from the response of a HTTP request, see Start, or directly from the asset cache, see CompleteFromCache. */
 class TUNDRA_HTTP_API HttpAssetTransfer : public IAssetTransfer
 {
 public:
-    HttpAssetTransfer(HttpAssetProvider *provider, HttpRequestPtr &request, const String &assetRef_, const String &assetType_);
+    HttpAssetTransfer(HttpAssetProvider *provider, const String &assetRef_, const String &assetType_);
     ~HttpAssetTransfer();
 
+    /// IAssetTransfer override. Sets the priority of the HTTP request.
+    void SetPriority(int priority) override;
+
+    /// Starts the HTTP request for the asset, conditional if the asset is in the asset cache.
+    /// @return False if the request could not be created.
+    bool Start();
+
+    /// Completes the transfer from the data in the asset cache, without a HTTP request.
+    /// @return False if the asset is no longer in the asset cache, in which case the transfer has not completed.
+    bool CompleteFromCache();
+
 private:
     void OnFinished(HttpRequestPtr &request, int status, const String &error);
 
     HttpAssetProvider *provider_;
+    /// The request, until it has finished.
+    HttpRequestPtr request_;
+    /// Writes the response body to the asset cache as it is downloaded.
+    SharedPtr<HttpAssetCacheWriter> cacheWriter_;
 };
 
 }
@@ -21,6 +21,10 @@ HttpClient::HttpClient(Framework *framework) :
     {
         queue_ = new HttpWorkQueue();
 
+        StringVector maxConnections = framework->CommandLineParameters("--httpMaxConnectionsPerHost");
+        if (!maxConnections.Empty())
+            queue_->SetMaxConnectionsPerHost(Urho3D::ToUInt(maxConnections.Front()));
+
         if (Stats())
             framework->Console()->RegisterCommand("httpStats", "Dump HTTP statistics to stdout", this, &HttpClient::DumpStats);
     }
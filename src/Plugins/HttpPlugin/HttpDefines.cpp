@@ -199,11 +199,51 @@ time_t HttpDateToUtcEpoch(const String &date)
 #endif
 }
 
+time_t FreshUntil(const String &cacheControl, const String &expires, const String &date, uint age, time_t now, bool &mustRevalidate)
+{
+    mustRevalidate = false;
+    bool hasMaxAge = false;
+    time_t maxAge = 0;
+
+    StringVector directives = cacheControl.Split(',');
+    for(uint i = 0; i < directives.Size(); ++i)
+    {
+        String directive = directives[i].Trimmed().ToLower();
+        if (directive == "no-cache" || directive == "no-store")
+        {
+            mustRevalidate = true;
+            return now;
+        }
+        else if (directive == "must-revalidate" || directive == "proxy-revalidate")
+            mustRevalidate = true;
+        else if (directive.StartsWith("max-age="))
+        {
+            hasMaxAge = true;
+            maxAge = static_cast<time_t>(Urho3D::ToUInt(directive.Substring(8).Trimmed()));
+        }
+    }
+    if (hasMaxAge)
+        return (maxAge > static_cast<time_t>(age) ? now + maxAge - static_cast<time_t>(age) : now);
+
+    if (expires.Empty())
+        return 0;
+    // Invalid dates, such as "0", mean already expired
+    time_t expiresEpoch = (expires.Trimmed().Split(' ').Size() == 6 ? HttpDateToUtcEpoch(expires) : 0);
+    if (expiresEpoch <= 0)
+        return now;
+    time_t dateEpoch = (!date.Empty() ? HttpDateToUtcEpoch(date) : 0);
+    if (dateEpoch <= 0)
+        return expiresEpoch;
+    return (expiresEpoch > dateEpoch ? now + (expiresEpoch - dateEpoch) : now);
+}
+
 // RequestData
 
 RequestData::RequestData() :
     curlHandle(0),
     curlHeaders(0),
+    borrowedHandle(false),
+    numConnects(-1),
     msecNetwork(-1),
     msecDiskRead(-1),
     msecDiskWrite(-1),
@@ -265,7 +305,9 @@ Stats::Stats() :
     downloads(0),
     uploads(0),
     diskReads(0),
-    diskWrites(0)
+    diskWrites(0),
+    connectionsOpened(0),
+    connectionsReused(0)
 {   
 }
 
@@ -329,6 +371,13 @@ void Stats::Dump(bool io_, bool averages_)
         PadString("", 12).CString(),
         PadString("", 12).CString()
     );
+    uint connected = connectionsOpened + connectionsReused;
+    l.InfoF("%s %s opened %s reused (%.1f%%)",
+        PadString("Connections", 14).CString(),
+        PadString(connectionsOpened, 12).CString(),
+        PadString(connectionsReused, 12).CString(),
+        connected > 0 ? 100.0 * connectionsReused / connected : 0.0
+    );
 }
 
 // Stats::IO
@@ -108,6 +108,16 @@ namespace Http
     /** @see http://tools.ietf.org/html/rfc2616#page-134 */
     time_t HttpDateToUtcEpoch(const String &date);
 
+    /// Returns the UTC epoch seconds until which a response is fresh, from its caching headers.
+    /** Cache-Control max-age takes precedence over Expires, which is taken relative to Date when present, to not depend on
+        the local clock. no-cache and no-store responses are stale right away.
+        @param age Value of the Age header, 0 if not present.
+        @param now Current UTC epoch seconds.
+        @param mustRevalidate [out] Set to whether the response must be revalidated before it is used once it is stale.
+        @return 0 if the response has no freshness information.
+        @see http://tools.ietf.org/html/rfc7234#section-4.2 */
+    time_t FreshUntil(const String &cacheControl, const String &expires, const String &date, uint age, time_t now, bool &mustRevalidate);
+
     /// @cond PRIVATE
     // Everything below is an implementation detail.
 
@@ -153,6 +163,12 @@ namespace Http
         // Error occurred during threaded run.
         String error;
 
+        // Whether curlHandle belongs to the worker thread, and is reset instead of cleaned up after the request.
+        bool borrowedHandle;
+
+        // Number of new connections the request opened, 0 if it reused a kept alive connection.
+        long numConnects;
+
         // Time spent executing request and processing data.
         int msecNetwork;
         int msecDiskRead;
@@ -236,6 +252,10 @@ namespace Http
         uint diskReads;
         uint diskWrites;
 
+        // Connections opened, and requests that reused a kept alive connection.
+        uint connectionsOpened;
+        uint connectionsReused;
+
         Totals totals;
         Averages averages;
 
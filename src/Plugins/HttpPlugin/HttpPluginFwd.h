@@ -22,10 +22,13 @@ namespace Tundra
     class HttpWorkQueue;
     class HttpClient;
     class HttpRequest;
+    class IHttpBodyReceiver;
 
     typedef SharedPtr<HttpWorkQueue> HttpWorkQueuePtr;
+    typedef WeakPtr<HttpWorkQueue> HttpWorkQueueWeakPtr;
     typedef SharedPtr<HttpClient> HttpClientPtr;
     typedef SharedPtr<HttpRequest> HttpRequestPtr;
+    typedef SharedPtr<IHttpBodyReceiver> HttpBodyReceiverPtr;
     typedef Vector<HttpRequestPtr> HttpRequestPtrList;
 
     typedef std::map<String, String, StringCompareCaseInsensitive> HttpHeaderMap;
@@ -2,6 +2,7 @@
 
 #include "StableHeaders.h"
 #include "HttpRequest.h"
+#include "HttpWorkQueue.h"
 
 #include "Framework.h"
 #include "JSON.h"
@@ -23,7 +24,9 @@ namespace Tundra
 
 HttpRequest::HttpRequest(Framework* framework, int method, const String &url) :
     framework_(framework),
+    priority_(0),
     log("HttpRequest"),
+    receivingBody_(false),
     executing_(false),
     verbose_(false),
     completed_(false)
@@ -31,6 +34,11 @@ HttpRequest::HttpRequest(Framework* framework, int method, const String &url) :
     requestData_.method = method;
     requestData_.options[Options::Url] = Curl::Option(CURLOPT_URL, Variant(url));
     requestData_.options[Options::Method] = Curl::Option(static_cast<CURLoption>(Http::Method::CurlOption(method)), Http::Method::CurlOptionValue(method));
+
+    // "scheme://host:port"
+    unsigned hostStart = url.Find("://");
+    hostStart = (hostStart != String::NPOS ? hostStart + 3 : 0);
+    host_ = url.Substring(0, url.Find('/', hostStart)).ToLower();
 }
 
 HttpRequest::~HttpRequest()
@@ -58,6 +66,22 @@ bool HttpRequest::HasCompleted()
     return completed_;
 }
 
+void HttpRequest::SetPriority(int priority)
+{
+    {
+        Urho3D::MutexLock m(mutexExecute_);
+        priority_ = priority;
+    }
+    if (queue_)
+        queue_->SetPriority(this, priority);
+}
+
+int HttpRequest::Priority()
+{
+    Urho3D::MutexLock m(mutexExecute_);
+    return priority_;
+}
+
 void HttpRequest::SetVerbose(bool enabled)
 {
     Urho3D::MutexLock m(mutexExecute_);
@@ -252,6 +276,18 @@ bool HttpRequest::SetCacheFile(const String &filepath, const String &lastModifie
     return true;
 }
 
+bool HttpRequest::SetBodyReceiver(const HttpBodyReceiverPtr &receiver)
+{
+    Urho3D::MutexLock m(mutexExecute_);
+    if (executing_)
+    {
+        log.Error("SetBodyReceiver: Cannot set body receiver to a running request.");
+        return false;
+    }
+    bodyReceiver_ = receiver;
+    return true;
+}
+
 // Response API
 
 int HttpRequest::StatusCode()
@@ -305,6 +341,17 @@ uint HttpRequest::ResponseBodySize()
     return responseData_.bodyBytes.Size();
 }
 
+bool HttpRequest::TakeResponseBody(Vector<u8> &dest)
+{
+    if (!HasCompleted() || responseData_.bodyBytes.Empty())
+        return false;
+    // Release the old buffer of dest, and leave the body without one
+    Vector<u8> old;
+    old.Swap(dest);
+    dest.Swap(responseData_.bodyBytes);
+    return true;
+}
+
 bool HttpRequest::CopyResponseBodyTo(Vector<u8> &dest)
 {
     if (!HasCompleted() || responseData_.bodyBytes.Empty())
@@ -531,16 +578,25 @@ uint HttpRequest::HeaderUIntInternal(const String &name, uint defaultValue, bool
     return value;
 }
 
-void HttpRequest::Perform()
+void HttpRequest::Perform(Curl::RequestHandle *handle, Curl::EngineHandle *share)
 {
     // @note Invoked in worker thread context
+    if (handle && !requestData_.curlHandle)
+    {
+        requestData_.curlHandle = handle;
+        requestData_.borrowedHandle = true;
+    }
     {
         Urho3D::MutexLock m(mutexExecute_);
-        executing_ = Prepare();
+        executing_ = Prepare(share);
         completed_ = !executing_;
     }
     if (!executing_)
+    {
+        // Hand the handle back to the worker thread
+        Cleanup();
         return;
+    }
 
     Urho3D::Timer timer;
     CURLcode res = curl_easy_perform(requestData_.curlHandle);
@@ -566,6 +622,8 @@ void HttpRequest::Perform()
             log.ErrorF("Failed to read response download speed");
         if (curl_easy_getinfo(requestData_.curlHandle, CURLINFO_SPEED_UPLOAD, &responseData_.uploadBytesPerSec) != CURLE_OK)
             log.ErrorF("Failed to read response upload speed");
+        if (curl_easy_getinfo(requestData_.curlHandle, CURLINFO_NUM_CONNECTS, &requestData_.numConnects) != CURLE_OK)
+            requestData_.numConnects = -1;
 
         // Parse headers if not done yet.
         ParseHeaders();
@@ -621,6 +679,13 @@ void HttpRequest::Perform()
         }
     }
 
+    if (receivingBody_)
+    {
+        uint contentLenght = HeaderUIntInternal(Http::Header::ContentLength, 0, true, false);
+        bodyReceiver_->EndBody(res == CURLE_OK && (contentLenght == 0 || responseData_.bodyBytes.Size() == contentLenght));
+        receivingBody_ = false;
+    }
+
     Cleanup();
 
     {
@@ -630,13 +695,12 @@ void HttpRequest::Perform()
     }
 }
 
-bool HttpRequest::Prepare()
+bool HttpRequest::Prepare(Curl::EngineHandle *share)
 {
     // @note Invoked in worker thread context
 
-    /* @todo If we want to reuse the curl handle, its possible,
-       but not within the same HttpRequest. They would need to be pooled somewhere.
-       Research if this would make a perf difference. */
+    /* The worker threads lend their own handles, which keep their connections alive
+       between requests. A handle of our own is only created when executed without one. */
     if (!requestData_.curlHandle)
         requestData_.curlHandle = curl_easy_init();
     if (!requestData_.curlHandle)
@@ -675,6 +739,8 @@ bool HttpRequest::Prepare()
     }
 
     // Standard options
+    if (share)
+        curl_easy_setopt(requestData_.curlHandle, CURLOPT_SHARE, static_cast<CURLSH*>(share));
     curl_easy_setopt(requestData_.curlHandle, CURLOPT_TCP_KEEPALIVE, 1L);
     curl_easy_setopt(requestData_.curlHandle, CURLOPT_FOLLOWLOCATION, 1L);
   
@@ -734,8 +800,13 @@ void HttpRequest::Cleanup()
 
     if (requestData_.curlHandle)
     {
-        curl_easy_cleanup(requestData_.curlHandle);
+        // Reset keeps the open connections and caches of the handle for the next request.
+        if (requestData_.borrowedHandle)
+            curl_easy_reset(requestData_.curlHandle);
+        else
+            curl_easy_cleanup(requestData_.curlHandle);
         requestData_.curlHandle = 0;
+        requestData_.borrowedHandle = false;
     }
     if (requestData_.curlHeaders)
     {
@@ -753,6 +824,12 @@ void HttpRequest::WriteStats(Http::Stats *stats)
         if (requestData_.msecNetwork > -1)
             stats->requests++;
 
+        // Connection reuse
+        if (requestData_.numConnects > 0)
+            stats->connectionsOpened += static_cast<uint>(requestData_.numConnects);
+        else if (requestData_.numConnects == 0)
+            stats->connectionsReused++;
+
         // Disk write
         if (requestData_.msecDiskWrite > -1)
         {
@@ -922,11 +999,25 @@ size_t HttpRequest::ReadBody(void *buffer, uint size)
             return 0; // Propagates a CURLE_WRITE_ERROR and aborts transfer
 
         // Headers have been parsed. Reserve bodyBytes_ to "Content-Length" size.
-        responseData_.bodyBytes.Reserve(HeaderUIntInternal(Http::Header::ContentLength, HTTP_INITIAL_BODY_SIZE, true, false));
+        uint contentLength = HeaderUIntInternal(Http::Header::ContentLength, 0, true, false);
+        responseData_.bodyBytes.Reserve(contentLength > 0 ? contentLength : HTTP_INITIAL_BODY_SIZE);
+
+        if (bodyReceiver_)
+        {
+            // The status of the final response, the headers may also contain the ones of redirects.
+            long status = 0;
+            curl_easy_getinfo(requestData_.curlHandle, CURLINFO_RESPONSE_CODE, &status);
+            receivingBody_ = bodyReceiver_->BeginBody(static_cast<int>(status), contentLength);
+        }
     }
 
-    Vector<u8> data(static_cast<u8*>(buffer), size);
-    responseData_.bodyBytes.Push(data);
+    // Append in place, the body is not copied again after this.
+    uint bodySize = responseData_.bodyBytes.Size();
+    responseData_.bodyBytes.Resize(bodySize + size);
+    memcpy(&responseData_.bodyBytes[bodySize], buffer, size);
+
+    if (receivingBody_ && !bodyReceiver_->ReceiveBody(static_cast<const u8*>(buffer), size))
+        receivingBody_ = false;
     return size;
 }
 
@@ -14,6 +14,7 @@
 #include <Engine/Container/RefCounted.h>
 
 #include "HttpCurlInterop.h"
+#include "IHttpBodyReceiver.h"
 
 struct http_parser;
 
@@ -51,6 +52,13 @@ public:
     /** @see Finished. */
     bool HasCompleted();
 
+    /// Sets the priority of this request. Requests with a higher priority are started first. The default priority is 0.
+    /** Has effect only before the request has started. A waiting request is reordered in the work queue. */
+    void SetPriority(int priority);
+
+    /// Returns the priority of this request.
+    int Priority();
+
     /// Sets verbose stdout logging for this request.
     /** Useful when you want to inspect outgoing and incoming headers and data. */
     void SetVerbose(bool enabled);
@@ -116,6 +124,10 @@ public:
     /** @param 'If-Modified-Since' header will be written to the provided @c lastModifiedHttpDate if non empty string. */
     bool SetCacheFile(const String &filepath, const String &lastModifiedHttpDate);
 
+    /// Sets @c receiver to receive the response body as it is downloaded, in the worker thread.
+    /** Lets the body be processed, for example written to disk, while it is being received, instead of after completion. */
+    bool SetBodyReceiver(const HttpBodyReceiverPtr &receiver);
+
     ///////////////////////// RESPONSE API
 
     /// Returns status code eg, 200 if request has completed successfully, otherwise -1.
@@ -146,6 +158,11 @@ public:
         @return Body if request has completed, otherwise an empty vector.*/
     const Vector<u8> &ResponseBody();
 
+    /// Moves the response body to @c dest without copying, if request has completed.
+    /** The response body of the request is empty afterwards. @see ResponseBody.
+        @return False if request has not completed or response body is empty. */
+    bool TakeResponseBody(Vector<u8> &dest);
+
     /// Copies the response body to @c dest if request has completed.
     /** This function uses memcpy and resizes @c dest. @see ResponseBody.
         @return False if request has not completed or response body is empty. */
@@ -195,9 +212,11 @@ private:
     uint HeaderUIntInternal(const String &name, uint defaultValue, bool respose, bool lock = true);
 
     /// Called by HttpWorkThread in worker thread context.
-    void Perform();
+    /** @param handle Curl handle of the worker thread. It keeps its connections alive for the next requests.
+        @param share Curl share handle for the DNS cache and TLS sessions of all workers. */
+    void Perform(Curl::RequestHandle *handle = 0, Curl::EngineHandle *share = 0);
     /// Invoked in worker thread context.
-    bool Prepare();
+    bool Prepare(Curl::EngineHandle *share);
     /// Invoked in worker thread context.
     void Cleanup();
 
@@ -227,10 +246,20 @@ private:
     // Framework for API/Urho access.
     Framework *framework_;
 
+    // Scheme, host and port of the URL, for limiting the concurrent requests per host.
+    String host_;
+    int priority_;
+    // Queue the request was scheduled to, for reordering it when the priority changes.
+    HttpWorkQueueWeakPtr queue_;
+
     // Outgoing/incomfing data structures
     Http::RequestData requestData_;
     Http::ResponseData responseData_;
 
+    // Receiver of the response body, and whether it is receiving the current body.
+    HttpBodyReceiverPtr bodyReceiver_;
+    bool receivingBody_;
+
     Urho3D::Mutex mutexExecute_;
     bool executing_;
     bool completed_;
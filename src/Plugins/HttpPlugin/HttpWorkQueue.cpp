@@ -10,22 +10,43 @@
 #include <Engine/Core/ProcessUtils.h>
 #include <Engine/Core/StringUtils.h>
 
+#include <algorithm>
+
 namespace Tundra
 {
 
 // HttpWorkQueue
 
 const float DurationKeepAliveThreads = 10.f;
+const uint DefaultMaxConnectionsPerHost = 6;
 
 HttpWorkQueue::HttpWorkQueue() :
     log("HttpWorkQueue"),
     durationNoWork_(0.f),
+    maxConnectionsPerHost_(DefaultMaxConnectionsPerHost),
+    share_(curl_share_init()),
+    numWaiting_(0),
+    numScheduled_(0),
     stats_(new Http::Stats())
 {
     numMaxThreads_ = Urho3D::GetNumLogicalCPUs();
     if (numMaxThreads_ < 1) numMaxThreads_ = 1;         // Need at least one worker
     else if (numMaxThreads_ > 32) numMaxThreads_ = 32;  // Cap to something sensible
     log.DebugF("Maximum number of threads %d detected from %d physical and %d logical CPUs", numMaxThreads_, Urho3D::GetNumPhysicalCPUs(), Urho3D::GetNumLogicalCPUs());
+
+    /* Share DNS lookups and TLS sessions between the workers, so that a new connection to a known host
+       skips the lookup and resumes the TLS session. Connections are not shared, as curl does not support
+       using a shared connection cache from concurrent threads. Each worker keeps its own alive instead. */
+    if (share_)
+    {
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &HttpWorkQueue::LockShare);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &HttpWorkQueue::UnlockShare);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    else
+        log.Warning("Failed to create curl share handle, DNS lookups and TLS sessions are not shared between requests.");
 }
 
 HttpWorkQueue::~HttpWorkQueue()
@@ -35,27 +56,70 @@ HttpWorkQueue::~HttpWorkQueue()
     {
         Urho3D::MutexLock m(mutexRequests_);
         created_.Clear();
-        requests_.Clear();
+        hosts_.Clear();
+        numWaiting_ = 0;
     }
     {
         Urho3D::MutexLock m(mutexCompleted_);
         completed_.Clear();
         executing_.Clear();
     }
+    if (share_)
+    {
+        curl_share_cleanup(share_);
+        share_ = 0;
+    }
     SAFE_DELETE(stats_);
 }
 
+void HttpWorkQueue::LockShare(CURL * /*handle*/, curl_lock_data data, curl_lock_access /*access*/, void *queue)
+{
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST)
+        static_cast<HttpWorkQueue*>(queue)->shareLocks_[data].Acquire();
+}
+
+void HttpWorkQueue::UnlockShare(CURL * /*handle*/, curl_lock_data data, void *queue)
+{
+    if (data >= 0 && data < CURL_LOCK_DATA_LAST)
+        static_cast<HttpWorkQueue*>(queue)->shareLocks_[data].Release();
+}
+
+void HttpWorkQueue::SetMaxConnectionsPerHost(uint max)
+{
+    Urho3D::MutexLock m(mutexRequests_);
+    maxConnectionsPerHost_ = max;
+}
+
 void HttpWorkQueue::Schedule(const HttpRequestPtr &request)
 {
+    request->queue_ = this;
     created_.Push(request);
 }
 
+void HttpWorkQueue::SetPriority(HttpRequest *request, int priority)
+{
+    Urho3D::MutexLock m(mutexRequests_);
+    HashMap<String, HostRequests>::Iterator host = hosts_.Find(request->host_);
+    if (host == hosts_.End())
+        return;
+    std::vector<WaitingRequest> &waiting = host->second_.waiting;
+    for (size_t i = 0; i < waiting.size(); ++i)
+    {
+        if (waiting[i].request.Get() == request)
+        {
+            waiting[i].priority = priority;
+            std::make_heap(waiting.begin(), waiting.end());
+            return;
+        }
+    }
+}
+
 uint HttpWorkQueue::NumPending()
 {
     uint num = created_.Size();
     {
         Urho3D::MutexLock m(mutexRequests_);
-        num += requests_.Size();
+        num += numWaiting_;
     }
     return num;
 }
@@ -80,13 +144,25 @@ void HttpWorkQueue::Update(float frametime)
        witin the creation frame update without threading conflicts. */
     uint numPending = 0;
     {
+        // Read the priorities before locking, as SetPriority locks the request before the queue
+        PODVector<int> priorities(created_.Size());
+        for (uint i = 0; i < created_.Size(); ++i)
+            priorities[i] = created_[i]->Priority();
+
         Urho3D::MutexLock m2(mutexRequests_);
-        if (created_.Size() > 0)
+        for (uint i = 0; i < created_.Size(); ++i)
         {
-            requests_.Insert(requests_.End(), created_.Begin(), created_.End());
-            created_.Clear();
+            WaitingRequest waiting;
+            waiting.request = created_[i];
+            waiting.priority = priorities[i];
+            waiting.order = numScheduled_++;
+            std::vector<WaitingRequest> &hostWaiting = hosts_[created_[i]->host_].waiting;
+            hostWaiting.push_back(waiting);
+            std::push_heap(hostWaiting.begin(), hostWaiting.end());
         }
-        numPending = requests_.Size();
+        numWaiting_ += created_.Size();
+        created_.Clear();
+        numPending = numWaiting_;
     }
 
     if (numPending + numExecuting == 0)
@@ -143,12 +219,26 @@ void HttpWorkQueue::StopThreads()
 HttpRequest* HttpWorkQueue::Next()
 {
     mutexRequests_.Acquire();
-    if (requests_.Size() > 0)
+
+    // Pick the oldest of the highest priority requests whose host is not at its connection limit.
+    HostRequests *best = 0;
+    for (auto iter = hosts_.Begin(); iter != hosts_.End(); ++iter)
+    {
+        HostRequests &host = iter->second_;
+        if (host.waiting.empty() || (maxConnectionsPerHost_ > 0 && host.numExecuting >= maxConnectionsPerHost_))
+            continue;
+        if (!best || best->waiting.front() < host.waiting.front())
+            best = &host;
+    }
+
+    if (best)
     {
         // Remove from pending
-        HttpRequestPtrList::Iterator iter = requests_.Begin();
-        HttpRequestPtr next = *iter;
-        requests_.Erase(iter);
+        std::pop_heap(best->waiting.begin(), best->waiting.end());
+        HttpRequestPtr next = best->waiting.back().request;
+        best->waiting.pop_back();
+        ++best->numExecuting;
+        --numWaiting_;
         mutexRequests_.Release();
 
         // Add to executing
@@ -174,6 +264,13 @@ HttpRequestPtrList::Iterator HttpWorkQueue::FindExecuting(HttpRequest *request)
 
 void HttpWorkQueue::Completed(HttpRequest *request)
 {
+    {
+        Urho3D::MutexLock m(mutexRequests_);
+        HashMap<String, HostRequests>::Iterator host = hosts_.Find(request->host_);
+        if (host != hosts_.End() && --host->second_.numExecuting == 0 && host->second_.waiting.empty())
+            hosts_.Erase(host);
+    }
+
     Urho3D::MutexLock m(mutexCompleted_);
 
     HttpRequestPtrList::Iterator done = FindExecuting(request);
@@ -191,7 +288,8 @@ void HttpWorkQueue::Completed(HttpRequest *request)
 // HttpWorkThread
 
 HttpWorkThread::HttpWorkThread(HttpWorkQueue *queue) :
-    queue_(queue)
+    queue_(queue),
+    handle_(0)
 {
 }
 
@@ -199,18 +297,27 @@ void HttpWorkThread::ThreadFunction()
 {
     LogDebug("[HttpWorkThread] Starting " + String(GetCurrentThreadID()));
 
+    // Kept for the lifetime of the thread, so that its connections stay alive between requests.
+    handle_ = curl_easy_init();
+
     while(shouldRun_)
     {
         HttpRequest  *request = queue_->Next();
         if (request)
         {
-            request->Perform();
+            request->Perform(handle_, queue_->share_);
             queue_->Completed(request);
         }
         else
             Urho3D::Time::Sleep(16);
     }
 
+    if (handle_)
+    {
+        curl_easy_cleanup(handle_);
+        handle_ = 0;
+    }
+
     LogDebug("[HttpWorkThread] Stopping " + String(GetCurrentThreadID()));
 }
 
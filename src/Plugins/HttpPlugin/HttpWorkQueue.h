@@ -7,15 +7,25 @@
 #include "FrameworkFwd.h"
 
 #include "LoggingFunctions.h"
+#include "HttpCurlInterop.h"
 
 #include <Engine/Container/RefCounted.h>
+#include <Engine/Container/HashMap.h>
 #include <Engine/Core/Thread.h>
 #include <Engine/Core/Mutex.h>
 
+#include <vector>
+
 namespace Tundra
 {
 
 /// HttpWorkQueue request
+/** Each worker thread keeps its own curl handle between requests, so that the connections it has opened stay alive
+    and are reused by the next requests to the same host. The workers share a DNS cache and TLS sessions.
+
+    The waiting requests are started in priority order, see HttpRequest::SetPriority. The number of requests executed
+    at the same time to one host is limited, set with --httpMaxConnectionsPerHost (default 6). The waiting requests of
+    each host are kept in a priority queue, so that picking the next request only compares the top request of each host. */
 class HttpWorkQueue : public Urho3D::RefCounted
 {
     /// @cond PRIVATE
@@ -32,7 +42,39 @@ public:
 
     uint NumPending();
 
+    /// Sets the maximum number of requests executed at the same time to one host. 0 for unlimited.
+    void SetMaxConnectionsPerHost(uint max);
+
 private:
+    /// Waiting request in the priority queue of its host.
+    struct WaitingRequest
+    {
+        HttpRequestPtr request;
+        int priority;
+        /// Scheduling order, for starting the oldest of the requests with equal priority first.
+        u64 order;
+
+        /// Heap order, the highest priority and oldest request is at the top.
+        bool operator < (const WaitingRequest &rhs) const { return priority < rhs.priority || (priority == rhs.priority && order > rhs.order); }
+    };
+
+    /// Waiting and executing requests of one host.
+    struct HostRequests
+    {
+        HostRequests() : numExecuting(0) {}
+
+        /// Waiting requests as a binary heap.
+        std::vector<WaitingRequest> waiting;
+        uint numExecuting;
+    };
+
+    /// Called by HttpRequest::SetPriority. Reorders @c request if it is waiting.
+    void SetPriority(HttpRequest *request, int priority);
+
+    /// Curl share handle lock functions, called by curl.
+    static void LockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *queue);
+    static void UnlockShare(CURL *handle, curl_lock_data data, void *queue);
+
     /// @note You have to ensure mutexCompleted_ is locked prior to calling this function.
     HttpRequestPtrList::Iterator FindExecuting(HttpRequest *request);
 
@@ -50,13 +92,24 @@ private:
     uint numMaxThreads_;
     HttpWorkThreadList threads_;
 
+    /// Maximum number of requests executed at the same time to one host, 0 for unlimited.
+    uint maxConnectionsPerHost_;
+
+    /// Curl share handle for the DNS cache and TLS sessions, and its locks.
+    CURLSH *share_;
+    Urho3D::Mutex shareLocks_[CURL_LOCK_DATA_LAST];
+
     Urho3D::Mutex mutexRequests_;
     Urho3D::Mutex mutexCompleted_;
 
-    /// Waiting requests.
+    /// Waiting and executing requests per host.
     /** Accessed from multiple thread,
         protected by mutexRequests_. */
-    HttpRequestPtrList requests_;
+    HashMap<String, HostRequests> hosts_;
+    /// Number of waiting requests, protected by mutexRequests_.
+    uint numWaiting_;
+    /// Number of requests moved to hosts_, protected by mutexRequests_.
+    u64 numScheduled_;
 
     /// Completed requests.
     /** Accessed from multiple thread,
@@ -67,7 +120,7 @@ private:
     HttpRequestPtrList executing_;
 
     /** Newly created requests that will be moved
-        to requests_ in the next frame update.
+        to hosts_ in the next frame update.
         This protects worker threads from starting
         the request while main thread is still
         setting body/headers etc. */
@@ -91,6 +144,8 @@ public:
 
 private:
     HttpWorkQueue *queue_;
+    /// Curl handle lent to the executed requests.
+    CURL *handle_;
 };
 
 /// @endcond
@@ -0,0 +1,36 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "HttpPluginApi.h"
+#include "CoreTypes.h"
+
+#include <Engine/Container/RefCounted.h>
+
+namespace Tundra
+{
+
+/// Receives the body of a HTTP response as it is downloaded.
+/** Set to a request with HttpRequest::SetBodyReceiver. The response body is still collected to the request as usual.
+    @note The functions are called in the worker thread that executes the request. */
+class TUNDRA_HTTP_API IHttpBodyReceiver : public Urho3D::RefCounted
+{
+public:
+    virtual ~IHttpBodyReceiver() {}
+
+    /// Called when the first bytes of the body arrive, once the headers have been received.
+    /** @param statusCode HTTP response status code.
+        @param contentLength Value of the Content-Length header, 0 if not known.
+        @return False to not receive the body of this response. */
+    virtual bool BeginBody(int statusCode, uint contentLength) = 0;
+
+    /// Called for each chunk of the body.
+    /** @return False to stop receiving the rest of the body. */
+    virtual bool ReceiveBody(const u8 *data, uint numBytes) = 0;
+
+    /// Called once the request has completed, if BeginBody accepted the body and receiving was not stopped.
+    /** @param complete True if the whole body was received successfully. */
+    virtual void EndBody(bool complete) = 0;
+};
+
+}
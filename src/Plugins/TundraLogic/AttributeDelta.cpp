@@ -0,0 +1,304 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include <kNet.h>
+
+#include "AttributeDelta.h"
+#include "SyncState.h"
+#include "IAttribute.h"
+#include "AttributeChangeType.h"
+
+#include <MathDefs.h>
+
+#include <cstring>
+
+namespace Tundra
+{
+
+namespace AttributeDelta
+{
+
+namespace
+{
+    /// Largest value that ToBinary serializes as 32-bit words: Transform, 9 floats.
+    const unsigned cMaxWords = 9;
+    /// Values whose generation is a multiple of this are sent in full, so that a receiver that skipped values recovers.
+    const unsigned cFullValueInterval = 64;
+
+    /// Returns the generation of the next value relative to @c base, and whether it may be sent as a delta.
+    u8 NextGeneration(const AttributeDeltaBase &base, bool &allowDelta)
+    {
+        const u8 generation = (u8)(base.generation + 1);
+        if (generation % cFullValueInterval == 0)
+            allowDelta = false;
+        return generation;
+    }
+
+    /// Returns whether a delta of @c generation follows the value in @c base.
+    bool FollowsBase(const AttributeDeltaBase &base, u8 generation)
+    {
+        return base.valid && (u8)(base.generation + 1) == generation;
+    }
+
+    /// Returns the number of 32-bit words ToBinary writes for @c attr, or 0 if the type is not a numeric one.
+    unsigned NumWords(const IAttribute *attr)
+    {
+        switch(attr->TypeId())
+        {
+        case IAttribute::IntId:
+        case IAttribute::UIntId:
+        case IAttribute::RealId:
+            return 1;
+        case IAttribute::Float2Id:
+        case IAttribute::PointId:
+            return 2;
+        case IAttribute::Float3Id:
+            return 3;
+        case IAttribute::Float4Id:
+        case IAttribute::QuatId:
+        case IAttribute::ColorId:
+            return 4;
+        case IAttribute::TransformId:
+            return 9;
+        default:
+            return 0;
+        }
+    }
+
+    /// Returns whether @c attr is delta encoded as an edit of its string value, and the longest string its ToBinary can represent.
+    bool IsText(const IAttribute *attr, unsigned &maxLength)
+    {
+        switch(attr->TypeId())
+        {
+        case IAttribute::StringId:
+            maxLength = 0xffff;
+            return true;
+        case IAttribute::AssetReferenceId:
+        case IAttribute::EntityReferenceId:
+            maxLength = 0xff;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Reads a word of a ToBinary serialization. The wire format is little-endian regardless of the host.
+    u32 ReadWord(const u8 *data)
+    {
+        return (u32)data[0] | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24);
+    }
+
+    void WriteWord(u8 *data, u32 word)
+    {
+        data[0] = (u8)word;
+        data[1] = (u8)(word >> 8);
+        data[2] = (u8)(word >> 16);
+        data[3] = (u8)(word >> 24);
+    }
+
+    unsigned CountLeadingZeros(u32 value)
+    {
+        unsigned count = 0;
+        for (u32 mask = 0x80000000; mask && !(value & mask); mask >>= 1)
+            ++count;
+        return count;
+    }
+
+    void WriteWords(kNet::DataSerializer &dest, const IAttribute *attr, unsigned numWords, AttributeDeltaBases &bases, AttributeDeltaBase &base, bool allowDelta)
+    {
+        u8 data[cMaxWords * 4];
+        kNet::DataSerializer valueDs((char*)data, sizeof(data));
+        attr->ToBinary(valueDs);
+        const unsigned size = (unsigned)valueDs.BytesFilled();
+        const u8 generation = NextGeneration(base, allowDelta);
+        const bool delta = allowDelta && size == numWords * 4 && base.valid && base.size == size;
+        const u8 *baseData = bases.Value(base);
+
+        dest.Add<kNet::bit>(delta ? 1 : 0);
+        dest.Add<u8>(generation);
+        if (!delta)
+            attr->ToBinary(dest);
+        else
+        {
+            for (unsigned i = 0; i < numWords; ++i)
+            {
+                u32 diff = ReadWord(&data[i * 4]) ^ ReadWord(&baseData[i * 4]);
+                if (!diff)
+                    dest.Add<kNet::bit>(0);
+                else
+                {
+                    unsigned leadingZeros = CountLeadingZeros(diff);
+                    dest.Add<kNet::bit>(1);
+                    dest.AppendBits(leadingZeros, 5);
+                    dest.AppendBits(diff, 32 - leadingZeros);
+                }
+            }
+        }
+        bases.SetValue(base, data, size);
+        base.generation = generation;
+    }
+
+    void WriteText(kNet::DataSerializer &dest, const IAttribute *attr, unsigned maxLength, AttributeDeltaBases &bases, AttributeDeltaBase &base, bool allowDelta)
+    {
+        const String value = attr->ToString();
+        const unsigned length = value.Length();
+        const u8 *data = (const u8*)value.CString();
+
+        unsigned prefix = 0;
+        unsigned suffix = 0;
+        const u8 generation = NextGeneration(base, allowDelta);
+        if (allowDelta && base.valid)
+        {
+            const unsigned baseLength = base.size;
+            const u8 *baseData = bases.Value(base);
+            const unsigned common = Min(length, baseLength);
+            while (prefix < common && data[prefix] == baseData[prefix])
+                ++prefix;
+            while (suffix < common - prefix && data[length - suffix - 1] == baseData[baseLength - suffix - 1])
+                ++suffix;
+        }
+
+        // The edit costs a few bytes of lengths, so send the full value unless enough of the previous value is reused
+        const bool delta = prefix + suffix > 4;
+        dest.Add<kNet::bit>(delta ? 1 : 0);
+        dest.Add<u8>(generation);
+        if (!delta)
+            attr->ToBinary(dest);
+        else
+        {
+            const unsigned middle = length - prefix - suffix;
+            dest.AddVLE<kNet::VLE8_16_32>(prefix);
+            dest.AddVLE<kNet::VLE8_16_32>(suffix);
+            dest.AddVLE<kNet::VLE8_16_32>(middle);
+            if (middle)
+                dest.AddArray<u8>(data + prefix, middle);
+        }
+
+        // A value too long for ToBinary arrives truncated, so it can not be a base
+        if (length <= maxLength)
+            bases.SetValue(base, data, length);
+        else
+            base.valid = false;
+        base.generation = generation;
+    }
+
+    bool ReadWords(kNet::DataDeserializer &source, IAttribute *attr, unsigned numWords, AttributeDeltaBases &bases, AttributeDeltaBase &base)
+    {
+        const bool isDelta = source.Read<kNet::bit>() != 0;
+        const u8 generation = source.Read<u8>();
+        if (!isDelta)
+        {
+            attr->FromBinary(source, AttributeChange::Disconnected);
+            u8 data[cMaxWords * 4];
+            kNet::DataSerializer valueDs((char*)data, sizeof(data));
+            attr->ToBinary(valueDs);
+            bases.SetValue(base, data, (unsigned)valueDs.BytesFilled());
+            base.generation = generation;
+            return true;
+        }
+
+        const bool hasBase = FollowsBase(base, generation) && base.size == numWords * 4;
+        const u8 *baseData = bases.Value(base);
+        u8 data[cMaxWords * 4];
+        for (unsigned i = 0; i < numWords; ++i)
+        {
+            u32 diff = 0;
+            if (source.Read<kNet::bit>())
+            {
+                unsigned leadingZeros = source.ReadBits(5);
+                diff = source.ReadBits(32 - leadingZeros);
+            }
+            if (hasBase)
+                WriteWord(&data[i * 4], ReadWord(&baseData[i * 4]) ^ diff);
+        }
+        if (!hasBase)
+        {
+            // Values were skipped, so the base is stale until the next full value
+            base.valid = false;
+            return false;
+        }
+
+        kNet::DataDeserializer valueDd((const char*)data, numWords * 4);
+        attr->FromBinary(valueDd, AttributeChange::Disconnected);
+        bases.SetValue(base, data, numWords * 4);
+        base.generation = generation;
+        return true;
+    }
+
+    bool ReadText(kNet::DataDeserializer &source, IAttribute *attr, AttributeDeltaBases &bases, AttributeDeltaBase &base)
+    {
+        const bool isDelta = source.Read<kNet::bit>() != 0;
+        const u8 generation = source.Read<u8>();
+        if (!isDelta)
+        {
+            attr->FromBinary(source, AttributeChange::Disconnected);
+            const String value = attr->ToString();
+            bases.SetValue(base, (const u8*)value.CString(), value.Length());
+            base.generation = generation;
+            return true;
+        }
+
+        const unsigned prefix = source.ReadVLE<kNet::VLE8_16_32>();
+        const unsigned suffix = source.ReadVLE<kNet::VLE8_16_32>();
+        const unsigned middle = source.ReadVLE<kNet::VLE8_16_32>();
+        if (middle > source.BitsLeft() / 8)
+            throw kNet::NetException("AttributeDelta: String edit longer than the remaining data");
+        const unsigned baseLength = base.size;
+        if (!FollowsBase(base, generation) || prefix > baseLength || suffix > baseLength - prefix)
+        {
+            for (unsigned i = 0; i < middle; ++i)
+                source.Read<u8>();
+            base.valid = false;
+            return false;
+        }
+
+        String value;
+        value.Resize(prefix + middle + suffix);
+        if (middle)
+            source.ReadArray<u8>((u8*)&value[prefix], middle);
+        if (prefix)
+            memcpy(&value[0], bases.Value(base), prefix);
+        if (suffix)
+            memcpy(&value[prefix + middle], bases.Value(base) + baseLength - suffix, suffix);
+
+        attr->FromString(value, AttributeChange::Disconnected);
+        bases.SetValue(base, (const u8*)value.CString(), value.Length());
+        base.generation = generation;
+        return true;
+    }
+}
+
+bool IsEncodable(const IAttribute *attr)
+{
+    unsigned maxLength;
+    return NumWords(attr) > 0 || IsText(attr, maxLength);
+}
+
+void Write(kNet::DataSerializer &dest, const IAttribute *attr, AttributeDeltaBases *bases, component_id_t compId, u8 attrIndex, bool allowDelta)
+{
+    unsigned maxLength = 0;
+    const unsigned numWords = NumWords(attr);
+    if (bases && numWords)
+        WriteWords(dest, attr, numWords, *bases, bases->Base(compId, attrIndex, false), allowDelta);
+    else if (bases && IsText(attr, maxLength))
+        WriteText(dest, attr, maxLength, *bases, bases->Base(compId, attrIndex, false), allowDelta);
+    else
+        attr->ToBinary(dest);
+}
+
+bool Read(kNet::DataDeserializer &source, IAttribute *attr, AttributeDeltaBases *bases, component_id_t compId, u8 attrIndex)
+{
+    unsigned maxLength = 0;
+    const unsigned numWords = NumWords(attr);
+    if (bases && numWords)
+        return ReadWords(source, attr, numWords, *bases, bases->Base(compId, attrIndex, true));
+    else if (bases && IsText(attr, maxLength))
+        return ReadText(source, attr, *bases, bases->Base(compId, attrIndex, true));
+
+    attr->FromBinary(source, AttributeChange::Disconnected);
+    return true;
+}
+
+}
+
+}
@@ -0,0 +1,52 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraLogicApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+
+namespace kNet
+{
+    class DataSerializer;
+    class DataDeserializer;
+}
+
+namespace Tundra
+{
+
+class AttributeDeltaBases;
+
+/// Delta encoding of attribute values in cEditAttributesMessage, used with ProtocolDeltaAttributes and newer.
+/** A delta encoded value is relative to the previous value of the same attribute that was sent to, or received from, the peer.
+    As kNet delivers the reliable messages in order, the previous value sent is also the value the peer received last,
+    so both ends keep their delta bases in the EntitySyncState without needing acks.
+
+    The receiver may still skip values, e.g. those of a component it does not have. So each value carries the 8-bit generation
+    of the base it creates, which counts the values of the attribute, and a delta is applied only if it follows the generation
+    of the receiver's base. Otherwise the value is dropped without corrupting the attribute. Every 64th value is sent in full,
+    so the receiver recovers without needing to report the mismatch to the sender.
+
+    Numeric attributes, which ToBinary serializes as 32-bit words, are sent as the XOR of each word against the previous value
+    with the leading zero bits dropped. An unchanged word costs one bit, and a small change of a float a dozen or so bits.
+    String attributes are sent as an edit which replaces the part of the previous string between the common prefix and suffix.
+
+    Delta encodable values start with a bit telling whether a delta or the full ToBinary value follows, so the sender can always
+    fall back to the full value, e.g. when it has no base yet. Values of the other attribute types are written with ToBinary as before. */
+namespace AttributeDelta
+{
+    /// Returns whether the values of @c attr are written with the delta flag bit.
+    bool TUNDRALOGIC_API IsEncodable(const IAttribute *attr);
+
+    /// Writes the current value of @c attr, as a delta against its sent base in @c bases if possible, and stores the value as the base.
+    /** @param bases Delta bases of the entity, or null to write the value with ToBinary.
+        @param allowDelta If false, the full value is always written, but the base is still updated. */
+    void TUNDRALOGIC_API Write(kNet::DataSerializer &dest, const IAttribute *attr, AttributeDeltaBases *bases, component_id_t compId, u8 attrIndex, bool allowDelta);
+
+    /// Reads a value written by Write into @c attr, and stores the value as its received base in @c bases.
+    /** @param bases Delta bases of the entity, or null to read the value with FromBinary.
+        @return False if the value was a delta that the base does not match. The value is consumed from @c source, but not applied. */
+    bool TUNDRALOGIC_API Read(kNet::DataDeserializer &source, IAttribute *attr, AttributeDeltaBases *bases, component_id_t compId, u8 attrIndex);
+}
+
+}
@@ -0,0 +1,183 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include <kNet.h>
+
+#include "InterestManager.h"
+#include "TundraLogic.h"
+#include "SyncState.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <cmath>
+
+namespace Tundra
+{
+
+InterestManager::InterestManager(TundraLogic* owner) :
+    Object(owner->GetContext()),
+    owner_(owner),
+    cellSize_(50.0f),
+    raycastWarningShown_(false)
+{
+}
+
+InterestManager::~InterestManager()
+{
+}
+
+void InterestManager::SetSettings(const InterestManagerSettings &settings)
+{
+    settings_ = settings;
+    if (settings_.criticalRange < 0.0f)
+        settings_.criticalRange = 0.0f;
+    if (settings_.relevanceRange < settings_.criticalRange)
+        settings_.relevanceRange = settings_.criticalRange;
+    if (settings_.updateInterval < 0.0f)
+        settings_.updateInterval = 0.0f;
+
+    // Size the cells so that a query touches only a handful of them
+    cellSize_ = Max(InterestRadius() * 0.5f, 1.0f);
+    grid_.Clear();
+    positions_.Clear();
+
+    if (settings_.enabled && settings_.raycast && !raycastWarningShown_)
+    {
+        LogWarning("InterestManager: Ray visibility filtering is not supported by the server, ignoring.");
+        raycastWarningShown_ = true;
+    }
+}
+
+InterestManager::GridCell InterestManager::CellOf(const float3 &pos) const
+{
+    return GridCell((int)floor(pos.x / cellSize_), (int)floor(pos.y / cellSize_), (int)floor(pos.z / cellSize_));
+}
+
+float InterestManager::InterestRadius() const
+{
+    return settings_.relevance ? Max(settings_.criticalRange, settings_.relevanceRange) : settings_.criticalRange;
+}
+
+float InterestManager::RelevanceAt(float distance) const
+{
+    if (!settings_.relevance || distance <= settings_.criticalRange)
+        return 1.0f;
+    if (distance >= settings_.relevanceRange)
+        return 0.0f;
+    return 1.0f - (distance - settings_.criticalRange) / (settings_.relevanceRange - settings_.criticalRange);
+}
+
+void InterestManager::UpdateSpatialGrid(const HashMap<entity_id_t, float3> &positions)
+{
+    PROFILE(InterestManager_UpdateSpatialGrid);
+
+    grid_.Clear();
+    positions_.Clear();
+    if (!settings_.enabled)
+        return;
+
+    positions_ = positions;
+    for (auto i = positions_.Begin(); i != positions_.End(); ++i)
+        grid_[CellOf(i->second_)].Push(i->first_);
+}
+
+void InterestManager::UpdateSyncState(SceneSyncState *state, float time)
+{
+    if (!settings_.enabled || !state || !state->locationInitialized || !state->clientLocation.IsFinite())
+        return;
+
+    PROFILE(InterestManager_UpdateSyncState);
+
+    const float3 &clientPos = state->clientLocation;
+    const float radius = InterestRadius();
+    const float radiusSq = radius * radius;
+
+    // Collect the entities inside the interest radius from the grid cells overlapping it
+    Urho3D::HashSet<entity_id_t> &inRange = state->inRangeEntities;
+    inRange.Clear();
+    GridCell minCell = CellOf(clientPos - float3::FromScalar(radius));
+    GridCell maxCell = CellOf(clientPos + float3::FromScalar(radius));
+    for (int x = minCell.x; x <= maxCell.x; ++x)
+        for (int y = minCell.y; y <= maxCell.y; ++y)
+            for (int z = minCell.z; z <= maxCell.z; ++z)
+            {
+                auto cell = grid_.Find(GridCell(x, y, z));
+                if (cell == grid_.End())
+                    continue;
+                const PODVector<entity_id_t> &ids = cell->second_;
+                for (unsigned i = 0; i < ids.Size(); ++i)
+                {
+                    float distSq = positions_[ids[i]].DistanceSq(clientPos);
+                    if (distSq > radiusSq)
+                        continue;
+                    inRange.Insert(ids[i]);
+                    state->relevanceFactors[ids[i]] = RelevanceAt(sqrt(distSq));
+                }
+            }
+
+    // Entities that left the interest radius
+    for (auto i = state->visibleEntities.Begin(); i != state->visibleEntities.End(); ++i)
+    {
+        if (inRange.Contains(*i))
+            continue;
+        state->relevanceFactors.erase(*i);
+        state->lastUpdatedEntitys_.erase(*i);
+        if (settings_.euclidean && positions_.Contains(*i))
+            state->MarkEntityPending(*i);
+    }
+
+    // Entities that entered the interest radius
+    for (auto i = inRange.Begin(); i != inRange.End(); ++i)
+    {
+        if (!state->visibleEntities.Contains(*i) && state->HasPendingEntity(*i))
+        {
+            state->MarkPendingEntityDirty(*i);
+            // Start the update rate scaling from the full state that is now being sent
+            state->lastUpdatedEntitys_[*i] = time;
+        }
+    }
+
+    // Withhold dirty entities that are out of range and have not been evaluated before, eg. newly created entities
+    if (settings_.euclidean)
+    {
+        PODVector<entity_id_t> outOfRange;
+        for (EntitySyncState *dirty = state->dirtyQueue.First(); dirty; dirty = dirty->nextDirty)
+        {
+            if (!dirty->removed && positions_.Contains(dirty->id) && !inRange.Contains(dirty->id))
+                outOfRange.Push(dirty->id);
+        }
+        for (unsigned i = 0; i < outOfRange.Size(); ++i)
+            state->MarkEntityPending(outOfRange[i]);
+    }
+
+    state->visibleEntities.Swap(inRange);
+}
+
+bool InterestManager::IsUpdateDue(const SceneSyncState *state, entity_id_t id, float time) const
+{
+    if (!settings_.enabled || !settings_.relevance || !state->locationInitialized)
+        return true;
+
+    // Entities without a Placeable are always relevant. Placed entities without a relevance factor are outside the relevance range.
+    float relevance = 1.0f;
+    auto factor = state->relevanceFactors.find(id);
+    if (factor != state->relevanceFactors.end())
+        relevance = factor->second;
+    else if (positions_.Contains(id))
+        relevance = 0.0f;
+    if (relevance >= 1.0f)
+        return true;
+
+    auto last = state->lastUpdatedEntitys_.find(id);
+    if (last == state->lastUpdatedEntitys_.end())
+        return true;
+    return time - last->second >= settings_.updateInterval * (1.0f - relevance);
+}
+
+void InterestManager::MarkUpdated(SceneSyncState *state, entity_id_t id, float time) const
+{
+    if (settings_.enabled && settings_.relevance)
+        state->lastUpdatedEntitys_[id] = time;
+}
+
+}
@@ -0,0 +1,111 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraLogicApi.h"
+#include "TundraLogicFwd.h"
+#include "SceneFwd.h"
+#include "Math/float3.h"
+
+#include <Object.h>
+#include <HashMap.h>
+#include <Vector.h>
+
+namespace Tundra
+{
+
+/// Interest management settings. See SyncManager::UpdateInterestManagerSettings.
+struct InterestManagerSettings
+{
+    InterestManagerSettings() :
+        enabled(false),
+        euclidean(true),
+        raycast(false),
+        relevance(true),
+        criticalRange(50.0f),
+        relevanceRange(200.0f),
+        updateInterval(1.0f),
+        raycastInterval(1.0f)
+    {
+    }
+
+    bool enabled; ///< Whether interest management is allowed to filter traffic.
+    bool euclidean; ///< Whether entities outside the interest radius are withheld from the client.
+    bool raycast; ///< Whether ray visibility filtering is requested. Not supported on the server without a physics world.
+    bool relevance; ///< Whether the update rate of entities is scaled by their distance to the client.
+    float criticalRange; ///< Radius in which entities are always fully relevant and updated on every tick.
+    float relevanceRange; ///< Radius after which entities receive updates at the slowest rate.
+    float updateInterval; ///< Slowest update interval in seconds for entities at the edge of the relevance range.
+    float raycastInterval; ///< Ray visibility check interval in seconds.
+};
+
+/// Server-side interest management for scene replication.
+/** Keeps a uniform spatial grid over the Placeable positions of the scene, rebuilt once per network tick and shared by all connections.
+    Each connection's SceneSyncState is then filtered by the client location received with cCameraOrientationUpdate:
+    entities leaving the interest radius are moved to the pending list with SceneSyncState::MarkEntityPending,
+    entities entering it are released with SceneSyncState::MarkPendingEntityDirty, and the relevance factor of each entity
+    is written to SceneSyncState::relevanceFactors, from which the update rate is scaled. Entities without a Placeable are always relevant. */
+class TUNDRALOGIC_API InterestManager : public Object
+{
+    OBJECT(InterestManager);
+
+public:
+    explicit InterestManager(TundraLogic* owner);
+    ~InterestManager();
+
+    /// Returns the current settings.
+    const InterestManagerSettings &Settings() const { return settings_; }
+
+    /// Sets new settings.
+    void SetSettings(const InterestManagerSettings &settings);
+
+    /// Returns whether interest management is enabled.
+    bool IsEnabled() const { return settings_.enabled; }
+
+    /// Rebuilds the spatial grid from the world positions of the replicated entities. Call once per network tick before filtering the sync states.
+    /** @param positions World positions of the non-local entities with a Placeable, by entity ID. */
+    void UpdateSpatialGrid(const HashMap<entity_id_t, float3> &positions);
+
+    /// Updates the visibility and relevance data of @c state and moves entities between the sync state and the pending list accordingly.
+    /** Does nothing before the client has reported its location. @param time Current time in seconds. */
+    void UpdateSyncState(SceneSyncState *state, float time);
+
+    /// Returns whether a dirty, already replicated entity should be updated to the client now, or deferred to a later tick.
+    /** @param time Current time in seconds. */
+    bool IsUpdateDue(const SceneSyncState *state, entity_id_t id, float time) const;
+
+    /// Records that an entity was updated to the client. @param time Current time in seconds.
+    void MarkUpdated(SceneSyncState *state, entity_id_t id, float time) const;
+
+private:
+    /// Integer coordinates of a spatial grid cell.
+    struct GridCell
+    {
+        GridCell() : x(0), y(0), z(0) {}
+        GridCell(int x_, int y_, int z_) : x(x_), y(y_), z(z_) {}
+
+        bool operator ==(const GridCell &rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z; }
+        bool operator !=(const GridCell &rhs) const { return !(*this == rhs); }
+        unsigned ToHash() const { return ((unsigned)x * 73856093u) ^ ((unsigned)y * 19349663u) ^ ((unsigned)z * 83492791u); }
+
+        int x, y, z;
+    };
+
+    /// Returns the grid cell containing @c pos.
+    GridCell CellOf(const float3 &pos) const;
+
+    /// Returns the radius outside of which entities are withheld from the client.
+    float InterestRadius() const;
+
+    /// Returns the relevance factor [0,1] of an entity at @c distance from the client.
+    float RelevanceAt(float distance) const;
+
+    TundraLogic* owner_;
+    InterestManagerSettings settings_;
+    float cellSize_; ///< Edge length of a grid cell.
+    HashMap<GridCell, PODVector<entity_id_t> > grid_; ///< Replicated entities with a Placeable, by grid cell.
+    HashMap<entity_id_t, float3> positions_; ///< World positions of the entities in the grid.
+    bool raycastWarningShown_;
+};
+
+}
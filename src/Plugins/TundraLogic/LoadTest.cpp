@@ -0,0 +1,385 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include <kNet.h>
+
+#include "LoadTest.h"
+#include "TundraLogic.h"
+#include "KristalliProtocol.h"
+#include "Client.h"
+#include "SyncManager.h"
+#include "UserConnection.h"
+#include "MsgLogin.h"
+#include "MsgLoginReply.h"
+#include "TundraMessages.h"
+#include "TundraLogicUtils.h"
+#include "Framework.h"
+#include "SceneAPI.h"
+#include "Scene/Scene.h"
+#include "Entity.h"
+#include "Placeable.h"
+#include "JSON.h"
+#include "LoggingFunctions.h"
+#include "Profiler.h"
+
+#include <Engine/Resource/XMLFile.h>
+#include <Engine/Resource/XMLElement.h>
+#include <Engine/Core/StringUtils.h>
+#include <File.h>
+
+#include <cmath>
+
+namespace Tundra
+{
+
+LoadTest::LoadTest(TundraLogic* owner) :
+    Object(owner->GetContext()),
+    owner_(owner),
+    framework_(owner->GetFramework()),
+    running_(false),
+    mutatorAcc_(0.0f),
+    mutatorTime_(0.0f),
+    numMutatorTicks_(0),
+    tickTimeSum_(0.0f),
+    tickTimeMax_(0.0f),
+    numTicks_(0),
+    latencySum_(0.0),
+    latencyMax_(0.0f),
+    numLatencySamples_(0),
+    startTime_(0)
+{
+}
+
+LoadTest::~LoadTest()
+{
+    Stop();
+}
+
+bool LoadTest::ReadSettings(Framework *framework, LoadTestSettings &settings)
+{
+    if (!framework->HasCommandLineParameter("--loadtest"))
+        return false;
+
+    StringVector values = framework->CommandLineParameters("--loadtesthost");
+    if (!values.Empty())
+        settings.host = values.Front();
+    values = framework->CommandLineParameters("--loadtestport");
+    if (!values.Empty())
+        settings.port = (unsigned short)Urho3D::ToUInt(values.Front());
+    values = framework->CommandLineParameters("--loadtestprotocol");
+    if (!values.Empty())
+        settings.protocol = values.Front().ToLower();
+    values = framework->CommandLineParameters("--loadtestbots");
+    if (!values.Empty())
+        settings.numBots = Urho3D::ToUInt(values.Front());
+    values = framework->CommandLineParameters("--loadtestentities");
+    if (!values.Empty())
+        settings.numEntities = Urho3D::ToUInt(values.Front());
+    values = framework->CommandLineParameters("--loadtestduration");
+    if (!values.Empty())
+        settings.duration = Urho3D::ToFloat(values.Front());
+    values = framework->CommandLineParameters("--loadtestreportinterval");
+    if (!values.Empty())
+        settings.reportInterval = Max(Urho3D::ToFloat(values.Front()), 0.1f);
+    values = framework->CommandLineParameters("--loadtestreport");
+    if (!values.Empty())
+        settings.reportFile = values.Front();
+    values = framework->CommandLineParameters("--loadtestmaxlatency");
+    if (!values.Empty())
+        settings.maxLatencyMs = Urho3D::ToFloat(values.Front());
+    values = framework->CommandLineParameters("--loadtestmaxbandwidth");
+    if (!values.Empty())
+        settings.maxBytesPerBotPerSecond = Urho3D::ToFloat(values.Front());
+    values = framework->CommandLineParameters("--loadtestmaxclienttick");
+    if (!values.Empty())
+        settings.maxClientSyncTickMs = Urho3D::ToFloat(values.Front());
+    return true;
+}
+
+void LoadTest::Start(const LoadTestSettings &settings)
+{
+    Stop();
+    settings_ = settings;
+    running_ = true;
+
+    // The client of this process acts as the scene mutator
+    owner_->Client()->Login(settings_.host, settings_.port, "LoadTestMutator", "", settings_.protocol);
+
+    const kNet::SocketTransportLayer transport = settings_.protocol == "tcp" ? kNet::SocketOverTCP : kNet::SocketOverUDP;
+    kNet::Network *network = owner_->KristalliProtocol()->Network();
+    bots_.Resize(settings_.numBots);
+    for (unsigned i = 0; i < bots_.Size(); ++i)
+    {
+        bots_[i].connection = network->Connect(settings_.host.CString(), settings_.port, transport, this);
+        if (bots_[i].connection)
+            botIndices_[bots_[i].connection.ptr()] = i;
+        else
+            LogWarning("LoadTest: Bot " + String(i) + " failed to connect to " + settings_.host + ":" + String(settings_.port));
+    }
+
+    LogInfo("LoadTest: Started " + String(botIndices_.Size()) + " bots against " + settings_.host + ":" + String(settings_.port) + " " + settings_.protocol.ToUpper() +
+        ", moving " + String(settings_.numEntities) + " entities per tick");
+    startTime_ = kNet::Clock::Tick();
+    reportTimer_.StartMSecs(settings_.reportInterval * 1000.0f);
+}
+
+void LoadTest::Stop()
+{
+    if (!running_)
+        return;
+    running_ = false;
+
+    for (unsigned i = 0; i < bots_.Size(); ++i)
+        if (bots_[i].connection)
+            bots_[i].connection->Close(0);
+    bots_.Clear();
+    botIndices_.Clear();
+
+    for (unsigned i = 0; i < entities_.Size(); ++i)
+    {
+        EntityPtr entity = entities_[i].Lock();
+        if (entity && entity->ParentScene())
+            entity->ParentScene()->RemoveEntity(entity->Id());
+    }
+    entities_.Clear();
+}
+
+void LoadTest::Update(float frametime)
+{
+    if (!running_)
+        return;
+
+    PROFILE(LoadTest_Update);
+
+    for (unsigned i = 0; i < bots_.Size(); ++i)
+    {
+        Bot &bot = bots_[i];
+        if (!bot.connection)
+            continue;
+        bot.connection->Process();
+        if (!bot.loginSent && bot.connection->GetConnectionState() == kNet::ConnectionOK)
+            SendLogin(bot, i);
+    }
+
+    // Mutate the scene at the sync rate, so that every sync tick carries the changes
+    SyncManager *syncManager = owner_->SyncManager().Get();
+    ClientPtr client = owner_->Client();
+    if (client->IsConnected())
+    {
+        ScenePtr scene = framework_->Scene()->SceneByName("TundraClient");
+        if (scene && entities_.Empty())
+            CreateEntities(scene.Get());
+
+        mutatorAcc_ += frametime;
+        mutatorTime_ += frametime;
+        if (mutatorAcc_ >= syncManager->GetUpdatePeriod())
+        {
+            mutatorAcc_ = fmod(mutatorAcc_, syncManager->GetUpdatePeriod());
+            MoveEntities(mutatorTime_);
+        }
+    }
+
+    if (syncManager->LastTickDuration() > 0.0f)
+    {
+        tickTimeSum_ += syncManager->LastTickDuration();
+        tickTimeMax_ = Max(tickTimeMax_, syncManager->LastTickDuration());
+        ++numTicks_;
+    }
+
+    if (reportTimer_.Test())
+    {
+        LogReport();
+        reportTimer_.StartMSecs(settings_.reportInterval * 1000.0f);
+    }
+
+    if (settings_.duration > 0.0f && kNet::Clock::SecondsSinceF(startTime_) >= settings_.duration)
+    {
+        LogReport();
+        WriteReport();
+        if (!CheckLimits())
+            framework_->SetExitCode(1);
+        Stop();
+        framework_->Exit();
+    }
+}
+
+void LoadTest::SendLogin(Bot &bot, unsigned index)
+{
+    Urho3D::XMLFile xml(GetContext());
+    Urho3D::XMLElement rootElem = xml.CreateRoot("login");
+    rootElem.CreateChild("username").SetAttribute("value", "LoadTestBot" + String(index));
+
+    MsgLogin msg;
+    msg.loginData = StringToBuffer(xml.ToString());
+    kNet::DataSerializer ds(msg.Size() + 4);
+    msg.SerializeTo(ds);
+    ds.AddVLE<kNet::VLE8_16_32>(cHighestSupportedProtocolVersion);
+    bot.connection->SendMessage(msg.messageID, msg.reliable, msg.inOrder, msg.priority, 0, ds.GetData(), ds.BytesFilled());
+    bot.loginSent = true;
+}
+
+void LoadTest::HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t /*packetId*/, kNet::message_id_t id, const char *data, size_t numBytes)
+{
+    auto index = botIndices_.Find(source);
+    if (index == botIndices_.End())
+        return;
+    Bot &bot = bots_[index->second_];
+
+    LoadTestMessageStats &stats = messageStats_[id];
+    ++stats.count;
+    stats.bytes += numBytes;
+    bot.bytesReceived += numBytes;
+
+    if (id == MsgLoginReply::messageID)
+    {
+        kNet::DataDeserializer dd(data, numBytes);
+        MsgLoginReply msg;
+        msg.DeserializeFrom(dd);
+        bot.loggedIn = msg.success != 0;
+        if (!bot.loggedIn)
+            LogWarning("LoadTest: Bot " + String(index->second_) + " failed to log in");
+    }
+    else if ((id == cEditAttributesMessage || id == cRigidBodyUpdateMessage) && bot.tickSentTime)
+    {
+        // The bots do not keep a scene, so the first scene update after a mutator tick is taken as its arrival
+        const float latency = (float)kNet::Clock::SecondsSinceF(bot.tickSentTime);
+        latencySum_ += latency;
+        latencyMax_ = Max(latencyMax_, latency);
+        ++numLatencySamples_;
+        bot.tickSentTime = 0;
+    }
+}
+
+void LoadTest::CreateEntities(Scene *scene)
+{
+    for (unsigned i = 0; i < settings_.numEntities; ++i)
+    {
+        EntityPtr entity = scene->CreateEntity(0, StringVector(), AttributeChange::Default, true, true, true);
+        if (!entity)
+            continue;
+        entity->SetName("LoadTest" + String(i));
+        entity->GetOrCreateComponent<Placeable>();
+        entities_.Push(EntityWeakPtr(entity));
+    }
+}
+
+void LoadTest::MoveEntities(float time)
+{
+    // Move the entities on circles on a grid, so that both the position and the velocity change on every tick
+    const unsigned gridSize = Max((unsigned)sqrtf((float)entities_.Size()), 1U);
+    for (unsigned i = 0; i < entities_.Size(); ++i)
+    {
+        EntityPtr entity = entities_[i].Lock();
+        Placeable *placeable = entity ? entity->Component<Placeable>().Get() : 0;
+        if (!placeable)
+            continue;
+        const float phase = time + (float)i;
+        Transform t = placeable->transform.Get();
+        t.pos = float3((float)(i % gridSize) * 10.0f + 3.0f * cosf(phase), 0.0f, (float)(i / gridSize) * 10.0f + 3.0f * sinf(phase));
+        t.SetOrientation(Quat::RotateY(phase));
+        placeable->transform.Set(t, AttributeChange::Default);
+    }
+
+    const kNet::tick_t now = kNet::Clock::Tick();
+    for (unsigned i = 0; i < bots_.Size(); ++i)
+        if (bots_[i].loggedIn && !bots_[i].tickSentTime)
+            bots_[i].tickSentTime = now;
+    ++numMutatorTicks_;
+}
+
+unsigned LoadTest::NumLoggedIn(double &bytesPerBotPerSecond) const
+{
+    const float elapsed = Max((float)kNet::Clock::SecondsSinceF(startTime_), 1e-3f);
+    unsigned numLoggedIn = 0;
+    u64 totalBytes = 0;
+    for (unsigned i = 0; i < bots_.Size(); ++i)
+    {
+        // Only the bots that logged in are averaged, so the bytes of the others are not counted either
+        if (bots_[i].loggedIn)
+        {
+            ++numLoggedIn;
+            totalBytes += bots_[i].bytesReceived;
+        }
+    }
+    bytesPerBotPerSecond = numLoggedIn ? (double)totalBytes / numLoggedIn / elapsed : 0.0;
+    return numLoggedIn;
+}
+
+String LoadTest::Report() const
+{
+    double bytesPerBotPerSecond = 0.0;
+    const unsigned numLoggedIn = NumLoggedIn(bytesPerBotPerSecond);
+
+    JSONValue report;
+    report["bots"] = settings_.numBots;
+    report["botsLoggedIn"] = numLoggedIn;
+    report["entities"] = (unsigned)entities_.Size();
+    report["seconds"] = Max((float)kNet::Clock::SecondsSinceF(startTime_), 1e-3f);
+    report["mutatorTicks"] = numMutatorTicks_;
+    report["clientSyncTickAvgMs"] = numTicks_ ? tickTimeSum_ * 1000.0f / numTicks_ : 0.0f;
+    report["clientSyncTickMaxMs"] = tickTimeMax_ * 1000.0f;
+    report["bytesPerBotPerSecond"] = bytesPerBotPerSecond;
+    report["latencyAvgMs"] = numLatencySamples_ ? latencySum_ * 1000.0 / numLatencySamples_ : 0.0;
+    report["latencyMaxMs"] = latencyMax_ * 1000.0f;
+
+    JSONValue messages;
+    for (auto i = messageStats_.Begin(); i != messageStats_.End(); ++i)
+    {
+        JSONValue stats;
+        stats["count"] = i->second_.count;
+        stats["bytes"] = (double)i->second_.bytes;
+        messages[String(i->first_)] = stats;
+    }
+    report["messages"] = messages;
+    return report.ToString();
+}
+
+bool LoadTest::CheckLimits() const
+{
+    double bytesPerBotPerSecond = 0.0;
+    bool passed = true;
+    if (NumLoggedIn(bytesPerBotPerSecond) == 0)
+    {
+        LogError("LoadTest: No bot logged in");
+        passed = false;
+    }
+    const double latencyAvgMs = numLatencySamples_ ? latencySum_ * 1000.0 / numLatencySamples_ : 0.0;
+    if (settings_.maxLatencyMs > 0.0f && latencyAvgMs > settings_.maxLatencyMs)
+    {
+        LogError("LoadTest: Average latency " + String(latencyAvgMs) + " ms exceeds the limit of " + String(settings_.maxLatencyMs) + " ms");
+        passed = false;
+    }
+    if (settings_.maxBytesPerBotPerSecond > 0.0f && bytesPerBotPerSecond > settings_.maxBytesPerBotPerSecond)
+    {
+        LogError("LoadTest: " + String(bytesPerBotPerSecond) + " bytes per bot per second exceeds the limit of " + String(settings_.maxBytesPerBotPerSecond));
+        passed = false;
+    }
+    const float clientSyncTickAvgMs = numTicks_ ? tickTimeSum_ * 1000.0f / numTicks_ : 0.0f;
+    if (settings_.maxClientSyncTickMs > 0.0f && clientSyncTickAvgMs > settings_.maxClientSyncTickMs)
+    {
+        LogError("LoadTest: Average client sync tick " + String(clientSyncTickAvgMs) + " ms exceeds the limit of " + String(settings_.maxClientSyncTickMs) + " ms");
+        passed = false;
+    }
+    return passed;
+}
+
+void LoadTest::LogReport() const
+{
+    LogInfo("LoadTest: " + Report());
+}
+
+void LoadTest::WriteReport() const
+{
+    if (settings_.reportFile.Empty())
+        return;
+    Urho3D::File file(GetContext(), settings_.reportFile, Urho3D::FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        LogError("LoadTest: Could not open " + settings_.reportFile + " for writing the report");
+        return;
+    }
+    String report = Report();
+    file.Write(report.CString(), report.Length());
+}
+
+}
@@ -0,0 +1,157 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include <kNet/IMessageHandler.h>
+#include <kNet/MessageConnection.h>
+#include <kNet/PolledTimer.h>
+
+#include "TundraLogicApi.h"
+#include "TundraLogicFwd.h"
+#include "FrameworkFwd.h"
+#include "SceneFwd.h"
+
+#include <Object.h>
+#include <HashMap.h>
+#include <Vector.h>
+
+namespace Tundra
+{
+
+/// Load test settings, read from the command line. See LoadTest.
+struct LoadTestSettings
+{
+    LoadTestSettings() :
+        host("127.0.0.1"),
+        port(2345),
+        protocol("udp"),
+        numBots(100),
+        numEntities(100),
+        duration(0.0f),
+        reportInterval(5.0f),
+        maxLatencyMs(0.0f),
+        maxBytesPerBotPerSecond(0.0f),
+        maxClientSyncTickMs(0.0f)
+    {
+    }
+
+    String host; ///< Server address, --loadtesthost.
+    unsigned short port; ///< Server port, --loadtestport.
+    String protocol; ///< "udp" or "tcp", --loadtestprotocol.
+    unsigned numBots; ///< Number of simulated client connections, --loadtestbots.
+    unsigned numEntities; ///< Number of entities the mutator moves on every sync tick, --loadtestentities.
+    float duration; ///< Seconds to run before writing the report and exiting, or 0 to run until exit, --loadtestduration.
+    float reportInterval; ///< Seconds between the logged reports, --loadtestreportinterval.
+    String reportFile; ///< File to write the final report to as JSON, --loadtestreport.
+    float maxLatencyMs; ///< Largest passing average latency in milliseconds, or 0 for no limit, --loadtestmaxlatency.
+    float maxBytesPerBotPerSecond; ///< Largest passing received bytes per bot per second, or 0 for no limit, --loadtestmaxbandwidth.
+    float maxClientSyncTickMs; ///< Largest passing average sync tick duration of this process in milliseconds, or 0 for no limit, --loadtestmaxclienttick.
+};
+
+/// Received network traffic of the load test bots of one message type.
+struct LoadTestMessageStats
+{
+    LoadTestMessageStats() : count(0), bytes(0) {}
+
+    unsigned count;
+    u64 bytes;
+};
+
+/// Headless load test harness for measuring the scene replication throughput of a server without real clients.
+/** Enabled with the --loadtest command line parameter, which logs the client of this process in to the server, and opens
+    the simulated client connections, the bots, to the same server. The bots log in like real clients with the highest supported
+    protocol version, but do not keep a scene: they only count and time the messages they receive. Once the client has logged in,
+    the scene mutator creates replicated entities with a Placeable into the client scene and moves them on every sync tick,
+    so that the server replicates the movement to every bot.
+
+    The report has the duration of the sync tick of this process, the client, the received bytes per bot per second, the message counts
+    and bytes per message type, and the latency from a mutator tick to the first scene update received by each bot.
+    Run the server on loopback for repeatable numbers, and use --loadtestduration with --loadtestreport to compare runs in CI.
+    When the duration ends, the process exits with code 1 if no bot logged in, or if the average latency, the bytes per bot
+    per second or the average client sync tick exceed the limits given with --loadtestmaxlatency, --loadtestmaxbandwidth
+    or --loadtestmaxclienttick, so that CI can fail the run. */
+class TUNDRALOGIC_API LoadTest : public Object, public kNet::IMessageHandler
+{
+    OBJECT(LoadTest);
+
+public:
+    explicit LoadTest(TundraLogic* owner);
+    ~LoadTest();
+
+    /// Reads the settings from the command line. Returns whether the load test was enabled with --loadtest.
+    static bool ReadSettings(Framework *framework, LoadTestSettings &settings);
+
+    /// Logs the client in, and opens the bot connections.
+    void Start(const LoadTestSettings &settings);
+
+    /// Disconnects the bots and removes the mutated entities.
+    void Stop();
+
+    /// Returns whether the load test is running.
+    bool IsRunning() const { return running_; }
+
+    /// Processes the bot connections and runs the mutator. Called by TundraLogic every frame.
+    void Update(float frametime);
+
+    /// Returns the report of the run so far as JSON.
+    String Report() const;
+
+    /// Invoked by kNet for each message received by a bot.
+    void HandleMessage(kNet::MessageConnection *source, kNet::packet_id_t packetId, kNet::message_id_t id, const char *data, size_t numBytes) override;
+
+private:
+    /// Simulated client connection.
+    struct Bot
+    {
+        Bot() : loginSent(false), loggedIn(false), bytesReceived(0), tickSentTime(0) {}
+
+        Ptr(kNet::MessageConnection) connection;
+        bool loginSent;
+        bool loggedIn;
+        u64 bytesReceived;
+        /// Time of the oldest mutator tick the bot has not received scene updates for since, or 0 if none.
+        kNet::tick_t tickSentTime;
+    };
+
+    void SendLogin(Bot &bot, unsigned index);
+    void CreateEntities(Scene *scene);
+    void MoveEntities(float time);
+    void LogReport() const;
+    void WriteReport() const;
+    /// Returns the number of logged in bots, and their received bytes per second on average.
+    unsigned NumLoggedIn(double &bytesPerBotPerSecond) const;
+    /// Logs the limits the run exceeded. Returns false if it exceeded any, or if no bot logged in.
+    bool CheckLimits() const;
+
+    TundraLogic* owner_;
+    Framework* framework_;
+    LoadTestSettings settings_;
+    bool running_;
+
+    Vector<Bot> bots_;
+    /// Bot index by connection
+    HashMap<kNet::MessageConnection*, unsigned> botIndices_;
+    /// Received traffic by message ID
+    HashMap<kNet::message_id_t, LoadTestMessageStats> messageStats_;
+
+    /// Entities moved by the mutator
+    Vector<EntityWeakPtr> entities_;
+    float mutatorAcc_;
+    float mutatorTime_;
+    unsigned numMutatorTicks_;
+
+    /// Sync tick duration of this process, the client, in seconds
+    float tickTimeSum_;
+    float tickTimeMax_;
+    unsigned numTicks_;
+
+    /// Latency from a mutator tick to the next scene update received by a bot, in seconds
+    double latencySum_;
+    float latencyMax_;
+    unsigned numLatencySamples_;
+
+    kNet::tick_t startTime_;
+    kNet::PolledTimer reportTimer_;
+};
+
+}
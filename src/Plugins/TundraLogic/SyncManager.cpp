@@ -22,10 +22,18 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 #include "Placeable.h"
+#include "InterestManager.h"
+#include "AttributeDelta.h"
+#include "FrameAPI.h"
+#include "IRenderer.h"
 
 #include <StringUtils.h>
+#include <WorkQueue.h>
+#include <Timer.h>
 
 #include <cstring>
+#include <cfloat>
+#include <queue>
 
 
 // Used to print EC mismatch warnings only once per EC.
@@ -36,44 +44,155 @@ static size_t oldAttrDataBufferSize = 16 * 1024;
 namespace Tundra
 {
 
-bool SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
+/// Dirty entity with its sync priority, for ordering the processing of a sync state's dirty queue.
+struct PrioritizedEntity
+{
+    PrioritizedEntity(entity_id_t id_, float priority_) : id(id_), priority(priority_) {}
+
+    bool operator <(const PrioritizedEntity &rhs) const { return priority < rhs.priority; }
+
+    entity_id_t id;
+    float priority;
+};
+
+bool SyncManager::WriteComponentFullUpdate(SyncSerializationContext &ctx, kNet::DataSerializer& ds, IComponent *comp)
 {
     // Component identification
     ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
     ds.AddVLE<kNet::VLE8_16_32>(comp->TypeId());
     ds.AddString(comp->Name().CString());
     
-    // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components
-    kNet::DataSerializer attrDs(attrDataBuffer_, NUMELEMS(attrDataBuffer_));
-
-    // Static-structured attributes
-    unsigned numStaticAttrs = comp->NumStaticAttributes();
-    const AttributeVector& attrs = comp->Attributes();
-    for (uint i = 0; i < numStaticAttrs; ++i)
-        attrs[i]->ToBinary(attrDs);
-    
-    // Dynamic-structured attributes (use EOF to detect so do not need to send their amount)
-    for (unsigned i = numStaticAttrs; i < attrs.Size(); ++i)
+    // The attribute data is identical for all users, so serialize it only once per tick
+    AttributeDataCacheKey key(comp->ParentEntity() ? comp->ParentEntity()->Id() : 0, comp->Id(), 0, 0, true);
+    auto cached = ctx.attrDataCache.Find(key);
+    if (cached == ctx.attrDataCache.End())
     {
-        if (attrs[i] && attrs[i]->IsDynamic())
-        {
-            attrDs.Add<u8>((u8)i); // Index
-            attrDs.Add<u8>((u8)attrs[i]->TypeId());
-            attrDs.AddString(attrs[i]->Name().CString());
+        // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components
+        kNet::DataSerializer attrDs(ctx.attrDataBuffer, NUMELEMS(ctx.attrDataBuffer));
+
+        // Static-structured attributes
+        unsigned numStaticAttrs = comp->NumStaticAttributes();
+        const AttributeVector& attrs = comp->Attributes();
+        for (uint i = 0; i < numStaticAttrs; ++i)
             attrs[i]->ToBinary(attrDs);
+        
+        // Dynamic-structured attributes (use EOF to detect so do not need to send their amount)
+        for (unsigned i = numStaticAttrs; i < attrs.Size(); ++i)
+        {
+            if (attrs[i] && attrs[i]->IsDynamic())
+            {
+                attrDs.Add<u8>((u8)i); // Index
+                attrDs.Add<u8>((u8)attrs[i]->TypeId());
+                attrDs.AddString(attrs[i]->Name().CString());
+                attrs[i]->ToBinary(attrDs);
+            }
         }
+
+        cached = CacheAttributeData(ctx, key, attrDs, ValidateAttributeBuffer(false, attrDs, comp));
     }
 
-    if (!ValidateAttributeBuffer(false, attrDs, comp))
+    const SerializedAttributeData &attrData = cached->second_;
+    if (!attrData.valid)
         return false;
     
     // Add the attribute array to the main serializer
-    ds.AddVLE<kNet::VLE8_16_32>((u32)attrDs.BytesFilled());
-    ds.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDs.BytesFilled());
+    ds.AddVLE<kNet::VLE8_16_32>(attrData.data.Size());
+    if (attrData.data.Size())
+        ds.AddArray<u8>(&attrData.data[0], attrData.data.Size());
     return true;
 }
 
-bool SyncManager::ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, ComponentPtr &comp, size_t maxBytes)
+Urho3D::HashMap<AttributeDataCacheKey, SerializedAttributeData>::Iterator SyncManager::CacheAttributeData(SyncSerializationContext &ctx, const AttributeDataCacheKey &key, kNet::DataSerializer &attrDs, bool valid)
+{
+    SerializedAttributeData &attrData = ctx.attrDataCache[key];
+    attrData.valid = valid;
+    if (valid)
+    {
+        attrData.data.Resize((unsigned)attrDs.BytesFilled());
+        if (attrDs.BytesFilled())
+            memcpy(&attrData.data[0], attrDs.GetData(), attrDs.BytesFilled());
+    }
+    else
+        attrData.data.Clear();
+    return ctx.attrDataCache.Find(key);
+}
+
+void SyncManager::WriteEditAttributeData(kNet::DataSerializer &ds, const AttributeVector &attrs, const ComponentSyncState &compState, const std::vector<u8> &changedAttributes, EntitySyncState *deltaState)
+{
+    // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
+    unsigned bitsMethod1 = (unsigned)changedAttributes.size() * 8 + 8;
+    unsigned bitsMethod2 = (unsigned)attrs.Size();
+    // Method 1: indices
+    if (bitsMethod1 <= bitsMethod2)
+    {
+        ds.Add<kNet::bit>(0);
+        ds.Add<u8>((u8)changedAttributes.size());
+        for (unsigned i = 0; i < changedAttributes.size(); ++i)
+        {
+            ds.Add<u8>(changedAttributes[i]);
+            WriteAttributeValue(ds, attrs[changedAttributes[i]], compState.id, changedAttributes[i], deltaState);
+        }
+    }
+    // Method 2: bitmask
+    else
+    {
+        ds.Add<kNet::bit>(1);
+        for (unsigned i = 0; i < attrs.Size(); ++i)
+        {
+            if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
+            {
+                ds.Add<kNet::bit>(1);
+                WriteAttributeValue(ds, attrs[i], compState.id, (u8)i, deltaState);
+            }
+            else
+                ds.Add<kNet::bit>(0);
+        }
+    }
+}
+
+void SyncManager::WriteAttributeValue(kNet::DataSerializer &ds, IAttribute *attr, component_id_t compId, u8 attrIndex, EntitySyncState *deltaState)
+{
+    if (deltaState && AttributeDelta::IsEncodable(attr))
+        AttributeDelta::Write(ds, attr, &deltaState->deltaBases, compId, attrIndex, deltaAttributes_);
+    else
+        attr->ToBinary(ds);
+}
+
+void SyncManager::ReadEditedAttribute(kNet::DataDeserializer &ds, IAttribute *attr, component_id_t compId, u8 attrIndex, EntitySyncState *deltaState,
+    Scene *scene, bool apply, float updateInterval, std::vector<IAttribute*> &changedAttrs)
+{
+    bool interpolate = (!owner_->IsServer() && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
+    if (apply && !interpolate)
+    {
+        if (ReadAttributeValue(ds, attr, compId, attrIndex, deltaState))
+            changedAttrs.push_back(attr);
+        return;
+    }
+
+    // Interpolated values are read to the end value of the interpolation, and rejected values to a copy that is discarded
+    IAttribute* value = attr->Clone();
+    if (ReadAttributeValue(ds, value, compId, attrIndex, deltaState) && apply)
+        scene->StartAttributeInterpolation(attr, value, updateInterval);
+    else
+        delete value;
+}
+
+bool SyncManager::ReadAttributeValue(kNet::DataDeserializer &ds, IAttribute *attr, component_id_t compId, u8 attrIndex, EntitySyncState *deltaState)
+{
+    if (!deltaState || !AttributeDelta::IsEncodable(attr))
+    {
+        attr->FromBinary(ds, AttributeChange::Disconnected);
+        return true;
+    }
+    if (AttributeDelta::Read(ds, attr, &deltaState->deltaBases, compId, attrIndex))
+        return true;
+
+    // Values were skipped, or the attribute was recreated. The sender sends a full value at least every few values, so this is transient.
+    LogDebug("SyncManager::ReadAttributeValue: No previous value for the delta of attribute index " + String((int)attrIndex) + " in component " + String(compId) + ", ignoring.");
+    return false;
+}
+
+bool SyncManager::ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, IComponent *comp, size_t maxBytes)
 {
     if (maxBytes == 0)
         maxBytes = oldAttrDataBufferSize;
@@ -87,7 +206,7 @@ bool SyncManager::ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds,
     if (ds.BytesFilled() > maxBytes)
     {
         // Exceeded the new bigger buffer as well. This will corrupt the buffers and is fatal!
-        if (ds.BytesFilled() > NUMELEMS(attrDataBuffer_))
+        if (ds.BytesFilled() > sizeof(SyncSerializationContext::attrDataBuffer))
             fatal = true;
 
         String entityIdentifier = (comp->ParentEntity() ? comp->ParentEntity()->ToString() : "");
@@ -111,12 +230,29 @@ SyncManager::SyncManager(TundraLogic* owner) :
     framework_(owner->GetFramework()),
     updatePeriod_(1.0f / 20.0f),
     updateAcc_(0.0),
+    maxBytesPerTick_(64 * 1024),
     maxLinExtrapTime_(3.0f),
     noClientPhysicsHandoff_(false),
+    sendCameraUpdates_(false),
+    parallelProcessing_(false),
+    deltaAttributes_(true),
+    lastTickDuration_(0.0f),
+    parallelScene_(0),
+    parallelTime_(0.f),
     componentTypeSender_(0)
 {
+    interestManager_ = SharedPtr<InterestManager>(new InterestManager(owner));
+
     if (framework_->HasCommandLineParameter("--noclientphysics"))
         noClientPhysicsHandoff_ = true;
+
+    StringVector bytesPerTickParam = framework_->CommandLineParameters("--syncbytespertick");
+    if (bytesPerTickParam.Size() > 0)
+        maxBytesPerTick_ = ToUInt(bytesPerTickParam.Front());
+    if (framework_->HasCommandLineParameter("--parallelsync"))
+        parallelProcessing_ = true;
+    if (framework_->HasCommandLineParameter("--nodeltaattributes"))
+        deltaAttributes_ = false;
     
     GetClientExtrapolationTime();
 
@@ -144,6 +280,46 @@ void SyncManager::SendCameraUpdateRequest(UserConnectionPtr conn, bool enabled)
     conn->Send(cCameraOrientationRequest, true, true, ds);
 }
 
+void SyncManager::UpdateInterestManagerSettings(bool enabled, bool eucl, bool ray, bool rel, int critrange, int relrange, int updateint, int raycastint)
+{
+    InterestManagerSettings settings;
+    settings.enabled = enabled;
+    settings.euclidean = eucl;
+    settings.raycast = ray;
+    settings.relevance = rel;
+    settings.criticalRange = (float)critrange;
+    settings.relevanceRange = (float)relrange;
+    settings.updateInterval = (float)updateint;
+    settings.raycastInterval = (float)raycastint;
+
+    bool wasEnabled = interestManager_->IsEnabled();
+    interestManager_->SetSettings(settings);
+
+    // Clients only send their camera location when asked to
+    if (owner_->IsServer() && wasEnabled != enabled)
+    {
+        UserConnectionList& users = owner_->Server()->UserConnections();
+        for(auto i = users.Begin(); i != users.End(); ++i)
+            SendCameraUpdateRequest(*i, enabled);
+    }
+
+    // Release everything that interest management was withholding
+    if (owner_->IsServer() && !enabled)
+    {
+        UserConnectionList& users = owner_->Server()->UserConnections();
+        for(auto i = users.Begin(); i != users.End(); ++i)
+        {
+            SceneSyncState *state = (*i)->syncState.Get();
+            if (!state)
+                continue;
+            for (auto j = state->visibleEntities.Begin(); j != state->visibleEntities.End(); ++j)
+                state->relevanceFactors.erase(*j);
+            state->visibleEntities.Clear();
+            state->MarkPendingEntitiesDirty();
+        }
+    }
+}
+
 void SyncManager::SetUpdatePeriod(float period)
 {
     // Allow max 100fps
@@ -191,6 +367,7 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     if (previous)
     {
         previous->AttributeChanged.Disconnect(this, &SyncManager::OnAttributeChanged);
+        previous->AttributeChangesFlushed.Disconnect(this, &SyncManager::OnAttributeChangesFlushed);
         previous->AttributeAdded.Disconnect(this, &SyncManager::OnAttributeAdded);
         previous->AttributeRemoved.Disconnect(this, &SyncManager::OnAttributeRemoved);
         previous->ComponentAdded.Disconnect(this, &SyncManager::OnComponentAdded);
@@ -219,6 +396,7 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     scene_ = scene;
     Scene* sceneptr = scene.Get();
     sceneptr->AttributeChanged.Connect(this, &SyncManager::OnAttributeChanged);
+    sceneptr->AttributeChangesFlushed.Connect(this, &SyncManager::OnAttributeChangesFlushed);
     sceneptr->AttributeAdded.Connect(this, &SyncManager::OnAttributeAdded);
     sceneptr->AttributeRemoved.Connect(this, &SyncManager::OnAttributeRemoved);
     sceneptr->ComponentAdded.Connect(this, &SyncManager::OnComponentAdded);
@@ -242,6 +420,9 @@ void SyncManager::HandleNetworkMessage(UserConnection* user, kNet::packet_id_t p
         case cCameraOrientationUpdate:
             HandleCameraOrientation(user, data, numBytes);
             break;
+        case cCameraOrientationRequest:
+            HandleCameraOrientationRequest(user, data, numBytes);
+            break;
         case cCreateEntityMessage:
             HandleCreateEntity(user, data, numBytes);
             break;
@@ -318,7 +499,11 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
     user->syncState->SetParentScene(scene_);
 
     if (owner_->IsServer())
+    {
         SceneStateCreated.Emit(user.Get(), user->syncState.Get());
+        if (interestManager_->IsEnabled())
+            SendCameraUpdateRequest(user, true);
+    }
 
     for(auto iter = scene->Begin(); iter != scene->End(); ++iter)
     {
@@ -375,6 +560,48 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
     }
 }
 
+void SyncManager::OnAttributeChangesFlushed(const AttributeChangeJournal& journal)
+{
+    PROFILE(SyncManager_OnAttributeChangesFlushed);
+
+    bool isServer = owner_->IsServer();
+    ScenePtr scene = scene_.Lock();
+
+    for (unsigned i = 0; i < journal.Size(); ++i)
+    {
+        const AttributeChangeJournal::ComponentChanges& changes = journal[i];
+        IComponent* comp = changes.component.Get();
+        if (!comp)
+            continue;
+
+        // Client: Check for stopping interpolation, as in OnAttributeChanged
+        if (!isServer && scene && !scene->IsInterpolating())
+        {
+            const AttributeVector& attrs = comp->Attributes();
+            for (unsigned j = 0; j < attrs.Size(); ++j)
+                if (attrs[j] && changes.IsChanged((u8)j) && attrs[j]->Metadata() && attrs[j]->Metadata()->interpolation == AttributeMetadata::Interpolate)
+                    scene->EndAttributeInterpolation(attrs[j]);
+        }
+
+        if (comp->IsLocal() || !changes.HasReplicated())
+            continue;
+        Entity* entity = comp->ParentEntity();
+        if (!entity || entity->IsLocal())
+            continue;
+
+        // Mark all the replicated attributes of the component dirty with one sync state lookup per user
+        if (isServer)
+        {
+            UserConnectionList& users = owner_->Server()->UserConnections();
+            for(auto j = users.Begin(); j != users.End(); ++j)
+                if ((*j)->syncState)
+                    (*j)->syncState->MarkAttributesDirty(entity->Id(), comp->Id(), changes.replicated);
+        }
+        else
+            serverConnection_->syncState->MarkAttributesDirty(entity->Id(), comp->Id(), changes.replicated);
+    }
+}
+
 void SyncManager::OnAttributeAdded(IComponent* comp, IAttribute* attr, AttributeChange::Type /*change*/)
 {
     assert(comp && attr);
@@ -494,7 +721,8 @@ void SyncManager::OnEntityCreated(Entity* entity, AttributeChange::Type change)
             if ((*i)->syncState)
             {
                 (*i)->syncState->MarkEntityDirty(entity->Id());
-                if ((*i)->syncState->entities[entity->Id()].removed)
+                auto entityState = (*i)->syncState->entities.Find(entity->Id());
+                if (entityState != (*i)->syncState->entities.End() && entityState->second_.removed)
                 {
                     LogWarning("An entity with ID " + String(entity->Id()) + " is queued to be deleted, but a new entity \"" + 
                         entity->Name() + "\" is to be added to the scene!");
@@ -727,117 +955,92 @@ float3 HermiteDerivative(const float3 &pos0, const float3 &vel0, const float3 &p
     return h1 * pos0 + h2 * pos1 + h3 * vel0 + h4 * vel1;
 }
 
-/// \todo Uncomment and fix once RigidBody component implemented
-void SyncManager::InterpolateRigidBodies(f64 /*frametime*/, SceneSyncState* /*state*/)
-{
-//    ScenePtr scene = scene_.Lock();
-//    if (!scene)
-//        return;
-//
-//    for(std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = state->entityInterpolations.begin(); 
-//        iter != state->entityInterpolations.end();)
-//    {
-//        EntityPtr e = scene->EntityById(iter->first);
-//        shared_ptr<EC_Placeable> placeable = e ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>();
-//        if (!placeable.get())
-//        {
-//            std::map<entity_id_t, RigidBodyInterpolationState>::iterator del = iter++;
-//            state->entityInterpolations.erase(del);
-//            continue;
-//        }
-//
-//        shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
-//
-//        RigidBodyInterpolationState &r = iter->second;
-//        if (!r.interpolatorActive)
-//        {
-//            ++iter;
-//            continue;
-//        }
-//
-//        const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
-//
-//        // Test: Uncomment to only interpolate.
-////        r.interpTime = std::min(1.0f, r.interpTime + (float)frametime / interpPeriod);
-//        r.interpTime += (float)frametime / interpPeriod;
-//
-//        // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
-//        const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
-//
-//        float3 pos;
-//        if (r.interpTime < 1.0f) // Interpolating between two messages from server.
-//        {
-//            if (isNewtonian)
-//                pos = HermiteInterpolate(r.interpStart.pos, r.interpStart.vel * interpPeriod, r.interpEnd.pos, r.interpEnd.vel * interpPeriod, r.interpTime);
-//            else
-//                pos = HermiteInterpolate(r.interpStart.pos, float3::zero, r.interpEnd.pos, float3::zero, r.interpTime);
-//        }
-//        else // Linear extrapolation if server has not sent an update.
-//        {
-//            if (isNewtonian && maxLinExtrapTime_ > 1.0f)
-//                pos = r.interpEnd.pos + r.interpEnd.vel * (r.interpTime-1.f) * interpPeriod;
-//            else
-//                pos = r.interpEnd.pos;
-//        }
-//        ///\todo Orientation is only interpolated, and capped to end result. Also extrapolate orientation.
-//        Quat rot = Quat::Slerp(r.interpStart.rot, r.interpEnd.rot, Clamp01(r.interpTime));
-//        float3 scale = float3::Lerp(r.interpStart.scale, r.interpEnd.scale, Clamp01(r.interpTime));
-//        
-//        Transform t;
-//        t.SetPos(pos);
-//        t.SetOrientation(rot);
-//        t.SetScale(scale);
-//        placeable->transform.Set(t, AttributeChange::LocalOnly);
-//
-//        // Local simulation steps:
-//        // One fixed update interval: interpolate
-//        // Two subsequent update intervals: linear extrapolation
-//        // All subsequente update intervals: local physics extrapolation.
-//        if (r.interpTime >= maxLinExtrapTime_) // Hand-off to client-side physics?
-//        {
-//            if (rigidBody)
-//            {
-//                if (!noClientPhysicsHandoff_)
-//                {
-//                    bool objectIsInRest = (r.interpEnd.vel.LengthSq() < 1e-4f && r.interpEnd.angVel.LengthSq() < 1e-4f);
-//                    // Now the local client-side physics will take over the simulation of this rigid body, but only if the object
-//                    // is moving. This is because the client shouldn't wake up the object (locally) if it's stationary, but wait for the
-//                    // server-side signal for that event.
-//                    rigidBody->SetClientExtrapolating(objectIsInRest == false);
-//                    // Give starting parameters for the simulation.
-//                    rigidBody->linearVelocity.Set(r.interpEnd.vel, AttributeChange::LocalOnly);
-//                    rigidBody->angularVelocity.Set(r.interpEnd.angVel, AttributeChange::LocalOnly);
-//                }
-//            }
-//            r.interpolatorActive = false;
-//            ++iter;
-//            
-//            // Could remove the interpolation structure here, as inter/extrapolation it is no longer active. However, it is currently
-//            // used to store most recently received entity position  & velocity data.
-//            //iter = state->entityInterpolations.erase(iter); // Finished interpolation.
-//        }
-//        else // Interpolation or linear extrapolation.
-//        {
-//            if (rigidBody)
-//            {
-//                // Ensure that the local side physics is not driving the position of this entity.
-//                rigidBody->SetClientExtrapolating(false);
-//
-//                // Setting these is rather redundant, since Bullet doesn't simulate the entity using these variables. However, other
-//                // (locally simulated) objects can collide to this entity, in which case it's good to have the proper velocities for bullet,
-//                // so that the collision response simulates the appropriate forces/velocities in play.
-//                float3 curVel = float3::Lerp(r.interpStart.vel, r.interpEnd.vel, Clamp01(r.interpTime));
-//                // Test: To set continous velocity based on the Hermite curve, use the following:
-// //               float3 curVel = HermiteDerivative(r.interpStart.pos, r.interpStart.vel*interpPeriod, r.interpEnd.pos, r.interpEnd.vel*interpPeriod, r.interpTime);
-//
-//                rigidBody->linearVelocity.Set(curVel, AttributeChange::LocalOnly);
-//
-//                ///\todo Setup angular velocity.
-//                rigidBody->angularVelocity.Set(float3::zero, AttributeChange::LocalOnly);
-//            }
-//            ++iter;
-//        }
-//    }
+/// Largest magnitude of the three smallest components of a unit quaternion, ie. 1/sqrt(2).
+static const float cSmallestThreeRange = 0.70710678f;
+
+/// Writes a unit quaternion with the "smallest three" encoding: the index of the largest component in 2 bits,
+/// followed by the three other components quantized to 10 bits each. Sends fixed 32 bits.
+static void AddSmallestThreeQuat(kNet::DataSerializer &ds, const Quat &q)
+{
+    const float c[4] = { q.x, q.y, q.z, q.w };
+    u32 largest = 0;
+    for (u32 i = 1; i < 4; ++i)
+        if (Abs(c[i]) > Abs(c[largest]))
+            largest = i;
+    // q and -q represent the same orientation, so flip the sign to make the omitted component positive.
+    const float sign = c[largest] < 0.f ? -1.f : 1.f;
+
+    ds.AppendBits(largest, 2);
+    for (u32 i = 0; i < 4; ++i)
+        if (i != largest)
+            ds.AddQuantizedFloat(-cSmallestThreeRange, cSmallestThreeRange, 10, Clamp(c[i] * sign, -cSmallestThreeRange, cSmallestThreeRange));
+}
+
+/// Reads a unit quaternion written with AddSmallestThreeQuat.
+static Quat ReadSmallestThreeQuat(kNet::DataDeserializer &dd)
+{
+    const u32 largest = dd.ReadBits(2);
+    float c[4];
+    float sumSq = 0.f;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+        c[i] = dd.ReadQuantizedFloat(-cSmallestThreeRange, cSmallestThreeRange, 10);
+        sumSq += c[i] * c[i];
+    }
+    c[largest] = Sqrt(Max(0.f, 1.f - sumSq));
+
+    Quat q(c[0], c[1], c[2], c[3]);
+    q.Normalize();
+    return q;
+}
+
+void SyncManager::InterpolateRigidBodies(f64 frametime, SceneSyncState* state)
+{
+    ScenePtr scene = scene_.Lock();
+    if (!scene || !state)
+        return;
+
+    const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
+
+    for(auto iter = state->entityInterpolations.begin(); iter != state->entityInterpolations.end();)
+    {
+        EntityPtr e = scene->EntityById(iter->first);
+        SharedPtr<Placeable> placeable = e ? e->Component<Placeable>() : SharedPtr<Placeable>();
+        if (!placeable)
+        {
+            state->entityInterpolations.erase(iter++);
+            continue;
+        }
+
+        RigidBodyInterpolationState &r = iter->second;
+        ++iter;
+        if (!r.interpolatorActive)
+            continue;
+
+        r.interpTime += (float)frametime / interpPeriod;
+
+        float3 pos;
+        if (r.interpTime < 1.0f) // Interpolating between two messages from server.
+            pos = HermiteInterpolate(r.interpStart.pos, r.interpStart.vel * interpPeriod, r.interpEnd.pos, r.interpEnd.vel * interpPeriod, r.interpTime);
+        else // Linear extrapolation if server has not sent an update. Capped to maxLinExtrapTime_ update periods.
+            pos = r.interpEnd.pos + r.interpEnd.vel * (Min(r.interpTime, maxLinExtrapTime_) - 1.f) * interpPeriod;
+        ///\todo Orientation is only interpolated, and capped to end result. Also extrapolate orientation.
+        Quat rot = Quat::Slerp(r.interpStart.rot, r.interpEnd.rot, Clamp01(r.interpTime));
+        float3 scale = float3::Lerp(r.interpStart.scale, r.interpEnd.scale, Clamp01(r.interpTime));
+
+        Transform t;
+        t.SetPos(pos);
+        t.SetOrientation(rot);
+        t.SetScale(scale);
+        placeable->transform.Set(t, AttributeChange::LocalOnly);
+
+        // Stop at the extrapolated position until the server sends the next update. The interpolation state is kept,
+        // as it stores the most recently received position & velocity data.
+        if (r.interpTime >= maxLinExtrapTime_)
+            r.interpolatorActive = false;
+    }
 }
 
 void SyncManager::Update(f64 frametime)
@@ -849,6 +1052,7 @@ void SyncManager::Update(f64 frametime)
         InterpolateRigidBodies(frametime, serverConnection_->syncState.Get());
 
     // Check if it is yet time to perform a network update tick.
+    lastTickDuration_ = 0.0f;
     updateAcc_ += (float)frametime;
     if (updateAcc_ < updatePeriod_)
         return;
@@ -859,470 +1063,380 @@ void SyncManager::Update(f64 frametime)
     ScenePtr scene = scene_.Lock();
     if (!scene)
         return;
+
+    Urho3D::HiresTimer tickTimer;
+
+    // Mark the attribute changes batched so far in this frame dirty before serializing
+    scene->FlushAttributeChanges();
+
+    // Serialized attribute data is only valid for the duration of one tick
+    for (unsigned i = 0; i < serializationContexts_.Size(); ++i)
+        serializationContexts_[i]->attrDataCache.Clear();
+
+    const float time = framework_->Frame()->WallClockTime();
     
     if (owner_->IsServer())
     {
         // If we are server, process all authenticated users
 
-        // Then send out changes to other attributes via the generic sync mechanism.
+        // Snapshot the entity locations once for the sync priorities and interest management of all users
+        UpdateWorldPositions(scene.Get());
+        const bool interestManagement = interestManager_->IsEnabled();
+        if (interestManagement)
+            interestManager_->UpdateSpatialGrid(worldPositions_);
+
         UserConnectionList& users = owner_->Server()->UserConnections();
         for(auto i = users.Begin(); i != users.End(); ++i)
             if ((*i)->syncState)
             {
-                // As of now only native clients understand the optimized rigid body sync message.
-                // This may change with future protocol versions
-                if (dynamic_cast<KNetUserConnection*>(i->Get()))
-                { 
-                    // First send out all changes to rigid bodies.
-                    // After processing this function, the bits related to rigid body states have been cleared,
-                    // so the generic sync will not double-replicate the rigid body positions and velocities.
-                    ReplicateRigidBodyChanges((*i).Get());
-                }
-                ProcessSyncState((*i).Get());
+                if (interestManagement)
+                    interestManager_->UpdateSyncState((*i)->syncState.Get(), time);
+                ReplicatePlaceholderComponentTypes(i->Get());
             }
+
+        // Then send out changes to rigid bodies and other attributes via the generic sync mechanism.
+        if (parallelProcessing_ && users.Size() > 1)
+            ProcessSyncStatesParallel(scene.Get(), time);
+        else
+        {
+            for(auto i = users.Begin(); i != users.End(); ++i)
+                if ((*i)->syncState)
+                    ProcessSyncState(i->Get(), scene.Get(), SerializationContext(0), time);
+        }
     }
     else
     {
         // If we are client and the connection is current, process just the server sync state
         if (Urho3D::StaticCast<KNetUserConnection>(serverConnection_)->connection)
-            ProcessSyncState(serverConnection_.Get());
-    }
-}
-
-/// \todo Uncomment and fix after RigidBody component implemented
-void SyncManager::ReplicateRigidBodyChanges(UserConnection* /*user*/)
-{
-//    PROFILE(SyncManager_ReplicateRigidBodyChanges);
-//    
-//    ScenePtr scene = scene_.Lock();
-//    if (!scene)
-//        return;
-//
-//    const int maxMessageSizeBytes = 1400;
-//    kNet::DataSerializer ds(maxMessageSizeBytes);
-//    bool msgReliable = false;
-//    SceneSyncState* state = user->syncState.Get();
-//
-//    QHashIterator<entity_id_t, EntitySyncState*> iter(state->dirtyQueue);
-//    while (iter.hasNext())
-//    {
-//        iter.next();
-//
-//        const int maxRigidBodyMessageSizeBits = 350; // An update for a single rigid body can take at most this many bits. (conservative bound)
-//        // If we filled up this message, send it out and start crafting anothero one.
-//        if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
-//        {
-//            user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
-//            ds = kNet::DataSerializer(maxMessageSizeBytes);
-//            msgReliable = false;
-//        }
-//
-//        EntitySyncState &ess = *iter.value();
-//
-//        if (ess.isNew || ess.removed)
-//            continue; // Newly created and removed entities are handled through the traditional sync mechanism.
-//
-//        EntityPtr e = ess.weak.lock();
-//        shared_ptr<EC_Placeable> placeable = (e.get() ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>());
-//        if (!placeable.get())
-//            continue;
-//
-//        std::map<component_id_t, ComponentSyncState>::iterator placeableComp = ess.components.find(placeable->Id());
-//
-//        bool transformDirty = false;
-//        if (placeableComp != ess.components.end())
-//        {
-//            ComponentSyncState &pss = placeableComp->second;
-//            if (!pss.isNew && !pss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
-//            {
-//                transformDirty = (pss.dirtyAttributes[0] & 1) != 0; // The Transform of an EC_Placeable is the first attibute in the component.
-//                pss.dirtyAttributes[0] &= ~1;
-//            }
-//        }
-//        bool velocityDirty = false;
-//        bool angularVelocityDirty = false;
-//        
-//        shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
-//        if (rigidBody)
-//        {
-//            std::map<component_id_t, ComponentSyncState>::iterator rigidBodyComp = ess.components.find(rigidBody->Id());
-//            if (rigidBodyComp != ess.components.end())
-//            {
-//                ComponentSyncState &rss = rigidBodyComp->second;
-//                if (!rss.isNew && !rss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
-//                {
-//                    velocityDirty = (rss.dirtyAttributes[1] & (1 << 5)) != 0;
-//                    angularVelocityDirty = (rss.dirtyAttributes[1] & (1 << 6)) != 0;
-//
-//                    rss.dirtyAttributes[1] &= ~(1 << 5);
-//                    rss.dirtyAttributes[1] &= ~(1 << 6);
-//
-//                    velocityDirty = velocityDirty && (rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f);
-//                    angularVelocityDirty = angularVelocityDirty && (rigidBody->angularVelocity.Get().DistanceSq(ess.angularVelocity) >= 1e-1f);
-//
-//                    // If the object enters rest, force an update, and force the update to be sent as reliable, so that the client
-//                    // is guaranteed to receive the message, and will put the object to rest, instead of extrapolating it away indefinitely.
-//                    if (rigidBody->linearVelocity.Get().IsZero(1e-4f) && !ess.linearVelocity.IsZero(1e-4f))
-//                    {
-//                        velocityDirty = true;
-//                        msgReliable = true;
-//                    }
-//                    if (rigidBody->angularVelocity.Get().IsZero(1e-4f) && !ess.angularVelocity.IsZero(1e-4f))
-//                    {
-//                        angularVelocityDirty = true;
-//                        msgReliable = true;
-//                    }
-//                }
-//            }
-//        }
-//
-//        if (!transformDirty && !velocityDirty && !angularVelocityDirty)
-//            continue;
-//
-//        const Transform &t = placeable->transform.Get();
-//
-//        float timeSinceLastSend = kNet::Clock::SecondsSinceF(ess.lastNetworkSendTime);
-//        const float3 predictedClientSidePosition = ess.transform.pos + timeSinceLastSend * ess.linearVelocity;
-//        float error = t.pos.DistanceSq(predictedClientSidePosition);
-//        UNREFERENCED_PARAM(error)
-//        // TEST: To have the server estimate how far the client has simulated, use this.
-////        bool posChanged = transformDirty && (timeSinceLastSend > 0.2f || t.pos.DistanceSq(/*ess.transform.pos*/ predictedClientSidePosition) > 5e-5f);
-//        bool posChanged = transformDirty && t.pos.DistanceSq(ess.transform.pos) > 1e-3f;
-//        bool rotChanged = transformDirty && (t.rot.DistanceSq(ess.transform.rot) > 1e-1f);
-//        bool scaleChanged = transformDirty && (t.scale.DistanceSq(ess.transform.scale) > 1e-3f);
-//
-//        // Detect whether to send compact or full states for each variable.
-//        // 0 - don't send, 1 - send compact, 2 - send full.
-//        int posSendType = posChanged ? (t.pos.Abs().MaxElement() >= 1023.f ? 2 : 1) : 0;
-//        int rotSendType;
-//        int scaleSendType;
-//        int velSendType;
-//        int angVelSendType;
-//
-//        float3x3 rot;
-//        if (rotChanged)
-//        {
-//            rot = t.Orientation3x3();
-//            float3 fwd = rot.Col(2);
-//            float3 up = rot.Col(1);
-//            float3 planeNormal = float3::unitY.Cross(rot.Col(2));
-//            float d = planeNormal.Dot(rot.Col(1));
-//
-//            if (up.Dot(float3::unitY) >= 0.999f)
-//                rotSendType = 1; // Looking upright, 1 DOF.
-//            else if (Abs(d) <= 0.001f && Abs(fwd.Dot(float3::unitY)) < 0.95f && up.Dot(float3::unitY) > 0.f)
-//                rotSendType = 2; // No roll, i.e. 2 DOF. Use this only if not looking too close towards the +Y axis, due to precision issues, and only when object +Y is towards world up.
-//            else
-//                rotSendType = 3; // Full 3 DOF
-//        }
-//        else
-//            rotSendType = 0;
-//
-//        if (scaleChanged)
-//        {
-//            float3 s = t.scale.Abs();
-//            scaleSendType = (s.MaxElement() - s.MinElement() <= 1e-3f) ? 1 : 2; // Uniform scale only?
-//        }
-//        else
-//            scaleSendType = 0;
-//
-//        const float3 &linearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-//        const float3 angVel = rigidBody ? DegToRad(rigidBody->angularVelocity.Get()) : float3::zero;
-//
-//        velSendType = velocityDirty ? (linearVel.LengthSq() >= 64.f ? 2 : 1) : 0;
-//        angVelSendType = angularVelocityDirty ? 1 : 0;
-//
-//        if (posSendType == 0 && rotSendType == 0 && scaleSendType == 0 && velSendType == 0 && angVelSendType == 0)
-//            continue;
-//
-//        size_t bitIdx = ds.BitsFilled();
-//        UNREFERENCED_PARAM(bitIdx)
-//        ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
-//
-//        ds.AddArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2); // Sends fixed 8 bits.
-//        if (posSendType == 1) // Sends fixed 57 bits.
-//        {
-//            ds.AddSignedFixedPoint(11, 8, t.pos.x);
-//            ds.AddSignedFixedPoint(11, 8, t.pos.y);
-//            ds.AddSignedFixedPoint(11, 8, t.pos.z);
-//        }
-//        else if (posSendType == 2) // Sends fixed 96 bits.
-//        {
-//            ds.Add<float>(t.pos.x);
-//            ds.Add<float>(t.pos.y);
-//            ds.Add<float>(t.pos.z);
-//        }        
-//
-//        if (rotSendType == 1) // Orientation with 1 DOF, only yaw.
-//        {
-//            // The transform is looking straight forward, i.e. the +y vector of the transform local space points straight towards +y in world space.
-//            // Therefore the forward vector has y == 0, so send (x,z) as a 2D vector.
-//            ds.AddNormalizedVector2D(rot.Col(2).x, rot.Col(2).z, 8);  // Sends fixed 8 bits.
-//        }
-//        else if (rotSendType == 2) // Orientation with 2 DOF, yaw and pitch.
-//        {
-//            float3 forward = rot.Col(2);
-//            forward.Normalize();
-//            ds.AddNormalizedVector3D(forward.x, forward.y, forward.z, 9, 8); // Sends fixed 17 bits.
-//        }
-//        else if (rotSendType == 3) // Orientation with 3 DOF, full yaw, pitch and roll.
-//        {
-//            Quat o = t.Orientation();
-//
-//            float3 axis;
-//            float angle;
-//            o.ToAxisAngle(axis, angle);
-//            if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
-//            {
-//                axis = -axis;
-//                angle = 2.f * 3.141592654f - angle;
-//            }
-//
-//            // Sends 10-31 bits.
-//            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
-//            if (quantizedAngle != 0)
-//                ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
-//        }
-//
-//        if (scaleSendType == 1) // Sends fixed 32 bytes.
-//        {
-//            ds.Add<float>(t.scale.x);
-//        }
-//        else if (scaleSendType == 2) // Sends fixed 96 bits.
-//        {
-//            ds.Add<float>(t.scale.x);
-//            ds.Add<float>(t.scale.y);
-//            ds.Add<float>(t.scale.z);
-//        }
-//
-//        if (velSendType == 1) // Sends fixed 32 bits.
-//        {
-//            ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 3, 8);
-//            ess.linearVelocity = linearVel;
-//        }
-//        else if (velSendType == 2) // Sends fixed 39 bits.
-//        {
-//            ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 10, 8);
-//            ess.linearVelocity = linearVel;
-//        }
-//
-//        if (angVelSendType == 1)
-//        {
-//            Quat o = Quat::FromEulerZYX(angVel.z, angVel.y, angVel.x);
-//
-//            float3 axis;
-//            float angle;
-//            o.ToAxisAngle(axis, angle);
-//            if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
-//            {
-//                axis = -axis;
-//                angle = 2.f * 3.141592654f - angle;
-//            }
-//             // Sends at most 31 bits.
-//            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
-//            if (quantizedAngle != 0)
-//                ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
-//
-//            ess.angularVelocity = angVel;
-//        }
-//        if (posSendType != 0)
-//            ess.transform.pos = t.pos;
-//        if (rotSendType != 0)
-//            ess.transform.rot = t.rot;
-//        if (scaleSendType != 0)
-//            ess.transform.scale = t.scale;
-//
-////        std::cout << "pos: " << posSendType << ", rot: " << rotSendType << ", scale: " << scaleSendType << ", vel: " << velSendType << ", angvel: " << angVelSendType << std::endl;
-//
-//        size_t bitsEnd = ds.BitsFilled();
-//        UNREFERENCED_PARAM(bitsEnd)
-//        ess.lastNetworkSendTime = kNet::Clock::Tick();
-//    }
-//    if (ds.BytesFilled() > 0)
-//        user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
-}
-
-void SyncManager::HandleRigidBodyChanges(UserConnection* /*source*/, kNet::packet_id_t /*packetId*/, const char* /*data*/, size_t /*numBytes*/)
-{
-//    ScenePtr scene = scene_.lock();
-//    if (!scene)
-//        return;
-//
-//    kNet::DataDeserializer dd(data, numBytes);
-//    while(dd.BitsLeft() >= 9)
-//    {
-//        u32 entityID = dd.ReadVLE<kNet::VLE8_16_32>();
-//        EntityPtr e = scene->EntityById(entityID);
-//        shared_ptr<EC_Placeable> placeable = e ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>();
-//        shared_ptr<EC_RigidBody> rigidBody = e ? e->GetComponent<EC_RigidBody>() : shared_ptr<EC_RigidBody>();
-//        Transform t = e ? placeable->transform.Get() : Transform();
-//
-//        float3 newLinearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-//
-//        // If the server omitted linear velocity, interpolate towards the last received linear velocity.
-//        std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = e ? serverConnection_->syncState->entityInterpolations.find(entityID) : serverConnection_->syncState->entityInterpolations.end();
-//        if (iter != serverConnection_->syncState->entityInterpolations.end())
-//            newLinearVel = iter->second.interpEnd.vel;
-//
-//        int posSendType;
-//        int rotSendType;
-//        int scaleSendType;
-//        int velSendType;
-//        int angVelSendType;
-//        dd.ReadArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2);
-//
-//        if (posSendType == 1)
-//        {
-//            t.pos.x = dd.ReadSignedFixedPoint(11, 8);
-//            t.pos.y = dd.ReadSignedFixedPoint(11, 8);
-//            t.pos.z = dd.ReadSignedFixedPoint(11, 8);
-//        }
-//        else if (posSendType == 2)
-//        {
-//            t.pos.x = dd.Read<float>();
-//            t.pos.y = dd.Read<float>();
-//            t.pos.z = dd.Read<float>();
-//        }
-//
-//        if (rotSendType == 1) // 1 DOF
-//        {
-//            float3 forward;
-//            dd.ReadNormalizedVector2D(8, forward.x, forward.z);
-//            forward.y = 0.f;
-//            float3x3 orientation = float3x3::LookAt(float3::unitZ, forward, float3::unitY, float3::unitY);
-//            t.SetOrientation(orientation);
-//        }
-//        else if (rotSendType == 2)
-//        {
-//            float3 forward;
-//            dd.ReadNormalizedVector3D(9, 8, forward.x, forward.y, forward.z);
-//
-//            float3x3 orientation = float3x3::LookAt(float3::unitZ, forward, float3::unitY, float3::unitY);
-//            t.SetOrientation(orientation);
-//
-//        }
-//        else if (rotSendType == 3)
-//        {
-//            // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
-//            u32 quantizedAngle = dd.ReadBits(10);
-//            if (quantizedAngle != 0)
-//            {
-//                float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
-//                float3 axis;
-//                dd.ReadNormalizedVector3D(11, 10, axis.x, axis.y, axis.z);
-//                t.SetOrientation(Quat(axis, angle));
-//            }
-//            else
-//                t.SetOrientation(Quat::identity);
-//        }
-//
-//        if (scaleSendType == 1)
-//            t.scale = float3::FromScalar(dd.Read<float>());
-//        else if (scaleSendType == 2)
-//        {
-//            t.scale.x = dd.Read<float>();
-//            t.scale.y = dd.Read<float>();
-//            t.scale.z = dd.Read<float>();
-//        }
-//
-//        if (velSendType == 1)
-//            dd.ReadVector3D(11, 10, 3, 8, newLinearVel.x, newLinearVel.y, newLinearVel.z);
-//        else if (velSendType == 2)
-//            dd.ReadVector3D(11, 10, 10, 8, newLinearVel.x, newLinearVel.y, newLinearVel.z);
-//
-//        float3 newAngVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
-//
-//        if (angVelSendType == 1)
-//        {
-//            // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
-//            u32 quantizedAngle = dd.ReadBits(10);
-//            if (quantizedAngle != 0)
-//            {
-//                float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
-//                float3 axis;
-//                dd.ReadNormalizedVector3D(11, 10, axis.x, axis.y, axis.z);
-//                Quat q(axis, angle);
-//                newAngVel = q.ToEulerZYX();
-//                Swap(newAngVel.z, newAngVel.x);
-//                newAngVel = RadToDeg(newAngVel);
-//            }
-//        }
-//
-//        if (!e) // Discard this message - we don't have the entity in our scene to which the message applies to.
-//            continue;
-//
-//        // Did anything change?
-//        if (posSendType != 0 || rotSendType != 0 || scaleSendType != 0 || velSendType != 0 || angVelSendType != 0)
-//        {
-//            // Create or update the interpolation state.
-//            Transform orig = placeable->transform.Get();
-//
-//            std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = serverConnection_->syncState->entityInterpolations.find(entityID);
-//            if (iter != serverConnection_->syncState->entityInterpolations.end())
-//            {
-//                RigidBodyInterpolationState &interp = iter->second;
-//
-//                KNetUserConnection* kNetSource = dynamic_cast<KNetUserConnection*>(source);
-//                kNet::MessageConnection* conn = kNetSource ? kNetSource->connection.ptr() : (kNet::MessageConnection*)0;
-//                if (conn && conn->GetSocket() && conn->GetSocket()->TransportLayer() == kNet::SocketOverUDP)
-//                {
-//                    if (kNet::PacketIDIsNewerThan(interp.lastReceivedPacketCounter, packetId))
-//                        continue; // This is an out-of-order received packet. Ignore it. (latest-data-guarantee)
-//                }
-//                
-//                interp.lastReceivedPacketCounter = packetId;
-//
-//                const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
-//                float3 curVel;
-//
-//                if (interp.interpTime < 1.0f)
-//                    curVel = HermiteDerivative(interp.interpStart.pos, interp.interpStart.vel*interpPeriod, interp.interpEnd.pos, interp.interpEnd.vel*interpPeriod, interp.interpTime);
-//                else
-//                    curVel = interp.interpEnd.vel;
-//                float3 curAngVel = float3::zero; ///\todo
-//                interp.interpStart.pos = orig.pos;
-//                if (posSendType != 0)
-//                    interp.interpEnd.pos = t.pos;
-//                interp.interpStart.rot = orig.Orientation();
-//                if (rotSendType != 0)
-//                    interp.interpEnd.rot = t.Orientation();
-//                interp.interpStart.scale = orig.scale;
-//                if (scaleSendType != 0)
-//                    interp.interpEnd.scale = t.scale;
-//                interp.interpStart.vel = curVel;
-//                if (velSendType != 0)
-//                    interp.interpEnd.vel = newLinearVel;
-//                interp.interpStart.angVel = curAngVel;
-//                if (angVelSendType != 0)
-//                    interp.interpEnd.angVel = newAngVel;
-//                interp.interpTime = 0.f;
-//                interp.interpolatorActive = true;
-//
-//                // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
-//                const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
-//                if (!isNewtonian)
-//                    interp.interpStart.vel = interp.interpEnd.vel = float3::zero;
-//            }
-//            else
-//            {
-//                RigidBodyInterpolationState interp;
-//                interp.interpStart.pos = orig.pos;
-//                interp.interpEnd.pos = t.pos;
-//                interp.interpStart.rot = orig.Orientation();
-//                interp.interpEnd.rot = t.Orientation();
-//                interp.interpStart.scale = orig.scale;
-//                interp.interpEnd.scale = t.scale;
-//                interp.interpStart.vel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-//                interp.interpEnd.vel = newLinearVel;
-//                interp.interpStart.angVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
-//                interp.interpEnd.angVel = newAngVel;
-//                interp.interpTime = 0.f;
-//                interp.lastReceivedPacketCounter = packetId;
-//                interp.interpolatorActive = true;
-//                serverConnection_->syncState->entityInterpolations[entityID] = interp;
-//            }
-//        }
-//    }
+        {
+            if (sendCameraUpdates_)
+                SendCameraOrientation();
+            ReplicatePlaceholderComponentTypes(serverConnection_.Get());
+            ProcessSyncState(serverConnection_.Get(), scene.Get(), SerializationContext(0), time);
+        }
+    }
+
+    lastTickDuration_ = tickTimer.GetUSec(false) / 1000000.0f;
+}
+
+/// Returns the Placeable of an entity without touching reference counts, so that it is safe to call from the worker threads.
+static Placeable *PlaceableOf(Entity *entity)
+{
+    if (!entity)
+        return 0;
+    const Entity::ComponentMap &components = entity->Components();
+    for (auto i = components.Begin(); i != components.End(); ++i)
+        if (i->second_->TypeId() == Placeable::TypeIdStatic())
+            return static_cast<Placeable*>(i->second_.Get());
+    return 0;
+}
+
+void SyncManager::ReplicateRigidBodyChanges(UserConnection* user, float time)
+{
+    PROFILE(SyncManager_ReplicateRigidBodyChanges);
+    
+    SceneSyncState* state = user->syncState.Get();
+    if (!state)
+        return;
+
+    const int maxMessageSizeBytes = 1400;
+    const int maxRigidBodyMessageSizeBits = 350; // An update for a single rigid body can take at most this many bits. (conservative bound)
+    kNet::DataSerializer ds(maxMessageSizeBytes);
+    bool msgReliable = false;
+
+    const bool interestManagement = interestManager_->IsEnabled();
+    const kNet::tick_t now = kNet::Clock::Tick();
+    Urho3D::HashSet<entity_id_t> updated;
+
+    for(EntitySyncState *dirty = state->dirtyQueue.First(); dirty; dirty = dirty->nextDirty)
+    {
+        EntitySyncState &ess = *dirty;
+        if (ess.isNew || ess.removed)
+            continue; // Newly created and removed entities are handled through the traditional sync mechanism.
+        // Keep the transform dirty until the interest manager allows updating the entity.
+        if (interestManagement && !interestManager_->IsUpdateDue(state, ess.id, time))
+            continue;
+
+        Placeable *placeable = PlaceableOf(ess.weak.Get());
+        if (!placeable)
+            continue;
+
+        auto placeableComp = ess.components.Find(placeable->Id());
+        if (placeableComp == ess.components.End())
+            continue;
+        ComponentSyncState &pss = placeableComp->second_;
+        // Newly created and deleted components are handled through the traditional sync mechanism.
+        // The Transform of a Placeable is the first attribute in the component.
+        if (pss.isNew || pss.removed || (pss.dirtyAttributes[0] & 1) == 0)
+            continue;
+        pss.dirtyAttributes[0] &= ~1;
+
+        // If we filled up this message, send it out and start crafting another one.
+        if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
+        {
+            user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
+            ds.ResetFill();
+            msgReliable = false;
+        }
+        WriteRigidBodyUpdate(ds, ess, placeable->transform.Get(), false, now);
+        updated.Insert(ess.id);
+        // Changes below the update thresholds were not sent, so send the exact transform once the entity stops changing.
+        if (!ess.linearVelocity.IsZero(1e-4f) || !ess.transformExact)
+            state->movingEntities.Insert(ess.id);
+    }
+
+    // Entities that were moving, or were sent inexactly, but did not change this tick have come to rest. Force an exact update with
+    // zero velocity, and send it as reliable, so that the client is guaranteed to receive it and will not extrapolate the entity away.
+    for(auto iter = state->movingEntities.Begin(); iter != state->movingEntities.End();)
+    {
+        auto essIter = state->entities.Find(*iter);
+        Placeable *placeable = essIter != state->entities.End() && !essIter->second_.removed ? PlaceableOf(essIter->second_.weak.Get()) : 0;
+        if (!placeable)
+        {
+            iter = state->movingEntities.Erase(iter);
+            continue;
+        }
+        EntitySyncState &ess = essIter->second_;
+        auto placeableComp = ess.components.Find(placeable->Id());
+        // Still moving, but the update was deferred by the interest manager.
+        if (placeableComp != ess.components.End() && (placeableComp->second_.dirtyAttributes[0] & 1) != 0)
+        {
+            ++iter;
+            continue;
+        }
+        if (updated.Contains(ess.id))
+        {
+            if (ess.linearVelocity.IsZero(1e-4f) && ess.transformExact)
+                iter = state->movingEntities.Erase(iter);
+            else
+                ++iter;
+            continue;
+        }
+
+        if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
+        {
+            user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
+            ds.ResetFill();
+            msgReliable = false;
+        }
+        WriteRigidBodyUpdate(ds, ess, placeable->transform.Get(), true, now);
+        msgReliable = true;
+        iter = state->movingEntities.Erase(iter);
+    }
+
+    if (ds.BytesFilled() > 0)
+        user->Send(cRigidBodyUpdateMessage, msgReliable, true, ds);
+}
+
+bool SyncManager::WriteRigidBodyUpdate(kNet::DataSerializer &ds, EntitySyncState &ess, const Transform &t, bool atRest, kNet::tick_t now)
+{
+    // The transform is sent without the Placeable's other attributes, so estimate the velocity for the client-side
+    // Hermite interpolation and extrapolation from the movement since the last sent state.
+    const float timeSinceLastSend = ess.transformSent ? kNet::Clock::TimespanToSecondsF(ess.lastTransformSendTime, now) : 0.f;
+    float3 linearVel = float3::zero;
+    if (!atRest && ess.transformSent && timeSinceLastSend > 1e-3f && timeSinceLastSend <= 1.0f)
+    {
+        linearVel = (t.pos - ess.transform.pos) / timeSinceLastSend;
+        if (linearVel.LengthSq() >= 1023.f * 1023.f) // Teleported, do not let the client extrapolate.
+            linearVel = float3::zero;
+    }
+
+    // The client extrapolates the last sent state for at most maxLinExtrapTime_ update periods,
+    // so the position can be omitted while the extrapolated position stays accurate.
+    const bool moving = !ess.linearVelocity.IsZero(1e-4f);
+    const bool extrapolating = !moving || timeSinceLastSend < (maxLinExtrapTime_ - 1.f) * updatePeriod_;
+    const float3 predictedClientSidePosition = ess.transform.pos + timeSinceLastSend * ess.linearVelocity;
+    bool velChanged = linearVel.DistanceSq(ess.linearVelocity) >= 1e-2f || (atRest && moving);
+    bool posChanged = !ess.transformSent || atRest || velChanged || !extrapolating || t.pos.DistanceSq(predictedClientSidePosition) > 1e-3f;
+    // The update at rest is the final one, so it includes any change, however small.
+    bool rotChanged = !ess.transformSent || t.rot.DistanceSq(ess.transform.rot) > (atRest ? 0.f : 1e-1f);
+    bool scaleChanged = !ess.transformSent || t.scale.DistanceSq(ess.transform.scale) > (atRest ? 0.f : 1e-3f);
+
+    if (!posChanged && !rotChanged && !scaleChanged && !velChanged)
+    {
+        ess.transformExact = false;
+        return false;
+    }
+
+    // Detect whether to send compact or full states for each variable.
+    // 0 - don't send, 1 - send compact, 2 - send full. The position at rest is sent in full, as the compact one is quantized.
+    int posSendType = posChanged ? (atRest || t.pos.Abs().MaxElement() >= 1023.f ? 2 : 1) : 0;
+    int rotSendType = rotChanged ? 1 : 0;
+    int scaleSendType = 0;
+    if (scaleChanged)
+    {
+        float3 s = t.scale.Abs();
+        scaleSendType = (s.MaxElement() - s.MinElement() <= 1e-3f) ? 1 : 2; // Uniform scale only?
+    }
+    int velSendType = velChanged ? (linearVel.LengthSq() >= 64.f ? 2 : 1) : 0;
+
+    ds.AddVLE<kNet::VLE8_16_32>(ess.id & UniqueIdGenerator::LAST_REPLICATED_ID); // Sends max. 32 bits.
+    ds.AddArithmeticEncoded(8, posSendType, 3, rotSendType, 2, scaleSendType, 3, velSendType, 3); // Sends fixed 8 bits.
+
+    if (posSendType == 1) // Sends fixed 57 bits.
+    {
+        ds.AddSignedFixedPoint(11, 8, t.pos.x);
+        ds.AddSignedFixedPoint(11, 8, t.pos.y);
+        ds.AddSignedFixedPoint(11, 8, t.pos.z);
+    }
+    else if (posSendType == 2) // Sends fixed 96 bits.
+    {
+        ds.Add<float>(t.pos.x);
+        ds.Add<float>(t.pos.y);
+        ds.Add<float>(t.pos.z);
+    }
+
+    if (rotSendType == 1) // Sends fixed 32 bits.
+        AddSmallestThreeQuat(ds, t.Orientation());
+
+    if (scaleSendType == 1) // Sends fixed 32 bits.
+        ds.Add<float>(t.scale.x);
+    else if (scaleSendType == 2) // Sends fixed 96 bits.
+    {
+        ds.Add<float>(t.scale.x);
+        ds.Add<float>(t.scale.y);
+        ds.Add<float>(t.scale.z);
+    }
+
+    if (velSendType == 1) // Sends fixed 32 bits.
+        ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 3, 8);
+    else if (velSendType == 2) // Sends fixed 39 bits.
+        ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 10, 8);
+
+    // Remember the state the client will have, to prune redundant data from the next updates.
+    if (posSendType != 0)
+        ess.transform.pos = t.pos;
+    else
+        ess.transform.pos = predictedClientSidePosition;
+    if (rotSendType != 0)
+        ess.transform.rot = t.rot;
+    if (scaleSendType != 0)
+        ess.transform.scale = t.scale;
+    if (velSendType != 0)
+        ess.linearVelocity = linearVel;
+    ess.transformExact = posSendType == 2 && ess.transform.rot.Equals(t.rot, 0.f) && ess.transform.scale.Equals(t.scale, 0.f);
+    ess.transformSent = true;
+    ess.lastTransformSendTime = now;
+    return true;
+}
+
+void SyncManager::HandleRigidBodyChanges(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
+{
+    // Rigid body updates are only sent by the server.
+    if (owner_->IsServer())
+        return;
+
+    ScenePtr scene = scene_.Lock();
+    SceneSyncState* state = source->syncState.Get();
+    if (!scene || !state)
+        return;
+
+    // Out-of-order packets are only possible when the connection is over UDP.
+    KNetUserConnection* kNetSource = dynamic_cast<KNetUserConnection*>(source);
+    kNet::MessageConnection* conn = kNetSource ? kNetSource->connection.ptr() : (kNet::MessageConnection*)0;
+    const bool checkPacketOrder = conn && conn->GetSocket() && conn->GetSocket()->TransportLayer() == kNet::SocketOverUDP;
+
+    kNet::DataDeserializer dd(data, numBytes);
+    while(dd.BitsLeft() >= 9)
+    {
+        entity_id_t entityID = dd.ReadVLE<kNet::VLE8_16_32>();
+
+        int posSendType;
+        int rotSendType;
+        int scaleSendType;
+        int velSendType;
+        dd.ReadArithmeticEncoded(8, posSendType, 3, rotSendType, 2, scaleSendType, 3, velSendType, 3);
+
+        float3 pos = float3::zero;
+        if (posSendType == 1)
+        {
+            pos.x = dd.ReadSignedFixedPoint(11, 8);
+            pos.y = dd.ReadSignedFixedPoint(11, 8);
+            pos.z = dd.ReadSignedFixedPoint(11, 8);
+        }
+        else if (posSendType == 2)
+        {
+            pos.x = dd.Read<float>();
+            pos.y = dd.Read<float>();
+            pos.z = dd.Read<float>();
+        }
+
+        Quat rot = Quat::identity;
+        if (rotSendType == 1)
+            rot = ReadSmallestThreeQuat(dd);
+
+        float3 scale = float3::one;
+        if (scaleSendType == 1)
+            scale = float3::FromScalar(dd.Read<float>());
+        else if (scaleSendType == 2)
+        {
+            scale.x = dd.Read<float>();
+            scale.y = dd.Read<float>();
+            scale.z = dd.Read<float>();
+        }
+
+        float3 vel = float3::zero;
+        if (velSendType == 1)
+            dd.ReadVector3D(11, 10, 3, 8, vel.x, vel.y, vel.z);
+        else if (velSendType == 2)
+            dd.ReadVector3D(11, 10, 10, 8, vel.x, vel.y, vel.z);
+
+        EntityPtr e = scene->EntityById(entityID);
+        SharedPtr<Placeable> placeable = e ? e->Component<Placeable>() : SharedPtr<Placeable>();
+        if (!placeable) // Discard this message - we don't have the entity in our scene to which the message applies to.
+            continue;
+
+        const Transform orig = placeable->transform.Get();
+        auto iter = state->entityInterpolations.find(entityID);
+        if (iter == state->entityInterpolations.end())
+        {
+            RigidBodyInterpolationState interp;
+            interp.interpEnd.pos = orig.pos;
+            interp.interpEnd.rot = orig.Orientation();
+            interp.interpEnd.scale = orig.scale;
+            interp.interpEnd.vel = float3::zero;
+            interp.interpEnd.angVel = float3::zero;
+            interp.interpStart = interp.interpEnd;
+            interp.interpTime = 1.f;
+            interp.interpolatorActive = false;
+            interp.lastReceivedPacketCounter = packetId;
+            iter = state->entityInterpolations.insert(std::make_pair(entityID, interp)).first;
+        }
+        else if (checkPacketOrder && kNet::PacketIDIsNewerThan(iter->second.lastReceivedPacketCounter, packetId))
+            continue; // This is an out-of-order received packet. Ignore it. (latest-data-guarantee)
+
+        RigidBodyInterpolationState &interp = iter->second;
+        interp.lastReceivedPacketCounter = packetId;
+
+        // Start the new curve from the current position and velocity, so that the movement stays continuous.
+        const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
+        float3 curVel = float3::zero;
+        if (interp.interpolatorActive)
+        {
+            if (interp.interpTime < 1.0f) // The derivative is per interpolation period, convert it to units per second.
+                curVel = HermiteDerivative(interp.interpStart.pos, interp.interpStart.vel * interpPeriod, interp.interpEnd.pos, interp.interpEnd.vel * interpPeriod, interp.interpTime) / interpPeriod;
+            else
+                curVel = interp.interpEnd.vel;
+        }
+        interp.interpStart.pos = orig.pos;
+        interp.interpStart.rot = orig.Orientation();
+        interp.interpStart.scale = orig.scale;
+        interp.interpStart.vel = curVel;
+
+        if (velSendType != 0)
+            interp.interpEnd.vel = vel;
+        // The server omits the position while the linear extrapolation of the last sent state is accurate.
+        if (posSendType != 0)
+            interp.interpEnd.pos = pos;
+        else
+            interp.interpEnd.pos = orig.pos + interp.interpEnd.vel * interpPeriod;
+        if (rotSendType != 0)
+            interp.interpEnd.rot = rot;
+        if (scaleSendType != 0)
+            interp.interpEnd.scale = scale;
+        interp.interpTime = 0.f;
+        interp.interpolatorActive = true;
+    }
 }
 
 void SyncManager::HandleEditEntityProperties(UserConnection* source, const char* data, size_t numBytes)
@@ -1483,18 +1597,14 @@ void SyncManager::HandleRegisterComponentType(UserConnection* source, const char
     componentTypeSender_ = 0;
 }
 
-void SyncManager::ProcessSyncState(UserConnection* user)
+void SyncManager::ReplicatePlaceholderComponentTypes(UserConnection* user)
 {
-    PROFILE(SyncManager_ProcessSyncState);
-    
-    ScenePtr scene = scene_.Lock();
-    bool isServer = owner_->IsServer();
-
     SceneSyncState* state = user->syncState.Get();
     
     // Send knowledge of registered placeholder components to the remote peer
-    if (user->ProtocolVersion() >= ProtocolCustomComponents && state->NeedSendPlaceholderComponents())
+    if (state && user->ProtocolVersion() >= ProtocolCustomComponents && state->NeedSendPlaceholderComponents())
     {
+        bool isServer = owner_->IsServer();
         SceneAPI* sceneAPI = framework_->Scene();
         const SceneAPI::PlaceholderComponentTypeMap& descs = sceneAPI->PlaceholderComponentTypes();
         for (auto i = descs.Begin(); i != descs.End(); ++i)
@@ -1504,16 +1614,58 @@ void SyncManager::ProcessSyncState(UserConnection* user)
         }
         state->MarkPlaceholderComponentsSent();
     }
+}
+
+void SyncManager::ProcessSyncState(UserConnection* user, Scene *scene, SyncSerializationContext &ctx, float time)
+{
+    PROFILE(SyncManager_ProcessSyncState);
+    
+    bool isServer = owner_->IsServer();
+
+    SceneSyncState* state = user->syncState.Get();
+
+    // As of now only native clients understand the optimized rigid body sync message.
+    // This may change with future protocol versions
+    if (isServer && dynamic_cast<KNetUserConnection*>(user) && user->ProtocolVersion() >= ProtocolCompactTransforms)
+    {
+        // First send out all changes to rigid bodies.
+        // After processing this function, the bits related to rigid body states have been cleared,
+        // so the generic sync will not double-replicate the rigid body positions and velocities.
+        ReplicateRigidBodyChanges(user, time);
+    }
 
-    // Process the state's dirty entity queue.
-    /// \todo Limit and prioritize the data sent. For now the whole queue is processed, regardless of whether the connection is being saturated.
-    if (state->dirtyQueue.Size() > 0)
+    // Process the state's dirty entity queue in priority order, until the byte budget of this tick is used up.
+    // Entities that do not fit the budget stay in the queue and are carried over to the next tick.
+    if (!state->dirtyQueue.Empty())
     {
-        for (auto iter = state->dirtyQueue.Begin() ; iter != state->dirtyQueue.End() ; ++iter)
-            ProcessEntitySyncState(isServer, user, scene.Get(), state, iter->second_);
+        std::priority_queue<PrioritizedEntity> queue;
+        for (EntitySyncState *dirty = state->dirtyQueue.First(); dirty; dirty = dirty->nextDirty)
+            queue.push(PrioritizedEntity(dirty->id, EntitySyncPriority(state, dirty)));
 
-        
-        state->dirtyQueue.Clear();
+        const bool interestManagement = isServer && interestManager_->IsEnabled();
+        const u64 bytesAtStart = user->bytesQueued;
+        while (!queue.empty())
+        {
+            if (maxBytesPerTick_ > 0 && user->bytesQueued - bytesAtStart >= maxBytesPerTick_)
+                break;
+
+            entity_id_t id = queue.top().id;
+            queue.pop();
+
+            // The entity may have already been processed as the parent of a new entity
+            auto entry = state->entities.Find(id);
+            if (entry == state->entities.End() || !entry->second_.isInQueue)
+                continue;
+            // Entities far from the client are updated at a lower rate. Defer the update while keeping the entity queued.
+            EntitySyncState *entityState = &entry->second_;
+            if (interestManagement && !entityState->isNew && !entityState->removed && !interestManager_->IsUpdateDue(state, id, time))
+                continue;
+            state->dirtyQueue.Remove(entityState);
+            // The state is erased if the entity removal was sent
+            ProcessEntitySyncState(isServer, user, scene, state, entityState, ctx);
+            if (interestManagement)
+                interestManager_->MarkUpdated(state, id, time);
+        }
     }
 
     // Send queued entity actions after scene sync
@@ -1526,14 +1678,103 @@ void SyncManager::ProcessSyncState(UserConnection* user)
     }
 }
 
-void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState *entityState)
+void SyncManager::ProcessSyncStatesParallel(Scene *scene, float time)
+{
+    PROFILE(SyncManager_ProcessSyncStatesParallel);
+
+    Urho3D::WorkQueue* workQueue = GetSubsystem<Urho3D::WorkQueue>();
+    // Create the contexts of all threads beforehand, the worker threads only index them. The main thread also executes work items.
+    SerializationContext(workQueue->GetNumThreads());
+    parallelScene_ = scene;
+    parallelTime_ = time;
+
+    UserConnectionList& users = owner_->Server()->UserConnections();
+    for(auto i = users.Begin(); i != users.End(); ++i)
+    {
+        if (!(*i)->syncState)
+            continue;
+        // Collect the messages of the connection to be sent from the main thread
+        (*i)->BeginDeferredSends();
+
+        SharedPtr<Urho3D::WorkItem> item(new Urho3D::WorkItem());
+        item->workFunction_ = ProcessSyncStateWork;
+        item->start_ = i->Get();
+        item->aux_ = this;
+        item->priority_ = Urho3D::M_MAX_UNSIGNED;
+        workQueue->AddWorkItem(item);
+    }
+    workQueue->Complete(Urho3D::M_MAX_UNSIGNED);
+    parallelScene_ = 0;
+
+    // Send in the order of the user connections, so that the network traffic does not depend on the scheduling of the worker threads
+    for(auto i = users.Begin(); i != users.End(); ++i)
+        (*i)->FlushDeferredSends();
+
+    for (unsigned i = 0; i < serializationContexts_.Size(); ++i)
+    {
+        if (!serializationContexts_[i]->error.Empty())
+        {
+            String error = serializationContexts_[i]->error;
+            for (unsigned j = 0; j < serializationContexts_.Size(); ++j)
+                serializationContexts_[j]->error.Clear();
+            /// \todo Better way to handle this?
+            throw std::runtime_error(error.CString());
+        }
+    }
+}
+
+void SyncManager::ProcessSyncStateWork(const Urho3D::WorkItem* item, unsigned threadIndex)
+{
+    SyncManager* syncManager = static_cast<SyncManager*>(item->aux_);
+    UserConnection* user = static_cast<UserConnection*>(item->start_);
+    SyncSerializationContext &ctx = *syncManager->serializationContexts_[threadIndex];
+    try
+    {
+        syncManager->ProcessSyncState(user, syncManager->parallelScene_, ctx, syncManager->parallelTime_);
+    }
+    catch(const std::exception &e)
+    {
+        // Exceptions can not cross the thread boundary, rethrow in the main thread
+        if (ctx.error.Empty())
+            ctx.error = e.what();
+    }
+}
+
+SyncSerializationContext &SyncManager::SerializationContext(unsigned threadIndex)
+{
+    while (serializationContexts_.Size() <= threadIndex)
+        serializationContexts_.Push(SharedPtr<SyncSerializationContext>(new SyncSerializationContext()));
+    return *serializationContexts_[threadIndex];
+}
+
+void SyncManager::UpdateWorldPositions(Scene *scene)
+{
+    PROFILE(SyncManager_UpdateWorldPositions);
+
+    worldPositions_.Clear();
+    Entity::ComponentVector placeables = scene->Components(Placeable::TypeIdStatic());
+    for (unsigned i = 0; i < placeables.Size(); ++i)
+    {
+        Placeable *placeable = static_cast<Placeable*>(placeables[i].Get());
+        Entity *entity = placeable->ParentEntity();
+        if (!entity || entity->IsLocal())
+            continue;
+
+        float3 pos = placeable->WorldPosition();
+        if (pos.IsFinite())
+            worldPositions_[entity->Id()] = pos;
+    }
+}
+
+void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState *entityState, SyncSerializationContext &ctx)
 {
     entityState->isInQueue = false;
 
     unsigned sceneId = 0;       /// @todo Replace with proper scene ID once multiscene support is in place.
     bool removeState = false;
 
-    EntityPtr entity = entityState->weak.Lock();
+    // Use raw pointers to the scene objects, as the reference counts may not be modified from worker threads
+    Entity *entity = entityState->weak.Get();
     if (!entity)
     {
         if (!entityState->removed)
@@ -1572,7 +1813,7 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
 
         removeState = true;
 
-        kNet::DataSerializer ds(removeEntityBuffer_, NUMELEMS(removeEntityBuffer_));
+        kNet::DataSerializer ds(ctx.removeEntityBuffer, NUMELEMS(ctx.removeEntityBuffer));
         ds.AddVLE<kNet::VLE8_16_32>(sceneId);
         ds.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
         user->Send(cRemoveEntityMessage, true, true, ds);
@@ -1581,13 +1822,14 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
     else if (entityState->isNew)
     {
         // Check if parent is dirty as a new state and send it first.
-        // Must be done prior to below code using the createEntityBuffer_.
+        // Must be done prior to below code using the createEntityBuffer.
         if (user->ProtocolVersion() >= ProtocolHierarchicScene)
         {
-            entity_id_t parentId = (entity->Parent() ? entity->Parent()->Id() : 0);
+            entity_id_t parentId = (entity->ParentPtr() ? entity->ParentPtr()->Id() : 0);
 
             // Check if parent is dirty as a new state and send it first.
-            if (parentId > 0 && sceneState->dirtyQueue.Contains(parentId))
+            auto parentEntry = (parentId > 0 ? sceneState->entities.Find(parentId) : sceneState->entities.End());
+            if (parentEntry != sceneState->entities.End() && parentEntry->second_.isInQueue)
             {
                 /* This will clear the .isNew etc. booleans in the queue,
                    once the main iteration reaches this parent it will do no
@@ -1595,13 +1837,16 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                    the parent chain is deeper than one level, it will recurse
                    here untill a unparented Entity is found and sent them in the
                    correct order. */
-                EntitySyncState *parentState = sceneState->dirtyQueue[parentId];
-                if (parentState && parentState->isNew)
-                    ProcessEntitySyncState(isServer, user, scene, sceneState, parentState);
+                EntitySyncState *parentState = &parentEntry->second_;
+                if (parentState->isNew)
+                {
+                    sceneState->dirtyQueue.Remove(parentState);
+                    ProcessEntitySyncState(isServer, user, scene, sceneState, parentState, ctx);
+                }
             }
         }
         
-        kNet::DataSerializer ds(createEntityBuffer_, NUMELEMS(createEntityBuffer_));
+        kNet::DataSerializer ds(ctx.createEntityBuffer, NUMELEMS(ctx.createEntityBuffer));
         
         // Entity identification and temporary flag
         ds.AddVLE<kNet::VLE8_16_32>(sceneId);
@@ -1611,10 +1856,11 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
         // If hierarchic scene is supported, send parent entity ID or 0 if unparented. Note that this is a full 32bit ID to handle the unacked range if necessary
         if (user->ProtocolVersion() >= ProtocolHierarchicScene)
         {
-            if (entity->Parent() && entity->Parent()->IsLocal())
+            Entity *parent = entity->ParentPtr();
+            if (parent && parent->IsLocal())
                 LogWarning("Replicated entity " + String(entityState->id) + " is parented to a local entity, can not replicate parenting properly over the network");
 
-            ds.Add<u32>(entity->Parent() ? entity->Parent()->Id() : 0);
+            ds.Add<u32>(parent ? parent->Id() : 0);
         }
         
         const Entity::ComponentMap& components = entity->Components();
@@ -1631,10 +1877,10 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
         bool bufferValid = true;
         for (auto i = components.Begin(); i != components.End(); ++i)
         {
-            ComponentPtr comp = i->second_;
+            IComponent *comp = i->second_.Get();
             if (!comp->IsReplicated())
                 continue;
-            if (bufferValid && !WriteComponentFullUpdate(ds, comp))
+            if (bufferValid && !WriteComponentFullUpdate(ctx, ds, comp))
             {
                 bufferValid = false;
                 ds.ResetFill();
@@ -1653,29 +1899,35 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
         if (!bufferValid && !isServer)
         {
             LogError("SyncManager: Failed to send new Entity to the server due to invalid buffer state. " + entity->ToString() + " will be forcefully destroyed from Scene.");
-            sceneState->RemoveFromQueue(entity->Id());
-            sceneState->entities.erase(entity->Id());
+            sceneState->RemoveEntitySyncState(entity->Id());
             scene->RemoveEntity(entity->Id(), AttributeChange::LocalOnly);
+            // The entity and its sync state no longer exist
+            return;
         }
     }
     else if (entity)
     {
-        if (!entityState->dirtyQueue.Empty())
+        if (entityState->HasDirtyComponents())
         {
             // Components or attributes have been added, changed, or removed. Prepare the dataserializers
-            kNet::DataSerializer removeCompsDs(removeCompsBuffer_, NUMELEMS(removeCompsBuffer_));
-            kNet::DataSerializer removeAttrsDs(removeAttrsBuffer_, NUMELEMS(removeAttrsBuffer_));
-            kNet::DataSerializer createCompsDs(createCompsBuffer_, NUMELEMS(createCompsBuffer_));
-            kNet::DataSerializer createAttrsDs(createAttrsBuffer_, NUMELEMS(createAttrsBuffer_));
-            kNet::DataSerializer editAttrsDs(editAttrsBuffer_, NUMELEMS(editAttrsBuffer_));
-
-            while (!entityState->dirtyQueue.Empty())
+            kNet::DataSerializer removeCompsDs(ctx.removeCompsBuffer, NUMELEMS(ctx.removeCompsBuffer));
+            kNet::DataSerializer removeAttrsDs(ctx.removeAttrsBuffer, NUMELEMS(ctx.removeAttrsBuffer));
+            kNet::DataSerializer createCompsDs(ctx.createCompsBuffer, NUMELEMS(ctx.createCompsBuffer));
+            kNet::DataSerializer createAttrsDs(ctx.createAttrsBuffer, NUMELEMS(ctx.createAttrsBuffer));
+            kNet::DataSerializer editAttrsDs(ctx.editAttrsBuffer, NUMELEMS(ctx.editAttrsBuffer));
+            const Entity::ComponentMap& components = entity->Components();
+
+            ctx.dirtyComponents.Clear();
+            entityState->TakeDirtyComponents(ctx.dirtyComponents);
+            for (unsigned ci = 0; ci < ctx.dirtyComponents.Size(); ++ci)
             {
-                ComponentSyncState& compState = *entityState->dirtyQueue.Front();
-                entityState->dirtyQueue.PopFront();
-                compState.isInQueue = false;
+                auto compStateIter = entityState->components.Find(ctx.dirtyComponents[ci]);
+                if (compStateIter == entityState->components.End())
+                    continue;
+                ComponentSyncState& compState = compStateIter->second_;
                 
-                ComponentPtr comp = entity->ComponentById(compState.id);
+                auto compIter = components.Find(compState.id);
+                IComponent *comp = compIter != components.End() ? compIter->second_.Get() : 0;
                 bool removeCompState = false;
                 if (!comp)
                 {
@@ -1715,7 +1967,7 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                         createCompsDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
                     }
                     // Then add the component data
-                    if (!WriteComponentFullUpdate(createCompsDs, comp))
+                    if (!WriteComponentFullUpdate(ctx, createCompsDs, comp))
                         createCompsDs.ResetFill();
                     // Mark the component undirty in the receiver's syncstate
                     sceneState->MarkComponentProcessed(entity->Id(), comp->Id());
@@ -1726,13 +1978,24 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                     const AttributeVector& attrs = comp->Attributes();
 
                     bool attrBufferValid = true;
-                    for (auto i = compState.newAndRemovedAttributes.Begin(); i != compState.newAndRemovedAttributes.End(); ++i)
+                    for (unsigned ai = 0; ai < 256; ++ai)
                     {
-                        u8 attrIndex = i->first_;
+                        // Skip whole bytes of the bitfields without created or removed attributes
+                        if (!(ai & 7) && !(compState.createdAttributes[ai >> 3] | compState.removedAttributes[ai >> 3]))
+                        {
+                            ai += 7;
+                            continue;
+                        }
+                        u8 attrIndex = (u8)ai;
+                        bool created = compState.IsAttributeCreated(attrIndex);
+                        if (!created && !compState.IsAttributeRemoved(attrIndex))
+                            continue;
                         // Clear the corresponding dirty flags, so that we don't redundantly send attribute edited data.
                         compState.dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+                        // The index will hold a different attribute, so forget the previous values of delta encoding
+                        entityState->deltaBases.Remove(compState.id, attrIndex);
                         
-                        if (i->second_)
+                        if (created)
                         {
                             // Create attribute. Make sure it exists and is dynamic.
                             if (attrIndex >= attrs.Size() || !attrs[attrIndex])
@@ -1774,14 +2037,14 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                             removeAttrsDs.Add<u8>(attrIndex);
                         }
                     }
-                    compState.newAndRemovedAttributes.Clear();
+                    compState.NewAndRemovedAttributesProcessed();
 
                     // Buffer in invalid state, reset data so it wont be sent to network.
                     if (!attrBufferValid)
                         createAttrsDs.ResetFill();
 
                     // Now, if remaining dirty bits exist, they must be sent in the edit attributes message. These are the majority of our network data.
-                    changedAttributes_.clear();
+                    ctx.changedAttributes.clear();
                     unsigned numBytes = ((unsigned)attrs.Size() + 7) >> 3;
                     for (unsigned ib = 0; ib < numBytes; ++ib)
                     {
@@ -1794,24 +2057,24 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                                 {
                                     u8 attrIndex = (u8)((ib * 8) + j);
                                     if (attrIndex < attrs.Size() && attrs[attrIndex])
-                                        changedAttributes_.push_back(attrIndex);
+                                        ctx.changedAttributes.push_back(attrIndex);
                                     else
                                         LogError("Attribute change for a nonexisting attribute index " + String((int)attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                 }
                             }
                         }
                     }
-                    if (changedAttributes_.size())
+                    if (ctx.changedAttributes.size())
                     {
-                        /// @todo HACK for web clients while ReplicateRigidBodyChanges() is not implemented! 
+                        /// @todo HACK for web clients and older native clients, which do not understand the compact transform updates of ReplicateRigidBodyChanges().
                         /// Don't send out minuscule pos/rot/scale changes as it spams the network.
                         bool sendChanges = true;
-                        if (dynamic_cast<KNetUserConnection*>(user) == 0)
+                        if (isServer && (dynamic_cast<KNetUserConnection*>(user) == 0 || user->ProtocolVersion() < ProtocolCompactTransforms))
                         {
-                            if (comp->TypeId() == Placeable::TypeIdStatic() && changedAttributes_.size() == 1 && changedAttributes_[0] == 0)
+                            if (comp->TypeId() == Placeable::TypeIdStatic() && ctx.changedAttributes.size() == 1 && ctx.changedAttributes[0] == 0)
                             {
                                 // Placeable::Transform is the only change!
-                                Placeable *placeable = dynamic_cast<Placeable*>(comp.Get());
+                                Placeable *placeable = dynamic_cast<Placeable*>(comp);
                                 if (placeable)
                                 {
                                     const Transform &t = placeable->transform.Get();
@@ -1840,52 +2103,50 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                             }
                             editAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                         
-                            // Create a nested dataserializer for the actual attribute data, so we can skip components
-                            kNet::DataSerializer attrDataDs(attrDataBuffer_, NUMELEMS(attrDataBuffer_));
-                        
-                            // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
-                            unsigned bitsMethod1 = (unsigned)changedAttributes_.size() * 8 + 8;
-                            unsigned bitsMethod2 = (unsigned)attrs.Size();
-                            // Method 1: indices
-                            if (bitsMethod1 <= bitsMethod2)
+                            // With delta encoding the attribute data depends on what was sent to this user before, so it is serialized per user.
+                            // Else it depends only on the component and its dirty mask, so serialize it once per tick and share it between users
+                            const SerializedAttributeData *attrData = 0;
+                            const bool deltaEncoding = user->ProtocolVersion() >= ProtocolDeltaAttributes;
+                            if (deltaEncoding)
                             {
-                                attrDataDs.Add<kNet::bit>(0);
-                                attrDataDs.Add<u8>((u8)changedAttributes_.size());
-                                for (unsigned i = 0; i < changedAttributes_.size(); ++i)
-                                {
-                                    attrDataDs.Add<u8>(changedAttributes_[i]);
-                                    attrs[changedAttributes_[i]]->ToBinary(attrDataDs);
-                                }
+                                kNet::DataSerializer attrDataDs(ctx.attrDataBuffer, NUMELEMS(ctx.attrDataBuffer));
+                                WriteEditAttributeData(attrDataDs, attrs, compState, ctx.changedAttributes, entityState);
+                                ctx.deltaAttrData.valid = ValidateAttributeBuffer(false, attrDataDs, comp);
+                                ctx.deltaAttrData.data.Resize(ctx.deltaAttrData.valid ? (unsigned)attrDataDs.BytesFilled() : 0);
+                                if (ctx.deltaAttrData.data.Size())
+                                    memcpy(&ctx.deltaAttrData.data[0], attrDataDs.GetData(), ctx.deltaAttrData.data.Size());
+                                attrData = &ctx.deltaAttrData;
                             }
-                            // Method 2: bitmask
                             else
                             {
-                                attrDataDs.Add<kNet::bit>(1);
-                                for (unsigned i = 0; i < attrs.Size(); ++i)
+                                AttributeDataCacheKey key(entityState->id, compState.id, compState.dirtyAttributes, numBytes, false);
+                                auto cached = ctx.attrDataCache.Find(key);
+                                if (cached == ctx.attrDataCache.End())
                                 {
-                                    if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
-                                    {
-                                        attrDataDs.Add<kNet::bit>(1);
-                                        attrs[i]->ToBinary(attrDataDs);
-                                    }
-                                    else
-                                        attrDataDs.Add<kNet::bit>(0);
+                                    // Create a nested dataserializer for the actual attribute data, so we can skip components
+                                    kNet::DataSerializer attrDataDs(ctx.attrDataBuffer, NUMELEMS(ctx.attrDataBuffer));
+                                    WriteEditAttributeData(attrDataDs, attrs, compState, ctx.changedAttributes, 0);
+                                    cached = CacheAttributeData(ctx, key, attrDataDs, ValidateAttributeBuffer(false, attrDataDs, comp));
                                 }
+                                attrData = &cached->second_;
                             }
+
                             // Add the attribute data array to the main serializer
-                            if (ValidateAttributeBuffer(false, attrDataDs, comp))
+                            if (attrData->valid)
                             {
-                                editAttrsDs.AddVLE<kNet::VLE8_16_32>((u32)attrDataDs.BytesFilled());
-                                editAttrsDs.AddArray<u8>((unsigned char*)attrDataBuffer_, (u32)attrDataDs.BytesFilled());
+                                editAttrsDs.AddVLE<kNet::VLE8_16_32>(attrData->data.Size());
+                                if (attrData->data.Size())
+                                    editAttrsDs.AddArray<u8>(&attrData->data[0], attrData->data.Size());
 
-                                if (!ValidateAttributeBuffer(false, editAttrsDs, comp, NUMELEMS(editAttrsBuffer_)))
+                                if (!ValidateAttributeBuffer(false, editAttrsDs, comp, NUMELEMS(ctx.editAttrsBuffer)))
                                     editAttrsDs.ResetFill();
                             }
                             else
-                            {
-                                attrDataDs.ResetFill();
                                 editAttrsDs.ResetFill();
-                            }
+
+                            // If the edits of the entity were dropped, the user never receives the values the delta bases were advanced to
+                            if (deltaEncoding && !editAttrsDs.BytesFilled())
+                                entityState->deltaBases.RemoveSent();
                         }
 
                         // Now zero out all remaining dirty bits
@@ -1895,7 +2156,7 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
                 }
                 
                 if (removeCompState)
-                    entityState->components.erase(compState.id);
+                    entityState->RemoveComponent(compState.id);
             }
             
             // Send the messages which have data
@@ -1918,7 +2179,7 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
         // Check if entity has other property changes (temporary flag)
         if (entityState->hasPropertyChanges)
         {
-            kNet::DataSerializer editPropertiesDs(editAttrsBuffer_, NUMELEMS(editAttrsBuffer_));
+            kNet::DataSerializer editPropertiesDs(ctx.editAttrsBuffer, NUMELEMS(ctx.editAttrsBuffer));
             editPropertiesDs.AddVLE<kNet::VLE8_16_32>(sceneId);
             editPropertiesDs.AddVLE<kNet::VLE8_16_32>(entityState->id & UniqueIdGenerator::LAST_REPLICATED_ID);
             editPropertiesDs.Add<u8>(entity->IsTemporary() ? 1 : 0);
@@ -1926,8 +2187,8 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
         }
         if (entityState->hasParentChange && user->ProtocolVersion() >= ProtocolHierarchicScene)
         {
-            EntityPtr parent = entity->Parent();
-            kNet::DataSerializer editParentDs(editAttrsBuffer_, 1024);
+            Entity *parent = entity->ParentPtr();
+            kNet::DataSerializer editParentDs(ctx.editAttrsBuffer, 1024);
             editParentDs.AddVLE<kNet::VLE8_16_32>(sceneId);
             editParentDs.Add<u32>(entityState->id);
             editParentDs.Add<u32>(parent ? parent->Id() : 0);
@@ -1940,7 +2201,33 @@ void SyncManager::ProcessEntitySyncState(bool isServer, UserConnection* user, Sc
     
     // Entity removal has been sent to the client, remove it from the SceneState.
     if (removeState)
-        sceneState->entities.erase(entityState->id);
+        sceneState->RemoveEntitySyncState(entityState->id);
+    else
+        entityState->lastNetworkSendTime = kNet::Clock::Tick();
+}
+
+float SyncManager::EntitySyncPriority(const SceneSyncState *sceneState, const EntitySyncState *entityState) const
+{
+    // Removals are cheap and free resources on the receiving end, send them first
+    if (entityState->removed)
+        return FLT_MAX;
+
+    float priority = 1.0f;
+    auto relevance = sceneState->relevanceFactors.find(entityState->id);
+    if (relevance != sceneState->relevanceFactors.end())
+        priority = Max(relevance->second, 0.001f);
+
+    // Entities that have waited longer gain priority, so that nothing starves
+    priority *= 1.0f + kNet::Clock::SecondsSinceF(entityState->lastNetworkSendTime);
+
+    // Entities closer to the client are more important
+    if (sceneState->locationInitialized)
+    {
+        auto pos = worldPositions_.Find(entityState->id);
+        if (pos != worldPositions_.End())
+            priority /= 1.0f + pos->second_.Distance(sceneState->clientLocation) * 0.1f;
+    }
+    return priority;
 }
 
 bool SyncManager::ValidateAction(UserConnection* source, unsigned /*messageID*/, entity_id_t /*entityID*/)
@@ -1993,6 +2280,45 @@ void SyncManager::HandleCameraOrientation(UserConnection* user, const char* data
     user->syncState->clientLocation = clientpos;
 }
 
+void SyncManager::HandleCameraOrientationRequest(UserConnection* /*source*/, const char* data, size_t numBytes)
+{
+    if (owner_->IsServer())
+        return;
+
+    kNet::DataDeserializer dd(data, numBytes);
+    sendCameraUpdates_ = dd.Read<u8>() != 0;
+    // Force the next update to be sent
+    lastSentCameraTransform_ = Transform(float3::nan, float3::zero, float3::one);
+}
+
+void SyncManager::SendCameraOrientation()
+{
+    IRenderer *renderer = framework_->Renderer();
+    Entity *cameraEntity = renderer ? renderer->MainCamera() : 0;
+    SharedPtr<Placeable> placeable = cameraEntity ? cameraEntity->Component<Placeable>() : SharedPtr<Placeable>();
+    if (!placeable)
+        return;
+
+    Quat orientation = placeable->WorldOrientation();
+    float3 pos = placeable->WorldPosition();
+    // Only send when the camera has moved noticeably
+    if (lastSentCameraTransform_.pos.IsFinite() && pos.DistanceSq(lastSentCameraTransform_.pos) < 1e-2f &&
+        orientation.Equals(lastSentCameraTransform_.Orientation(), 1e-3f))
+        return;
+    lastSentCameraTransform_.pos = pos;
+    lastSentCameraTransform_.SetOrientation(orientation);
+
+    kNet::DataSerializer ds(64);
+    ds.AddSignedFixedPoint(11, 8, orientation.x);
+    ds.AddSignedFixedPoint(11, 8, orientation.y);
+    ds.AddSignedFixedPoint(11, 8, orientation.z);
+    ds.AddSignedFixedPoint(11, 8, orientation.w);
+    ds.AddSignedFixedPoint(11, 8, pos.x);
+    ds.AddSignedFixedPoint(11, 8, pos.y);
+    ds.AddSignedFixedPoint(11, 8, pos.z);
+    serverConnection_->Send(cCameraOrientationUpdate, false, true, ds);
+}
+
 void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, size_t numBytes)
 {
     assert(source);
@@ -2106,8 +2432,7 @@ void SyncManager::HandleCreateEntity(UserConnection* source, const char* data, s
                     String(NUMELEMS(attrDataBuffer_)) + " bytes. In " + framework_->Scene()->ComponentTypeNameForTypeId(typeID) + 
                     " in Entity " + String(entity->Id()) + ". Entity will be ignored!"));
 
-                state->RemoveFromQueue(entity->Id());
-                state->entities.erase(entity->Id());
+                state->RemoveEntitySyncState(entity->Id());
                 scene->RemoveEntity(entity->Id(), AttributeChange::LocalOnly);
                 return;
             }
@@ -2420,8 +2745,7 @@ void SyncManager::HandleRemoveEntity(UserConnection* source, const char* data, s
     scene->RemoveEntity(entityID, change);
 
     // Delete from the sender's syncstate so that we don't echo the delete back needlessly
-    state->RemoveFromQueue(entityID); // Be sure to erase from dirty queue so that we don't invoke UDB
-    state->entities.erase(entityID);
+    state->RemoveEntitySyncState(entityID); // Also unlinks from the dirty queue so that we don't invoke UDB
 }
 
 void SyncManager::HandleRemoveComponents(UserConnection* source, const char* data, size_t numBytes)
@@ -2469,8 +2793,7 @@ void SyncManager::HandleRemoveComponents(UserConnection* source, const char* dat
         }
         entity->RemoveComponent(comp, change);
 
-        entityState.RemoveFromQueue(compID); // Be sure to erase from dirty queue so that we don't invoke UDB
-        entityState.components.erase(compID);
+        entityState.RemoveComponent(compID);
     }
 }
 
@@ -2554,7 +2877,8 @@ void SyncManager::HandleCreateAttributes(UserConnection* source, const char* dat
         }
         
         // Remove the corresponding add command from the sender's syncstate, so that the attribute add is not echoed back
-        entityState.components[compID].newAndRemovedAttributes.Erase(attrIndex);
+        entityState.components[compID].ClearAttributeCreatedOrRemoved(attrIndex);
+        entityState.deltaBases.Remove(compID, attrIndex);
     }
     
     // Signal attribute changes after creating and reading all
@@ -2618,7 +2942,8 @@ void SyncManager::HandleRemoveAttributes(UserConnection* source, const char* dat
         comp->RemoveAttribute(attrIndex, change);
 
         // Remove the corresponding remove command from the sender's syncstate, so that the attribute remove is not echoed back
-        entityState.components[compID].newAndRemovedAttributes.Erase(attrIndex);
+        entityState.components[compID].ClearAttributeCreatedOrRemoved(attrIndex);
+        entityState.deltaBases.Remove(compID, attrIndex);
     }
 }
 
@@ -2643,18 +2968,16 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
     UNREFERENCED_PARAM(sceneID)
     entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
     
-    if (!ValidateAction(source, cRemoveAttributesMessage, entityID))
-        return;
-
     EntitySyncState &entityState = state->entities[entityID];
     EntityPtr entity = entityState.weak.Lock();
-    if (entity && !scene->AllowModifyEntity(source, entity.Get())) // check if allowed to modify this entity.
-        return;
     if (!entity)
     {
         LogWarning("Entity " + String(entityID) + " not found for EditAttributes message");
         return;
     }
+    // A rejected edit is still read, without applying it, so that the delta bases follow the values the peer sent.
+    // The values of missing components are skipped, after which their deltas are dropped until the sender's next full value.
+    const bool allowed = ValidateAction(source, cRemoveAttributesMessage, entityID) && scene->AllowModifyEntity(source, entity.Get());
     
     // Record the update time for calculating the update interval
     // Default update interval if state not found or interval not measured yet
@@ -2666,6 +2989,11 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
     // Add a fudge factor in case there is jitter in packet receipt or the server is too taxed
     updateInterval *= 1.25f;
 
+    // Peers with ProtocolDeltaAttributes send the values relative to the ones they sent previously
+    EntitySyncState *deltaState = source->ProtocolVersion() >= ProtocolDeltaAttributes ? &entityState : 0;
+    if (!allowed && !deltaState)
+        return;
+
     std::vector<IAttribute*> changedAttrs;
     while (ds.BitsLeft() >= 8)
     {
@@ -2712,18 +3040,7 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
                     break;
                 }
                 
-                bool interpolate = (!isServer && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
-                if (!interpolate)
-                {
-                    attr->FromBinary(attrDs, AttributeChange::Disconnected);
-                    changedAttrs.push_back(attr);
-                }
-                else
-                {
-                    IAttribute* endValue = attr->Clone();
-                    endValue->FromBinary(attrDs, AttributeChange::Disconnected);
-                    scene->StartAttributeInterpolation(attr, endValue, updateInterval);
-                }
+                ReadEditedAttribute(attrDs, attr, compID, attrIndex, deltaState, scene.Get(), allowed, updateInterval, changedAttrs);
             }
         }
         else
@@ -2744,18 +3061,7 @@ void SyncManager::HandleEditAttributes(UserConnection* source, const char* data,
                         LogWarning("Nonexistent attribute in EditAttributes message, skipping to next component");
                         break;
                     }
-                    bool interpolate = (!isServer && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
-                    if (!interpolate)
-                    {
-                        attr->FromBinary(attrDs, AttributeChange::Disconnected);
-                        changedAttrs.push_back(attr);
-                    }
-                    else
-                    {
-                        IAttribute* endValue = attr->Clone();
-                        endValue->FromBinary(attrDs, AttributeChange::Disconnected);
-                        scene->StartAttributeInterpolation(attr, endValue, updateInterval);
-                    }
+                    ReadEditedAttribute(attrDs, attr, compID, (u8)i, deltaState, scene.Get(), allowed, updateInterval, changedAttrs);
                 }
             }
         }
@@ -2799,11 +3105,8 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
     entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
     scene->ChangeEntityId(senderEntityID, entityID);
 
-    state->RemoveFromQueue(senderEntityID);                         // Make sure we don't have stale pointers in the dirty queue
-    state->entities[entityID] = state->entities[senderEntityID];    // Copy the sync state to the new ID
-    state->entities[entityID].id = entityID;                        // Must remember to change ID manually
+    state->ChangeEntityId(senderEntityID, entityID);                // Move the sync state to the new ID, out of the dirty queue
     state->entities[entityID].weak = scene->EntityById(entityID);   // Refresh the weak ptr
-    state->entities.erase(senderEntityID);                          // Remove old id from the state
     
     //std::cout << "CreateEntityReply, entity " << senderEntityID << " -> " << entityID << std::endl;
 
@@ -2824,9 +3127,7 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
         //std::cout << "CreateEntityReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        entityState.ChangeComponentId(senderCompID, compID); // Move the sync state to the new ID
         
         // Send notification
         IComponent* comp = entity->ComponentById(compID).Get();
@@ -2837,8 +3138,8 @@ void SyncManager::HandleCreateEntityReply(UserConnection* source, const char* da
     scene->EmitEntityAcked(entity.Get(), senderEntityID);
 
     // Now mark every component dirty so they will be inspected for changes on the next update
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
-        state->MarkComponentDirty(entityID, i->first);
+    for (auto i = entityState.components.Begin(); i != entityState.components.End(); ++i)
+        state->MarkComponentDirty(entityID, i->first_);
 }
 
 void SyncManager::HandleCreateComponentsReply(UserConnection* source, const char* data, size_t numBytes)
@@ -2882,19 +3183,17 @@ void SyncManager::HandleCreateComponentsReply(UserConnection* source, const char
         //std::cout << "CreateComponentReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        entityState.ChangeComponentId(senderCompID, compID); // Move the sync state to the new ID
         
         // Send notification
         IComponent* comp = entity->ComponentById(compID).Get();
         scene->EmitComponentAcked(comp, senderCompID);
     }
     
-    for (auto i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (auto i = entityState.components.Begin(); i != entityState.components.End(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
-        state->MarkComponentDirty(entityID, i->first);
+        state->MarkComponentDirty(entityID, i->first_);
     }
 }
 
@@ -16,10 +16,43 @@
 #include "EntityAction.h"
 
 #include <Object.h>
+#include <RefCounted.h>
+
+namespace Urho3D
+{
+    struct WorkItem;
+}
 
 namespace Tundra
 {
 
+/// Buffers and caches for serializing sync messages. SyncManager has one context per thread that processes sync states.
+struct SyncSerializationContext : public Urho3D::RefCounted
+{
+    /// Fixed buffers for crafting messages
+    char createEntityBuffer[64 * 1024];
+    char createCompsBuffer[64 * 1024];
+    char editAttrsBuffer[64 * 1024];
+    char createAttrsBuffer[64 * 1024];
+    char attrDataBuffer[64 * 1024];
+    char removeCompsBuffer[1024];
+    char removeEntityBuffer[1024];
+    char removeAttrsBuffer[1024];
+    std::vector<u8> changedAttributes;
+    /// Dirty components of the entity being processed
+    Urho3D::PODVector<component_id_t> dirtyComponents;
+
+    /// Serialized attribute data of the current network update tick.
+    /** Cleared at the start of each tick. Lets a changed attribute set be serialized once and spliced into the messages of every user connection
+        processed by the same thread. */
+    Urho3D::HashMap<AttributeDataCacheKey, SerializedAttributeData> attrDataCache;
+    /// Delta encoded attribute data of the component being processed, which is specific to one user and not cached.
+    SerializedAttributeData deltaAttrData;
+
+    /// Error that aborted processing a sync state in a worker thread, rethrown in the main thread.
+    String error;
+};
+
 /// Performs synchronization of the changes in a scene between the server and the client.
 /** SyncManager and SceneSyncState combined can be used to implement prioritization logic on how and when
     a sync state is filled per client connection. SyncManager object is only exposed to scripting on the server. */
@@ -48,6 +81,33 @@ public:
     /// Get update period
     float GetUpdatePeriod() const { return updatePeriod_; }
 
+    /// Set the maximum amount of scene sync data queued for one user connection per network update tick.
+    /** Dirty entities are processed in priority order, and the ones that do not fit the budget are carried over to the next tick.
+        At least one dirty entity is always processed per tick.
+        @param bytes Byte budget, or 0 for unlimited. */
+    void SetMaxBytesPerTick(u32 bytes) { maxBytesPerTick_ = bytes; }
+
+    /// Get the per-connection byte budget per network update tick, 0 if unlimited.
+    u32 GetMaxBytesPerTick() const { return maxBytesPerTick_; }
+
+    /// Set whether the sync states of the user connections are processed in parallel on the worker threads (server only).
+    /** Each connection is serialized by one worker using the worker's own buffers, and its messages are sent from the main thread
+        after all connections have been processed, in the order of the user connections. */
+    void SetParallelProcessing(bool enabled) { parallelProcessing_ = enabled; }
+
+    /// Returns whether the sync states are processed in parallel.
+    bool IsParallelProcessing() const { return parallelProcessing_; }
+
+    /// Set whether changed attribute values are sent as deltas against the previous values, to connections that support ProtocolDeltaAttributes.
+    /** When disabled, the values are sent in full, but the previous values are still tracked. Enabled by default. */
+    void SetDeltaAttributes(bool enabled) { deltaAttributes_ = enabled; }
+
+    /// Returns whether changed attribute values are sent as deltas.
+    bool IsDeltaAttributes() const { return deltaAttributes_; }
+
+    /// Returns the duration in seconds of the network update tick run by the last Update, or 0 if it did not run a tick.
+    float LastTickDuration() const { return lastTickDuration_; }
+
     /// Returns SceneSyncState for a client connection.
     /** @note This slot is only exposed on Server, other wise will return null ptr.
         @param u32 connection ID of the client. */
@@ -66,8 +126,12 @@ public:
         @param int raycastint specifies the raycasting interval for the ray visibility filter. */
     void UpdateInterestManagerSettings(bool enabled, bool eucl, bool ray, bool rel, int critrange, int relrange, int updateint, int raycastint);
 
+    /// Requests a client to start or stop sending cCameraOrientationUpdate messages, which drive the interest management.
     void SendCameraUpdateRequest(UserConnectionPtr conn, bool enabled);
 
+    /// Returns the interest manager.
+    InterestManager* GetInterestManager() const { return interestManager_.Get(); }
+
     // signals
     /// This signal is emitted when a new user connects and a new SceneSyncState is created for the connection.
     /// @note See signals of the SceneSyncState object to build prioritization logic how the sync state is filled.
@@ -80,6 +144,9 @@ private:
     /// Trigger EC sync because of component attributes changing
     void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
 
+    /// Trigger EC sync because of batched component attribute changes
+    void OnAttributeChangesFlushed(const AttributeChangeJournal& journal);
+
     /// Trigger EC sync because of component attribute added
     void OnAttributeAdded(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
 
@@ -115,7 +182,19 @@ private:
 
 private:
     /// Craft a component full update, with all static and dynamic attributes.
-    bool WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
+    bool WriteComponentFullUpdate(SyncSerializationContext &ctx, kNet::DataSerializer& ds, IComponent *comp);
+    /// Store the serialized attribute data in @c attrDs to the per-tick cache of @c ctx and return the cache entry.
+    Urho3D::HashMap<AttributeDataCacheKey, SerializedAttributeData>::Iterator CacheAttributeData(SyncSerializationContext &ctx, const AttributeDataCacheKey &key, kNet::DataSerializer &attrDs, bool valid);
+    /// Write the changed attributes of a component as the attribute data of an edit attributes message.
+    /** @param deltaState Sync state holding the delta bases of the values, or null if the user does not support ProtocolDeltaAttributes. */
+    void WriteEditAttributeData(kNet::DataSerializer &ds, const AttributeVector &attrs, const ComponentSyncState &compState, const std::vector<u8> &changedAttributes, EntitySyncState *deltaState);
+    /// Write an attribute value of an edit attributes message, delta encoded if @c deltaState is given.
+    void WriteAttributeValue(kNet::DataSerializer &ds, IAttribute *attr, component_id_t compId, u8 attrIndex, EntitySyncState *deltaState);
+    /// Read an attribute value of an edit attributes message, delta encoded if @c deltaState is given. Returns false if the value could not be applied.
+    bool ReadAttributeValue(kNet::DataDeserializer &ds, IAttribute *attr, component_id_t compId, u8 attrIndex, EntitySyncState *deltaState);
+    /// Read an attribute value of an edit attributes message to @c attr, or to its interpolation. If @c apply is false, the value is read and discarded.
+    void ReadEditedAttribute(kNet::DataDeserializer &ds, IAttribute *attr, component_id_t compId, u8 attrIndex, EntitySyncState *deltaState,
+        Scene *scene, bool apply, float updateInterval, std::vector<IAttribute*> &changedAttrs);
     /// Handle entity action message.
     void HandleEntityAction(UserConnection* source, MsgEntityAction& msg);
     /// Handle create entity message.
@@ -124,6 +203,10 @@ private:
     void HandleCreateComponents(UserConnection* source, const char* data, size_t numBytes);
     /// Handle a Camera Orientation Update message
     void HandleCameraOrientation(UserConnection* source, const char* data, size_t numBytes);
+    /// Handle a Camera Orientation Request message (client only)
+    void HandleCameraOrientationRequest(UserConnection* source, const char* data, size_t numBytes);
+    /// Send the main camera location to the server if it has requested it (client only)
+    void SendCameraOrientation();
     /// Handle create attributes message.
     void HandleCreateAttributes(UserConnection* source, const char* data, size_t numBytes);
     /// Handle edit attributes message.
@@ -145,10 +228,19 @@ private:
     /// Handle entity parent change message.
     void HandleSetEntityParent(UserConnection* source, const char* data, size_t numBytes);
 
+    /// Handle compact transform updates sent by the server with cRigidBodyUpdateMessage (client only).
     void HandleRigidBodyChanges(UserConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
     
-    void ReplicateRigidBodyChanges(UserConnection* user);
+    /// Send the dirty Placeable transforms of a user's sync state as compact, unreliable cRigidBodyUpdateMessages.
+    /** Clears the transform dirty bits, so that the generic sync will not double-replicate them. */
+    void ReplicateRigidBodyChanges(UserConnection* user, float time);
+
+    /// Write the compact update of one entity's transform and estimated velocity, if it differs enough from the state last sent to the user.
+    /** @param atRest Force an update with zero velocity and the exact transform, including changes below the update thresholds.
+        @return True if an update was written. */
+    bool WriteRigidBodyUpdate(kNet::DataSerializer &ds, EntitySyncState &ess, const Transform &t, bool atRest, kNet::tick_t now);
 
+    /// Move the Placeables updated with cRigidBodyUpdateMessage along their Hermite curves (client only).
     void InterpolateRigidBodies(f64 frametime, SceneSyncState* state);
 
     void ReplicateComponentType(u32 typeId, UserConnection* connection = 0);
@@ -156,13 +248,34 @@ private:
     /// Read client extrapolation time parameter from command line and match it to the current sync period.
     void GetClientExtrapolationTime();
 
+    /// Send the registered placeholder component types to a user connection if not sent yet.
+    void ReplicatePlaceholderComponentTypes(UserConnection* user);
+
     /// Process one user connection's sync state for changes in the scene. Note that on the client the server is a "virtual" user
-    /** @param user User connection to process */
-    void ProcessSyncState(UserConnection* user);
+    /** Does not modify the reference counts of the scene objects, so that connections can be processed in parallel.
+        @param user User connection to process
+        @param ctx Serialization buffers of the calling thread */
+    void ProcessSyncState(UserConnection* user, Scene *scene, SyncSerializationContext &ctx, float time);
+
+    /// Process the sync states of the server's user connections on the worker threads.
+    void ProcessSyncStatesParallel(Scene *scene, float time);
+
+    /// Worker thread function for ProcessSyncStatesParallel.
+    static void ProcessSyncStateWork(const Urho3D::WorkItem* item, unsigned threadIndex);
+
+    /// Returns the serialization context of a thread, creating the contexts as necessary. Index 0 is the main thread.
+    SyncSerializationContext &SerializationContext(unsigned threadIndex);
+
+    /// Store the world positions of the scene's Placeables for the sync priorities of this tick.
+    void UpdateWorldPositions(Scene *scene);
+
+    /// Returns the sync priority of a dirty @c entityState for the user owning @c sceneState. Higher values are sent first.
+    /** Combines the relevance factor of the entity, its distance to the client location and the time since it was last sent. */
+    float EntitySyncPriority(const SceneSyncState *sceneState, const EntitySyncState *entityState) const;
 
     /// Process @c entityState that belongs to @c sceneState.
-    /** This function must only be called if @c entityState is in the @c sceneStates dirtyQueue. */
-    void ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState *entityState);
+    /** This function must only be called after @c entityState has been unlinked from the @c sceneStates dirtyQueue. */
+    void ProcessEntitySyncState(bool isServer, UserConnection* user, Scene *scene, SceneSyncState *sceneState, EntitySyncState *entityState, SyncSerializationContext &ctx);
     
     /// Validate the scene manipulation action. If returns false, it is ignored
     /** @param source Where the action came from
@@ -170,7 +283,7 @@ private:
         @param entityID What entity it affects */
     bool ValidateAction(UserConnection* source, unsigned messageID, entity_id_t entityID);
     
-    bool ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, ComponentPtr &comp, size_t maxBytes = 0);
+    bool ValidateAttributeBuffer(bool fatal, kNet::DataSerializer& ds, IComponent *comp, size_t maxBytes = 0);
     
     ScenePtr GetRegisteredScene() const { return scene_.Lock(); }
 
@@ -187,25 +300,41 @@ private:
     float updatePeriod_;
     /// Time accumulator for update
     float updateAcc_;
+    /// Per-connection byte budget for one update tick, 0 if unlimited
+    u32 maxBytesPerTick_;
     
     /// Physics client interpolation/extrapolation period length as number of network update intervals (default 3)
     float maxLinExtrapTime_;
     /// Disable client physics handoff -flag
     bool noClientPhysicsHandoff_;
     
+    /// Interest manager filtering the replication per user (server only)
+    SharedPtr<InterestManager> interestManager_;
+    /// Whether the server has requested camera orientation updates (client only)
+    bool sendCameraUpdates_;
+    /// Last camera transform sent to the server (client only)
+    Transform lastSentCameraTransform_;
+
     /// "User" representing the server connection (client only)
     KNetUserConnectionPtr serverConnection_;
     
-    /// Fixed buffers for crafting messages
+    /// Fixed buffers for handling received messages
     char createEntityBuffer_[64 * 1024];
-    char createCompsBuffer_[64 * 1024];
-    char editAttrsBuffer_[64 * 1024];
-    char createAttrsBuffer_[64 * 1024];
     char attrDataBuffer_[64 * 1024];
-    char removeCompsBuffer_[1024];
-    char removeEntityBuffer_[1024];
-    char removeAttrsBuffer_[1024];
-    std::vector<u8> changedAttributes_;
+
+    /// Serialization contexts for processing sync states, by thread index. Index 0 is the main thread.
+    Urho3D::Vector<SharedPtr<SyncSerializationContext> > serializationContexts_;
+    /// Whether the sync states are processed in parallel on the worker threads
+    bool parallelProcessing_;
+    /// Whether changed attribute values are sent as deltas to the connections that support it
+    bool deltaAttributes_;
+    /// Duration of the network update tick run by the last Update
+    float lastTickDuration_;
+    /// Scene and time of the parallel processing in progress, read by the work items
+    Scene* parallelScene_;
+    float parallelTime_;
+    /// World positions of the scene's Placeables at the start of the current network update tick (server only)
+    Urho3D::HashMap<entity_id_t, float3> worldPositions_;
 
     /// The sender of a component type. Used to avoid sending component description back to sender
     UserConnection* componentTypeSender_;
@@ -79,12 +79,7 @@ bool SceneSyncState::HasPendingEntities() const
 /// @remark Enables a 'pending' logic in SyncManager, with which a script can throttle the sending of entities to clients.
 bool SceneSyncState::HasPendingEntity(entity_id_t id) const
 {
-    for(PendingConstIter iter = pendingEntities_.begin(); iter != pendingEntities_.end(); ++iter)
-    {
-        if ((*iter) == id)
-            return true;
-    }
-    return false;
+    return pendingEntitySet_.Contains(id);
 }
 
 /// @remark Enables a 'pending' logic in SyncManager, with which a script can throttle the sending of entities to clients.
@@ -95,8 +90,7 @@ void SceneSyncState::MarkEntityPending(entity_id_t id)
 
     // If user does not have the entity in the first place, do nothing.
     // Its going to be asked to be added to the state via the permission signals later.
-    auto i = entities.find(id);
-    if (i == entities.end())
+    if (!entities.Contains(id))
         return;
 
     MarkEntityRemoved(id);  // Remove from current sync state (removes entity from client)
@@ -163,9 +157,13 @@ EntitySyncState &SceneSyncState::GetOrCreateEntitySyncState(entity_id_t id)
 
 void SceneSyncState::Clear()
 {
+    // Unlink the queued states before they are destroyed
     dirtyQueue.Clear();
-    entities.clear();
+    entities.Clear();
+    entityInterpolations.clear();
+    movingEntities.Clear();
     pendingEntities_.clear();
+    pendingEntitySet_.Clear();
     changeRequest_.Reset();
     scene_.Reset();
     placeholderComponentsSent_ = false;
@@ -173,21 +171,42 @@ void SceneSyncState::Clear()
 
 void SceneSyncState::RemoveFromQueue(entity_id_t id)
 {
-    auto i = entities.find(id);
-    if (i != entities.end())
+    auto i = entities.Find(id);
+    if (i != entities.End())
     {
-        if (i->second.isInQueue)
+        if (i->second_.isInQueue)
         {
-            dirtyQueue.Erase(id);
-
-            i->second.isInQueue = false;
-            for (auto j = i->second.components.begin(); j != i->second.components.end(); ++j)
-                j->second.isInQueue = false;
-            i->second.dirtyQueue.Clear();
+            dirtyQueue.Remove(&i->second_);
+            i->second_.ClearComponentQueue();
         }
     }
 }
 
+void SceneSyncState::RemoveEntitySyncState(entity_id_t id)
+{
+    auto i = entities.Find(id);
+    if (i != entities.End())
+    {
+        dirtyQueue.Remove(&i->second_);
+        entities.Erase(id);
+    }
+}
+
+EntitySyncState *SceneSyncState::ChangeEntityId(entity_id_t oldId, entity_id_t newId)
+{
+    auto i = entities.Find(oldId);
+    if (i == entities.End())
+        return 0;
+
+    RemoveFromQueue(oldId);
+    RemoveEntitySyncState(newId);
+    EntitySyncState &newState = entities[newId]; // Does not move the old state, as the state addresses are stable
+    newState = i->second_; // Copy the sync state to the new ID
+    newState.id = newId; // Must remember to change ID manually
+    entities.Erase(oldId);
+    return &newState;
+}
+
 void SceneSyncState::MarkEntityProcessed(entity_id_t id)
 {
     EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
@@ -219,11 +238,7 @@ bool SceneSyncState::MarkEntityDirty(entity_id_t id, bool hasPropertyChanges, bo
         return false;
 
     EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
-    if (!entityState.isInQueue)
-    {
-        dirtyQueue.Insert(Urho3D::MakePair(id, &entityState));
-        entityState.isInQueue = true;
-    }
+    dirtyQueue.Push(&entityState);
     if (hasPropertyChanges)
         entityState.hasPropertyChanges = true;
     if (hasParentChange)
@@ -238,23 +253,18 @@ void SceneSyncState::MarkEntityRemoved(entity_id_t id)
         RemovePendingEntity(id);
 
     // If user did not have the entity in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    auto i = entities.Find(id);
+    if (i == entities.End())
         return;
     // If entity is marked new, it was not sent yet and can be simply removed from the sync state
-    if (i->second.isNew)
+    if (i->second_.isNew)
     {
-        RemoveFromQueue(id);
-        entities.erase(id);
+        RemoveEntitySyncState(id);
         return;
     }
     // Else mark as removed and queue the update
-    i->second.removed = true;
-    if (!i->second.isInQueue)
-    {
-        dirtyQueue.Insert(Urho3D::MakePair(id, &i->second));
-        i->second.isInQueue = true;
-    }
+    i->second_.removed = true;
+    dirtyQueue.Push(&i->second_);
 }
 
 void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
@@ -269,11 +279,11 @@ void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
 void SceneSyncState::MarkComponentRemoved(entity_id_t id, component_id_t compId)
 {
     // If user did not have the entity or component in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i != entities.end())
+    auto i = entities.Find(id);
+    if (i != entities.End())
     {
         MarkEntityDirty(id);
-        i->second.MarkComponentRemoved(compId);
+        i->second_.MarkComponentRemoved(compId);
     }
 }
 
@@ -288,6 +298,17 @@ void SceneSyncState::MarkAttributeDirty(entity_id_t id, component_id_t compId, u
     }
 }
 
+void SceneSyncState::MarkAttributesDirty(entity_id_t id, component_id_t compId, const u8 *attrBits)
+{
+    if (MarkEntityDirty(id))
+    {
+        EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
+        entityState.MarkComponentDirty(compId);
+        ComponentSyncState& compState = entityState.components[compId];
+        compState.MarkAttributesDirty(attrBits);
+    }
+}
+
 void SceneSyncState::MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex)
 {
     if (MarkEntityDirty(id))
@@ -324,8 +345,7 @@ bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
     // Only request if this entity does not have a sync state yet.
     // Otherwise this id will spam the signal handler on every change if
     // the addition to sync state was accepted.
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!entities.Contains(id))
     {
         PROFILE(SyncState_Emit_AboutToDirtyEntity);
         
@@ -345,6 +365,9 @@ bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
 
 void SceneSyncState::RemovePendingEntity(entity_id_t id)
 {
+    if (!pendingEntitySet_.Erase(id))
+        return;
+
     // This assumes that the id has not been added multiple times to our vector.
     for(PendingIter iter = pendingEntities_.begin(); iter != pendingEntities_.end(); ++iter)
     {
@@ -406,7 +429,10 @@ void SceneSyncState::AddPendingEntity(entity_id_t id)
         return;
         
     if (!HasPendingEntity(id))
+    {
         pendingEntities_.push_back(id);
+        pendingEntitySet_.Insert(id);
+    }
 }
 
 EntitySyncState& SceneSyncState::MarkEntityDirtySilent(entity_id_t id)
@@ -414,20 +440,14 @@ EntitySyncState& SceneSyncState::MarkEntityDirtySilent(entity_id_t id)
     // Verify that this entity is not known to this client state.
     // If it is we need to remove the ptr from any queues and remove the entity state.
     // This ensures the below creates a new EntitySyncState with isNew == true.
-    std::map<entity_id_t, EntitySyncState>::iterator existingIter = entities.find(id);
-    if (existingIter != entities.end())
+    if (entities.Contains(id))
     {
         LogWarning(String("SceneSyncState::MarkEntityDirtySilent: State for Entity " + String(id) + " already exist, removing for full recreation."));
-        RemoveFromQueue(id);
-        entities.erase(existingIter);
+        RemoveEntitySyncState(id);
     }
 
     EntitySyncState& entityState = GetOrCreateEntitySyncState(id);
-    if (!entityState.isInQueue)
-    {
-        dirtyQueue.Insert(Urho3D::MakePair(id, &entityState));
-        entityState.isInQueue = true;
-    }
+    dirtyQueue.Push(&entityState);
     return entityState;
 }
 
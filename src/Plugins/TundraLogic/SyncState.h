@@ -10,6 +10,8 @@
 #include "CoreTypes.h"
 #include "SceneFwd.h"
 
+#include "SyncStateMap.h"
+
 #include "Math/Transform.h"
 #include "Math/float3.h"
 #include "MsgEntityAction.h"
@@ -19,9 +21,12 @@
 #include <Variant.h>
 #include <List.h>
 #include <HashMap.h>
+#include <HashSet.h>
+#include <Vector.h>
 //#include <list>
 #include <map>
 #include <set>
+#include <cstring>
 
 namespace Tundra
 {
@@ -29,47 +34,264 @@ namespace Tundra
 class SceneSyncState;
 
 /// Component's per-user network sync state
+/** Trivially copyable, so that the component states of an entity can be stored in one contiguous array. */
 struct ComponentSyncState
 {
     ComponentSyncState() :
+        id(0),
         removed(false),
         isNew(true),
-        isInQueue(false),
-        id(0)
+        isInQueue(false)
     {
-        for (unsigned i = 0; i < 32; ++i)
-            dirtyAttributes[i] = 0;
+        memset(dirtyAttributes, 0, sizeof(dirtyAttributes));
+        memset(createdAttributes, 0, sizeof(createdAttributes));
+        memset(removedAttributes, 0, sizeof(removedAttributes));
     }
     
     void MarkAttributeDirty(u8 attrIndex)
     {
         dirtyAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
     }
+
+    /// Marks the attributes set in the 256-bit @c attrBits mask dirty.
+    void MarkAttributesDirty(const u8 *attrBits)
+    {
+        for (unsigned i = 0; i < sizeof(dirtyAttributes); ++i)
+            dirtyAttributes[i] |= attrBits[i];
+    }
     
     void MarkAttributeCreated(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = true;
+        createdAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        removedAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
     
     void MarkAttributeRemoved(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = false;
+        removedAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        createdAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+    }
+
+    /// Forgets a pending create or remove of a dynamic attribute.
+    void ClearAttributeCreatedOrRemoved(u8 attrIndex)
+    {
+        createdAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        removedAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+    }
+
+    bool IsAttributeCreated(u8 attrIndex) const { return (createdAttributes[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0; }
+    bool IsAttributeRemoved(u8 attrIndex) const { return (removedAttributes[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0; }
+
+    /// Clears the created and removed dynamic attributes.
+    void NewAndRemovedAttributesProcessed()
+    {
+        memset(createdAttributes, 0, sizeof(createdAttributes));
+        memset(removedAttributes, 0, sizeof(removedAttributes));
     }
     
     void DirtyProcessed()
     {
-        for (unsigned i = 0; i < 32; ++i)
-            dirtyAttributes[i] = 0;
-        newAndRemovedAttributes.Clear();
+        memset(dirtyAttributes, 0, sizeof(dirtyAttributes));
+        NewAndRemovedAttributesProcessed();
         isNew = false;
     }
     
     u8 dirtyAttributes[32]; ///< Dirty attributes bitfield. A maximum of 256 attributes are supported.
-    Urho3D::HashMap<u8, bool> newAndRemovedAttributes; ///< Dynamic attributes by index that have been removed or created since last update. True = create, false = delete
+    u8 createdAttributes[32]; ///< Dynamic attributes that have been created since last update, as a bitfield.
+    u8 removedAttributes[32]; ///< Dynamic attributes that have been removed since last update, as a bitfield.
     component_id_t id; ///< Component ID. Duplicated here intentionally to allow recognizing the component without the parent map.
     bool removed; ///< The component has been removed since last update
     bool isNew; ///< The client does not have the component and it must be serialized in full
-    bool isInQueue; ///< The component is already in the entity's dirty queue
+    bool isInQueue; ///< The component is dirty and will be processed with the entity
+};
+
+/// Component sync states of an entity. Entities have only a few components, which are searched linearly.
+typedef SmallSyncStateMap<component_id_t, ComponentSyncState> ComponentSyncStateMap;
+
+/// Previous value of an attribute sent to or received from the peer, which the delta encoded values of the attribute are relative to.
+/** The value is stored in the byte pool of the owning AttributeDeltaBases. @see AttributeDelta.h */
+struct AttributeDeltaBase
+{
+    /// Returns the sort key of the base of an attribute in one direction.
+    static u64 Key(component_id_t compId, u8 attrIndex, bool received) { return ((u64)compId << 9) | ((u64)attrIndex << 1) | (received ? 1 : 0); }
+
+    u64 key; ///< Component ID, attribute index and direction, see Key
+    unsigned offset; ///< Offset of the value in the byte pool
+    unsigned size; ///< Size of the value: the 32-bit words of a numeric value as serialized by ToBinary, or the UTF-8 of a string value
+    unsigned capacity; ///< Bytes reserved for the value in the byte pool
+    bool valid; ///< Whether the base holds a value. An empty string is a valid value
+    u8 generation; ///< Number of values of the attribute sent or received, modulo 256
+
+    component_id_t ComponentId() const { return (component_id_t)(key >> 9); }
+    u8 AttrIndex() const { return (u8)(key >> 1); }
+    bool IsReceived() const { return (key & 1) != 0; }
+};
+
+/// Delta bases of the attributes of an entity in both directions.
+/** The bases are kept sorted by key in one array, and their values in one byte pool, so that an entity needs two allocations
+    regardless of how many of its attributes are delta encoded. The pool is compacted once more than half of it is unused.
+    References to the bases are invalidated when a base is added or removed. */
+class AttributeDeltaBases
+{
+public:
+    AttributeDeltaBases() : unusedBytes_(0) {}
+
+    /// Returns the base of an attribute in either direction, or creates an invalid one if it does not exist.
+    AttributeDeltaBase &Base(component_id_t compId, u8 attrIndex, bool received)
+    {
+        const u64 key = AttributeDeltaBase::Key(compId, attrIndex, received);
+        unsigned i = LowerBound(key);
+        if (i < bases_.Size() && bases_[i].key == key)
+            return bases_[i];
+        AttributeDeltaBase base;
+        base.key = key;
+        base.offset = 0;
+        base.size = 0;
+        base.capacity = 0;
+        base.valid = false;
+        base.generation = 0;
+        bases_.Insert(i, base);
+        return bases_[i];
+    }
+
+    /// Returns the value of @c base.
+    const u8 *Value(const AttributeDeltaBase &base) const { return base.size ? &bytes_[base.offset] : 0; }
+
+    /// Stores @c size bytes from @c data as the value of @c base, and makes it valid. @c data must not point to the pool.
+    void SetValue(AttributeDeltaBase &base, const u8 *data, unsigned size)
+    {
+        if (size > base.capacity)
+        {
+            // Numeric values keep their size, so only a string that grows needs more room
+            unusedBytes_ += base.capacity;
+            base.offset = bytes_.Size();
+            base.capacity = size;
+            bytes_.Resize(bytes_.Size() + size);
+        }
+        base.size = size;
+        base.valid = true;
+        if (size)
+            memcpy(&bytes_[base.offset], data, size);
+        if (unusedBytes_ > 1024 && unusedBytes_ > bytes_.Size() / 2)
+            Compact();
+    }
+
+    /// Forgets the bases of a component in both directions.
+    void Remove(component_id_t compId)
+    {
+        RemoveRange((u64)compId << 9, ((u64)compId + 1) << 9);
+    }
+
+    /// Forgets the bases of an attribute in both directions, e.g. when a dynamic attribute is created or removed in its index.
+    void Remove(component_id_t compId, u8 attrIndex)
+    {
+        RemoveRange(AttributeDeltaBase::Key(compId, attrIndex, false), AttributeDeltaBase::Key(compId, attrIndex, true) + 1);
+    }
+
+    /// Forgets the bases of the values sent to the peer, so that the next values are sent in full.
+    void RemoveSent()
+    {
+        unsigned dest = 0;
+        for (unsigned i = 0; i < bases_.Size(); ++i)
+        {
+            if (!bases_[i].IsReceived())
+                unusedBytes_ += bases_[i].capacity;
+            else
+                bases_[dest++] = bases_[i];
+        }
+        bases_.Resize(dest);
+        Compact();
+    }
+
+    /// Moves the bases of a component to a new ID.
+    void ChangeComponentId(component_id_t oldId, component_id_t newId)
+    {
+        Remove(newId);
+        const u64 begin = (u64)oldId << 9;
+        const u64 end = ((u64)oldId + 1) << 9;
+        for (unsigned i = LowerBound(begin); i < bases_.Size() && bases_[i].key < end; ++i)
+            bases_[i].key = AttributeDeltaBase::Key(newId, bases_[i].AttrIndex(), bases_[i].IsReceived());
+        // Restore the order with an insertion sort, as only the moved range is out of place
+        for (unsigned i = 1; i < bases_.Size(); ++i)
+        {
+            AttributeDeltaBase base = bases_[i];
+            unsigned j = i;
+            for (; j > 0 && bases_[j - 1].key > base.key; --j)
+                bases_[j] = bases_[j - 1];
+            bases_[j] = base;
+        }
+    }
+
+    void Clear()
+    {
+        bases_.Clear();
+        bytes_.Clear();
+        unusedBytes_ = 0;
+    }
+
+    unsigned Size() const { return bases_.Size(); }
+    const AttributeDeltaBase &At(unsigned index) const { return bases_[index]; }
+
+    /// Returns the number of bytes allocated for the bases.
+    size_t MemoryUse() const { return bases_.Capacity() * sizeof(AttributeDeltaBase) + bytes_.Capacity(); }
+
+private:
+    unsigned LowerBound(u64 key) const
+    {
+        unsigned first = 0;
+        unsigned count = bases_.Size();
+        while (count > 0)
+        {
+            unsigned step = count / 2;
+            if (bases_[first + step].key < key)
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    void RemoveRange(u64 begin, u64 end)
+    {
+        unsigned first = LowerBound(begin);
+        unsigned last = first;
+        for (; last < bases_.Size() && bases_[last].key < end; ++last)
+            unusedBytes_ += bases_[last].capacity;
+        if (last > first)
+            bases_.Erase(first, last - first);
+        if (bases_.Empty())
+            Clear();
+    }
+
+    /// Moves the values to the start of the pool in the order of the bases, dropping the unused bytes.
+    void Compact()
+    {
+        if (bases_.Empty())
+        {
+            Clear();
+            return;
+        }
+        Urho3D::PODVector<u8> bytes;
+        bytes.Reserve(bytes_.Size() - unusedBytes_);
+        for (unsigned i = 0; i < bases_.Size(); ++i)
+        {
+            AttributeDeltaBase &base = bases_[i];
+            unsigned offset = bytes.Size();
+            bytes.Resize(offset + base.capacity);
+            if (base.capacity)
+                memcpy(&bytes[offset], &bytes_[base.offset], base.capacity);
+            base.offset = offset;
+        }
+        bytes_.Swap(bytes);
+        unusedBytes_ = 0;
+    }
+
+    Urho3D::PODVector<AttributeDeltaBase> bases_;
+    Urho3D::PODVector<u8> bytes_;
+    unsigned unusedBytes_; ///< Bytes of the pool no longer reserved by a base
 };
 
 /// Entity's per-user network sync state
@@ -82,28 +304,26 @@ struct EntitySyncState
         hasPropertyChanges(false),
         hasParentChange(false),
         id(0),
+        numDirtyComponents(0),
+        prevDirty(0),
+        nextDirty(0),
         avgUpdateInterval(0.0f),
-        lastNetworkSendTime(kNet::Clock::Tick())
+        linearVelocity(float3::zero),
+        angularVelocity(float3::zero),
+        lastNetworkSendTime(kNet::Clock::Tick()),
+        transformSent(false),
+        transformExact(false),
+        lastTransformSendTime(0)
     {
     }
     
     void RemoveFromQueue(component_id_t id)
     {
-        auto i = components.find(id);
-        if (i != components.end())
+        auto i = components.Find(id);
+        if (i != components.End() && i->second_.isInQueue)
         {
-            if (i->second.isInQueue)
-            {
-                for (auto j = dirtyQueue.Begin(); j != dirtyQueue.End(); ++j)
-                {
-                    if ((*j) == &i->second)
-                    {
-                        dirtyQueue.Erase(j);
-                        break;
-                    }
-                }
-                i->second.isInQueue = false;
-            }
+            i->second_.isInQueue = false;
+            --numDirtyComponents;
         }
     }
     
@@ -114,41 +334,90 @@ struct EntitySyncState
             compState.id = id;
         if (!compState.isInQueue)
         {
-            dirtyQueue.Push(&compState);
             compState.isInQueue = true;
+            ++numDirtyComponents;
         }
     }
     
     void MarkComponentRemoved(component_id_t id)
     {
         // If user did not have the component in the first place, do nothing
-        auto i = components.find(id);
-        if (i == components.end())
+        auto i = components.Find(id);
+        if (i == components.End())
             return;
         // If component is marked new, it was not sent yet and can be simply removed from the sync state
-        if (i->second.isNew)
+        if (i->second_.isNew)
         {
-            RemoveFromQueue(id);
-            components.erase(id);
+            RemoveComponent(id);
             return;
         }
         // Else mark as removed and queue the update
-        i->second.removed = true;
-        if (!i->second.isInQueue)
+        i->second_.removed = true;
+        if (!i->second_.isInQueue)
+        {
+            i->second_.isInQueue = true;
+            ++numDirtyComponents;
+        }
+    }
+
+    /// Removes the sync state of a component.
+    void RemoveComponent(component_id_t id)
+    {
+        RemoveFromQueue(id);
+        components.Erase(id);
+        deltaBases.Remove(id);
+    }
+
+    /// Moves the sync state of a component to a new ID, e.g. after the server has acked a component created by the client.
+    void ChangeComponentId(component_id_t oldId, component_id_t newId)
+    {
+        auto i = components.Find(oldId);
+        if (i == components.End())
+            return;
+        ComponentSyncState compState = i->second_;
+        compState.id = newId;
+        RemoveComponent(newId);
+        RemoveFromQueue(oldId);
+        components.Erase(oldId);
+        components[newId] = compState;
+        if (compState.isInQueue)
+            ++numDirtyComponents;
+        deltaBases.ChangeComponentId(oldId, newId);
+    }
+
+    /// Returns whether components or attributes have been added, changed, or removed since last update.
+    bool HasDirtyComponents() const { return numDirtyComponents > 0; }
+
+    /// Appends the IDs of the dirty components to @c dest in storage order and clears their queued flags.
+    void TakeDirtyComponents(Urho3D::PODVector<component_id_t> &dest)
+    {
+        for (auto i = components.Begin(); i != components.End() && numDirtyComponents > 0; ++i)
         {
-            dirtyQueue.Push(&i->second);
-            i->second.isInQueue = true;
+            if (i->second_.isInQueue)
+            {
+                dest.Push(i->first_);
+                i->second_.isInQueue = false;
+                --numDirtyComponents;
+            }
         }
     }
+
+    /// Clears the queued flags of all components without processing them.
+    void ClearComponentQueue()
+    {
+        for (auto i = components.Begin(); i != components.End(); ++i)
+            i->second_.isInQueue = false;
+        numDirtyComponents = 0;
+    }
     
     void DirtyProcessed()
     {
-        for (auto i = components.begin(); i != components.end(); ++i)
+        for (auto i = components.Begin(); i != components.End(); ++i)
         {
-            i->second.DirtyProcessed();
-            i->second.isInQueue = false;
+            i->second_.DirtyProcessed();
+            i->second_.isInQueue = false;
         }
-        dirtyQueue.Clear();
+        numDirtyComponents = 0;
         isNew = false;
         hasPropertyChanges = false;
         hasParentChange = false;
@@ -168,17 +437,21 @@ struct EntitySyncState
             avgUpdateInterval = 0.5f * time + 0.5f * avgUpdateInterval;
     }
     
-    Urho3D::List<ComponentSyncState*> dirtyQueue; ///< Dirty components
-    std::map<component_id_t, ComponentSyncState> components; ///< Component syncstates
+    ComponentSyncStateMap components; ///< Component syncstates
+    AttributeDeltaBases deltaBases; ///< Last attribute values sent to and received from the user, for delta encoded attribute updates
 
     entity_id_t id; ///< Entity ID. Duplicated here intentionally to allow recognizing the entity without the parent map.
     EntityWeakPtr weak; ///< Entity weak ptr.
 
     bool removed; ///< The entity has been removed since last update
     bool isNew; ///< The client does not have the entity and it must be serialized in full
-    bool isInQueue; ///< The entity is already in the scene's dirty queue
+    bool isInQueue; ///< The entity is linked to the scene's dirty queue
     bool hasPropertyChanges; ///< The entity has changes into its other properties, such as temporary flag
     bool hasParentChange; ///> The entity's parent has changed
+
+    unsigned numDirtyComponents; ///< Number of components with the isInQueue flag set
+    EntitySyncState *prevDirty; ///< Previous entity in the scene's dirty queue
+    EntitySyncState *nextDirty; ///< Next entity in the scene's dirty queue
     
     kNet::PolledTimer updateTimer; ///< Last update received timer
     float avgUpdateInterval; ///< Average network update interval in seconds
@@ -189,6 +462,124 @@ struct EntitySyncState
     float3 linearVelocity;
     float3 angularVelocity;
     kNet::tick_t lastNetworkSendTime;
+    bool transformSent; ///< Whether transform and linearVelocity hold the state last sent with cRigidBodyUpdateMessage
+    bool transformExact; ///< Whether the client has the exact current transform, instead of one with changes below the update thresholds omitted
+    kNet::tick_t lastTransformSendTime; ///< Time of the last cRigidBodyUpdateMessage update, used for estimating the velocity
+};
+
+/// Dirty entity sync states of a scene, as an intrusive list linked through EntitySyncState::prevDirty and nextDirty.
+/** Linking and unlinking do not allocate. The linked states are owned by SceneSyncState::entities, and must be removed
+    from the queue before they are erased. */
+class EntitySyncStateQueue
+{
+public:
+    EntitySyncStateQueue() : first_(0), last_(0), size_(0) {}
+
+    /// Links @c state to the end of the queue, unless it is already queued.
+    void Push(EntitySyncState *state)
+    {
+        if (state->isInQueue)
+            return;
+        state->prevDirty = last_;
+        state->nextDirty = 0;
+        if (last_)
+            last_->nextDirty = state;
+        else
+            first_ = state;
+        last_ = state;
+        state->isInQueue = true;
+        ++size_;
+    }
+
+    /// Unlinks @c state from the queue, if it is queued.
+    void Remove(EntitySyncState *state)
+    {
+        if (!state->isInQueue)
+            return;
+        if (state->prevDirty)
+            state->prevDirty->nextDirty = state->nextDirty;
+        else
+            first_ = state->nextDirty;
+        if (state->nextDirty)
+            state->nextDirty->prevDirty = state->prevDirty;
+        else
+            last_ = state->prevDirty;
+        state->prevDirty = 0;
+        state->nextDirty = 0;
+        state->isInQueue = false;
+        --size_;
+    }
+
+    /// Unlinks all states.
+    void Clear()
+    {
+        while (first_)
+            Remove(first_);
+    }
+
+    /// Returns the first queued state, or null if the queue is empty. Continue with EntitySyncState::nextDirty.
+    EntitySyncState *First() const { return first_; }
+    unsigned Size() const { return size_; }
+    bool Empty() const { return size_ == 0; }
+
+private:
+    EntitySyncState *first_;
+    EntitySyncState *last_;
+    unsigned size_;
+};
+
+/// Identifies a serialized attribute data blob of a component within one network update tick.
+/** The same entity, component and dirty attribute mask always serialize to the same bytes during a tick,
+    so the data can be serialized once and shared by all user connections. */
+struct AttributeDataCacheKey
+{
+    AttributeDataCacheKey() :
+        entityId(0),
+        componentId(0),
+        fullUpdate(false)
+    {
+        memset(dirtyAttributes, 0, sizeof(dirtyAttributes));
+    }
+
+    AttributeDataCacheKey(entity_id_t entityId_, component_id_t componentId_, const u8 *dirtyAttributes_, unsigned numMaskBytes, bool fullUpdate_) :
+        entityId(entityId_),
+        componentId(componentId_),
+        fullUpdate(fullUpdate_)
+    {
+        memset(dirtyAttributes, 0, sizeof(dirtyAttributes));
+        if (dirtyAttributes_ && numMaskBytes)
+            memcpy(dirtyAttributes, dirtyAttributes_, numMaskBytes < sizeof(dirtyAttributes) ? numMaskBytes : sizeof(dirtyAttributes));
+    }
+
+    bool operator ==(const AttributeDataCacheKey &rhs) const
+    {
+        return entityId == rhs.entityId && componentId == rhs.componentId && fullUpdate == rhs.fullUpdate &&
+            memcmp(dirtyAttributes, rhs.dirtyAttributes, sizeof(dirtyAttributes)) == 0;
+    }
+
+    bool operator !=(const AttributeDataCacheKey &rhs) const { return !(*this == rhs); }
+
+    unsigned ToHash() const
+    {
+        unsigned hash = entityId * 31 + componentId;
+        for (unsigned i = 0; i < sizeof(dirtyAttributes); ++i)
+            hash = hash * 31 + dirtyAttributes[i];
+        return fullUpdate ? ~hash : hash;
+    }
+
+    entity_id_t entityId; ///< Entity ID.
+    component_id_t componentId; ///< Component ID.
+    u8 dirtyAttributes[32]; ///< Dirty attributes bitfield that was serialized. Zero for full updates.
+    bool fullUpdate; ///< Whether the data is a full component update with all static and dynamic attributes.
+};
+
+/// Serialized attribute data shared between user connections during one network update tick.
+struct SerializedAttributeData
+{
+    SerializedAttributeData() : valid(false) {}
+
+    Urho3D::PODVector<u8> data; ///< Serialized bytes, ready to be spliced into a sync message.
+    bool valid; ///< False if the serialization overflowed the attribute buffer and should not be sent.
 };
 
 struct RigidBodyInterpolationState
@@ -278,18 +669,25 @@ public:
     explicit SceneSyncState(UserConnection* owner, u32 userConnectionID = 0, bool isServer = false);
     virtual ~SceneSyncState();
 
-    /// Entity sync states
-    std::map<entity_id_t, EntitySyncState> entities; 
+    /// Entity sync states. The addresses of the states are stable, which allows linking them to the dirty queue.
+    SyncStateMap<entity_id_t, EntitySyncState> entities;
 
     /// Dirty entities pending processing
-    Urho3D::HashMap<entity_id_t,EntitySyncState*> dirtyQueue;
+    EntitySyncStateQueue dirtyQueue;
 
     /// Entity interpolations
     std::map<entity_id_t, RigidBodyInterpolationState> entityInterpolations;
 
+    /// Entities last sent with a nonzero velocity, or with transform changes below the update thresholds,
+    /// which need a final exact update once they come to rest (server only)
+    Urho3D::HashSet<entity_id_t> movingEntities;
+
     /// Maps containing the relevance factors and visibility data
     /// @remarks InterestManager functionality
-    std::map<entity_id_t, bool> visibleEntities;
+    Urho3D::HashSet<entity_id_t> visibleEntities;
+    /// Entities found in range on the current update, swapped with visibleEntities. Kept so that its nodes are reused on each update.
+    /// @remarks InterestManager functionality
+    Urho3D::HashSet<entity_id_t> inRangeEntities;
     std::map<entity_id_t, float> relevanceFactors;
 
     /// Couple of maps containing the timestamps of last updates and raycasts
@@ -355,6 +753,13 @@ public:
     
     void RemoveFromQueue(entity_id_t id);
 
+    /// Removes the sync state of an entity, unlinking it from the dirty queue first.
+    void RemoveEntitySyncState(entity_id_t id);
+
+    /// Moves the sync state of an entity to a new ID, e.g. after the server has acked an entity created by the client.
+    /** The state is removed from the dirty queue. @return The moved state, or null if no state existed with @c oldId. */
+    EntitySyncState *ChangeEntityId(entity_id_t oldId, entity_id_t newId);
+
     void MarkEntityProcessed(entity_id_t id);
     void MarkComponentProcessed(entity_id_t id, component_id_t compId);
 
@@ -369,6 +774,8 @@ public:
     void MarkComponentRemoved(entity_id_t id, component_id_t compId);
 
     void MarkAttributeDirty(entity_id_t id, component_id_t compId, u8 attrIndex);
+    /// Marks the attributes set in the 256-bit @c attrBits mask dirty, see AttributeChangeJournal.
+    void MarkAttributesDirty(entity_id_t id, component_id_t compId, const u8 *attrBits);
     void MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex);
     void MarkAttributeRemoved(entity_id_t id, component_id_t compId, u8 attrIndex);
 
@@ -395,6 +802,8 @@ private:
     /// @todo This data structure needs to be removed. This is double book-keeping. Instead, track the dirty and pending entities
     ///       with the same dirty bit in EntitySyncState and ComponentSyncState.
     std::vector<entity_id_t> pendingEntities_;
+    /// Set of the pending entity IDs for fast lookups. Interest management may keep most of the scene pending.
+    Urho3D::HashSet<entity_id_t> pendingEntitySet_;
 
     StateChangeRequest changeRequest_;
     bool isServer_;
@@ -0,0 +1,313 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <Hash.h>
+#include <Vector.h>
+
+#include <cassert>
+
+namespace Tundra
+{
+
+/// Map of per-user sync states by ID, with the states stored in dense slot pages and indexed by an open addressing hash table.
+/** Unlike std::map, inserting a state does not allocate a node. The states are allocated a page at a time, and erased slots
+    are reused. The addresses of the states are stable for as long as they are in the map, so they can be linked to intrusive
+    dirty lists. The index is a linear probing table of slot numbers which is rehashed on growth, not the states themselves.
+    @note The value type must be default constructible and assignable. Erasing a state resets its slot to a default constructed value. */
+template <class K, class T> class SyncStateMap
+{
+public:
+    /// Key-value pair of a slot.
+    struct Entry
+    {
+        K first_;
+        T second_;
+    };
+
+    /// Iterator over the states in slot order.
+    class Iterator
+    {
+    public:
+        Iterator() : map_(0), slot_(0) {}
+        Iterator(SyncStateMap *map, unsigned slot) : map_(map), slot_(slot) {}
+
+        Entry *operator ->() const { return &map_->EntryAt(slot_); }
+        Entry &operator *() const { return map_->EntryAt(slot_); }
+        Iterator &operator ++() { slot_ = map_->NextUsedSlot(slot_ + 1); return *this; }
+        bool operator ==(const Iterator &rhs) const { return slot_ == rhs.slot_ && map_ == rhs.map_; }
+        bool operator !=(const Iterator &rhs) const { return !(*this == rhs); }
+
+    private:
+        friend class SyncStateMap;
+        SyncStateMap *map_;
+        unsigned slot_;
+    };
+
+    /// Number of slots allocated at a time.
+    static const unsigned PageSize = 256;
+
+    SyncStateMap() : numSlots_(0), size_(0), shift_(32) {}
+    ~SyncStateMap()
+    {
+        for (unsigned i = 0; i < pages_.Size(); ++i)
+            delete[] pages_[i];
+    }
+
+    /// Returns the state of @c key, or End() if the key does not exist.
+    Iterator Find(const K &key)
+    {
+        unsigned pos;
+        return FindIndex(key, pos) ? Iterator(this, index_[pos] - 1) : End();
+    }
+
+    /// Returns whether the map has a state for @c key.
+    bool Contains(const K &key) const
+    {
+        unsigned pos;
+        return FindIndex(key, pos);
+    }
+
+    /// Returns the state of @c key, or inserts a default constructed state if the key does not exist.
+    T &operator [](const K &key)
+    {
+        unsigned pos;
+        if (FindIndex(key, pos))
+            return EntryAt(index_[pos] - 1).second_;
+
+        if ((size_ + 1) * 4 > index_.Size() * 3)
+        {
+            Rehash(index_.Size() ? index_.Size() * 2 : 64);
+            FindIndex(key, pos);
+        }
+        unsigned slot = AllocateSlot();
+        EntryAt(slot).first_ = key;
+        index_[pos] = slot + 1;
+        ++size_;
+        return EntryAt(slot).second_;
+    }
+
+    /// Erases the state of @c key. Returns false if the key did not exist.
+    bool Erase(const K &key)
+    {
+        unsigned pos;
+        if (!FindIndex(key, pos))
+            return false;
+
+        unsigned slot = index_[pos] - 1;
+        EntryAt(slot) = Entry();
+        used_[slot] = 0;
+        freeSlots_.Push(slot);
+        --size_;
+
+        // Backward shift deletion: move the following entries of the probe sequence into the hole, so that no tombstones are needed
+        const unsigned mask = index_.Size() - 1;
+        unsigned hole = pos;
+        for (unsigned next = (pos + 1) & mask; index_[next]; next = (next + 1) & mask)
+        {
+            unsigned home = Bucket(EntryAt(index_[next] - 1).first_);
+            bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+            if (movable)
+            {
+                index_[hole] = index_[next];
+                hole = next;
+            }
+        }
+        index_[hole] = 0;
+        return true;
+    }
+
+    /// Erases all states and releases the memory.
+    void Clear()
+    {
+        for (unsigned i = 0; i < pages_.Size(); ++i)
+            delete[] pages_[i];
+        pages_.Clear();
+        index_.Clear();
+        used_.Clear();
+        freeSlots_.Clear();
+        numSlots_ = 0;
+        size_ = 0;
+        shift_ = 32;
+    }
+
+    Iterator Begin() { return Iterator(this, NextUsedSlot(0)); }
+    Iterator End() { return Iterator(this, numSlots_); }
+
+    /// Returns the number of states.
+    unsigned Size() const { return size_; }
+    /// Returns whether the map is empty.
+    bool Empty() const { return size_ == 0; }
+
+    /// Returns the number of bytes allocated by the map, excluding heap memory owned by the states themselves.
+    size_t MemoryUse() const
+    {
+        return pages_.Size() * PageSize * sizeof(Entry) + pages_.Capacity() * sizeof(Entry*) +
+            index_.Capacity() * sizeof(unsigned) + used_.Capacity() + freeSlots_.Capacity() * sizeof(unsigned);
+    }
+
+private:
+    Entry &EntryAt(unsigned slot) { return pages_[slot / PageSize][slot % PageSize]; }
+    const Entry &EntryAt(unsigned slot) const { return pages_[slot / PageSize][slot % PageSize]; }
+
+    unsigned NextUsedSlot(unsigned slot) const
+    {
+        while (slot < numSlots_ && !used_[slot])
+            ++slot;
+        return slot;
+    }
+
+    /// Returns the home bucket of @c key. Fibonacci hashing spreads sequential IDs over the table.
+    unsigned Bucket(const K &key) const
+    {
+        return (unsigned)(Urho3D::MakeHash(key) * 2654435769u) >> shift_;
+    }
+
+    /// Looks up @c key. Returns true with @c pos set to its index position, or false with @c pos set to the free position it would be inserted to.
+    bool FindIndex(const K &key, unsigned &pos) const
+    {
+        pos = 0;
+        if (index_.Empty())
+            return false;
+        const unsigned mask = index_.Size() - 1;
+        for (pos = Bucket(key); index_[pos]; pos = (pos + 1) & mask)
+        {
+            if (EntryAt(index_[pos] - 1).first_ == key)
+                return true;
+        }
+        return false;
+    }
+
+    unsigned AllocateSlot()
+    {
+        unsigned slot;
+        if (!freeSlots_.Empty())
+        {
+            slot = freeSlots_.Back();
+            freeSlots_.Pop();
+        }
+        else
+        {
+            slot = numSlots_++;
+            if (slot / PageSize >= pages_.Size())
+                pages_.Push(new Entry[PageSize]);
+            used_.Push(0);
+        }
+        used_[slot] = 1;
+        return slot;
+    }
+
+    void Rehash(unsigned newSize)
+    {
+        assert((newSize & (newSize - 1)) == 0);
+        index_.Resize(newSize);
+        for (unsigned i = 0; i < newSize; ++i)
+            index_[i] = 0;
+        shift_ = 32;
+        for (unsigned i = newSize; i > 1; i >>= 1)
+            --shift_;
+
+        const unsigned mask = newSize - 1;
+        for (unsigned slot = 0; slot < numSlots_; ++slot)
+        {
+            if (!used_[slot])
+                continue;
+            unsigned pos = Bucket(EntryAt(slot).first_);
+            while (index_[pos])
+                pos = (pos + 1) & mask;
+            index_[pos] = slot + 1;
+        }
+    }
+
+    SyncStateMap(const SyncStateMap &);
+    SyncStateMap &operator =(const SyncStateMap &);
+
+    Urho3D::PODVector<Entry*> pages_; ///< Slot pages. Never reallocated, which keeps the state addresses stable.
+    Urho3D::PODVector<unsigned> index_; ///< Open addressing table of slot numbers + 1, zero for an empty position. Size is a power of two.
+    Urho3D::PODVector<u8> used_; ///< Whether each slot holds a state.
+    Urho3D::PODVector<unsigned> freeSlots_; ///< Erased slots available for reuse.
+    unsigned numSlots_; ///< High water mark of allocated slots.
+    unsigned size_; ///< Number of states.
+    unsigned shift_; ///< Right shift of the hashed key that leaves the index bits.
+};
+
+/// Small map of per-user sync states by ID, stored contiguously and searched linearly.
+/** Meant for the few components of an entity, for which a single contiguous array is both smaller and faster than a tree or a hash table.
+    Erasing moves the last state into the erased position, so pointers to the states are invalidated by Erase and by growth.
+    @note The value type must be trivially copyable. */
+template <class K, class T> class SmallSyncStateMap
+{
+public:
+    struct Entry
+    {
+        K first_;
+        T second_;
+    };
+
+    typedef Entry *Iterator;
+    typedef const Entry *ConstIterator;
+
+    /// Returns the state of @c key, or End() if the key does not exist.
+    Iterator Find(const K &key)
+    {
+        for (Iterator i = Begin(); i != End(); ++i)
+            if (i->first_ == key)
+                return i;
+        return End();
+    }
+
+    ConstIterator Find(const K &key) const
+    {
+        for (ConstIterator i = Begin(); i != End(); ++i)
+            if (i->first_ == key)
+                return i;
+        return End();
+    }
+
+    /// Returns whether the map has a state for @c key.
+    bool Contains(const K &key) const { return Find(key) != End(); }
+
+    /// Returns the state of @c key, or inserts a default constructed state if the key does not exist.
+    T &operator [](const K &key)
+    {
+        Iterator i = Find(key);
+        if (i != End())
+            return i->second_;
+        Entry entry;
+        entry.first_ = key;
+        entry.second_ = T();
+        entries_.Push(entry);
+        return entries_.Back().second_;
+    }
+
+    /// Erases the state of @c key. Returns false if the key did not exist.
+    bool Erase(const K &key)
+    {
+        Iterator i = Find(key);
+        if (i == End())
+            return false;
+        *i = entries_.Back();
+        entries_.Pop();
+        return true;
+    }
+
+    void Clear() { entries_.Clear(); }
+
+    Iterator Begin() { return entries_.Buffer(); }
+    Iterator End() { return entries_.Buffer() + entries_.Size(); }
+    ConstIterator Begin() const { return entries_.Buffer(); }
+    ConstIterator End() const { return entries_.Buffer() + entries_.Size(); }
+
+    unsigned Size() const { return entries_.Size(); }
+    bool Empty() const { return entries_.Empty(); }
+
+    /// Returns the number of bytes allocated by the map.
+    size_t MemoryUse() const { return entries_.Capacity() * sizeof(Entry); }
+
+private:
+    Urho3D::PODVector<Entry> entries_;
+};
+
+}
@@ -6,12 +6,14 @@
 #include "SyncManager.h"
 #include "Client.h"
 #include "Server.h"
+#include "LoadTest.h"
 #include "Framework.h"
 #include "FrameAPI.h"
 #include "ConsoleAPI.h"
 #include "IRenderer.h"
 #include "SceneAPI.h"
 #include "Scene/Scene.h"
+#include "Scene/SceneJournal.h"
 #include "LoggingFunctions.h"
 
 #include "AssetAPI.h"
@@ -49,6 +51,7 @@ void TundraLogic::Initialize()
     client_ = SharedPtr<Tundra::Client>(new Tundra::Client(this));
     server_ = SharedPtr<Tundra::Server>(new Tundra::Server(this));
     syncManager_ = SharedPtr<Tundra::SyncManager>(new Tundra::SyncManager(this)); // Syncmanager expects client (and server) to exist
+    loadTest_ = SharedPtr<Tundra::LoadTest>(new Tundra::LoadTest(this));
     
     framework->Console()->RegisterCommand("connect", "Connects to a server. Usage: connect(address,port,username,password,protocol)")->ExecutedWith.Connect(
         this, &TundraLogic::HandleLogin);
@@ -81,6 +84,7 @@ void TundraLogic::HandleLogin(const StringVector &params) const
 
 void TundraLogic::Uninitialize()
 {
+    loadTest_.Reset(); // Closes the bot connections, so must be released before the kNet network
     kristalliProtocol_->Uninitialize();
     kristalliProtocol_.Reset();
     syncManager_.Reset();
@@ -95,6 +99,10 @@ void TundraLogic::OnUpdate(float frametime)
     {
         LoadStartupScene();
         startupSceneLoaded = true;
+
+        LoadTestSettings loadTestSettings;
+        if (Tundra::LoadTest::ReadSettings(framework, loadTestSettings))
+            loadTest_->Start(loadTestSettings);
     }
 
     kristalliProtocol_->Update(frametime);
@@ -102,6 +110,8 @@ void TundraLogic::OnUpdate(float frametime)
         client_->Update(frametime);
     if (server_)
         server_->Update(frametime);
+    if (loadTest_)
+        loadTest_->Update(frametime);
     // Run scene sync
     if (syncManager_)
         syncManager_->Update(frametime);
@@ -118,6 +128,18 @@ void TundraLogic::LoadStartupScene()
     StringVector files = framework->CommandLineParameters("--file");
     if (hasFile && files.Empty())
         LogError("TundraLogicModule: --file specified without a value.");
+    if (files.Empty())
+        return;
+
+    // A scene restored by --sceneJournal already contains the startup content, loading it again would duplicate it
+    Scene *scene = framework->Scene()->MainCameraScene();
+    if (!scene)
+        scene = framework->Scene()->CreateScene("TundraServer", true, true).Get();
+    if (scene && scene->Journal() && scene->Journal()->IsRestored())
+    {
+        LogInfo("TundraLogicModule: Scene was restored from " + scene->Journal()->SnapshotPath() + ", not loading the startup scene.");
+        return;
+    }
 
     foreach(const String &file, files)
     {
@@ -186,6 +208,11 @@ ServerPtr TundraLogic::Server() const
     return server_;
 }
 
+SharedPtr<LoadTest> TundraLogic::LoadTest() const
+{
+    return loadTest_;
+}
+
 extern "C"
 {
 
@@ -38,6 +38,9 @@ public:
     /// Returns server pointer
     ServerPtr Server() const;
 
+    /// Returns the load test harness. It is running only if started with --loadtest.
+    SharedPtr<Tundra::LoadTest> LoadTest() const;
+
     /// For console command
     void HandleLogin(const StringVector &params) const;
 
@@ -68,6 +71,8 @@ private:
     ServerPtr server_;
     /// The kristalli protocol
     SharedPtr<Tundra::KristalliProtocol> kristalliProtocol_;
+    /// The load test harness
+    SharedPtr<Tundra::LoadTest> loadTest_;
 };
 
 }
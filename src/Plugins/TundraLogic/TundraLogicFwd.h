@@ -10,6 +10,8 @@ namespace Tundra
     class TundraLogic;
     class KristalliProtocol;
     class SyncManager;
+    class InterestManager;
+    class LoadTest;
     class Client;
     class Server;
     class UserConnection;
@@ -8,20 +8,60 @@
 #include "LoggingFunctions.h"
 #include "Client.h"
 
+#include <cstring>
+
 namespace Tundra
 {
 
 UserConnection::UserConnection(Object* owner) : 
     Object(owner->GetContext()),
     userID(0),
-    protocolVersion(ProtocolOriginal)
+    protocolVersion(ProtocolOriginal),
+    bytesQueued(0),
+    deferSends_(false)
 {}
 
 void UserConnection::Send(kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds, unsigned long priority, unsigned long contentID)
 {
+    bytesQueued += ds.BytesFilled();
+    if (deferSends_)
+    {
+        DeferredMessage msg;
+        msg.id = id;
+        msg.offset = deferredData_.Size();
+        msg.numBytes = (unsigned)ds.BytesFilled();
+        msg.reliable = reliable;
+        msg.inOrder = inOrder;
+        msg.priority = priority;
+        msg.contentID = contentID;
+        deferredMessages_.Push(msg);
+        if (msg.numBytes)
+        {
+            deferredData_.Resize(msg.offset + msg.numBytes);
+            memcpy(&deferredData_[msg.offset], ds.GetData(), msg.numBytes);
+        }
+        return;
+    }
     Send(id, ds.GetData(), ds.BytesFilled(), reliable, inOrder, priority, contentID);
 }
 
+void UserConnection::BeginDeferredSends()
+{
+    deferSends_ = true;
+}
+
+void UserConnection::FlushDeferredSends()
+{
+    deferSends_ = false;
+    for (unsigned i = 0; i < deferredMessages_.Size(); ++i)
+    {
+        const DeferredMessage &msg = deferredMessages_[i];
+        Send(msg.id, msg.numBytes ? &deferredData_[msg.offset] : 0, msg.numBytes, msg.reliable, msg.inOrder, msg.priority, msg.contentID);
+    }
+    deferredMessages_.Clear();
+    deferredData_.Clear();
+}
+
 void UserConnection::EmitNetworkMessageReceived(kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes)
 {
     NetworkMessageReceived.Emit(this, packetId, messageId, data, numBytes);
@@ -23,11 +23,13 @@ enum NetworkProtocolVersion
 {
     ProtocolOriginal = 0x1,         // Original
     ProtocolCustomComponents = 0x2, // Adds support for transmitting new static-structured component types without actual C++ implementation, using EC_PlaceholderComponent
-    ProtocolHierarchicScene = 0x3   // Adds support for hierarchic scene, ie. entities having child entities,
+    ProtocolHierarchicScene = 0x3,  // Adds support for hierarchic scene, ie. entities having child entities,
+    ProtocolCompactTransforms = 0x4, // Adds compact, unreliable Placeable transform updates with cRigidBodyUpdateMessage
+    ProtocolDeltaAttributes = 0x5    // Adds delta encoding of the attribute values in cEditAttributesMessage, see AttributeDelta.h
 };
 
 /// Highest supported protocol version in the build. Update this when a new protocol version is added
-const NetworkProtocolVersion cHighestSupportedProtocolVersion = ProtocolHierarchicScene;
+const NetworkProtocolVersion cHighestSupportedProtocolVersion = ProtocolDeltaAttributes;
 
 /// Represents a client connection on the server side. Subclassed by networking implementations.
 class TUNDRALOGIC_API UserConnection : public Object
@@ -56,6 +58,8 @@ public:
     NetworkProtocolVersion protocolVersion;
     /// Map of the unacked entity IDs a user has sent, and the real entity IDs they have been assigned
     std::map<u32, u32> unackedIdsToRealIds;
+    /// Total number of bytes queued for sending using the DataSerializer overload of Send. Used by SyncManager for bandwidth budgeting.
+    u64 bytesQueued;
 
     /// Queue a network message to be sent to the client. All implementations may not use the reliable, inOrder, priority and contentID parameters.
     virtual void Send(kNet::message_id_t id, const char* data, size_t numBytes, bool reliable, bool inOrder, unsigned long priority = 100, unsigned long contentID = 0) = 0;
@@ -63,6 +67,14 @@ public:
     /// Queue a network message to be sent to the client, with the data to be sent in a DataSerializer. All implementations may not use the reliable, inOrder, priority and contentID parameters.
     void Send(kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds, unsigned long priority = 100, unsigned long contentID = 0);
 
+    /// Starts collecting the messages queued with the DataSerializer overload of Send, instead of sending them immediately.
+    /** Used by SyncManager for serializing the sync state of the connection in a worker thread.
+        The messages are sent in their original order by FlushDeferredSends, which must be called from the main thread. */
+    void BeginDeferredSends();
+
+    /// Sends the messages collected since BeginDeferredSends in their original order and returns to sending messages immediately.
+    void FlushDeferredSends();
+
     /// Queue a typed network message to be sent to the client.
     template<typename SerializableMessage> void Send(const SerializableMessage &data)
     {
@@ -108,6 +120,26 @@ public:
     Signal4<UserConnection* ARG(connection), Entity* ARG(entity), const String& ARG(action), const StringVector& ARG(params)> ActionTriggered;
     /// Emitted when the client has sent a network message. PacketId will be 0 if not supported by the networking implementation.
     Signal5<UserConnection* ARG(connection), kNet::packet_id_t ARG(packetId), kNet::message_id_t ARG(messageId), const char* ARG(data), size_t ARG(numBytes)> NetworkMessageReceived;
+
+private:
+    /// Message collected while sends are deferred. The data is stored in deferredData_.
+    struct DeferredMessage
+    {
+        kNet::message_id_t id;
+        unsigned offset;
+        unsigned numBytes;
+        bool reliable;
+        bool inOrder;
+        unsigned long priority;
+        unsigned long contentID;
+    };
+
+    /// Whether messages are currently collected instead of sent.
+    bool deferSends_;
+    /// Collected messages in the order they were queued.
+    Urho3D::PODVector<DeferredMessage> deferredMessages_;
+    /// Data of the collected messages.
+    Urho3D::PODVector<char> deferredData_;
 };
 
 /// A kNet user connection.
@@ -34,6 +34,12 @@ bool IMaterialAsset::IsLoaded() const
     return material != nullptr;
 }
 
+uint IMaterialAsset::MemoryUsage() const
+{
+    // The textures of the material are assets of their own
+    return material ? material->GetMemoryUse() : 0;
+}
+
 Urho3D::Material* IMaterialAsset::UrhoMaterial() const
 {
     return material;
@@ -26,6 +26,9 @@ public:
     /// IAsset override.
     bool IsLoaded() const override;
 
+    /// IAsset override.
+    uint MemoryUsage() const override;
+
     /// Textures and the units they belong to.
     Vector<Pair<int, AssetReference> > textures_;
 
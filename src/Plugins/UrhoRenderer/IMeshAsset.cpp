@@ -9,6 +9,8 @@
 #include "IMeshAsset.h"
 
 #include <Engine/Graphics/Model.h>
+#include <Engine/Graphics/VertexBuffer.h>
+#include <Engine/Graphics/IndexBuffer.h>
 
 namespace Tundra
 {
@@ -38,6 +40,24 @@ bool IMeshAsset::IsLoaded() const
     return model != nullptr;
 }
 
+uint IMeshAsset::MemoryUsage() const
+{
+    if (!IsLoaded())
+        return 0;
+
+    // Meshes built in code do not report their memory use, so count the buffers. Shadowed buffers are also kept in CPU memory.
+    uint bytes = 0;
+    const Vector<SharedPtr<Urho3D::VertexBuffer> > &vertexBuffers = model->GetVertexBuffers();
+    for(uint i = 0; i < vertexBuffers.Size(); ++i)
+        if (vertexBuffers[i])
+            bytes += vertexBuffers[i]->GetVertexCount() * vertexBuffers[i]->GetVertexSize() * (vertexBuffers[i]->IsShadowed() ? 2 : 1);
+    const Vector<SharedPtr<Urho3D::IndexBuffer> > &indexBuffers = model->GetIndexBuffers();
+    for(uint i = 0; i < indexBuffers.Size(); ++i)
+        if (indexBuffers[i])
+            bytes += indexBuffers[i]->GetIndexCount() * indexBuffers[i]->GetIndexSize() * (indexBuffers[i]->IsShadowed() ? 2 : 1);
+    return Urho3D::Max(bytes, model->GetMemoryUse());
+}
+
 Urho3D::Model* IMeshAsset::UrhoModel() const
 {
     return model;
@@ -26,6 +26,9 @@ public:
     /// IAsset override.
     bool IsLoaded() const override;
 
+    /// IAsset override.
+    uint MemoryUsage() const override;
+
     /// Returns submesh count.
     uint NumSubmeshes() const;
 
@@ -89,6 +89,8 @@ public:
     /// IComponent override, implemented to support old TXML with the "Mesh materials" attribute instead of "materialRefs"/"Material refs".
     /// @todo 2014-10-17 This can be removed at some point when enough time has passed.
     void DeserializeFrom(Urho3D::XMLElement& element, AttributeChange::Type change) override;
+    /// IComponent override, the above is not default deserialization.
+    bool HasDefaultDeserialization() const override { return false; }
 
     /// Emitted before the mesh is about to be destroyed
     Signal0<void> MeshAboutToBeDestroyed;
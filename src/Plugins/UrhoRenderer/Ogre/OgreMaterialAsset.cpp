@@ -7,6 +7,7 @@
 #include "LoggingFunctions.h"
 #include "Framework.h"
 #include "AssetAPI.h"
+#include "AssetDecodeQueue.h"
 #include "TextureAsset.h"
 #include "UrhoRenderer.h"
 
@@ -23,35 +24,66 @@ OgreMaterialAsset::OgreMaterialAsset(AssetAPI *owner, const String &type_, const
 {
 }
 
-bool OgreMaterialAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*allowAsynchronous*/)
+namespace
+{
+    /// Parses the material script on a worker thread. The material is created on the main thread.
+    class OgreMaterialDecodeJob : public AssetDecodeJob
+    {
+    public:
+        bool Decode() override
+        {
+            if (parser.Parse((const char*)data.Buffer(), data.Size()))
+                return true;
+            error = "parse failed: " + parser.Error();
+            return false;
+        }
+
+        bool Finish(IAsset *asset) override
+        {
+            return static_cast<OgreMaterialAsset*>(asset)->CreateMaterial(parser);
+        }
+
+        Ogre::MaterialParser parser;
+    };
+}
+
+bool OgreMaterialAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous)
 {
     PROFILE(OgreMaterialAsset_LoadFromFileInMemory);
 
     /// Force an unload of previous data first.
     Unload();
 
+    if (allowAsynchronous && assetAPI->DecodeQueue()->IsEnabled())
+    {
+        assetAPI->DecodeQueue()->Decode(this, data_, numBytes, SharedPtr<AssetDecodeJob>(new OgreMaterialDecodeJob()));
+        return true;
+    }
+
     Ogre::MaterialParser parser;
     if (parser.Parse((const char*)data_, numBytes))
-    {
-        material = new Urho3D::Material(GetContext());
-        material->SetNumTechniques(1);
+        return CreateMaterial(parser);
 
-        UrhoRenderer* renderer = static_cast<UrhoRenderer*>(assetAPI->GetFramework()->Renderer());
-        IOgreMaterialProcessor* proc = renderer->FindOgreMaterialProcessor(parser);
-        if (proc)
-        {
-            proc->Convert(parser, this);
-            // Inform load has finished. Triggering any textures_ to be fetched.
-            assetAPI->AssetLoadCompleted(Name());
-            return true;
-        }
+    LogError("OgreMaterialAsset::DeserializeFromData: parse failed for " + Name() + ": " + parser.Error());
+    return false;
+}
+
+bool OgreMaterialAsset::CreateMaterial(const Ogre::MaterialParser &parser)
+{
+    material = new Urho3D::Material(GetContext());
+    material->SetNumTechniques(1);
 
-        LogError("OgreMaterialAsset::DeserializeFromData: no material processor found that could handle data in " + Name());
-        material.Reset();
-        return false;
+    UrhoRenderer* renderer = static_cast<UrhoRenderer*>(assetAPI->GetFramework()->Renderer());
+    IOgreMaterialProcessor* proc = renderer->FindOgreMaterialProcessor(parser);
+    if (proc)
+    {
+        proc->Convert(parser, this);
+        // Inform load has finished. Triggering any textures_ to be fetched.
+        assetAPI->AssetLoadCompleted(Name());
+        return true;
     }
 
-    LogError("OgreMaterialAsset::DeserializeFromData: parse failed for " + Name() + ": " + parser.Error());
+    LogError("OgreMaterialAsset::CreateMaterial: no material processor found that could handle data in " + Name());
     material.Reset();
     return false;
 }
@@ -19,6 +19,9 @@ public:
 
     /// IAsset override.
     bool DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous) override;
+    /// Creates the material from a parsed material script, and completes the load.
+    /** Called by DeserializeFromData, or on the main thread by the decode job queued by it when loading asynchronously. */
+    bool CreateMaterial(const Ogre::MaterialParser &parser);
     /// IAsset override.
     Vector<AssetReference> FindReferences() const override;
     /// IAsset override.
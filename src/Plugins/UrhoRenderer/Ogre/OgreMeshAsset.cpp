@@ -48,6 +48,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "LoggingFunctions.h"
 #include "OgreMeshAsset.h"
 #include "OgreMeshDefines.h"
+#include "AssetDecodeQueue.h"
 
 #include <Model.h>
 #include <Profiler.h>
@@ -70,13 +71,11 @@ const unsigned short    HEADER_CHUNK_ID         = 0x1000;
 
 const long              MSTREAM_OVERHEAD_SIZE   = sizeof(u16) + sizeof(uint);
 
-static u32 currentLength;
-
 void ReadMesh(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
 void ReadMeshLodInfo(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
 void ReadMeshSkeletonLink(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
 void ReadMeshBounds(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
-void ReadMeshExtremes(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
+void ReadMeshExtremes(Urho3D::Deserializer& stream, Ogre::Mesh *mesh, u32 chunkLength);
 void ReadSubMesh(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
 void ReadSubMeshNames(Urho3D::Deserializer& stream, Ogre::Mesh *mesh);
 void ReadSubMeshOperation(Urho3D::Deserializer& stream, SubMesh *submesh);
@@ -107,11 +106,16 @@ static String ReadLine(Urho3D::Deserializer& stream)
     return str;
 }
 
-static u16 ReadHeader(Urho3D::Deserializer& stream, bool readLength = true)
+/// Reads a chunk header. The chunk length is returned in @c length, if given. Keeps no state, so that meshes can be parsed on several threads.
+static u16 ReadHeader(Urho3D::Deserializer& stream, bool readLength = true, u32 *length = 0)
 {
     u16 id = stream.ReadUShort();
     if (readLength)
-        currentLength = stream.ReadUInt();
+    {
+        u32 chunkLength = stream.ReadUInt();
+        if (length)
+            *length = chunkLength;
+    }
 
     return id;
 }
@@ -132,7 +136,8 @@ void ReadMesh(Urho3D::Deserializer& stream, Ogre::Mesh *mesh)
 
     if (!stream.IsEof())
     {
-        u16 id = ReadHeader(stream);
+        u32 chunkLength = 0;
+        u16 id = ReadHeader(stream, true, &chunkLength);
         while (!stream.IsEof() &&
             (id == M_GEOMETRY ||
              id == M_SUBMESH ||
@@ -201,13 +206,13 @@ void ReadMesh(Urho3D::Deserializer& stream, Ogre::Mesh *mesh)
                 }
                 case M_TABLE_EXTREMES:
                 {
-                    ReadMeshExtremes(stream, mesh);
+                    ReadMeshExtremes(stream, mesh, chunkLength);
                     break;
                 }
             }
 
             if (!stream.IsEof())
-                id = ReadHeader(stream);
+                id = ReadHeader(stream, true, &chunkLength);
         }
         if (!stream.IsEof())
             RollbackHeader(stream);
@@ -278,10 +283,10 @@ void ReadMeshBounds(Urho3D::Deserializer& stream, Ogre::Mesh *mesh)
     SkipBytes(stream, sizeof(float));
 }
 
-void ReadMeshExtremes(Urho3D::Deserializer& stream, Ogre::Mesh * /*mesh*/)
+void ReadMeshExtremes(Urho3D::Deserializer& stream, Ogre::Mesh * /*mesh*/, u32 chunkLength)
 {
     // Skip extremes, not compatible with Assimp.
-    uint numBytes = currentLength - MSTREAM_OVERHEAD_SIZE; 
+    uint numBytes = chunkLength - MSTREAM_OVERHEAD_SIZE;
     SkipBytes(stream, numBytes);
 }
 
@@ -900,19 +905,16 @@ OgreMeshAsset::OgreMeshAsset(AssetAPI *owner, const String &type_, const String
 {
 }
 
-bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*allowAsynchronous*/)
+/// Parses an Ogre binary mesh. Only uses the data, so can be called on a worker thread.
+/** @return False if the data is not a valid mesh, in which case @c error tells why. */
+static bool ParseOgreMesh(const u8 *data, uint numBytes, Ogre::Mesh *mesh, String &error)
 {
-    PROFILE(OgreMeshAsset_LoadFromFileInMemory);
-
-    /// Force an unload of previous data first.
-    Unload();
-
-    Urho3D::MemoryBuffer buffer(data_, numBytes);
+    Urho3D::MemoryBuffer buffer(data, numBytes);
 
     u16 id = ReadHeader(buffer, false);
     if (id != HEADER_CHUNK_ID)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: Invalid Ogre Mesh file header in " + Name());
+        error = "Invalid Ogre Mesh file header";
         return false;
     }
 
@@ -921,7 +923,7 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*a
     /*
     if (version != MESH_VERSION_1_8)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: mesh version " + version + " not supported in " + Name());
+        error = "mesh version " + version + " not supported";
         return false;
     }
     */
@@ -929,21 +931,72 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*a
     id = ReadHeader(buffer);
     if (id != M_MESH)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: header was not followed by M_MESH chunk in " + Name());
+        error = "header was not followed by M_MESH chunk";
         return false;
     }
 
-    SharedPtr<Ogre::Mesh> mesh(new Ogre::Mesh());
     try
     {
         ReadMesh(buffer, mesh);
     }
     catch (std::exception& e)
     {
-        LogError("OgreMeshAsset::DeserializeFromData: " + String(e.what()));
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+    /// Parses the mesh on a worker thread. The Urho model is built on the main thread.
+    class OgreMeshDecodeJob : public AssetDecodeJob
+    {
+    public:
+        OgreMeshDecodeJob() : mesh(new Ogre::Mesh()) {}
+
+        bool Decode() override
+        {
+            return ParseOgreMesh(data.Buffer(), data.Size(), mesh, error);
+        }
+
+        bool Finish(IAsset *asset) override
+        {
+            return static_cast<OgreMeshAsset*>(asset)->CreateModel(mesh);
+        }
+
+        SharedPtr<Ogre::Mesh> mesh;
+    };
+}
+
+bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous)
+{
+    PROFILE(OgreMeshAsset_LoadFromFileInMemory);
+
+    /// Force an unload of previous data first.
+    Unload();
+
+    if (allowAsynchronous && assetAPI->DecodeQueue()->IsEnabled())
+    {
+        assetAPI->DecodeQueue()->Decode(this, data_, numBytes, SharedPtr<AssetDecodeJob>(new OgreMeshDecodeJob()));
+        return true;
+    }
+
+    SharedPtr<Ogre::Mesh> mesh(new Ogre::Mesh());
+    String error;
+    if (!ParseOgreMesh(data_, numBytes, mesh, error))
+    {
+        LogError("OgreMeshAsset::DeserializeFromData: " + error + " in " + Name());
         return false;
     }
 
+    return CreateModel(mesh);
+}
+
+bool OgreMeshAsset::CreateModel(Ogre::Mesh *mesh)
+{
+    PROFILE(OgreMeshAsset_CreateModel);
+
     model = new Urho3D::Model(GetContext());
     uint subMeshCount = mesh->NumSubMeshes();
     model->SetNumGeometries(subMeshCount);
@@ -956,7 +1009,7 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*a
         Ogre::SubMesh* subMesh = mesh->subMeshes[i];
         if (!subMesh->indexData)
         {
-            LogWarning("OgreMeshAsset::DeserializeFromData: missing index data on submesh " + String(i) + " in " + Name());
+            LogWarning("OgreMeshAsset::CreateModel: missing index data on submesh " + String(i) + " in " + Name());
             continue;
         }
 
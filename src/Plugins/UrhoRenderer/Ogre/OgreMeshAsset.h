@@ -20,6 +20,10 @@ public:
 
     /// Load mesh from memory. IAsset override.
     bool DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous) override;
+
+    /// Builds the Urho model from a parsed Ogre mesh, and completes the load.
+    /** Called by DeserializeFromData, or on the main thread by the decode job queued by it when loading asynchronously. */
+    bool CreateModel(Ogre::Mesh *mesh);
 };
 
 }
@@ -7,6 +7,7 @@
 #include "Profiler.h"
 #include "LoggingFunctions.h"
 #include "TextureAsset.h"
+#include "AssetDecodeQueue.h"
 
 #include <MemoryBuffer.h>
 #include <Texture2D.h>
@@ -25,29 +26,75 @@ TextureAsset::~TextureAsset()
     Unload();
 }
 
-bool TextureAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*allowAsynchronous*/)
+namespace
 {
-    PROFILE(TextureAsset_LoadFromFileInMemory);
+    /// Decodes the image on a worker thread. The texture is created on the main thread.
+    class TextureDecodeJob : public AssetDecodeJob
+    {
+    public:
+        explicit TextureDecodeJob(Urho3D::Texture2D *texture_) : texture(texture_) {}
+
+        bool Decode() override
+        {
+            Urho3D::MemoryBuffer imageBuffer(data.Buffer(), data.Size());
+            if (texture->BeginLoad(imageBuffer))
+                return true;
+            error = "Failed to decode image";
+            return false;
+        }
+
+        bool Finish(IAsset *asset) override
+        {
+            return static_cast<TextureAsset*>(asset)->FinishLoad(texture);
+        }
+
+        SharedPtr<Urho3D::Texture2D> texture;
+    };
+}
 
-    bool success = false;
+bool TextureAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous)
+{
+    PROFILE(TextureAsset_LoadFromFileInMemory);
 
     /// Force an unload of previous data first.
     Unload();
     
+    SharedPtr<Urho3D::Texture2D> newTexture(new Urho3D::Texture2D(GetContext()));
+    if (allowAsynchronous && assetAPI->DecodeQueue()->IsEnabled())
+    {
+        newTexture->SetAsyncLoadState(Urho3D::ASYNC_LOADING);
+        assetAPI->DecodeQueue()->Decode(this, data_, numBytes, SharedPtr<AssetDecodeJob>(new TextureDecodeJob(newTexture)));
+        return true;
+    }
+
     Urho3D::MemoryBuffer imageBuffer(data_, numBytes);
-    
-    texture = new Urho3D::Texture2D(GetContext());
-    if (texture->Load(imageBuffer))
+    if (newTexture->Load(imageBuffer))
     {
+        texture = newTexture;
         assetAPI->AssetLoadCompleted(Name());
-        success = true;
-    } else
+        return true;
+    }
+
+    LogError("TextureAsset::DeserializeFromData: Failed to load texture asset " + Name());
+    return false;
+}
+
+bool TextureAsset::FinishLoad(Urho3D::Texture2D *decodedTexture)
+{
+    PROFILE(TextureAsset_FinishLoad);
+
+    // Create the GPU texture from the image decoded on a worker thread
+    bool success = decodedTexture->EndLoad();
+    decodedTexture->SetAsyncLoadState(Urho3D::ASYNC_DONE);
+    if (!success)
     {
-        LogError("TextureAsset::DeserializeFromData: Failed to load texture asset " + Name());
-        texture.Reset();
+        LogError("TextureAsset::FinishLoad: Failed to load texture asset " + Name());
+        return false;
     }
 
-    return success;
+    texture = decodedTexture;
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
 }
 
 void TextureAsset::DoUnload()
@@ -60,6 +107,16 @@ bool TextureAsset::IsLoaded() const
     return texture != nullptr;
 }
 
+uint TextureAsset::MemoryUsage() const
+{
+    if (!IsLoaded())
+        return 0;
+    // Textures created without image data do not report their memory use
+    if (texture->GetMemoryUse() > 0)
+        return texture->GetMemoryUse();
+    return texture->GetDataSize(texture->GetWidth(), texture->GetHeight());
+}
+
 Urho3D::Texture2D* TextureAsset::UrhoTexture() const
 {
     return texture;
@@ -25,6 +25,13 @@ public:
     /// IAsset override.
     bool IsLoaded() const override;
 
+    /// IAsset override.
+    uint MemoryUsage() const override;
+
+    /// Finishes an asynchronous load by creating the GPU texture from a texture whose image has been decoded with BeginLoad.
+    /** Called on the main thread by the decode job queued by DeserializeFromData. */
+    bool FinishLoad(Urho3D::Texture2D *decodedTexture);
+
     /// Returns Urho3D texture
     Urho3D::Texture2D* UrhoTexture() const;
 
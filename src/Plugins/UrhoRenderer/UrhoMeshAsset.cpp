@@ -7,6 +7,7 @@
 #include "Profiler.h"
 #include "LoggingFunctions.h"
 #include "UrhoMeshAsset.h"
+#include "AssetDecodeQueue.h"
 
 #include <Model.h>
 #include <Profiler.h>
@@ -20,26 +21,76 @@ UrhoMeshAsset::UrhoMeshAsset(AssetAPI *owner, const String &type_, const String
 {
 }
 
-bool UrhoMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool /*allowAsynchronous*/)
+namespace
+{
+    /// Reads the vertex and index data on a worker thread. The GPU buffers are created on the main thread.
+    class UrhoMeshDecodeJob : public AssetDecodeJob
+    {
+    public:
+        explicit UrhoMeshDecodeJob(Urho3D::Model *model_) : model(model_) {}
+
+        bool Decode() override
+        {
+            Urho3D::MemoryBuffer buffer(data.Buffer(), data.Size());
+            if (model->BeginLoad(buffer))
+                return true;
+            error = "Failed to read Urho format model";
+            return false;
+        }
+
+        bool Finish(IAsset *asset) override
+        {
+            return static_cast<UrhoMeshAsset*>(asset)->FinishLoad(model);
+        }
+
+        SharedPtr<Urho3D::Model> model;
+    };
+}
+
+bool UrhoMeshAsset::DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous)
 {
     PROFILE(UrhoMeshAsset_LoadFromFileInMemory);
 
     /// Force an unload of previous data first.
     Unload();
 
+    SharedPtr<Urho3D::Model> newModel(new Urho3D::Model(GetContext()));
+    if (allowAsynchronous && assetAPI->DecodeQueue()->IsEnabled())
+    {
+        newModel->SetAsyncLoadState(Urho3D::ASYNC_LOADING);
+        assetAPI->DecodeQueue()->Decode(this, data_, numBytes, SharedPtr<AssetDecodeJob>(new UrhoMeshDecodeJob(newModel)));
+        return true;
+    }
+
     Urho3D::MemoryBuffer buffer(data_, numBytes);
-    model = new Urho3D::Model(GetContext());
-    if (model->Load(buffer))
+    if (newModel->Load(buffer))
     {
+        model = newModel;
         assetAPI->AssetLoadCompleted(Name());
         return true;
     }
     else
     {
         LogError("MeshAsset::DeserializeFromData: Failed to load Urho format asset " + Name());
-        model.Reset();
         return false;
     }
 }
 
+bool UrhoMeshAsset::FinishLoad(Urho3D::Model *decodedModel)
+{
+    PROFILE(UrhoMeshAsset_FinishLoad);
+
+    bool success = decodedModel->EndLoad();
+    decodedModel->SetAsyncLoadState(Urho3D::ASYNC_DONE);
+    if (!success)
+    {
+        LogError("MeshAsset::FinishLoad: Failed to load Urho format asset " + Name());
+        return false;
+    }
+
+    model = decodedModel;
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
+}
+
 }
@@ -20,6 +20,10 @@ public:
 
     /// Load mesh from memory. IAsset override.
     bool DeserializeFromData(const u8 *data_, uint numBytes, bool allowAsynchronous) override;
+
+    /// Finishes an asynchronous load by creating the GPU buffers of a model whose data has been read with BeginLoad.
+    /** Called on the main thread by the decode job queued by DeserializeFromData. */
+    bool FinishLoad(Urho3D::Model *decodedModel);
 };
 
 }
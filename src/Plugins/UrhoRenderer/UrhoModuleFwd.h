@@ -31,5 +31,6 @@ namespace Tundra
     namespace Ogre
     {
         class MaterialParser;
+        class Mesh;
     }
 }
@@ -16,6 +16,8 @@
 #include "NullAssetFactory.h"
 #include "LocalAssetProvider.h"
 #include "AssetCache.h"
+#include "AssetCachePack.h"
+#include "AssetDecodeQueue.h"
 
 #include "Framework.h"
 #include "LoggingFunctions.h"
@@ -27,6 +29,8 @@
 #include <FileSystem.h>
 #include <File.h>
 #include <FileWatcher.h>
+#include <MathDefs.h>
+#include <Sort.h>
 
 namespace Tundra
 {
@@ -35,8 +39,12 @@ AssetAPI::AssetAPI(Framework *framework, bool headless) :
     Object(framework->GetContext()),
     fw(framework),
     isHeadless(headless),
-    assetCache(0)
+    assetCache(0),
+    memoryBudget(0),
+    memoryBudgetTimer(0.f)
 {
+    decodeQueue = new AssetDecodeQueue(this);
+
     AssetProviderPtr local(new LocalAssetProvider(fw));
     RegisterAssetProvider(local);
 
@@ -55,6 +63,10 @@ AssetAPI::AssetAPI(Framework *framework, bool headless) :
         LogWarning("--no_async_asset_load: this format of the command-line parameter is deprecated and support for it will be removed. Use --noAsyncAssetLoad instead.");
     if (fw->HasCommandLineParameter("--clear-asset-cache"))
         LogWarning("--clear-asset-cache: this format of the command-line parameter is deprecated and support for it will be removed. Use --clearAssetCache instead.");
+
+    StringVector budget = fw->CommandLineParameters("--assetMemoryBudget");
+    if (!budget.Empty())
+        SetMemoryBudget((unsigned long long)Urho3D::ToUInt(budget.Front()) * 1024 * 1024);
 }
 
 AssetAPI::~AssetAPI()
@@ -69,6 +81,85 @@ void AssetAPI::OpenAssetCache(String directory)
     assetCache = new AssetCache(this, directory);
 }
 
+unsigned long long AssetAPI::MemoryUsage() const
+{
+    unsigned long long usage = 0;
+    for(AssetMap::const_iterator iter = assets.begin(); iter != assets.end(); ++iter)
+        if (iter->second->IsLoaded())
+            usage += iter->second->MemoryUsage();
+    return usage;
+}
+
+void AssetAPI::SetMemoryBudget(unsigned long long bytes)
+{
+    memoryBudget = bytes;
+    if (memoryBudget > 0)
+        EnforceMemoryBudget();
+}
+
+static bool LeastRecentlyUsed(const Pair<uint, IAsset*> &lhs, const Pair<uint, IAsset*> &rhs)
+{
+    return lhs.first_ < rhs.first_;
+}
+
+uint AssetAPI::EnforceMemoryBudget()
+{
+    if (memoryBudget == 0)
+        return 0;
+
+    PROFILE(AssetAPI_EnforceMemoryBudget);
+
+    unsigned long long usage = 0;
+    PODVector<Pair<uint, IAsset*> > candidates;
+    for(AssetMap::iterator iter = assets.begin(); iter != assets.end(); ++iter)
+    {
+        IAsset *asset = iter->second.Get();
+        if (!asset->IsLoaded())
+            continue;
+        const uint bytes = asset->MemoryUsage();
+        usage += bytes;
+
+        // Only unload assets that nothing else holds, and that can be reloaded as they were.
+        if (bytes == 0 || iter->second.Refs() > 1 || asset->NumRefListeners() > 0 || asset->IsModified())
+            continue;
+        if (asset->DiskSourceType() != IAsset::Original && asset->DiskSourceType() != IAsset::Cached)
+            continue;
+        if (asset->DiskSource().Empty() && !(assetCache && assetCache->IsPacked(asset->Name())))
+            continue;
+        candidates.Push(MakePair(asset->LastUsed(), asset));
+    }
+    if (usage <= memoryBudget)
+        return 0;
+
+    Urho3D::Sort(candidates.Begin(), candidates.End(), LeastRecentlyUsed);
+
+    uint numUnloaded = 0;
+    for(uint i = 0; i < candidates.Size() && usage > memoryBudget; ++i)
+    {
+        IAsset *asset = candidates[i].second_;
+        // A loaded dependent, such as a material of a texture, still uses the asset.
+        bool hasLoadedDependents = false;
+        Vector<AssetPtr> dependents = FindDependents(asset->Name());
+        for(uint j = 0; j < dependents.Size() && !hasLoadedDependents; ++j)
+            hasLoadedDependents = dependents[j]->IsLoaded();
+        if (hasLoadedDependents)
+            continue;
+
+        const uint bytes = asset->MemoryUsage();
+        unloadedByBudget.Insert(asset->Name().ToLower());
+        asset->Unload();
+        usage -= Urho3D::Min((unsigned long long)bytes, usage);
+        ++numUnloaded;
+    }
+
+    if (numUnloaded > 0)
+        LogDebug("AssetAPI::EnforceMemoryBudget: Unloaded " + String(numUnloaded) + " assets, " + String((uint)(usage / 1024)) + " KB in use.");
+    if (usage > memoryBudget)
+        LogDebug("AssetAPI::EnforceMemoryBudget: " + String((uint)(usage / 1024)) + " KB in use exceeds the budget of " +
+            String((uint)(memoryBudget / 1024)) + " KB, the rest of the assets are in use.");
+    return numUnloaded;
+}
+
 Vector<AssetProviderPtr> AssetAPI::AssetProviders() const
 {
     return providers;
@@ -493,6 +584,8 @@ bool AssetAPI::ForgetAsset(AssetPtr asset, bool removeDiskSource)
             assetCache->DeleteAsset(asset->Name());
         asset->SetDiskSource("");
     }
+    else if (removeDiskSource && assetCache && assetCache->IsPacked(asset->Name()))
+        assetCache->DeleteAsset(asset->Name()); // Packed to the asset cache, so there is no disk source
 
     // Do an explicit unload of the asset before deletion (the dtor of each asset has to do unload as well, but this handles the cases where
     // some object left a dangling strong ref to an asset).
@@ -512,6 +605,10 @@ bool AssetAPI::ForgetAsset(AssetPtr asset, bool removeDiskSource)
     }
 
     assets.erase(iter);
+    unloadedByBudget.Erase(asset->Name().ToLower());
+
+    // Forget the dependencies of the asset, and make its dependents see it as missing.
+    RemoveAssetDependencies(asset->Name());
     return true;
 }
 
@@ -720,6 +817,8 @@ void AssetAPI::ForgetAllAssets()
 
 void AssetAPI::Reset()
 {
+    if (decodeQueue)
+        decodeQueue->Clear();
     ForgetAllAssets();
     assetCache.Reset();
     assets.clear();
@@ -731,7 +830,9 @@ void AssetAPI::Reset()
     defaultStorage.Reset();
     readyTransfers.Clear();
     readySubTransfers.Clear();
-    assetDependencies.Clear();
+    dependencyGraph.Clear();
+    updatingDependencyNodes.Clear();
+    unloadedByBudget.Clear();
     currentUploadTransfers.clear();
     currentTransfers.clear();
     providers.Clear();
@@ -801,6 +902,9 @@ AssetTransferPtr AssetAPI::RequestAsset(String assetRef, String assetType, bool
     if (ongoingTransferIter != currentTransfers.end())
     {
         AssetTransferPtr transfer = ongoingTransferIter->second;
+        // Someone needs the asset now, so a transfer started with a low priority, such as a prefetch, should not wait anymore.
+        if (transfer->Priority() < 0)
+            transfer->SetPriority(0);
         if (forceTransfer && dynamic_cast<VirtualAssetTransfer*>(transfer.Get()))
         {
             // If forceTransfer is on, but the transfer is virtual, log error. This case can not be currently handled properly.
@@ -872,6 +976,13 @@ AssetTransferPtr AssetAPI::RequestAsset(String assetRef, String assetType, bool
     // Whenever the client requests an asset that was loaded before, we create a request for that asset nevertheless.
     // The idea is to have the code path run the same independent of whether the asset existed or had to be downloaded, i.e.
     // a request is always made, and the receiver writes only a single asynchronous code path for handling the asset.
+    // An asset unloaded by the memory budget is reloaded from its disk source when it is requested again.
+    if (existingAsset && !existingAsset->IsLoaded() && !forceTransfer && unloadedByBudget.Erase(existingAsset->Name().ToLower()))
+    {
+        if (!existingAsset->LoadFromCache())
+            LogWarning("AssetAPI::RequestAsset: Failed to reload asset \"" + existingAsset->Name() + "\" from its disk source, requesting it from its storage.");
+    }
+
     /// @todo Evaluate whether existing->IsLoaded() should rather be existing->IsEmpty().
     if (existingAsset && existingAsset->IsLoaded() && !forceTransfer)
     {
@@ -1266,6 +1377,11 @@ AssetPtr AssetAPI::CreateNewAsset(String type, String name, AssetStoragePtr stor
     // Remember this asset in the global AssetAPI storage.
     assets[name] = asset;
 
+    // Keep the dependency graph up to date with the load state of the asset, also when it is not loaded through a transfer.
+    asset->Loaded.Connect(this, &AssetAPI::OnAssetLoaded);
+    asset->Unloaded.Connect(this, &AssetAPI::OnAssetStatusChanged);
+    asset->PropertyStatusChanged.Connect(this, &AssetAPI::OnAssetStatusChanged);
+
     ///\bug DiskSource and DiskSourceType are not set yet.
     {
         PROFILE(AssetAPI_CreateNewAsset_emit_AssetCreated);
@@ -1465,6 +1581,20 @@ void AssetAPI::Update(float frametime)
     for(uint i = 0; i < providers.Size(); ++i)
         providers[i]->Update(frametime);
 
+    // Finish the asynchronous loads that have been decoded on the worker threads
+    decodeQueue->Update();
+
+    if (assetCache)
+        assetCache->Update();
+
+    // Checking the budget walks all the assets, so do not do it every frame
+    memoryBudgetTimer += frametime;
+    if (memoryBudget > 0 && memoryBudgetTimer >= 1.f)
+    {
+        memoryBudgetTimer = 0.f;
+        EnforceMemoryBudget();
+    }
+
     // Proceed with ready transfers.
     if (readyTransfers.Size() > 0)
     {
@@ -1674,7 +1804,8 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         // Save this asset to cache, and find out which file will represent a cached version of this asset.
         String assetDiskSource = transfer->DiskSource(); // The asset provider may have specified an explicit filename to use as a disk source.
         if (transfer->CachingAllowed() && transfer->rawAssetData.Size() > 0 && assetCache)
-            assetDiskSource = assetCache->StoreAsset(&transfer->rawAssetData[0], transfer->rawAssetData.Size(), transfer->source.ref);
+            assetDiskSource = assetCache->StoreAsset(&transfer->rawAssetData[0], transfer->rawAssetData.Size(), transfer->source.ref,
+                !transfer->asset->RequiresDiskSource());
 
         // If disksource is still empty, forcibly look up if the asset exists in the cache now.
         if (assetDiskSource.Empty() && assetCache)
@@ -1692,7 +1823,14 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         bool success = false;
         const u8 *data = (transfer->rawAssetData.Size() > 0 ? &transfer->rawAssetData[0] : 0);
         if (data)
-            success = transfer->asset->LoadFromFileInMemory(data, transfer->rawAssetData.Size());
+            success = transfer->asset->LoadFromFileInMemory(data, transfer->rawAssetData.Size(), true, transfer.Get());
+        else if (transfer->cachedAssetData)
+        {
+            // Served from the asset cache, load straight from the mapped cache file
+            success = transfer->asset->LoadFromFileInMemory(transfer->cachedAssetData->Data(), transfer->cachedAssetData->Size(), true,
+                transfer->cachedAssetData.Get());
+            transfer->cachedAssetData.Reset();
+        }
         else
             success = transfer->asset->LoadFromFile(transfer->asset->DiskSource());
 
@@ -1787,6 +1925,8 @@ void AssetAPI::AssetLoadCompleted(const String assetRef)
 
     if (asset.Get())
     {
+        // The references of the asset may have changed with the load
+        NotifyAssetDependenciesChanged(asset);
         asset->LoadCompleted();
 
         // Add to watch this path for changed, note this does nothing if the path is already added
@@ -1921,24 +2061,39 @@ void AssetAPI::AssetDependenciesCompleted(AssetTransferPtr transfer)
         pendingDownloadRequests.erase(downloadIter);
 }
 
+/// Returns what an asset adds to the pending dependencies of each asset that refers to it.
+static int DependencyContribution(const IAsset *asset, int numPending)
+{
+    // If asset is empty, count it as an unloaded dependency
+    if (!asset || asset->IsEmpty())
+        return 1;
+    // We want all of the assets down the chain to be loaded before we load the base asset
+    return (asset->IsLoaded() ? 0 : 1) + numPending;
+}
+
 void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
 {
     PROFILE(AssetAPI_NotifyAssetDependenciesChanged);
 
-    /// Delete all old stored asset dependencies for this asset.
-    RemoveAssetDependencies(asset->Name());
-
+    const String key = asset->Name().ToLower();
+    Vector<String> dependencyRefs;
     Vector<AssetReference> refs = asset->FindReferences();
     for(uint i = 0; i < refs.Size(); ++i)
     {
-        // Turn named storage (and default storage) specifiers to absolute specifiers.
-        String ref = refs[i].ref;
-        if (ref.Empty())
+        if (refs[i].ref.Empty())
             continue;
 
-        // Remember this assetref for future lookup.
-        assetDependencies.Push(MakePair(asset->Name(), ref));
+        // We silently ignore this dependency if the asset type in question is disabled.
+        if (dynamic_cast<NullAssetFactory*>(AssetTypeFactory(ResourceTypeForAssetRef(refs[i])).Get()))
+            continue;
+
+        dependencyRefs.Push(refs[i].ref);
     }
+
+    SetAssetDependencies(key, asset->Name(), dependencyRefs);
+    // The asset has typically just been (re)loaded, so update its own state as well.
+    UpdateDependencyNode(key);
+    PruneDependencyNode(key);
 }
 
 void AssetAPI::RequestAssetDependencies(AssetPtr asset)
@@ -1966,109 +2121,160 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
 void AssetAPI::RemoveAssetDependencies(String asset)
 {
     PROFILE(AssetAPI_RemoveAssetDependencies);
-    for(uint i = 0; i < assetDependencies.Size(); ++i)
-        if (String::Compare(assetDependencies[i].first_.CString(), asset.CString(), false) == 0)
-        {
-            assetDependencies.Erase(assetDependencies.Begin() + i);
-            --i;
-        }
+
+    const String key = asset.ToLower();
+    if (!dependencyGraph.Contains(key))
+        return;
+    SetAssetDependencies(key, asset, Vector<String>());
+    UpdateDependencyNode(key);
+    PruneDependencyNode(key);
 }
 
-Vector<AssetPtr> AssetAPI::FindDependents(String dependee)
+String AssetAPI::DependencyKey(const String &assetRef) const
 {
-    PROFILE(AssetAPI_FindDependents);
+    // Same lookup as FindAsset: first an exact match, then the resolved ref.
+    AssetMap::const_iterator iter = assets.find(assetRef);
+    if (iter != assets.end())
+        return iter->second->Name().ToLower();
+    return ResolveAssetRef("", assetRef).ToLower();
+}
 
-    Vector<AssetPtr> dependents;
-    for(uint i = 0; i < assetDependencies.Size(); ++i)
+AssetAPI::DependencyNode &AssetAPI::GetDependencyNode(const String &key, const String &assetRef)
+{
+    DependencyGraph::Iterator iter = dependencyGraph.Find(key);
+    if (iter != dependencyGraph.End())
+        return iter->second_;
+
+    DependencyNode &node = dependencyGraph[key];
+    node.ref = assetRef;
+    AssetMap::const_iterator asset = assets.find(key);
+    node.contribution = DependencyContribution(asset != assets.end() ? asset->second.Get() : 0, 0);
+    return node;
+}
+
+void AssetAPI::SetAssetDependencies(const String &key, const String &assetRef, const Vector<String> &dependencyRefs)
+{
+    Vector<String> dependencies;
+    Vector<String> refs;
+    for(uint i = 0; i < dependencyRefs.Size(); ++i)
     {
-        if (String::Compare(assetDependencies[i].second_.CString(), dependee.CString(), false) == 0)
+        String dependencyKey = DependencyKey(dependencyRefs[i]);
+        if (dependencyKey != key) // An asset referring to itself would never complete
         {
-            AssetMap::iterator iter = assets.find(assetDependencies[i].first_);
-            if (iter != assets.end())
-                dependents.Push(iter->second);
+            dependencies.Push(dependencyKey);
+            refs.Push(dependencyRefs[i]);
         }
     }
-    return dependents;
-}
 
-int AssetAPI::NumPendingDependencies(AssetPtr asset) const
-{
-    PROFILE(AssetAPI_NumPendingDependencies);
-    int numDependencies = 0;
+    DependencyGraph::Iterator iter = dependencyGraph.Find(key);
+    if (iter != dependencyGraph.End() && iter->second_.dependencies == dependencies)
+        return;
+    if (iter == dependencyGraph.End() && dependencies.Empty())
+        return;
 
-    Vector<AssetReference> refs = asset->FindReferences();
-    for(uint i = 0; i < refs.Size(); ++i)
+    DependencyNode &node = GetDependencyNode(key, assetRef);
+    Vector<String> oldDependencies;
+    oldDependencies.Swap(node.dependencies);
+    for(uint i = 0; i < oldDependencies.Size(); ++i)
     {
-        String ref = refs[i].ref;
-        if (ref.Empty())
-            continue;
-
-        // We silently ignore this dependency if the asset type in question is disabled.
-        if (dynamic_cast<NullAssetFactory*>(AssetTypeFactory(ResourceTypeForAssetRef(refs[i])).Get()))
+        DependencyGraph::Iterator dependency = dependencyGraph.Find(oldDependencies[i]);
+        if (dependency == dependencyGraph.End())
             continue;
+        node.numPending -= dependency->second_.contribution;
+        HashMap<String, uint>::Iterator edge = dependency->second_.dependents.Find(key);
+        if (edge != dependency->second_.dependents.End() && --edge->second_ == 0)
+            dependency->second_.dependents.Erase(edge);
+    }
 
-        AssetPtr existing = FindAsset(refs[i].ref);
-        if (!existing)
-        {
-            // Not loaded, just mark the single one
-            ++numDependencies;
-        }
-        else
-        {
-            // If asset is empty, count it as an unloaded dependency
-            if (existing->IsEmpty())
-                ++numDependencies;
-            else
-            {
-                if (!existing->IsLoaded())
-                    ++numDependencies;
-                // Ask the dependencies of the dependency, we want all of the asset
-                // down the chain to be loaded before we load the base asset
-                // Note: if the dependency is unloaded, it may or may not be able to tell the dependencies correctly
-                numDependencies += NumPendingDependencies(existing);
-            }
-        }
+    for(uint i = 0; i < dependencies.Size(); ++i)
+    {
+        DependencyNode &dependency = GetDependencyNode(dependencies[i], refs[i]);
+        node.numPending += dependency.contribution;
+        ++dependency.dependents[key];
     }
+    node.dependencies = dependencies;
 
-    return numDependencies;
+    for(uint i = 0; i < oldDependencies.Size(); ++i)
+        PruneDependencyNode(oldDependencies[i]);
 }
 
-bool AssetAPI::HasPendingDependencies(AssetPtr asset) const
+void AssetAPI::UpdateDependencyNode(const String &key)
 {
-    PROFILE(AssetAPI_HasPendingDependencies);
+    DependencyGraph::Iterator iter = dependencyGraph.Find(key);
+    if (iter == dependencyGraph.End())
+        return;
 
-    Vector<AssetReference> refs = asset->FindReferences();
-    for(uint i = 0; i < refs.Size(); ++i)
+    DependencyNode &node = iter->second_;
+    AssetMap::const_iterator asset = assets.find(key);
+    const int contribution = DependencyContribution(asset != assets.end() ? asset->second.Get() : 0, node.numPending);
+    const int delta = contribution - node.contribution;
+    if (delta == 0)
+        return;
+    if (updatingDependencyNodes.Contains(key))
     {
-        if (refs[i].ref.Empty())
-            continue;
+        LogWarning("AssetAPI: Circular dependency through asset \"" + node.ref + "\", the assets in the cycle will not complete loading.");
+        return;
+    }
 
-        // We silently ignore this dependency if the asset type in question is disabled.
-        if (dynamic_cast<NullAssetFactory*>(AssetTypeFactory(ResourceTypeForAssetRef(refs[i])).Get()))
+    node.contribution = contribution;
+    updatingDependencyNodes.Insert(key);
+    for(HashMap<String, uint>::ConstIterator dependent = node.dependents.Begin(); dependent != node.dependents.End(); ++dependent)
+    {
+        DependencyGraph::Iterator dependentIter = dependencyGraph.Find(dependent->first_);
+        if (dependentIter == dependencyGraph.End())
             continue;
+        dependentIter->second_.numPending += delta * (int)dependent->second_;
+        UpdateDependencyNode(dependent->first_);
+    }
+    updatingDependencyNodes.Erase(key);
+}
 
-        AssetPtr existing = FindAsset(refs[i].ref);
-        if (!existing) // Not loaded, just mark the single one
-            return true;
-        else
-        {            
-            if (existing->IsEmpty())
-                return true; // If asset is empty, count it as an unloaded dependency
-            else
-            {
-                if (!existing->IsLoaded())
-                    return true;
-                // Ask the dependencies of the dependency, we want all of the asset
-                // down the chain to be loaded before we load the base asset
-                // Note: if the dependency is unloaded, it may or may not be able to tell the dependencies correctly
-                bool dependencyHasDependencies = HasPendingDependencies(existing);
-                if (dependencyHasDependencies)
-                    return true;
-            }
-        }
+void AssetAPI::PruneDependencyNode(const String &key)
+{
+    DependencyGraph::Iterator iter = dependencyGraph.Find(key);
+    if (iter != dependencyGraph.End() && iter->second_.dependencies.Empty() && iter->second_.dependents.Empty())
+        dependencyGraph.Erase(iter);
+}
+
+Vector<AssetPtr> AssetAPI::FindDependents(String dependee)
+{
+    PROFILE(AssetAPI_FindDependents);
+
+    Vector<AssetPtr> dependents;
+    DependencyGraph::ConstIterator node = dependencyGraph.Find(DependencyKey(dependee));
+    if (node == dependencyGraph.End())
+        return dependents;
+
+    for(HashMap<String, uint>::ConstIterator dependent = node->second_.dependents.Begin(); dependent != node->second_.dependents.End(); ++dependent)
+    {
+        AssetMap::iterator iter = assets.find(dependent->first_);
+        if (iter != assets.end())
+            dependents.Push(iter->second);
     }
+    return dependents;
+}
 
-    return false;
+int AssetAPI::NumPendingDependencies(AssetPtr asset) const
+{
+    DependencyGraph::ConstIterator node = dependencyGraph.Find(asset->Name().ToLower());
+    return node != dependencyGraph.End() ? Urho3D::Max(node->second_.numPending, 0) : 0;
+}
+
+bool AssetAPI::HasPendingDependencies(AssetPtr asset) const
+{
+    return NumPendingDependencies(asset) > 0;
+}
+
+AssetAPI::AssetDependenciesMap AssetAPI::DebugGetAssetDependencies() const
+{
+    AssetDependenciesMap dependencies;
+    for(DependencyGraph::ConstIterator iter = dependencyGraph.Begin(); iter != dependencyGraph.End(); ++iter)
+        for(uint i = 0; i < iter->second_.dependencies.Size(); ++i)
+        {
+            DependencyGraph::ConstIterator dependency = dependencyGraph.Find(iter->second_.dependencies[i]);
+            dependencies.Push(MakePair(iter->second_.ref, dependency != dependencyGraph.End() ? dependency->second_.ref : iter->second_.dependencies[i]));
+        }
+    return dependencies;
 }
 
 void AssetAPI::HandleAssetDiscovery(const String &assetRef, const String &assetType)
@@ -2149,6 +2355,9 @@ void AssetAPI::OnAssetLoaded(AssetPtr asset)
 {
     PROFILE(AssetAPI_OnAssetLoaded);
 
+    // Update the pending dependency counts of the dependents first
+    UpdateDependencyNode(asset->Name().ToLower());
+
     Vector<AssetPtr> dependents = FindDependents(asset->Name());
     for(uint i = 0; i < dependents.Size(); ++i)
     {
@@ -2168,6 +2377,11 @@ void AssetAPI::OnAssetLoaded(AssetPtr asset)
     }
 }
 
+void AssetAPI::OnAssetStatusChanged(IAsset *asset)
+{
+    UpdateDependencyNode(asset->Name().ToLower());
+}
+
 void AssetAPI::OnAssetDiskSourceChanged(const String &path)
 {
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
@@ -14,6 +14,8 @@
 #include "Signals.h"
 
 #include <Object.h>
+#include <HashMap.h>
+#include <HashSet.h>
 #include <map>
 
 namespace Tundra
@@ -90,6 +92,9 @@ public:
     /// Returns all the currently ongoing or waiting asset transfers.
     Vector<AssetTransferPtr> PendingTransfers() const;
 
+    /// Returns the queue for decoding asset data on the worker threads. Never null.
+    AssetDecodeQueue *DecodeQueue() const { return decodeQueue; }
+
     /// Performs internal tick-based updates of the whole asset system.
     /** This function is intended to be called only by the core, do not call it yourself. */
     void Update(float frametime);
@@ -119,6 +124,7 @@ public:
 
     void AssetDependenciesCompleted(AssetTransferPtr transfer);
 
+    /// Updates the dependency graph with the references the asset has now. Called whenever the asset has been (re)loaded.
     void NotifyAssetDependenciesChanged(AssetPtr asset);
 
     bool IsHeadless() const { return isHeadless; }
@@ -263,6 +269,22 @@ public:
     /// Returns the asset cache object that generates a disk source for all assets.
     AssetCache *Cache() const { return assetCache; }
 
+    /// Returns the estimated memory usage of the loaded assets in bytes. See IAsset::MemoryUsage.
+    unsigned long long MemoryUsage() const;
+
+    /// Returns the asset memory budget in bytes, or 0 if unlimited.
+    unsigned long long MemoryBudget() const { return memoryBudget; }
+
+    /// Sets the asset memory budget in bytes, 0 for unlimited.
+    /** When the loaded assets use more memory than the budget, the least recently used assets that no AssetRefListener
+        or loaded asset refers to are unloaded, if they can be reloaded from their disk source or the asset cache.
+        An asset unloaded this way is reloaded when it is requested again. Set in megabytes with --assetMemoryBudget. */
+    void SetMemoryBudget(unsigned long long bytes);
+
+    /// Unloads unused assets until the memory usage is within the budget. Called periodically by Update.
+    /** @return Number of assets unloaded. */
+    uint EnforceMemoryBudget();
+
     /// Returns the asset storage of the given name.
     /// @param name The name of the storage to get. Remember that Asset Storage names are case-insensitive.
     AssetStoragePtr AssetStorageByName(const String &name) const;
@@ -402,11 +424,10 @@ public:
     void RequestAssetDependencies(AssetPtr transfer);
 
     /// A utility function that counts the number of dependencies the given asset has to other assets that have not been loaded in.
+    /** Dependencies of the dependencies are counted as well. The count is maintained by the dependency graph, so this is O(1). */
     int NumPendingDependencies(AssetPtr asset) const;
 
     /// A utility function that returns true if the given asset still has some unloaded dependencies left to process.
-    /// @note For performance reasons, calling this function is highly advisable instead of calling NumPendingDependencies, if it is only
-    ///       desirable to known whether the asset has any pending dependencies or not.
     bool HasPendingDependencies(AssetPtr asset) const;
 
     /// Handle discovery of a new asset through the AssetDiscovery network message
@@ -427,8 +448,8 @@ public:
     /// A utility function that counts the number of current asset transfers.
     size_t NumCurrentTransfers() const { return currentTransfers.size(); }
     
-    /// Return the current asset dependency map (debugging)
-    const AssetDependenciesMap& DebugGetAssetDependencies() const { return assetDependencies; }
+    /// Return the current asset dependencies as (dependent, dependee) pairs (debugging)
+    AssetDependenciesMap DebugGetAssetDependencies() const;
     
     /// Return ready asset transfers (debugging)
     const Vector<AssetTransferPtr>& DebugGetReadyTransfers() const { return readyTransfers; }
@@ -471,6 +492,9 @@ private:
     /// The Asset API listens on each asset when they get loaded, to track the completion of the dependencies of other loaded assets.
     void OnAssetLoaded(AssetPtr asset);
 
+    /// Updates the asset in the dependency graph when it is unloaded or its disk source changes.
+    void OnAssetStatusChanged(IAsset *asset);
+
     /// The Asset API reloads all assets from file when their disk source contents change.
     void OnAssetDiskSourceChanged(const String &path);
 
@@ -495,9 +519,40 @@ private:
         Deletes the asset cache and the disk watcher. Called by Framework. */
     void Reset();
 
-    /// Removes from AssetDependenciesMap all dependencies the given asset has.
+    /// Removes from the dependency graph all dependencies the given asset has.
     void RemoveAssetDependencies(String asset);
 
+    /// A node of the asset dependency graph. There is a node for each asset that has dependencies or is depended on,
+    /// whether or not the asset exists.
+    struct DependencyNode
+    {
+        DependencyNode() : numPending(0), contribution(1) {}
+
+        /// The asset ref, as first seen.
+        String ref;
+        /// Keys of the assets this asset refers to, once per reference.
+        Vector<String> dependencies;
+        /// Keys of the assets that refer to this asset, with the number of references.
+        HashMap<String, uint> dependents;
+        /// NumPendingDependencies of this asset, the sum of the contributions of the dependencies.
+        int numPending;
+        /// What this asset adds to numPending of each dependent: 1 if it does not exist or is empty,
+        /// otherwise 1 if it is not loaded, plus numPending.
+        int contribution;
+    };
+    typedef HashMap<String, DependencyNode> DependencyGraph;
+
+    /// Returns the key of the graph node of an asset ref.
+    String DependencyKey(const String &assetRef) const;
+    /// Returns the graph node with @c key, creating it if it does not exist.
+    DependencyNode &GetDependencyNode(const String &key, const String &assetRef);
+    /// Replaces the dependencies of the node with @c key.
+    void SetAssetDependencies(const String &key, const String &assetRef, const Vector<String> &dependencyRefs);
+    /// Recomputes the contribution of the node with @c key from the current state of the asset, and propagates a change to the dependents.
+    void UpdateDependencyNode(const String &key);
+    /// Removes the node with @c key if it no longer has any edges.
+    void PruneDependencyNode(const String &key);
+
     /// Handle discovery of a new asset, when the storage is already known. This is used internally for optimization, so that providers don't need to be queried
     void HandleAssetDiscovery(const String &assetRef, const String &assetType, AssetStoragePtr storage);
     
@@ -522,9 +577,10 @@ private:
     /// Stores all the currently ongoing asset uploads, maps full assetRefs to the asset upload transfer structures.
     AssetUploadTransferMap currentUploadTransfers;
 
-    /// Keeps track of all the dependencies each asset has to each other asset.
-    /// \todo Find a more effective data structure for this. Needs something like boost::bimap but for multi-indices.
-    AssetDependenciesMap assetDependencies;
+    /// Keeps track of all the dependencies each asset has to each other asset, and the number of pending dependencies of each asset.
+    DependencyGraph dependencyGraph;
+    /// Nodes being updated by UpdateDependencyNode, to stop propagation around circular dependencies.
+    HashSet<String> updatingDependencyNodes;
 
     /// Stores a list of asset requests to assets that have already been downloaded into the system. These requests don't go to the asset providers
     /// to process, but are internally filled by the Asset API. This member vector is needed to be able to delay the requests and virtual completions
@@ -568,6 +624,14 @@ private:
 
     Framework *fw;
     SharedPtr<AssetCache> assetCache;
+    SharedPtr<AssetDecodeQueue> decodeQueue;
+
+    /// Asset memory budget in bytes, 0 for unlimited.
+    unsigned long long memoryBudget;
+    /// Time since the memory budget was last enforced.
+    float memoryBudgetTimer;
+    /// Names (lowercase) of the assets unloaded by the memory budget, which are reloaded when requested.
+    HashSet<String> unloadedByBudget;
 };
 
 }
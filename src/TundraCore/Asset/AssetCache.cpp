@@ -3,6 +3,7 @@
 #include "StableHeaders.h"
 
 #include "AssetCache.h"
+#include "AssetCachePack.h"
 #include "AssetAPI.h"
 #include "IAsset.h"
 
@@ -11,14 +12,83 @@
 #include "LoggingFunctions.h"
 
 #include <FileSystem.h>
+#include <File.h>
+#include <VectorBuffer.h>
+#include <MemoryBuffer.h>
+#include <Timer.h>
+#include <MathDefs.h>
+#include <Sort.h>
+#include <StringUtils.h>
+#include <Profiler.h>
+
+#include <cstring>
 
 namespace Tundra
 {
 
-AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) : 
+static const char * const cJournalFileId = "TACJ";
+static const uint cJournalVersion = 1;
+static const String cJournalName = "index.journal";
+static const String cDataDirectory = "data/";
+/// How often at most the last access time of an asset is written to the journal, in seconds.
+static const uint cAccessJournalInterval = 60;
+/// Largest asset that is packed. Larger assets gain little from packing.
+static const uint cMaxPackedSize = 1024 * 1024;
+/// Size after which a new pack is started.
+static const uint cMaxPackSize = 256 * 1024 * 1024;
+/// Bytes moved per Update when compacting a pack.
+static const uint cCompactionBytesPerUpdate = 4 * 1024 * 1024;
+
+/// Extension of the files downloads are streamed to before they are stored.
+static const String cStreamFileExtension = ".part";
+
+unsigned long long AssetCache::HashContent(const u8 *data, uint numBytes, unsigned long long hash)
+{
+    for (uint i = 0; i < numBytes; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Returns the name of the data file for content with @c hash. The extension of the asset ref is kept, as some assets are loaded by the file type.
+/** @param collision Number of different contents with the same hash and extension before this one. */
+static String DataFileName(unsigned long long hash, const String &assetRef, uint collision)
+{
+    String extension;
+    String ext = Urho3D::GetExtension(AssetAPI::ExtractFilenameFromAssetRef(assetRef));
+    for (uint i = 0; i < ext.Length() && i < 16; ++i)
+        if (IsAlpha(ext[i]) || IsDigit(ext[i]) || ext[i] == '.')
+            extension += ext[i];
+    String name = cDataDirectory + Urho3D::ToString("%08x%08x", (uint)(hash >> 32), (uint)(hash & 0xFFFFFFFF));
+    if (collision > 0)
+        name += "_" + String(collision);
+    return name + extension;
+}
+
+static String PackFileName(uint id)
+{
+    return cDataDirectory + Urho3D::ToString("%08u.pack", id);
+}
+
+/// Returns the key of packed data, used in place of the file name of data in a file of its own.
+static String PackedDataKey(uint pack, uint offset)
+{
+    return Urho3D::ToString("%u:%u", pack, offset);
+}
+
+AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) :
     Object(owner->GetContext()),
     assetAPI(owner),
-    cacheDirectory(GuaranteeTrailingSlash(Urho3D::GetInternalPath(assetCacheDirectory)))
+    cacheDirectory(GuaranteeTrailingSlash(Urho3D::GetInternalPath(assetCacheDirectory))),
+    totalSize(0),
+    sizeLimit(2048ULL * 1024 * 1024),
+    packingEnabled(owner->GetFramework()->HasCommandLineParameter("--assetCachePack")),
+    currentPack(0),
+    compactedPack(0),
+    numJournalRecords(0),
+    numStreamFiles(0)
 {
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
     if (!Urho3D::IsAbsolutePath(cacheDirectory))
@@ -27,6 +97,12 @@ AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) :
     // Check that the main directory exists
     if (!fileSystem->DirExists(cacheDirectory))
         fileSystem->CreateDir(cacheDirectory);
+    if (!fileSystem->DirExists(cacheDirectory + cDataDirectory))
+        fileSystem->CreateDir(cacheDirectory + cDataDirectory);
+
+    StringVector cacheSize = owner->GetFramework()->CommandLineParameters("--assetCacheSize");
+    if (!cacheSize.Empty())
+        sizeLimit = (unsigned long long)Urho3D::ToUInt(cacheSize.Front()) * 1024 * 1024;
 
     // Check --clearAssetCache start param
     if (owner->GetFramework()->HasCommandLineParameter("--clearAssetCache") ||
@@ -35,23 +111,62 @@ AssetCache::AssetCache(AssetAPI *owner, String assetCacheDirectory) :
         LogInfo("AssetCache: Removing all data and metadata files from cache, found 'clearAssetCache' from the startup params!");
         ClearAssetCache();
     }
+    else
+        OpenJournal();
+    OpenPacks();
+    DeleteUnreferencedFiles();
+
+    Evict();
+}
+
+AssetCache::~AssetCache()
+{
+    // Persist the last access times that have not been written yet, so that the eviction order survives restarts
+    for (EntryMap::Iterator iter = entries.Begin(); iter != entries.End(); ++iter)
+        if (iter->second_.lastAccess != iter->second_.journaledAccess)
+            AppendRecord(RecordAccess, iter->first_, &iter->second_);
 }
 
 String AssetCache::FindInCache(const String &assetRef)
 {
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    String absolutePath = DiskSourceByRef(assetRef);
-    if (fileSystem->FileExists(absolutePath))
-        return absolutePath;
-    else // The file is not in cache, return an empty string to denote that.
-        return "";
+    EntryMap::Iterator iter = entries.Find(assetRef);
+    if (iter == entries.End())
+        return ""; // The file is not in cache, return an empty string to denote that.
+    Touch(assetRef, iter->second_);
+    return iter->second_.pack == 0 ? cacheDirectory + iter->second_.file : String();
+}
+
+String AssetCache::DiskSourceByRef(const String &assetRef) const
+{
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() && iter->second_.pack == 0 ? cacheDirectory + iter->second_.file : String();
+}
+
+uint AssetCache::MaxPackedSize() const
+{
+    return packingEnabled ? cMaxPackedSize : 0;
 }
 
-String AssetCache::DiskSourceByRef(const String &assetRef)
+bool AssetCache::IsPacked(const String &assetRef) const
 {
-    // Return the path where the given asset ref would be stored, if it was saved in the cache
-    // (regardless of whether it now exists in the cache).
-    return cacheDirectory + AssetAPI::SanitateAssetRef(assetRef);
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() && iter->second_.pack != 0;
+}
+
+AssetCacheViewPtr AssetCache::View(const String &assetRef)
+{
+    EntryMap::Iterator iter = entries.Find(assetRef);
+    if (iter == entries.End())
+        return AssetCacheViewPtr();
+    Entry &entry = iter->second_;
+    Touch(assetRef, entry);
+
+    if (entry.pack != 0)
+        return Pack(entry.pack)->View(entry.offset, entry.size);
+    SharedPtr<MappedFile> file = MappedFile::Map(cacheDirectory + entry.file);
+    if (!file || file->Size() != entry.size)
+        return AssetCacheViewPtr();
+    return AssetCacheViewPtr(new AssetCacheView(file, 0, entry.size));
 }
 
 String AssetCache::CacheDirectory() const
@@ -63,52 +178,753 @@ String AssetCache::StoreAsset(AssetPtr asset)
 {
     Vector<u8> data;
     asset->SerializeTo(data);
-    return StoreAsset(&data[0], data.Size(), asset->Name());
+    return StoreAsset(&data[0], data.Size(), asset->Name(), !asset->RequiresDiskSource());
 }
 
-String AssetCache::StoreAsset(const u8 *data, uint numBytes, const String &assetName)
+String AssetCache::StoreAsset(const u8 *data, uint numBytes, const String &assetName, bool allowPacking)
 {
-    String absolutePath = DiskSourceByRef(assetName);
-    bool success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath);
-    if (success)
-        return absolutePath;
-    return "";
+    Entry stored;
+    stored.hash = HashContent(data, numBytes);
+    stored.size = numBytes;
+    const bool packed = allowPacking && numBytes > 0 && numBytes <= MaxPackedSize();
+    if (packed)
+    {
+        // Identical content of another asset ref is shared
+        HashMap<unsigned long long, String>::ConstIterator existing = packedContents.Find(stored.hash);
+        if (existing != packedContents.End() && PackedDataEquals(existing->second_, data, numBytes))
+        {
+            StringVector location = existing->second_.Split(':');
+            stored.file = existing->second_;
+            stored.pack = Urho3D::ToUInt(location[0]);
+            stored.offset = Urho3D::ToUInt(location[1]);
+        }
+    }
+    bool shared = false;
+    if (!packed)
+        stored.file = DataFile(data, numBytes, stored.hash, assetName, shared);
+
+    EntryMap::Iterator iter = entries.Find(assetName);
+    if (iter != entries.End() && iter->second_.hash == stored.hash && iter->second_.size == numBytes &&
+        (iter->second_.file == stored.file || (packed && iter->second_.pack != 0 && PackedDataEquals(iter->second_.file, data, numBytes))))
+    {
+        // Downloaded again with the same content, nothing to write
+        Touch(assetName, iter->second_);
+        return DiskSourceByRef(assetName);
+    }
+
+    if (packed && stored.file.Empty())
+    {
+        if (!AppendToPack(data, numBytes, stored))
+            return "";
+    }
+    // Identical content of another asset ref is shared
+    else if (!packed && !shared && !SaveAssetFromMemoryToFile(data, numBytes, cacheDirectory + stored.file))
+        return "";
+
+    return AddEntry(assetName, stored);
 }
 
-unsigned AssetCache::LastModified(const String &assetRef)
+String AssetCache::DataFile(const u8 *data, uint numBytes, unsigned long long hash, const String &assetName, bool &shared)
 {
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    String absolutePath = FindInCache(assetRef);
-    if (absolutePath.Empty())
-        return 0;
-    return fileSystem->GetLastModifiedTime(absolutePath);
+    for (uint collision = 0;; ++collision)
+    {
+        const String file = DataFileName(hash, assetName, collision);
+        shared = fileRefCounts.Contains(file);
+        if (!shared || FileDataEquals(file, data, numBytes))
+            return file;
+        LogWarning("AssetCache: Content of " + assetName + " differs from the cached content with the same hash, " + file + ".");
+    }
+}
+
+bool AssetCache::FileDataEquals(const String &file, const u8 *data, uint numBytes) const
+{
+    SharedPtr<MappedFile> mapped = MappedFile::Map(cacheDirectory + file);
+    if (!mapped)
+        return numBytes == 0; // Empty files can not be mapped
+    return mapped->Size() == numBytes && memcmp(mapped->Data(), data, numBytes) == 0;
+}
+
+bool AssetCache::PackedDataEquals(const String &key, const u8 *data, uint numBytes)
+{
+    StringVector location = key.Split(':');
+    if (location.Size() != 2)
+        return false;
+    AssetCacheViewPtr view = Pack(Urho3D::ToUInt(location[0]))->View(Urho3D::ToUInt(location[1]), numBytes);
+    return view && memcmp(view->Data(), data, numBytes) == 0;
+}
+
+String AssetCache::NewStreamFile()
+{
+    return cacheDirectory + cDataDirectory + Urho3D::ToString("%u_%u", Urho3D::Time::GetTimeSinceEpoch(), ++numStreamFiles) + cStreamFileExtension;
+}
+
+String AssetCache::StoreFile(const String &path, unsigned long long hash, uint numBytes, const String &assetName)
+{
+    Urho3D::FileSystem *fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    Entry stored;
+    stored.hash = hash;
+    stored.size = numBytes;
+    bool shared = false;
+    {
+        // The mapping is released before the file is moved
+        SharedPtr<MappedFile> mapped = MappedFile::Map(path);
+        if (numBytes > 0 && (!mapped || mapped->Size() != numBytes))
+        {
+            LogWarning("AssetCache: Streamed file " + path + " does not have the expected size of " + String(numBytes) + " bytes.");
+            fileSystem->Delete(path);
+            return "";
+        }
+        stored.file = DataFile(mapped ? mapped->Data() : 0, numBytes, hash, assetName, shared);
+    }
+
+    EntryMap::Iterator iter = entries.Find(assetName);
+    if (iter != entries.End() && iter->second_.hash == hash && iter->second_.size == numBytes && iter->second_.file == stored.file)
+    {
+        // Downloaded again with the same content, nothing to move
+        fileSystem->Delete(path);
+        Touch(assetName, iter->second_);
+        return DiskSourceByRef(assetName);
+    }
+
+    // Identical content of another asset ref is shared
+    if (shared)
+        fileSystem->Delete(path);
+    else
+    {
+        // A data file no entry refers to is left over from an earlier run, replace it
+        if (fileSystem->FileExists(cacheDirectory + stored.file))
+            fileSystem->Delete(cacheDirectory + stored.file);
+        if (!fileSystem->Rename(path, cacheDirectory + stored.file))
+        {
+            fileSystem->Delete(path);
+            return "";
+        }
+    }
+
+    return AddEntry(assetName, stored);
+}
+
+String AssetCache::AddEntry(const String &assetName, const Entry &stored)
+{
+    RetainFile(stored);
+    Entry &entry = entries[assetName];
+    if (!entry.file.Empty())
+        ReleaseFile(entry);
+
+    entry = stored;
+    entry.lastAccess = entry.journaledAccess = Urho3D::Time::GetTimeSinceEpoch();
+    AppendRecord(RecordStore, assetName, &entry);
+
+    Evict();
+    // An asset larger than the whole budget is evicted right away
+    return DiskSourceByRef(assetName);
+}
+
+unsigned AssetCache::LastModified(const String &assetRef) const
+{
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() ? iter->second_.lastModified : 0;
 }
 
 bool AssetCache::SetLastModified(const String & assetRef, unsigned dateTime)
 {
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    String absolutePath = FindInCache(assetRef);
-    if (absolutePath.Empty())
+    EntryMap::Iterator iter = entries.Find(assetRef);
+    if (iter == entries.End())
+        return false;
+    if (iter->second_.lastModified != dateTime)
+    {
+        iter->second_.lastModified = dateTime;
+        AppendRecord(RecordValidators, assetRef, &iter->second_);
+    }
+    return true;
+}
+
+String AssetCache::ETag(const String &assetRef) const
+{
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() ? iter->second_.etag : String();
+}
+
+bool AssetCache::SetETag(const String &assetRef, const String &etag)
+{
+    EntryMap::Iterator iter = entries.Find(assetRef);
+    if (iter == entries.End())
+        return false;
+    if (iter->second_.etag != etag)
+    {
+        iter->second_.etag = etag;
+        AppendRecord(RecordValidators, assetRef, &iter->second_);
+    }
+    return true;
+}
+
+unsigned AssetCache::Expires(const String &assetRef) const
+{
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() ? iter->second_.expires : 0;
+}
+
+bool AssetCache::MustRevalidate(const String &assetRef) const
+{
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() && iter->second_.mustRevalidate;
+}
+
+bool AssetCache::SetFreshness(const String &assetRef, unsigned expires, bool mustRevalidate)
+{
+    EntryMap::Iterator iter = entries.Find(assetRef);
+    if (iter == entries.End())
         return false;
-    return fileSystem->SetLastModifiedTime(absolutePath, dateTime);
+    if (iter->second_.expires != expires || iter->second_.mustRevalidate != mustRevalidate)
+    {
+        iter->second_.expires = expires;
+        iter->second_.mustRevalidate = mustRevalidate;
+        AppendRecord(RecordFreshness, assetRef, &iter->second_);
+    }
+    return true;
+}
+
+unsigned long long AssetCache::ContentHash(const String &assetRef) const
+{
+    EntryMap::ConstIterator iter = entries.Find(assetRef);
+    return iter != entries.End() ? iter->second_.hash : 0;
 }
 
 void AssetCache::DeleteAsset(const String &assetRef)
 {
-    String absolutePath = DiskSourceByRef(assetRef);
-    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
-    if (fileSystem->FileExists(absolutePath))
-        fileSystem->Delete(absolutePath);
+    EntryMap::Iterator iter = entries.Find(assetRef);
+    if (iter == entries.End())
+        return;
+    ReleaseFile(iter->second_);
+    entries.Erase(iter);
+    AppendRecord(RecordRemove, assetRef, 0);
 }
 
 void AssetCache::ClearAssetCache()
 {
+    journal.Reset();
+    entries.Clear();
+    fileRefCounts.Clear();
+    totalSize = 0;
+    packs.Clear();
+    packedContents.Clear();
+    currentPack = 0;
+    compactedPack = 0;
+    compactionQueue.Clear();
+
+    // Only the files of the cache are deleted, as the cache directory may have been given with --assetCacheDir
     Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
     StringVector filenames;
-    fileSystem->ScanDir(filenames, cacheDirectory, "*.*", Urho3D::SCAN_FILES, true);
+    fileSystem->ScanDir(filenames, cacheDirectory + cDataDirectory, "*.*", Urho3D::SCAN_FILES, false);
     foreach(String file, filenames)
-        fileSystem->Delete(cacheDirectory + file);
+        fileSystem->Delete(cacheDirectory + cDataDirectory + file);
+
+    CompactJournal();
 }
 
+void AssetCache::DeleteUnreferencedFiles()
+{
+    // Removes the data files of entries whose records were lost with an incomplete or missing journal, and the leftovers
+    // of downloads that were interrupted. Packs are handled by OpenPacks.
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    StringVector filenames;
+    fileSystem->ScanDir(filenames, cacheDirectory + cDataDirectory, "*.*", Urho3D::SCAN_FILES, false);
+    uint numDeleted = 0;
+    foreach(const String &file, filenames)
+    {
+        if (file.EndsWith(".pack") || fileRefCounts.Contains(cDataDirectory + file))
+            continue;
+        fileSystem->Delete(cacheDirectory + cDataDirectory + file);
+        if (!file.EndsWith(cStreamFileExtension))
+            ++numDeleted;
+    }
+    if (numDeleted > 0)
+        LogInfo("AssetCache: Removed " + String(numDeleted) + " data files not in the cache index.");
+}
+
+void AssetCache::SetSizeLimit(unsigned long long bytes)
+{
+    sizeLimit = bytes;
+    Evict();
+}
+
+void AssetCache::Touch(const String &assetRef, Entry &entry)
+{
+    entry.lastAccess = Urho3D::Time::GetTimeSinceEpoch();
+    if (entry.lastAccess - entry.journaledAccess >= cAccessJournalInterval)
+    {
+        entry.journaledAccess = entry.lastAccess;
+        AppendRecord(RecordAccess, assetRef, &entry);
+    }
 }
 
+void AssetCache::RetainFile(const Entry &entry)
+{
+    uint &refCount = fileRefCounts[entry.file];
+    if (refCount++ > 0)
+        return;
+    totalSize += entry.size;
+    if (entry.pack != 0)
+    {
+        Pack(entry.pack)->liveBytes += entry.size;
+        packedContents[entry.hash] = entry.file;
+    }
+}
+
+void AssetCache::ReleaseFile(const Entry &entry, bool deleteFile)
+{
+    HashMap<String, uint>::Iterator iter = fileRefCounts.Find(entry.file);
+    if (iter == fileRefCounts.End() || --iter->second_ > 0)
+        return;
+    fileRefCounts.Erase(iter);
+    totalSize -= Urho3D::Min(totalSize, (unsigned long long)entry.size);
+    if (entry.pack != 0)
+    {
+        AssetCachePack *pack = Pack(entry.pack);
+        pack->liveBytes -= Urho3D::Min(pack->liveBytes, (unsigned long long)entry.size);
+        pack->deadBytes += entry.size;
+        HashMap<unsigned long long, String>::Iterator content = packedContents.Find(entry.hash);
+        if (content != packedContents.End() && content->second_ == entry.file)
+            packedContents.Erase(content);
+    }
+    else if (deleteFile)
+        GetSubsystem<Urho3D::FileSystem>()->Delete(cacheDirectory + entry.file);
+}
+
+AssetCachePack *AssetCache::Pack(uint id)
+{
+    SharedPtr<AssetCachePack> &pack = packs[id];
+    if (!pack)
+        pack = new AssetCachePack(GetContext(), id, cacheDirectory + PackFileName(id));
+    return pack;
+}
+
+bool AssetCache::AppendToPack(const u8 *data, uint numBytes, Entry &entry)
+{
+    if (currentPack == 0 || Pack(currentPack)->Size() + numBytes > cMaxPackSize)
+    {
+        // The full pack is only read from now on
+        if (currentPack != 0)
+            Pack(currentPack)->Close();
+        ++currentPack;
+        while(packs.Contains(currentPack))
+            ++currentPack;
+    }
+
+    uint offset = 0;
+    if (!Pack(currentPack)->Append(data, numBytes, offset))
+    {
+        LogWarning("AssetCache: Failed to write to " + Pack(currentPack)->Path());
+        return false;
+    }
+    entry.pack = currentPack;
+    entry.offset = offset;
+    entry.file = PackedDataKey(currentPack, offset);
+    return true;
+}
+
+void AssetCache::OpenPacks()
+{
+    // Drop the entries whose data did not reach the pack before an interruption, so that their offsets, which the next
+    // appends reuse, do not serve the data of other assets
+    StringVector lost;
+    for (EntryMap::ConstIterator iter = entries.Begin(); iter != entries.End(); ++iter)
+        if (iter->second_.pack != 0 && (unsigned long long)iter->second_.offset + iter->second_.size > Pack(iter->second_.pack)->Size())
+            lost.Push(iter->first_);
+    foreach(const String &assetRef, lost)
+    {
+        EntryMap::Iterator iter = entries.Find(assetRef);
+        ReleaseFile(iter->second_);
+        entries.Erase(iter);
+        AppendRecord(RecordRemove, assetRef, 0);
+    }
+    if (!lost.Empty())
+        LogWarning("AssetCache: Removed " + String(lost.Size()) + " packed entries whose data is missing from the packs.");
+
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    StringVector filenames;
+    fileSystem->ScanDir(filenames, cacheDirectory + cDataDirectory, "*.pack", Urho3D::SCAN_FILES, false);
+    foreach(String file, filenames)
+    {
+        uint id = Urho3D::ToUInt(Urho3D::GetFileName(file));
+        if (id == 0 || !packs.Contains(id))
+            fileSystem->Delete(cacheDirectory + cDataDirectory + file); // No live entries
+    }
+    for (HashMap<uint, SharedPtr<AssetCachePack> >::Iterator iter = packs.Begin(); iter != packs.End();)
+    {
+        // Packs whose every entry was lost
+        uint id = iter->first_;
+        ++iter;
+        if (packs[id]->liveBytes == 0)
+            DeletePack(id);
+    }
+
+    for (HashMap<uint, SharedPtr<AssetCachePack> >::Iterator iter = packs.Begin(); iter != packs.End(); ++iter)
+    {
+        AssetCachePack *pack = iter->second_;
+        pack->deadBytes = pack->Size() - Urho3D::Min((unsigned long long)pack->Size(), pack->liveBytes);
+        currentPack = Urho3D::Max(currentPack, pack->Id());
+    }
+}
+
+void AssetCache::DeletePack(uint id)
+{
+    HashMap<uint, SharedPtr<AssetCachePack> >::Iterator iter = packs.Find(id);
+    if (iter == packs.End())
+        return;
+    String path = iter->second_->Path();
+    iter->second_->Close();
+    packs.Erase(iter);
+    GetSubsystem<Urho3D::FileSystem>()->Delete(path);
+}
+
+void AssetCache::Update()
+{
+    if (packs.Empty())
+        return;
+
+    if (compactionQueue.Empty())
+    {
+        if (compactedPack != 0)
+        {
+            // All entries have been moved
+            AssetCachePack *pack = Pack(compactedPack);
+            if (pack->liveBytes == 0)
+                DeletePack(compactedPack);
+            compactedPack = 0;
+        }
+
+        // Compact a pack that is more than half dead
+        for (HashMap<uint, SharedPtr<AssetCachePack> >::ConstIterator iter = packs.Begin(); iter != packs.End(); ++iter)
+            if (iter->first_ != currentPack && iter->second_->deadBytes > iter->second_->liveBytes)
+            {
+                compactedPack = iter->first_;
+                break;
+            }
+        if (compactedPack == 0)
+            return;
+
+        for (EntryMap::ConstIterator iter = entries.Begin(); iter != entries.End(); ++iter)
+            if (iter->second_.pack == compactedPack)
+                compactionQueue.Push(iter->first_);
+        return;
+    }
+
+    PROFILE(AssetCache_CompactPack);
+
+    uint movedBytes = 0;
+    while(!compactionQueue.Empty() && movedBytes < cCompactionBytesPerUpdate)
+    {
+        const String assetRef = compactionQueue.Back();
+        compactionQueue.Pop();
+        EntryMap::Iterator iter = entries.Find(assetRef);
+        if (iter == entries.End() || iter->second_.pack != compactedPack)
+            continue;
+
+        Entry moved = iter->second_;
+        AssetCacheViewPtr data = Pack(moved.pack)->View(moved.offset, moved.size);
+        if (!data)
+        {
+            DeleteAsset(assetRef);
+            continue;
+        }
+        HashMap<unsigned long long, String>::ConstIterator existing = packedContents.Find(moved.hash);
+        if (existing != packedContents.End() && existing->second_ != moved.file && PackedDataEquals(existing->second_, data->Data(), data->Size()))
+        {
+            // The content has already been moved for another asset ref
+            StringVector location = existing->second_.Split(':');
+            moved.file = existing->second_;
+            moved.pack = Urho3D::ToUInt(location[0]);
+            moved.offset = Urho3D::ToUInt(location[1]);
+        }
+        else
+        {
+            if (!AppendToPack(data->Data(), data->Size(), moved))
+            {
+                DeleteAsset(assetRef);
+                continue;
+            }
+            movedBytes += moved.size;
+        }
+
+        RetainFile(moved);
+        ReleaseFile(iter->second_);
+        iter->second_ = moved;
+        AppendRecord(RecordStore, assetRef, &moved);
+        if (moved.expires != 0 || moved.mustRevalidate)
+            AppendRecord(RecordFreshness, assetRef, &moved);
+    }
+}
+
+void AssetCache::Evict()
+{
+    if (sizeLimit == 0 || totalSize <= sizeLimit)
+        return;
+
+    // Evict to below the budget by a margin, so that every store after the budget has been reached does not evict
+    const unsigned long long target = sizeLimit - sizeLimit / 10;
+    const unsigned long long sizeBefore = totalSize;
+    const uint numBefore = entries.Size();
+
+    Vector<Pair<uint, String> > byAccess;
+    byAccess.Reserve(entries.Size());
+    for (EntryMap::ConstIterator iter = entries.Begin(); iter != entries.End(); ++iter)
+        byAccess.Push(MakePair(iter->second_.lastAccess, iter->first_));
+    Urho3D::Sort(byAccess.Begin(), byAccess.End());
+
+    for (uint i = 0; i < byAccess.Size() && totalSize > target; ++i)
+        DeleteAsset(byAccess[i].second_);
+
+    LogDebug(Urho3D::ToString("AssetCache: Evicted %u assets, %.1f MB, to stay within the budget of %.1f MB.", numBefore - entries.Size(),
+        (sizeBefore - totalSize) / (1024.0 * 1024.0), sizeLimit / (1024.0 * 1024.0)));
+}
+
+void AssetCache::OpenJournal()
+{
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    const String path = cacheDirectory + cJournalName;
+    if (!fileSystem->FileExists(path))
+    {
+        // The data files, if any, are not referenced by the new index and are deleted by DeleteUnreferencedFiles. Files outside
+        // the data directory are not the cache's own: older versions named their files by asset ref, but those can not be told
+        // apart from other files in a directory given with --assetCacheDir, so they are left alone.
+        CompactJournal();
+        return;
+    }
+
+    bool intact = false;
+    {
+        Urho3D::File file(GetContext(), path, Urho3D::FILE_READ);
+        Vector<u8> data;
+        if (file.IsOpen() && file.GetSize() > 0)
+        {
+            data.Resize(file.GetSize());
+            data.Resize(file.Read(&data[0], data.Size()));
+        }
+        Urho3D::MemoryBuffer src(data.Buffer(), data.Size());
+        if (src.GetSize() >= 8 && src.ReadFileID() == cJournalFileId && src.ReadUInt() == cJournalVersion)
+        {
+            intact = true;
+            while(!src.IsEof())
+            {
+                // A record is not complete if writing it was interrupted. The rest of the journal is discarded.
+                if (src.GetSize() - src.GetPosition() < 5)
+                {
+                    intact = false;
+                    break;
+                }
+                u8 type = src.ReadUByte();
+                uint length = src.ReadUInt();
+                if (src.GetSize() - src.GetPosition() < length)
+                {
+                    intact = false;
+                    break;
+                }
+                Urho3D::MemoryBuffer record(data.Buffer() + src.GetPosition(), length);
+                ReadRecord(type, record);
+                src.Seek(src.GetPosition() + length);
+                ++numJournalRecords;
+            }
+        }
+    }
+
+    if (!intact)
+        LogWarning("AssetCache: Cache index " + path + " is incomplete, recovered " + String(entries.Size()) + " assets.");
+
+    if (!intact || numJournalRecords > 2 * entries.Size() + 1024)
+        CompactJournal();
+    else
+    {
+        journal = new Urho3D::File(GetContext(), path, Urho3D::FILE_READWRITE);
+        if (journal->IsOpen())
+            journal->Seek(journal->GetSize());
+        else
+        {
+            LogWarning("AssetCache: Failed to open cache index " + path + " for writing.");
+            journal.Reset();
+        }
+    }
+}
+
+void AssetCache::ReadRecord(u8 type, Urho3D::Deserializer &src)
+{
+    const String assetRef = src.ReadString();
+    switch(type)
+    {
+    case RecordStore:
+    case RecordStorePacked:
+    {
+        Entry &entry = entries[assetRef];
+        if (!entry.file.Empty())
+            ReleaseFile(entry, false);
+        if (type == RecordStorePacked)
+        {
+            entry.pack = src.ReadUInt();
+            entry.offset = src.ReadUInt();
+            entry.file = PackedDataKey(entry.pack, entry.offset);
+        }
+        else
+        {
+            entry.pack = entry.offset = 0;
+            entry.file = src.ReadString();
+        }
+        entry.hash = (unsigned long long)src.ReadUInt() << 32;
+        entry.hash |= src.ReadUInt();
+        entry.size = src.ReadUInt();
+        entry.lastModified = src.ReadUInt();
+        entry.lastAccess = entry.journaledAccess = src.ReadUInt();
+        entry.etag = src.ReadString();
+        // Stored content has not been reported fresh until a freshness record follows
+        entry.expires = 0;
+        entry.mustRevalidate = false;
+        RetainFile(entry);
+        break;
+    }
+    case RecordAccess:
+    {
+        EntryMap::Iterator iter = entries.Find(assetRef);
+        if (iter != entries.End())
+            iter->second_.lastAccess = iter->second_.journaledAccess = src.ReadUInt();
+        break;
+    }
+    case RecordValidators:
+    {
+        EntryMap::Iterator iter = entries.Find(assetRef);
+        if (iter != entries.End())
+        {
+            iter->second_.lastModified = src.ReadUInt();
+            iter->second_.etag = src.ReadString();
+        }
+        break;
+    }
+    case RecordFreshness:
+    {
+        EntryMap::Iterator iter = entries.Find(assetRef);
+        if (iter != entries.End())
+        {
+            iter->second_.expires = src.ReadUInt();
+            iter->second_.mustRevalidate = src.ReadBool();
+        }
+        break;
+    }
+    case RecordRemove:
+    {
+        EntryMap::Iterator iter = entries.Find(assetRef);
+        if (iter != entries.End())
+        {
+            ReleaseFile(iter->second_, false);
+            entries.Erase(iter);
+        }
+        break;
+    }
+    default:
+        // Unknown records are skipped, so that newer versions can add records
+        break;
+    }
+}
+
+void AssetCache::WriteRecord(Urho3D::Serializer &dst, RecordType type, const String &assetRef, const Entry *entry)
+{
+    if (type == RecordStore && entry->pack != 0)
+        type = RecordStorePacked;
+
+    Urho3D::VectorBuffer record;
+    record.WriteString(assetRef);
+    switch(type)
+    {
+    case RecordStore:
+    case RecordStorePacked:
+        if (type == RecordStorePacked)
+        {
+            record.WriteUInt(entry->pack);
+            record.WriteUInt(entry->offset);
+        }
+        else
+            record.WriteString(entry->file);
+        record.WriteUInt((uint)(entry->hash >> 32));
+        record.WriteUInt((uint)(entry->hash & 0xFFFFFFFF));
+        record.WriteUInt(entry->size);
+        record.WriteUInt(entry->lastModified);
+        record.WriteUInt(entry->lastAccess);
+        record.WriteString(entry->etag);
+        break;
+    case RecordAccess:
+        record.WriteUInt(entry->lastAccess);
+        break;
+    case RecordValidators:
+        record.WriteUInt(entry->lastModified);
+        record.WriteString(entry->etag);
+        break;
+    case RecordFreshness:
+        record.WriteUInt(entry->expires);
+        record.WriteBool(entry->mustRevalidate);
+        break;
+    case RecordRemove:
+        break;
+    }
+
+    dst.WriteUByte((u8)type);
+    dst.WriteUInt(record.GetSize());
+    dst.Write(record.GetData(), record.GetSize());
+}
+
+void AssetCache::AppendRecord(RecordType type, const String &assetRef, const Entry *entry)
+{
+    if (!journal)
+        return;
+
+    // Write the record with a single write, so that an interrupted write leaves at most one incomplete record at the end
+    Urho3D::VectorBuffer buffer;
+    WriteRecord(buffer, type, assetRef, entry);
+    journal->Write(buffer.GetData(), buffer.GetSize());
+    journal->Flush();
+    ++numJournalRecords;
+
+    if (numJournalRecords > 2 * entries.Size() + 1024)
+        CompactJournal();
+}
+
+bool AssetCache::WriteJournal(const String &path)
+{
+    Urho3D::File file(GetContext(), path, Urho3D::FILE_WRITE);
+    if (!file.IsOpen())
+        return false;
+
+    Urho3D::VectorBuffer buffer;
+    buffer.WriteFileID(cJournalFileId);
+    buffer.WriteUInt(cJournalVersion);
+    for (EntryMap::ConstIterator iter = entries.Begin(); iter != entries.End(); ++iter)
+    {
+        WriteRecord(buffer, RecordStore, iter->first_, &iter->second_);
+        if (iter->second_.expires != 0 || iter->second_.mustRevalidate)
+            WriteRecord(buffer, RecordFreshness, iter->first_, &iter->second_);
+    }
+    return file.Write(buffer.GetData(), buffer.GetSize()) == buffer.GetSize();
+}
+
+void AssetCache::CompactJournal()
+{
+    Urho3D::FileSystem* fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    const String path = cacheDirectory + cJournalName;
+    const String tempPath = path + ".tmp";
+
+    journal.Reset();
+    for (EntryMap::Iterator iter = entries.Begin(); iter != entries.End(); ++iter)
+        iter->second_.journaledAccess = iter->second_.lastAccess;
+
+    // Write the new journal aside, so that the old one stays valid if writing fails
+    if (!WriteJournal(tempPath) || (fileSystem->FileExists(path) && !fileSystem->Delete(path)) || !fileSystem->Rename(tempPath, path))
+    {
+        LogWarning("AssetCache: Failed to write cache index " + path + ", the cache will not be persisted.");
+        return;
+    }
+    numJournalRecords = entries.Size();
+
+    journal = new Urho3D::File(GetContext(), path, Urho3D::FILE_READWRITE);
+    if (journal->IsOpen())
+        journal->Seek(journal->GetSize());
+    else
+        journal.Reset();
+}
+
+}
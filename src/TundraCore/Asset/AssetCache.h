@@ -7,62 +7,230 @@
 #include "AssetFwd.h"
 
 #include <Object.h>
+#include <HashMap.h>
+
+namespace Urho3D
+{
+    class File;
+    class Serializer;
+    class Deserializer;
+}
 
 namespace Tundra
 {
 
 /// Implements a disk cache for asset files to avoid re-downloading assets between runs.
+/** The cached data files are named by the hash of their content, so identical content downloaded from several asset refs
+    is stored only once. Content is compared byte for byte before it is shared, as the hash is not collision free. The cache keeps an in-memory index of the cached asset refs, with their size, last access time,
+    content hash, HTTP validators (Last-Modified and ETag) and freshness. The index is persisted to a single journal file in the cache
+    directory, so opening the cache does not scan the disk, and lookups do not touch the file system.
+
+    The total size of the cached data is limited by a disk budget, set in megabytes with --assetCacheSize (default 2048, 0 for
+    unlimited). When the budget is exceeded, the least recently used assets are evicted.
+
+    With --assetCachePack, assets up to 1 MB that do not require a disk source are packed into large append-only pack files
+    instead of a file each, so that a warm cache is read without opening a file per asset. Packed assets have no disk source
+    of their own; they are read through memory mapped views, see View. Packs whose entries are mostly evicted or replaced are
+    compacted a few megabytes per frame by Update.
+
+    Asset providers can stream large downloads to the cache as they are received, see NewStreamFile and StoreFile. */
 class TUNDRACORE_API AssetCache : public Object
 {
     OBJECT(AssetCache);
 
 public:
     explicit AssetCache(AssetAPI *owner, String assetCacheDirectory);
+    ~AssetCache();
 
     /// Returns the absolute path on the local file system that contains a cached copy of the given asset ref.
-    /// If the given asset file does not exist in the cache, an empty string is returned.
+    /// If the given asset file does not exist in the cache, an empty string is returned. Marks the asset as used.
     /// @param assetRef The asset reference URL, which must be of type AssetRefExternalUrl.
     String FindInCache(const String &assetRef);
 
     /// Returns the absolute path on the local file system for the cached version of the given asset ref.
-    /// This function is otherwise identical to FindInCache, except this version does not check whether the asset exists 
-    /// in the cache, but simply returns the absolute path where the asset would be stored in the cache.
+    /// This function is otherwise identical to FindInCache, except this version does not mark the asset as used.
+    /// As the cached files are named by their content, the path is not known before the asset is stored, in which case an empty string is returned.
     /// @param assetRef The asset reference URL, which must be of type AssetRefExternalUrl.
-    String DiskSourceByRef(const String &assetRef);
-    
+    String DiskSourceByRef(const String &assetRef) const;
+
+    /// Returns whether the given asset ref is in the cache.
+    bool Contains(const String &assetRef) const { return entries.Contains(assetRef); }
+
+    /// Returns whether the given asset ref is stored in a pack, and so has no file of its own.
+    bool IsPacked(const String &assetRef) const;
+
+    /// Returns a read-only view to the cached data of the given asset ref, or null if not in the cache. Marks the asset as used.
+    /** Works for both packed and file assets. The view stays valid even if the asset is removed from the cache. */
+    AssetCacheViewPtr View(const String &assetRef);
+
     /// Saves the given asset to cache.
-    /// @return String the absolute path name to the asset cache entry. If not successful returns an empty string.
+    /// @return String the absolute path name to the asset cache entry. If not successful, or the asset was packed, returns an empty string.
     String StoreAsset(AssetPtr asset);
 
     /// Saves the specified data to the asset cache.
-    /// @return String the absolute path name to the asset cache entry. If not successful returns an empty string.
-    String StoreAsset(const u8 *data, uint numBytes, const String &assetName);
-
-    /// Return the last modified time for assetRefs cache file as seconds since 1.1.1970.
-    /// If cache file does not exist for assetRef return invalid QDateTime. You can check return value with QDateTime::isValid().
-    /// @param String assetRef Asset reference of which cache file last modified date and time will be returned.
-    /// @return QDateTime Last modified date and time of the cache file.
-    unsigned LastModified(const String &assetRef);
-
-    /// Sets the last modified date and time for the assetRefs cache file.
-    /// @param String assetRef Asset reference thats cache file last modified date and time will be set.
-    /// @param QDateTime The date and time to set.
-    /// @return bool Returns true if successful, false otherwise.
+    /** If the same content is already in the cache, it is not written again. Clears the Last-Modified and ETag of the asset ref
+        if the content changes.
+        @param allowPacking Whether the asset can be stored in a pack, if packing is enabled. Pass false if the asset requires a disk source.
+        @return String the absolute path name to the asset cache entry. If not successful, or the asset was packed, returns an empty string. */
+    String StoreAsset(const u8 *data, uint numBytes, const String &assetName, bool allowPacking = false);
+
+    /// Returns a new path in the cache directory to write a download to while it is received. Pass the file to StoreFile once complete.
+    /** The files left over from interrupted downloads are deleted when the cache is opened. */
+    String NewStreamFile();
+
+    /// Moves a complete file written to a path returned by NewStreamFile into the asset cache.
+    /** This saves the caller from passing the data through memory again, and the file is never packed. If the same content
+        is already in the cache, the file is deleted. Clears the Last-Modified and ETag of the asset ref if the content changes.
+        @param hash The content hash of the file, computed with HashContent.
+        @return String the absolute path name to the asset cache entry. If not successful, returns an empty string and deletes the file. */
+    String StoreFile(const String &path, unsigned long long hash, uint numBytes, const String &assetName);
+
+    /// Returns the size of the largest asset that is stored in a pack, or 0 if packing is disabled.
+    uint MaxPackedSize() const;
+
+    /// Hashes @c data into @c hash with FNV-1a. Content hashes can be computed incrementally by passing the previous result as @c hash.
+    static unsigned long long HashContent(const u8 *data, uint numBytes, unsigned long long hash = 14695981039346656037ULL);
+
+    /// Return the last modified time, as UTC seconds since 1.1.1970, the source of the cached asset ref reported.
+    /// @param String assetRef Asset reference of which last modified date and time will be returned.
+    /// @return Last modified time, or 0 if the asset ref is not in the cache or its last modified time is not known.
+    unsigned LastModified(const String &assetRef) const;
+
+    /// Sets the last modified time, as UTC seconds since 1.1.1970, of the cached asset ref.
+    /// @param String assetRef Asset reference of which last modified date and time will be set.
+    /// @param dateTime The date and time to set.
+    /// @return bool Returns true if successful, false if the asset ref is not in the cache.
     bool SetLastModified(const String &assetRef, unsigned dateTime);
 
+    /// Returns the ETag the source of the cached asset ref reported, or an empty string if not known.
+    String ETag(const String &assetRef) const;
+
+    /// Sets the ETag of the cached asset ref.
+    /// @return bool Returns true if successful, false if the asset ref is not in the cache.
+    bool SetETag(const String &assetRef, const String &etag);
+
+    /// Returns the time, as UTC seconds since 1.1.1970, until which the source reported the cached asset ref to be fresh.
+    /** @return 0 if the asset ref is not in the cache or the source did not report a freshness lifetime. */
+    unsigned Expires(const String &assetRef) const;
+
+    /// Returns whether the source requires the cached asset ref to be revalidated before it is used, once it is not fresh.
+    bool MustRevalidate(const String &assetRef) const;
+
+    /// Sets the freshness of the cached asset ref, as reported by its source. See Expires and MustRevalidate.
+    /// @return bool Returns true if successful, false if the asset ref is not in the cache.
+    bool SetFreshness(const String &assetRef, unsigned expires, bool mustRevalidate);
+
+    /// Returns the hash of the content of the cached asset ref, or 0 if the asset ref is not in the cache.
+    unsigned long long ContentHash(const String &assetRef) const;
+
     /// Deletes the asset with the given assetRef from the cache, if it exists.
+    /// The data file is deleted once no other asset ref has the same content.
     /// @param String asset reference.
     void DeleteAsset(const String &assetRef);
 
-    /// Deletes all data and metadata files from the asset cache.
-    /// Will not clear sub folders in the cache folders, or remove any folders.
+    /// Deletes all data files from the asset cache, and starts a new index.
+    /// Files in the cache directory that the cache did not write are not deleted, and no folders are removed.
     void ClearAssetCache();
 
+    /// Returns the number of cached asset refs.
+    uint NumAssets() const { return entries.Size(); }
+
+    /// Returns the total size in bytes of the cached data.
+    unsigned long long TotalSize() const { return totalSize; }
+
+    /// Returns the disk budget in bytes, or 0 if unlimited.
+    unsigned long long SizeLimit() const { return sizeLimit; }
+
+    /// Sets the disk budget in bytes, 0 for unlimited. Evicts the least recently used assets if the budget is exceeded.
+    void SetSizeLimit(unsigned long long bytes);
+
+    /// Returns whether small assets are stored in packs.
+    bool IsPackingEnabled() const { return packingEnabled; }
+
+    /// Compacts the packs with mostly dead entries, a few megabytes per call. Called by AssetAPI::Update.
+    void Update();
+
     /// Get the cache directory. Returned path is guaranteed to have a trailing slash /.
     /// @return String absolute path to the caches data directory
     String CacheDirectory() const;
-    
+
 private:
+    /// A cached asset ref.
+    struct Entry
+    {
+        Entry() : hash(0), size(0), pack(0), offset(0), lastModified(0), lastAccess(0), journaledAccess(0), expires(0), mustRevalidate(false) {}
+
+        String file; ///< Data file, relative to the cache directory, or the pack and offset of packed data.
+        unsigned long long hash;
+        uint size;
+        uint pack; ///< Id of the pack, or 0 if the data is in a file of its own.
+        uint offset; ///< Offset of the data in the pack.
+        uint lastModified;
+        uint lastAccess;
+        uint journaledAccess; ///< The last access time written to the journal.
+        String etag;
+        uint expires;
+        bool mustRevalidate;
+    };
+    typedef HashMap<String, Entry> EntryMap;
+
+    /// Journal record types.
+    enum RecordType
+    {
+        RecordStore = 1,
+        RecordAccess,
+        RecordValidators,
+        RecordRemove,
+        RecordStorePacked,
+        RecordFreshness
+    };
+
+    /// Reads the index from the journal, or starts a new journal if there is none.
+    void OpenJournal();
+    /// Rewrites the journal with only the current state of the index.
+    void CompactJournal();
+    /// Starts a new journal at @c path, and writes the whole index to it.
+    bool WriteJournal(const String &path);
+    /// Applies a record read from the journal to the index.
+    void ReadRecord(u8 type, Urho3D::Deserializer &src);
+    /// Writes a record to @c dst.
+    static void WriteRecord(Urho3D::Serializer &dst, RecordType type, const String &assetRef, const Entry *entry);
+    /// Appends a record of @c assetRef to the journal.
+    void AppendRecord(RecordType type, const String &assetRef, const Entry *entry);
+
+    /// Adds a reference to the data of @c entry.
+    void RetainFile(const Entry &entry);
+    /// Removes a reference to the data of @c entry. Deletes the file, or marks the data in the pack dead, when it is no longer referenced.
+    void ReleaseFile(const Entry &entry, bool deleteFile = true);
+
+    /// Returns the pack with @c id, creating it if it does not exist.
+    AssetCachePack *Pack(uint id);
+    /// Appends @c data to the current pack. Starts a new pack when the current one is full.
+    bool AppendToPack(const u8 *data, uint numBytes, Entry &entry);
+    /// Removes the entries whose data is past the end of their pack, deletes the packs that have no live entries, and accounts the
+    /// dead bytes of the others. Called once the index has been read.
+    void OpenPacks();
+    /// Deletes the files in the data directory that no entry refers to, other than packs. Called once the index has been read.
+    void DeleteUnreferencedFiles();
+    void DeletePack(uint id);
+
+    /// Returns the data file for content with @c hash. If the file already has the same content, sets @c shared.
+    /** Different content with the same hash gets a file name of its own. */
+    String DataFile(const u8 *data, uint numBytes, unsigned long long hash, const String &assetName, bool &shared);
+    /// Returns whether the data file @c file has the content @c data.
+    bool FileDataEquals(const String &file, const u8 *data, uint numBytes) const;
+    /// Returns whether the packed data at @c key, see Entry::file, starts with @c data.
+    bool PackedDataEquals(const String &key, const u8 *data, uint numBytes);
+
+    /// Adds @c stored to the index as the data of @c assetName, once its data has been written.
+    String AddEntry(const String &assetName, const Entry &stored);
+
+    /// Evicts the least recently used assets until the cache is below the disk budget.
+    void Evict();
+
+    /// Marks an asset as used.
+    void Touch(const String &assetRef, Entry &entry);
+
 #ifdef WIN32
     /// Windows specific helper to open a file handle to absolutePath
     void *OpenFileHandle(const String &absolutePath);
@@ -72,6 +240,36 @@ private:
 
     /// AssetAPI ptr.
     AssetAPI *assetAPI;
+
+    /// Cached asset refs.
+    EntryMap entries;
+    /// Number of asset refs referring to each data file.
+    HashMap<String, uint> fileRefCounts;
+    /// Total size of the data files.
+    unsigned long long totalSize;
+    /// Disk budget, 0 for unlimited.
+    unsigned long long sizeLimit;
+
+    /// Whether small assets are stored in packs.
+    bool packingEnabled;
+    /// Packs by id.
+    HashMap<uint, SharedPtr<AssetCachePack> > packs;
+    /// The pack new data is appended to.
+    uint currentPack;
+    /// Packed data by content hash, for sharing identical content.
+    HashMap<unsigned long long, String> packedContents;
+    /// The pack being compacted, or 0.
+    uint compactedPack;
+    /// Asset refs left to move out of the pack being compacted.
+    Vector<String> compactionQueue;
+
+    /// The journal, kept open for appending.
+    SharedPtr<Urho3D::File> journal;
+    /// Number of records in the journal. When it grows much larger than the number of entries, the journal is compacted.
+    uint numJournalRecords;
+
+    /// Number of stream files handed out, to keep their names unique.
+    uint numStreamFiles;
 };
 
 }
@@ -0,0 +1,159 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "Win.h"
+
+#include "AssetCachePack.h"
+
+#include <File.h>
+#include <FileSystem.h>
+#include <MathDefs.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Tundra
+{
+
+MappedFile::MappedFile() :
+    data_(0),
+    size_(0)
+#ifdef WIN32
+    , fileHandle_(INVALID_HANDLE_VALUE),
+    mappingHandle_(0)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef WIN32
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mappingHandle_)
+        CloseHandle(mappingHandle_);
+    if (fileHandle_ != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle_);
+#else
+    if (data_)
+        munmap((void*)data_, size_);
+#endif
+}
+
+SharedPtr<MappedFile> MappedFile::Map(const String &path)
+{
+    SharedPtr<MappedFile> file(new MappedFile());
+#ifdef WIN32
+    // Allow the pack to be appended to while it is mapped
+    file->fileHandle_ = CreateFileW(Urho3D::WString(Urho3D::GetNativePath(path)).CString(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file->fileHandle_ == INVALID_HANDLE_VALUE)
+        return SharedPtr<MappedFile>();
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->fileHandle_, &size) || size.QuadPart == 0 || size.QuadPart > M_MAX_UNSIGNED)
+        return SharedPtr<MappedFile>();
+    file->mappingHandle_ = CreateFileMappingW(file->fileHandle_, 0, PAGE_READONLY, 0, 0, 0);
+    if (!file->mappingHandle_)
+        return SharedPtr<MappedFile>();
+    file->data_ = (const u8*)MapViewOfFile(file->mappingHandle_, FILE_MAP_READ, 0, 0, 0);
+    if (!file->data_)
+        return SharedPtr<MappedFile>();
+    file->size_ = (uint)size.QuadPart;
+#else
+    int fd = open(Urho3D::GetNativePath(path).CString(), O_RDONLY);
+    if (fd < 0)
+        return SharedPtr<MappedFile>();
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0 || (unsigned long long)info.st_size > M_MAX_UNSIGNED)
+    {
+        close(fd);
+        return SharedPtr<MappedFile>();
+    }
+    void *data = mmap(0, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file referenced
+    close(fd);
+    if (data == MAP_FAILED)
+        return SharedPtr<MappedFile>();
+    file->data_ = (const u8*)data;
+    file->size_ = (uint)info.st_size;
+#endif
+    return file;
+}
+
+AssetCachePack::AssetCachePack(Urho3D::Context *context, uint id, const String &path) :
+    liveBytes(0),
+    deadBytes(0),
+    context_(context),
+    id_(id),
+    path_(path),
+    size_(0)
+{
+    Urho3D::File file(context_, path_, Urho3D::FILE_READ);
+    if (file.IsOpen())
+        size_ = file.GetSize();
+}
+
+AssetCachePack::~AssetCachePack()
+{
+    Close();
+}
+
+bool AssetCachePack::Append(const u8 *data, uint numBytes, uint &offset)
+{
+    if (!writer_)
+    {
+        writer_ = new Urho3D::File(context_, path_, Urho3D::FILE_READWRITE);
+        if (!writer_->IsOpen())
+        {
+            writer_.Reset();
+            return false;
+        }
+    }
+
+    writer_->Seek(size_);
+    if (writer_->Write(data, numBytes) != numBytes)
+    {
+        // Leave the partial write as dead bytes
+        const uint oldSize = size_;
+        size_ = writer_->GetSize();
+        deadBytes += size_ - oldSize;
+        return false;
+    }
+    // The journal record that refers to the data is written next, so the data must not be left in the write buffer
+    writer_->Flush();
+    offset = size_;
+    size_ += numBytes;
+    return true;
+}
+
+AssetCacheViewPtr AssetCachePack::View(uint offset, uint numBytes)
+{
+    if (offset + numBytes > size_ || numBytes == 0)
+        return AssetCacheViewPtr();
+
+    if (!mapping_ || offset + numBytes > mapping_->Size())
+    {
+        // The pack has grown since it was mapped. Views of the old mapping keep it alive.
+        if (writer_)
+            writer_->Flush();
+        mapping_ = MappedFile::Map(path_);
+        if (!mapping_ || offset + numBytes > mapping_->Size())
+        {
+            mapping_.Reset();
+            return AssetCacheViewPtr();
+        }
+    }
+    return AssetCacheViewPtr(new AssetCacheView(mapping_, offset, numBytes));
+}
+
+void AssetCachePack::Close()
+{
+    writer_.Reset();
+    mapping_.Reset();
+}
+
+}
@@ -0,0 +1,102 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "AssetFwd.h"
+
+#include <RefCounted.h>
+
+namespace Urho3D
+{
+    class Context;
+    class File;
+}
+
+namespace Tundra
+{
+
+/// A read-only memory mapping of a whole file.
+class TUNDRACORE_API MappedFile : public RefCounted
+{
+public:
+    ~MappedFile();
+
+    /// Maps @c path. Returns null if the file can not be opened, or is empty.
+    static SharedPtr<MappedFile> Map(const String &path);
+
+    const u8 *Data() const { return data_; }
+    uint Size() const { return size_; }
+
+private:
+    MappedFile();
+
+    const u8 *data_;
+    uint size_;
+#ifdef WIN32
+    void *fileHandle_;
+    void *mappingHandle_;
+#endif
+};
+
+/// Cached asset data in a memory mapped file. Keeps the mapping alive while referenced.
+class TUNDRACORE_API AssetCacheView : public RefCounted
+{
+public:
+    AssetCacheView(const SharedPtr<MappedFile> &file, uint offset, uint size) :
+        file_(file), data_(file->Data() + offset), size_(size)
+    {
+    }
+
+    const u8 *Data() const { return data_; }
+    uint Size() const { return size_; }
+
+private:
+    SharedPtr<MappedFile> file_;
+    const u8 *data_;
+    uint size_;
+};
+
+/// An append-only file of packed asset cache entries. See AssetCache.
+/** Entries are addressed by their offset in the file. Removed entries are not reclaimed, instead AssetCache moves
+    the live entries of a pack with mostly dead bytes to a newer pack, and deletes the old pack. */
+class TUNDRACORE_API AssetCachePack : public RefCounted
+{
+public:
+    AssetCachePack(Urho3D::Context *context, uint id, const String &path);
+    ~AssetCachePack();
+
+    /// Appends @c data to the end of the pack.
+    /** @param offset [out] Receives the offset of the data in the pack.
+        @return False if writing failed. */
+    bool Append(const u8 *data, uint numBytes, uint &offset);
+
+    /// Returns a view to the data at @c offset, or null if the pack can not be mapped or is too small.
+    AssetCacheViewPtr View(uint offset, uint numBytes);
+
+    /// Closes the file handle used for appending. Views stay valid.
+    void Close();
+
+    uint Id() const { return id_; }
+    const String &Path() const { return path_; }
+    /// Returns the size of the pack file.
+    uint Size() const { return size_; }
+
+    /// Bytes of the entries still in the cache.
+    unsigned long long liveBytes;
+    /// Bytes of the entries removed from the cache.
+    unsigned long long deadBytes;
+
+private:
+    Urho3D::Context *context_;
+    uint id_;
+    String path_;
+    uint size_;
+    /// Open for appending, created on the first append.
+    SharedPtr<Urho3D::File> writer_;
+    /// Mapping of the pack, recreated when a view beyond its end is requested.
+    SharedPtr<MappedFile> mapping_;
+};
+
+}
@@ -0,0 +1,174 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+
+#include "AssetDecodeQueue.h"
+#include "AssetAPI.h"
+#include "IAsset.h"
+#include "Framework.h"
+#include "LoggingFunctions.h"
+
+#include <Profiler.h>
+#include <WorkQueue.h>
+#include <Timer.h>
+#include <MathDefs.h>
+#include <StringUtils.h>
+
+#include <cstring>
+#include <exception>
+
+namespace Tundra
+{
+
+AssetDecodeQueue::AssetDecodeQueue(AssetAPI *owner) :
+    Object(owner->GetContext()),
+    owner_(owner),
+    enabled_(true),
+    frameBudget_(5.0f)
+{
+    Framework *framework = owner->GetFramework();
+    if (framework->HasCommandLineParameter("--noAsyncAssetLoad") || framework->HasCommandLineParameter("--no_async_asset_load"))
+        enabled_ = false;
+    StringVector budget = framework->CommandLineParameters("--assetDecodeBudget");
+    if (!budget.Empty())
+        frameBudget_ = Urho3D::Max(Urho3D::ToFloat(budget.Front()), 0.0f);
+}
+
+AssetDecodeQueue::~AssetDecodeQueue()
+{
+    Clear();
+}
+
+bool AssetDecodeQueue::IsEnabled() const
+{
+    if (!enabled_)
+        return false;
+    Urho3D::WorkQueue *workQueue = GetSubsystem<Urho3D::WorkQueue>();
+    return workQueue && workQueue->GetNumThreads() > 0;
+}
+
+void AssetDecodeQueue::Decode(IAsset *asset, const u8 *data, uint numBytes, const SharedPtr<AssetDecodeJob> &job)
+{
+    AssetDecodeData &jobData = job->data;
+    jobData.owner_ = asset->LoadDataOwner();
+    if (jobData.owner_)
+        jobData.buffer_ = data;
+    else
+    {
+        jobData.copy_.Resize(numBytes);
+        if (numBytes)
+            memcpy(&jobData.copy_[0], data, numBytes);
+        jobData.buffer_ = jobData.copy_.Buffer();
+    }
+    jobData.size_ = numBytes;
+    latestJobs_[asset] = job.Get();
+
+    PendingJob pending;
+    pending.key = asset;
+    pending.asset = asset;
+    pending.job = job;
+    pending.item = new Urho3D::WorkItem();
+    pending.item->workFunction_ = DecodeWork;
+    pending.item->start_ = job.Get();
+    // Lowest priority, so that completing the time critical work of the frame does not wait for the decodes
+    pending.item->priority_ = 0;
+    pending_.Push(pending);
+    GetSubsystem<Urho3D::WorkQueue>()->AddWorkItem(pending.item);
+}
+
+void AssetDecodeQueue::Cancel(IAsset *asset)
+{
+    latestJobs_.Erase(asset);
+}
+
+void AssetDecodeQueue::DecodeWork(const Urho3D::WorkItem *item, unsigned /*threadIndex*/)
+{
+    AssetDecodeJob *job = static_cast<AssetDecodeJob*>(item->start_);
+    try
+    {
+        job->decoded = job->Decode();
+    }
+    catch(const std::exception &e)
+    {
+        // Exceptions can not cross the thread boundary, the load is failed on the main thread
+        job->decoded = false;
+        job->error = e.what();
+    }
+    // Free a copy of the data as soon as possible, as many jobs may wait to be finished. Referenced data is released in Update.
+    if (!job->data.owner_)
+    {
+        PODVector<u8> copy;
+        copy.Swap(job->data.copy_);
+        job->data.buffer_ = 0;
+        job->data.size_ = 0;
+    }
+}
+
+void AssetDecodeQueue::Update()
+{
+    if (pending_.Empty())
+        return;
+
+    PROFILE(AssetDecodeQueue_Update);
+
+    Urho3D::HiresTimer timer;
+    const long long budgetUSec = (long long)(frameBudget_ * 1000.0f);
+    uint i = 0;
+    while(i < pending_.Size())
+    {
+        if (!pending_[i].item->completed_)
+        {
+            ++i;
+            continue;
+        }
+
+        // Take the job out before finishing it, as finishing can queue new jobs
+        PendingJob pending = pending_[i];
+        pending_.Erase(i);
+        AssetDecodeData &jobData = pending.job->data;
+        jobData.owner_.Reset();
+        jobData.buffer_ = 0;
+        jobData.size_ = 0;
+        Finish(pending);
+
+        if (timer.GetUSec(false) >= budgetUSec)
+            break;
+    }
+}
+
+void AssetDecodeQueue::Finish(const PendingJob &pending)
+{
+    // Drop the job if the asset has been unloaded, loaded again or destroyed since the job was queued
+    HashMap<IAsset*, AssetDecodeJob*>::Iterator latest = latestJobs_.Find(pending.key);
+    if (latest == latestJobs_.End() || latest->second_ != pending.job.Get())
+        return;
+    latestJobs_.Erase(latest);
+    AssetPtr asset = pending.asset.Lock();
+    if (!asset)
+        return;
+
+    PROFILE(AssetDecodeQueue_Finish);
+    if (!pending.job->decoded)
+    {
+        LogError("AssetDecodeQueue: Failed to decode " + asset->Type() + " '" + asset->Name() + "'" +
+            (pending.job->error.Empty() ? String() : ": " + pending.job->error));
+        owner_->AssetLoadFailed(asset->Name());
+    }
+    else if (!pending.job->Finish(asset.Get()))
+        owner_->AssetLoadFailed(asset->Name());
+}
+
+void AssetDecodeQueue::Clear()
+{
+    if (!pending_.Empty())
+    {
+        // The worker threads refer to the jobs, so wait for them
+        Urho3D::WorkQueue *workQueue = GetSubsystem<Urho3D::WorkQueue>();
+        if (workQueue)
+            workQueue->Complete(0);
+    }
+    pending_.Clear();
+    latestJobs_.Clear();
+}
+
+}
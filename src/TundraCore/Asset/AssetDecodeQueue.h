@@ -0,0 +1,133 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "AssetFwd.h"
+
+#include <Object.h>
+#include <HashMap.h>
+#include <Vector.h>
+
+namespace Urho3D
+{
+    struct WorkItem;
+}
+
+namespace Tundra
+{
+
+/// Asset data decoded by an AssetDecodeJob.
+/** References the data of the asset transfer or the asset cache while it is being decoded, or holds a copy of data that has no owner. */
+class TUNDRACORE_API AssetDecodeData
+{
+public:
+    AssetDecodeData() : buffer_(0), size_(0) {}
+
+    const u8 *Buffer() const { return buffer_; }
+    uint Size() const { return size_; }
+
+private:
+    friend class AssetDecodeQueue;
+
+    const u8 *buffer_;
+    uint size_;
+    /// Keeps the referenced data alive. Only released on the main thread, as reference counts are not atomic.
+    SharedPtr<RefCounted> owner_;
+    /// Copy of data that has no owner.
+    PODVector<u8> copy_;
+};
+
+/// Intermediate state of an asset being loaded on a worker thread. See AssetDecodeQueue.
+/** Asset types that support asynchronous loading subclass this to hold their CPU side representation of the asset data
+    between the decode on a worker thread and the creation of the actual resources on the main thread. */
+class TUNDRACORE_API AssetDecodeJob : public RefCounted
+{
+public:
+    AssetDecodeJob() : decoded(false) {}
+    virtual ~AssetDecodeJob() {}
+
+    /// Decodes @c data to the intermediate representation. Called on a worker thread.
+    /** Must not create GPU resources, log, emit signals, or access the asset, the scene or the asset API.
+        @return False if the data could not be decoded. Set @c error to tell why. */
+    virtual bool Decode() = 0;
+
+    /// Creates the resources of @c asset from the decoded representation. Called on the main thread once Decode has succeeded.
+    /** Like IAsset::DeserializeFromData, has to call AssetAPI::AssetLoadCompleted when successful.
+        @return False if loading failed, in which case AssetAPI::AssetLoadFailed is called. */
+    virtual bool Finish(IAsset *asset) = 0;
+
+    /// The asset data to decode. Released once decoded.
+    AssetDecodeData data;
+    /// Reason of a failed decode.
+    String error;
+    /// Result of Decode.
+    bool decoded;
+};
+
+/// Decodes asset data on the Urho3D worker threads, and finishes the loads on the main thread within a time budget per frame.
+/** IAsset::DeserializeFromData implementations that have a thread safe decode step queue an AssetDecodeJob here when they are
+    allowed to load asynchronously, and return true without loading. The asset then stays unloaded, and its transfer pending,
+    until the job has been finished by Update. Finishing, which typically creates the GPU resources, happens on the main
+    thread in AssetAPI::Update, at most for the duration of the frame budget per frame, but always at least one job.
+
+    Disabled with --noAsyncAssetLoad, or when there are no worker threads. The frame budget in milliseconds is set with --assetDecodeBudget. */
+class TUNDRACORE_API AssetDecodeQueue : public Object
+{
+    OBJECT(AssetDecodeQueue);
+
+public:
+    explicit AssetDecodeQueue(AssetAPI *owner);
+    ~AssetDecodeQueue();
+
+    /// Returns whether asynchronous loads should be queued here.
+    bool IsEnabled() const;
+
+    /// Enables or disables the queue. Already queued jobs are still finished.
+    void SetEnabled(bool enabled) { enabled_ = enabled; }
+
+    /// Sets the time in milliseconds that Update may spend finishing jobs per frame.
+    void SetFrameBudget(float msecs) { frameBudget_ = msecs; }
+    float FrameBudget() const { return frameBudget_; }
+
+    /// Starts decoding @c data in @c job on a worker thread. A previous job of @c asset is canceled.
+    /** The data is referenced if it is kept alive by IAsset::LoadDataOwner, otherwise it is copied. */
+    void Decode(IAsset *asset, const u8 *data, uint numBytes, const SharedPtr<AssetDecodeJob> &job);
+
+    /// Cancels the job of @c asset, if any. Called when the asset is unloaded.
+    void Cancel(IAsset *asset);
+
+    /// Returns the number of jobs being decoded or waiting to be finished.
+    uint NumPending() const { return pending_.Size(); }
+
+    /// Finishes the decoded jobs within the frame budget. Called by AssetAPI::Update.
+    void Update();
+
+    /// Waits for the jobs being decoded, and drops all jobs.
+    void Clear();
+
+private:
+    struct PendingJob
+    {
+        IAsset *key; ///< The asset, only for looking up latestJobs_ even when it has been destroyed.
+        AssetWeakPtr asset;
+        SharedPtr<AssetDecodeJob> job;
+        SharedPtr<Urho3D::WorkItem> item;
+    };
+
+    static void DecodeWork(const Urho3D::WorkItem *item, unsigned threadIndex);
+
+    /// Finishes a job, or fails the load of its asset.
+    void Finish(const PendingJob &pending);
+
+    AssetAPI *owner_;
+    bool enabled_;
+    float frameBudget_;
+    /// Jobs in the order they were queued.
+    Vector<PendingJob> pending_;
+    /// The latest job of each asset. Superseded jobs are dropped when they complete.
+    HashMap<IAsset*, AssetDecodeJob*> latestJobs_;
+};
+
+}
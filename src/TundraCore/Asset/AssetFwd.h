@@ -15,6 +15,11 @@ namespace Tundra
 class Framework;
 class AssetAPI;
 class AssetCache;
+class AssetCachePack;
+class AssetCacheView;
+typedef SharedPtr<AssetCacheView> AssetCacheViewPtr;
+class AssetDecodeQueue;
+class AssetDecodeJob;
 
 class IAsset;
 typedef SharedPtr<IAsset> AssetPtr;
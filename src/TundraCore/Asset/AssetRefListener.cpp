@@ -24,6 +24,11 @@ AssetRefListener::AssetRefListener() :
 {
 }
 
+AssetRefListener::~AssetRefListener()
+{
+    SetAsset(AssetPtr());
+}
+
 AssetPtr AssetRefListener::Asset() const
 {
     return asset.Lock();
@@ -77,7 +82,7 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, String assetRef,
             // Asset is loaded, emit Loaded with 1 msec delay to preserve the logic
             // that HandleAssetRefChange won't emit anything itself as before.
             // Otherwise existing connection can break/be too late after calling this function.
-            asset = loadedAsset;
+            SetAsset(loadedAsset);
             assetApi->GetFramework()->Frame()->DelayedExecute(0.0f).Connect(this, &AssetRefListener::EmitLoaded);
             return;
         }
@@ -109,7 +114,7 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, String assetRef,
     AssetPtr assetData = asset.Lock();
     if (assetData)
         assetData->Loaded.Disconnect(this, &AssetRefListener::OnAssetLoaded);
-    asset = AssetPtr();
+    SetAsset(AssetPtr());
 }
 
 void AssetRefListener::OnTransferSucceeded(AssetPtr assetData)
@@ -118,7 +123,7 @@ void AssetRefListener::OnTransferSucceeded(AssetPtr assetData)
         return;
     
     // Connect to further reloads of the asset to be able to notify of them.
-    asset = assetData;
+    SetAsset(assetData);
     assetData->Loaded.Connect(this, &AssetRefListener::OnAssetLoaded);
     Loaded.Emit(assetData);
 }
@@ -149,13 +154,25 @@ void AssetRefListener::OnAssetCreated(AssetPtr assetData)
 
         // The asset we are waiting for has been created, hook to the IAsset::Loaded signal.
         currentWaitingRef = "";
-        asset = assetData;
+        SetAsset(assetData);
         assetData->Loaded.Connect(this, &AssetRefListener::OnAssetLoaded);
         if (myAssetAPI)
             myAssetAPI->AssetCreated.Disconnect(this, &AssetRefListener::OnAssetCreated);
     }
 }
 
+void AssetRefListener::SetAsset(const AssetPtr &newAsset)
+{
+    AssetPtr oldAsset = asset.Lock();
+    if (oldAsset == newAsset)
+        return;
+    if (oldAsset)
+        oldAsset->RemoveRefListener();
+    asset = newAsset;
+    if (newAsset)
+        newAsset->AddRefListener();
+}
+
 void AssetRefListener::EmitLoaded(float /*time*/)
 {
     AssetPtr currentAsset = asset.Lock();
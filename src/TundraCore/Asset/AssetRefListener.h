@@ -19,6 +19,7 @@ class TUNDRACORE_API AssetRefListener : public RefCounted
 {
 public:
     AssetRefListener();
+    ~AssetRefListener();
 
     /// Issues a new asset request to the given AssetReference.
     /// @param assetRef A pointer to an attribute of type AssetReference.
@@ -50,6 +51,9 @@ private:
     
     void EmitLoaded(float time);
 
+    /// Sets the asset this listener refers to, and updates the ref listener counts of the assets.
+    void SetAsset(const AssetPtr &newAsset);
+
 private:
     AssetAPI *myAssetAPI;
     AssetWeakPtr asset;
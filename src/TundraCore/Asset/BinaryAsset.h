@@ -56,6 +56,17 @@ public:
         return data.Size() > 0;
     }
 
+    uint MemoryUsage() const override
+    {
+        return data.Size();
+    }
+
+    /// Binary assets are often used through their disk source, e.g. scene files.
+    bool RequiresDiskSource() const override
+    {
+        return true;
+    }
+
     Vector<u8> data;
 };
 
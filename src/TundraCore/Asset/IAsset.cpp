@@ -6,16 +6,21 @@
 #include "AssetAPI.h"
 #include "IAssetStorage.h"
 #include "IAssetProvider.h"
+#include "AssetDecodeQueue.h"
+#include "AssetCache.h"
+#include "AssetCachePack.h"
 #include "LoggingFunctions.h"
 
 #include <Profiler.h>
 #include <HashSet.h>
+#include <Timer.h>
 
 namespace Tundra
 {
 
 IAsset::IAsset(AssetAPI *owner, const String &type_, const String &name_) :
-Object(owner->GetContext()), assetAPI(owner), type(type_), name(name_), diskSourceType(Programmatic), modified(false)
+Object(owner->GetContext()), assetAPI(owner), type(type_), name(name_), diskSourceType(Programmatic), modified(false),
+    numRefListeners(0), lastUsed(0), loadDataOwner(0)
 {
     assert(assetAPI);
 }
@@ -38,12 +43,20 @@ void IAsset::SetDiskSourceType(SourceType type)
 bool IAsset::LoadFromCache()
 {
     // If asset did not have dependencies, this causes Loaded() to be emitted
-    bool success = LoadFromFile(DiskSource());
+    bool success = false;
+    AssetCacheViewPtr packed;
+    if (DiskSource().Empty() && assetAPI->Cache() && assetAPI->Cache()->IsPacked(Name()))
+        packed = assetAPI->Cache()->View(Name());
+    if (packed)
+        success = LoadFromFileInMemory(packed->Data(), packed->Size(), false);
+    else
+        success = LoadFromFile(DiskSource());
     if (!success)
         return false;
 
     AssetPtr thisAsset(this);
 
+    assetAPI->NotifyAssetDependenciesChanged(thisAsset);
     if (assetAPI->HasPendingDependencies(thisAsset))
         assetAPI->RequestAssetDependencies(thisAsset);
 
@@ -53,6 +66,9 @@ bool IAsset::LoadFromCache()
 void IAsset::Unload()
 {
 //    LogDebug("IAsset::Unload called for asset \"" + name.toStdString() + "\".");
+    // Drop an asynchronous load in progress, so that it does not complete after this
+    if (assetAPI && assetAPI->DecodeQueue())
+        assetAPI->DecodeQueue()->Cancel(this);
     DoUnload();
     Unloaded.Emit(this);
 }
@@ -179,6 +195,14 @@ bool IAsset::LoadFromFileInMemory(const u8 *data, uint numBytes, bool allowAsync
     return DeserializeFromData(data, numBytes, allowAsynchronous);
 }
 
+bool IAsset::LoadFromFileInMemory(const u8 *data, uint numBytes, bool allowAsynchronous, RefCounted *dataOwner)
+{
+    loadDataOwner = dataOwner;
+    bool success = LoadFromFileInMemory(data, numBytes, allowAsynchronous);
+    loadDataOwner = 0;
+    return success;
+}
+
 void IAsset::DependencyLoaded(AssetPtr dependee)
 {
     // If we are loaded, and this was the last dependency, emit Loaded().
@@ -187,9 +211,23 @@ void IAsset::DependencyLoaded(AssetPtr dependee)
     LoadCompleted();
 }
 
+void IAsset::AddRefListener()
+{
+    ++numRefListeners;
+    lastUsed = Urho3D::Time::GetTimeSinceEpoch();
+}
+
+void IAsset::RemoveRefListener()
+{
+    if (numRefListeners > 0)
+        --numRefListeners;
+    lastUsed = Urho3D::Time::GetTimeSinceEpoch();
+}
+
 void IAsset::LoadCompleted()
 {
     PROFILE(IAsset_LoadCompleted);
+    lastUsed = Urho3D::Time::GetTimeSinceEpoch();
     // If asset was loaded successfully, and there are no pending dependencies, emit Loaded() now.
     AssetPtr thisAsset(this);
     if (IsLoaded() && !assetAPI->HasPendingDependencies(thisAsset))
@@ -62,8 +62,13 @@ public:
     virtual bool LoadFromFile(String filename);
 
     /// Forces a reload of this asset from its disk source. Returns true if loading succeeded, false otherwise.
+    /** If the asset has no disk source, it is loaded from the asset cache, if it is packed there. */
     bool LoadFromCache();
 
+    /// Returns whether the users of this asset need its data in a file of its own, i.e. a disk source.
+    /** If false, the asset cache may pack the asset with others. @note Default implementation returns false. */
+    virtual bool RequiresDiskSource() const { return false; }
+
     /// Unloads this asset from memory.
     /** After calling this function, this asset still can be queried for its Type(), Name() and CacheFile(),
         but its dependencies cannot be determined and it cannot be used in any other way. */
@@ -73,6 +78,22 @@ public:
     /// An asset can be in an unloaded state, to save memory. In this state the asset can be reloaded from its DiskSource() to enable using it.
     virtual bool IsLoaded() const = 0;
 
+    /// Returns an estimate of the memory the loaded asset takes on the CPU and GPU, in bytes.
+    /** Used for the asset memory budget, see AssetAPI::SetMemoryBudget. @note Default implementation returns 0. */
+    virtual uint MemoryUsage() const { return 0; }
+
+    /// Returns the number of AssetRefListeners that refer to this asset.
+    uint NumRefListeners() const { return numRefListeners; }
+
+    /// Called by AssetRefListener when it starts to refer to this asset.
+    void AddRefListener();
+
+    /// Called by AssetRefListener when it stops referring to this asset.
+    void RemoveRefListener();
+
+    /// Returns the time, as seconds since epoch, the asset was last loaded or referred to by an AssetRefListener.
+    uint LastUsed() const { return lastUsed; }
+
     /// Returns true if the asset is empty. An empty asset is unloaded, and has an empty disk source.
     bool IsEmpty() const;
 
@@ -147,6 +168,13 @@ public:
         @return true if loading succeeded, false otherwise. */
     bool LoadFromFileInMemory(const u8 *data, uint numBytes, bool allowAsynchronous = true);
 
+    /// Loads this asset from file data in memory that is kept alive by @c dataOwner.
+    /** Asynchronous loads refer to the data, instead of copying it, until it has been decoded. The data must not be modified while referred to. */
+    bool LoadFromFileInMemory(const u8 *data, uint numBytes, bool allowAsynchronous, RefCounted *dataOwner);
+
+    /// Returns the owner of the data being loaded by LoadFromFileInMemory, or null if the data has no owner. Valid only during DeserializeFromData.
+    RefCounted *LoadDataOwner() const { return loadDataOwner; }
+
     /// Called when this asset is loaded by AssetAPI::AssetLoadCompleted and DependencyLoaded functions.
     /// Emits Loaded() signal if all the dependencies have been loaded, otherwise does nothing.
     void LoadCompleted();
@@ -181,6 +209,7 @@ protected:
     /** The data pointer that is passed in is never null, and numBytes is always greater than zero.
         The allowAsynchronous boolean must be respected, if it is false you should not do asynchronous even if you have a code path for it.
         The parameter is set to false when the requesting code is expecting the asset to be loaded when this function returns.
+        Asynchronous loads can decode the data on a worker thread by queueing an AssetDecodeJob to AssetAPI::DecodeQueue.
         @note Implementation has to call AssetAPI::AssetLoadCompleted after loaded successfully (both synchronous and asynchronous).
         AssetAPI::AssetLoadCompleted can be called inside this function, how ever just returning true is not enough.
         AssetAPI::AssetLoadFailed will be called automatically if false is returned. */
@@ -211,6 +240,15 @@ protected:
     
     /// Modified in memory -status of the asset.
     bool modified;
+
+    /// Number of AssetRefListeners referring to this asset.
+    uint numRefListeners;
+
+    /// Last time the asset was loaded or referred to, as seconds since epoch.
+    uint lastUsed;
+
+    /// Owner of the data being loaded by LoadFromFileInMemory.
+    RefCounted *loadDataOwner;
 };
 
 }
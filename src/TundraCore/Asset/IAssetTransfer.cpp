@@ -4,6 +4,7 @@
 #include "IAssetTransfer.h"
 #include "IAssetProvider.h"
 #include "IAsset.h"
+#include "AssetCachePack.h"
 
 #include "LoggingFunctions.h"
 
@@ -12,6 +13,7 @@ namespace Tundra
 
 IAssetTransfer::IAssetTransfer() : 
     cachingAllowed(true),
+    priority(0),
     diskSourceType(IAsset::Original)
 {
 }
@@ -50,6 +52,11 @@ void IAssetTransfer::EmitAssetFailed(IAssetTransfer* transfer, String reason)
     Failed.Emit(transfer, reason);
 }
 
+void IAssetTransfer::SetPriority(int priority_)
+{
+    priority = priority_;
+}
+
 bool IAssetTransfer::Abort()
 {
     if (provider.Get())
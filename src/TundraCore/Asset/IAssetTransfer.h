@@ -52,14 +52,25 @@ public:
     /// Emits Failed signal with reason.
     void EmitAssetFailed(String reason);
 
-    /// Stores the raw asset bytes for this asset.
+    /// Stores the raw asset bytes for this asset. Asynchronous loads refer to them, so they must not be modified once the transfer has completed.
     Vector<u8> rawAssetData;
 
+    /// Asset data served from the asset cache, loaded instead of rawAssetData if that is empty.
+    AssetCacheViewPtr cachedAssetData;
+
     /// Aborts the transfer immediately. Override this function in a subclass implementation.
     /** @note Default IAssetTransfer implementation logs a not implemented warning and return false.
         @return True if abort was successful, false otherwise. */
     virtual bool Abort();
 
+    /// Sets the priority of the transfer. Transfers with a higher priority are started first. The default priority is 0.
+    /** Has effect only before the transfer has started, and only if the provider supports priorities. Override this function
+        in a subclass implementation to pass the priority to the provider, and call the base implementation. */
+    virtual void SetPriority(int priority);
+
+    /// Returns the priority of the transfer.
+    int Priority() const { return priority; }
+
     /// Set caching behavior and disk source. Can be set after the transfer has been requested to determine disk caching.
     /** Contract between IAssetProvider and AssetAPI: IAssetProvider is expected to call this upon completion of the transfer,
         to specify whether the results of this transfer are allowed to be cached, and to specify an existing local disk source
@@ -112,6 +123,7 @@ public:
 private:
     String diskSource;
     bool cachingAllowed;
+    int priority;
 };
 
 /// Virtual asset transfer for assets that have already been loaded, but are re-requested
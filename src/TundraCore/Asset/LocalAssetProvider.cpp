@@ -20,6 +20,7 @@
 #include <Timer.h>
 #include <StringUtils.h>
 #include <FileWatcher.h>
+#include <WorkQueue.h>
 
 namespace Tundra
 {
@@ -30,10 +31,26 @@ LocalAssetProvider::LocalAssetProvider(Framework* framework_) :
 {
     enableRequestsOutsideStorages = (framework_->HasCommandLineParameter("--acceptUnknownLocalSources") ||
         framework_->HasCommandLineParameter("--accept_unknown_local_sources"));  /**< @todo Remove support for the deprecated underscore version at some point. */
+
+    Urho3D::WorkQueue *workQueue = GetSubsystem<Urho3D::WorkQueue>();
+    parallelReads = workQueue && workQueue->GetNumThreads() > 0 && !framework_->HasCommandLineParameter("--noParallelLocalReads");
+    // Keep the disks busy, but bound the memory held by the reads that have not been handed to the Asset API yet
+    maxActiveReads = 32;
+    bytesRead = 0;
+    periodBytesRead = 0;
+    periodTime = 0.f;
+    readThroughput = 0.f;
 }
 
 LocalAssetProvider::~LocalAssetProvider()
 {
+    // The worker threads refer to the reads, so wait for them
+    if (!activeReads.Empty())
+    {
+        Urho3D::WorkQueue *workQueue = GetSubsystem<Urho3D::WorkQueue>();
+        if (workQueue)
+            workQueue->Complete(0);
+    }
 }
 
 String LocalAssetProvider::Name() const
@@ -104,6 +121,17 @@ bool LocalAssetProvider::AbortTransfer(IAssetTransfer *transfer)
             return true;
         }
     }
+    for (uint i = 0; i < activeReads.Size(); ++i)
+    {
+        if (activeReads[i]->transfer.Get() == transfer)
+        {
+            framework->Asset()->AssetTransferAborted(transfer);
+
+            // The read can not be interrupted, its result is discarded once it finishes
+            activeReads[i]->transfer.Reset();
+            return true;
+        }
+    }
     return false;
 }
 
@@ -158,7 +186,7 @@ String LocalAssetProvider::GetPathForAsset(const String &assetRef, LocalAssetSto
     return "";
 }
 
-void LocalAssetProvider::Update(float /*frametime*/)
+void LocalAssetProvider::Update(float frametime)
 {
     PROFILE(LocalAssetProvider_Update);
 
@@ -170,6 +198,18 @@ void LocalAssetProvider::Update(float /*frametime*/)
     CompletePendingFileUploads();
     CompletePendingFileDownloads();
     CheckForPendingFileSystemChanges();
+
+    // Measure the read throughput only over the time during which there is something to read
+    if (!activeReads.Empty() || !pendingDownloads.Empty() || periodBytesRead > 0)
+    {
+        periodTime += frametime;
+        if (periodTime >= 1.f)
+        {
+            readThroughput = (float)periodBytesRead / periodTime;
+            periodBytesRead = 0;
+            periodTime = 0.f;
+        }
+    }
 }
 
 void LocalAssetProvider::DeleteAssetFromStorage(String assetRef)
@@ -314,76 +354,145 @@ AssetUploadTransferPtr LocalAssetProvider::UploadAssetFromFileInMemory(const u8
     return transfer;
 }
 
-void LocalAssetProvider::CompletePendingFileDownloads()
+bool LocalAssetProvider::ResolveDownloadFile(IAssetTransfer *transfer, String &file, LocalAssetStoragePtr &storage)
 {
-    // If we have any uploads running, first wait for each of them to complete, until we download any more.
-    // This is because we might want to download the same asset that we uploaded, so they must be done in
-    // the proper order.
-    if (pendingUploads.Size() > 0)
+    const String &ref = transfer->source.ref;
+
+    String path_filename;
+    AssetAPI::AssetRefType refType = AssetAPI::ParseAssetRef(ref.Trimmed(), 0, 0, 0, 0, &path_filename);
+
+    if (refType == AssetAPI::AssetRefLocalPath)
+    {
+        file = path_filename;
+    }
+    else // Using a local relative path, like "local://asset.ref" or "asset.ref".
+    {
+        AssetAPI::AssetRefType urlRefType = AssetAPI::ParseAssetRef(path_filename);
+        if (urlRefType == AssetAPI::AssetRefLocalPath)
+            file = path_filename; // 'file://C:/path/to/asset/asset.png'.
+        else // The ref is of form 'file://relativePath/asset.png'.
+        {
+            String path = GetPathForAsset(path_filename, &storage);
+            if (path.Empty())
+            {
+                String reason = "Failed to find local asset with filename \"" + ref + "\"!";
+                framework->Asset()->AssetTransferFailed(transfer, reason);
+                return false;
+            }
+        
+            file = GuaranteeTrailingSlash(path) + path_filename;
+        }
+    }
+    return true;
+}
+
+bool LocalAssetProvider::ReadFile(const String &file, Vector<u8> &dst, String &error)
+{
+    // To open Urho files, need access to the Context. Abuse Framework static accessor
+    Urho3D::File source(Framework::Instance()->GetContext(), file, Urho3D::FILE_READ);
+    if (!source.IsOpen())
+    {
+        error = "could not open file";
+        return false;
+    }
+    // Read straight to the final buffer, so that the data is not copied before handing it to the Asset API
+    unsigned fileSize = source.GetSize();
+    dst.Resize(fileSize);
+    if (fileSize > 0 && source.Read(&dst[0], fileSize) < fileSize)
+    {
+        error = "could not read all of the " + String(fileSize) + " bytes";
+        dst.Clear();
+        return false;
+    }
+    return true;
+}
+
+void LocalAssetProvider::ReadFileWork(const Urho3D::WorkItem *item, unsigned /*threadIndex*/)
+{
+    FileRead *read = static_cast<FileRead*>(item->start_);
+    read->success = ReadFile(read->file, read->data, read->error);
+}
+
+void LocalAssetProvider::CompleteFileDownload(FileRead *read)
+{
+    IAssetTransfer *transfer = read->transfer.Get();
+    if (!read->success)
+    {
+        String reason = "Failed to read asset data for asset \"" + transfer->source.ref + "\" from file \"" + read->file + "\"";
+        if (!read->error.Empty())
+            reason += ": " + read->error;
+        framework->Asset()->AssetTransferFailed(transfer, reason);
         return;
+    }
 
+    bytesRead += read->data.Size();
+    periodBytesRead += read->data.Size();
+    transfer->rawAssetData.Swap(read->data);
+
+    // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
+    // as a disk source, rather than generating a cache file for it.
+    transfer->SetCachingBehavior(false, read->file);
+    transfer->storage = read->storage;
+
+    // Signal the Asset API that this asset is now successfully downloaded.
+    framework->Asset()->AssetTransferCompleted(transfer);
+}
+
+void LocalAssetProvider::CompletePendingFileDownloads()
+{
     const int maxLoadMSecs = 16;
     Urho3D::HiresTimer downloadTimer;
 
-    while(pendingDownloads.Size() > 0)
+    // Hand the finished reads to the Asset API, which loads the assets. Throttle to at most 16 msecs/frame.
+    for(uint i = 0; i < activeReads.Size();)
     {
+        FileReadPtr read = activeReads[i];
+        if (!read->item->completed_)
+        {
+            ++i;
+            continue;
+        }
+        activeReads.Erase(i);
+        if (!read->transfer)
+            continue; // Aborted
+
         PROFILE(LocalAssetProvider_ProcessPendingDownload);
+        CompleteFileDownload(read);
+        if (downloadTimer.GetUSec(false) / 1000 > maxLoadMSecs)
+            return;
+    }
+
+    // If we have any uploads running, first wait for each of them to complete, until we download any more.
+    // This is because we might want to download the same asset that we uploaded, so they must be done in
+    // the proper order.
+    if (pendingUploads.Size() > 0)
+        return;
 
+    while(pendingDownloads.Size() > 0 && (!parallelReads || activeReads.Size() < maxActiveReads))
+    {
         AssetTransferPtr transfer = pendingDownloads.Back();
         pendingDownloads.Pop();
-            
-        String ref = transfer->source.ref;
 
-        String path_filename;
-        String file;
-        AssetAPI::AssetRefType refType = AssetAPI::ParseAssetRef(ref.Trimmed(), 0, 0, 0, 0, &path_filename);
-
-        LocalAssetStoragePtr storage;
-
-        if (refType == AssetAPI::AssetRefLocalPath)
-        {
-            file = path_filename;
-        }
-        else // Using a local relative path, like "local://asset.ref" or "asset.ref".
-        {
-            AssetAPI::AssetRefType urlRefType = AssetAPI::ParseAssetRef(path_filename);
-            if (urlRefType == AssetAPI::AssetRefLocalPath)
-                file = path_filename; // 'file://C:/path/to/asset/asset.png'.
-            else // The ref is of form 'file://relativePath/asset.png'.
-            {
-                String path = GetPathForAsset(path_filename, &storage);
-                if (path.Empty())
-                {
-                    String reason = "Failed to find local asset with filename \"" + ref + "\"!";
-                    framework->Asset()->AssetTransferFailed(transfer.Get(), reason);
-                    // Also throttle asset loading here. This is needed in the case we have a lot of failed refs.
-                    //if (GetCurrentClockTime() - startTime >= GetCurrentClockFreq() * maxLoadMSecs / 1000)
-                    //    break;
-                    continue;
-                }
-            
-                file = GuaranteeTrailingSlash(path) + path_filename;
-            }
-        }
+        FileReadPtr read(new FileRead());
+        if (!ResolveDownloadFile(transfer, read->file, read->storage))
+            continue;
+        read->transfer = transfer;
 
-        bool success = LoadFileToVector(file, transfer->rawAssetData);
-        if (!success)
+        if (parallelReads)
         {
-            String reason = "Failed to read asset data for asset \"" + ref + "\" from file \"" + file + "\"";
-            framework->Asset()->AssetTransferFailed(transfer.Get(), reason);
-            // Also throttle asset loading here. This is needed in the case we have a lot of failed refs.
-            if (downloadTimer.GetUSec(false) / 1000 > maxLoadMSecs)
-                break;
+            read->item = new Urho3D::WorkItem();
+            read->item->workFunction_ = ReadFileWork;
+            read->item->start_ = read.Get();
+            // Lowest priority, so that completing the time critical work of the frame does not wait for the reads
+            read->item->priority_ = 0;
+            activeReads.Push(read);
+            GetSubsystem<Urho3D::WorkQueue>()->AddWorkItem(read->item);
             continue;
         }
-        
-        // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
-        // as a disk source, rather than generating a cache file for it.
-        transfer->SetCachingBehavior(false, file);
-        transfer->storage = storage;
 
-        // Signal the Asset API that this asset is now successfully downloaded.
-        framework->Asset()->AssetTransferCompleted(transfer.Get());
+        PROFILE(LocalAssetProvider_ProcessPendingDownload);
+        read->success = ReadFile(read->file, read->data, read->error);
+        CompleteFileDownload(read);
 
         // Throttle asset loading to at most 16 msecs/frame.
         if (downloadTimer.GetUSec(false) / 1000 > maxLoadMSecs)
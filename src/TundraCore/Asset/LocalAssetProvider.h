@@ -6,6 +6,11 @@
 #include "IAssetProvider.h"
 #include "AssetFwd.h"
 
+namespace Urho3D
+{
+    struct WorkItem;
+}
+
 namespace Tundra
 {
 
@@ -51,7 +56,46 @@ public:
     /// IAssetProvider override.
     AssetUploadTransferPtr UploadAssetFromFileInMemory(const u8 *data, uint numBytes, AssetStoragePtr destination, const String &assetName) override;
 
+    /// Returns the number of downloads waiting for a file read to be started.
+    uint NumQueuedDownloads() const { return pendingDownloads.Size(); }
+
+    /// Returns the number of file reads in progress on the worker threads, or waiting to be handed to the Asset API.
+    uint NumActiveReads() const { return activeReads.Size(); }
+
+    /// Returns the number of bytes read from disk for downloads so far.
+    unsigned long long BytesRead() const { return bytesRead; }
+
+    /// Returns the read throughput in bytes per second, measured over the last second during which files were read.
+    float ReadThroughput() const { return readThroughput; }
+
 private:
+    /// A file read of a download, done on a worker thread.
+    struct FileRead : public RefCounted
+    {
+        FileRead() : success(false) {}
+
+        AssetTransferPtr transfer; ///< Null if the transfer has been aborted during the read.
+        LocalAssetStoragePtr storage;
+        String file;
+        Vector<u8> data;
+        String error;
+        bool success;
+        SharedPtr<Urho3D::WorkItem> item;
+    };
+    typedef SharedPtr<FileRead> FileReadPtr;
+
+    static void ReadFileWork(const Urho3D::WorkItem *item, unsigned threadIndex);
+
+    /// Reads @c file fully into @c dst, describing a failure in @c error. Can be called on a worker thread:
+    /// Urho3D::File logs open failures itself, and Urho3D's Log queues the messages of other threads to the main thread.
+    static bool ReadFile(const String &file, Vector<u8> &dst, String &error);
+
+    /// Finds the file of a download. Fails the transfer if the file is not found.
+    bool ResolveDownloadFile(IAssetTransfer *transfer, String &file, LocalAssetStoragePtr &storage);
+
+    /// Hands the data of a finished read to the Asset API, or fails the transfer.
+    void CompleteFileDownload(FileRead *read);
+
     /// IAssetProvider override.
     AssetStoragePtr TryCreateStorage(HashMap<String, String> &storageParams, bool fromNetwork) override;
 
@@ -82,6 +126,17 @@ private:
     /// If true, assets outside any known local storages are allowed. Otherwise, requests to them will fail.
     bool enableRequestsOutsideStorages;
 
+    /// If true, files are read on the worker threads, otherwise on the main thread.
+    bool parallelReads;
+    /// Maximum number of reads in progress at once.
+    uint maxActiveReads;
+    Vector<FileReadPtr> activeReads;
+    unsigned long long bytesRead;
+    /// Bytes read during the current throughput measurement period.
+    unsigned long long periodBytesRead;
+    float periodTime;
+    float readThroughput;
+
     void OnFileChanged(const String &path);
     void OnDirectoryChanged(const String &path);
 };
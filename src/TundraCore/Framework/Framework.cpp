@@ -53,7 +53,7 @@ int run(int argc_, char** argv_)
     fw.Go();
     fw.Uninitialize();
 
-    return 0;
+    return fw.ExitCode();
 }
 
 void set_run_args(int argc_, char** argv_)
@@ -65,6 +65,7 @@ void set_run_args(int argc_, char** argv_)
 Framework::Framework(Context* ctx) :
     Object(ctx),
     exitSignal(false),
+    exitCode(0),
     headless(false),
     renderer(0)
 {
@@ -127,6 +127,12 @@ public:
     /// Cancel exit request.
     void CancelExit();
 
+    /// Sets the exit code of the process, returned by run(). The default is 0.
+    void SetExitCode(int code) { exitCode = code; }
+
+    /// Returns the exit code of the process.
+    int ExitCode() const { return exitCode; }
+
     /// Return whether is headless (no rendering)
     bool IsHeadless() const { return headless; }
 
@@ -228,6 +234,8 @@ private:
     Vector<String> configFiles;
     /// Exiting flag. When raised, the Framework will exit on the next main loop iteration
     bool exitSignal;
+    /// Exit code of the process
+    int exitCode;
     /// Headless flag. When headless, no rendering window is created
     bool headless;
     /// Renderer object
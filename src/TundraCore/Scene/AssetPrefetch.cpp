@@ -0,0 +1,301 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "AssetPrefetch.h"
+#include "SceneDesc.h"
+#include "Scene.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+#include "AttributeMetadata.h"
+#include "AssetAPI.h"
+#include "IAsset.h"
+#include "IAssetTypeFactory.h"
+#include "IAssetTransfer.h"
+#include "NullAssetFactory.h"
+#include "Math/Transform.h"
+
+#include <Profiler.h>
+#include <Sort.h>
+
+#include <cfloat>
+
+namespace Tundra
+{
+
+static bool ItemLess(const AssetPrefetch::Item &lhs, const AssetPrefetch::Item &rhs)
+{
+    if (lhs.typePriority != rhs.typePriority)
+        return lhs.typePriority < rhs.typePriority;
+    if (lhs.distanceSq != rhs.distanceSq)
+        return lhs.distanceSq < rhs.distanceSq;
+    return lhs.order < rhs.order;
+}
+
+/// Returns whether the type name of a component is @c typeName, with or without the "EC_" prefix.
+static bool IsComponentType(const String &componentTypeName, const String &typeName)
+{
+    return IComponent::EnsureTypeNameWithoutPrefix(componentTypeName).Compare(typeName, false) == 0;
+}
+
+/// Returns the position of an entity description from its Placeable, if it has one.
+static bool DescPosition(const EntityDesc &entity, float3 &position)
+{
+    for(uint i = 0; i < entity.components.Size(); ++i)
+    {
+        const ComponentDesc &comp = entity.components[i];
+        if (!IsComponentType(comp.typeName, "Placeable"))
+            continue;
+        for(uint j = 0; j < comp.attributes.Size(); ++j)
+            if (comp.attributes[j].id.Compare("transform", false) == 0)
+            {
+                position = Transform::FromString(comp.attributes[j].value).pos;
+                return true;
+            }
+    }
+    return false;
+}
+
+/// Returns the position of an entity from its Placeable, if it has one.
+static bool EntityPosition(Entity *entity, float3 &position)
+{
+    ComponentPtr placeable = entity->Component("Placeable");
+    IAttribute *transform = (placeable ? placeable->AttributeById("transform") : 0);
+    if (!transform || transform->TypeId() != IAttribute::TransformId)
+        return false;
+    position = static_cast<Attribute<Transform>*>(transform)->Get().pos;
+    return true;
+}
+
+/// Returns the position of the first camera in @c entities or their children.
+static bool FindCamera(const EntityDescList &entities, float3 &position)
+{
+    for(uint i = 0; i < entities.Size(); ++i)
+    {
+        const EntityDesc &entity = entities[i];
+        for(uint j = 0; j < entity.components.Size(); ++j)
+            if (IsComponentType(entity.components[j].typeName, "Camera") && DescPosition(entity, position))
+                return true;
+        if (FindCamera(entity.children, position))
+            return true;
+    }
+    return false;
+}
+
+AssetPrefetch::AssetPrefetch(AssetAPI *assetAPI) :
+    assetAPI_(assetAPI),
+    hasViewPosition_(false)
+{
+}
+
+void AssetPrefetch::SetViewPosition(const float3 &position)
+{
+    viewPosition_ = position;
+    hasViewPosition_ = true;
+}
+
+bool AssetPrefetch::SetViewPositionFromCamera(Scene *scene)
+{
+    EntityVector cameras = scene->EntitiesWithComponent("Camera");
+    for(uint i = 0; i < cameras.Size(); ++i)
+    {
+        float3 position;
+        if (EntityPosition(cameras[i].Get(), position))
+        {
+            SetViewPosition(position);
+            return true;
+        }
+    }
+    return false;
+}
+
+void AssetPrefetch::Collect(const SceneDesc &desc)
+{
+    PROFILE(AssetPrefetch_CollectSceneDesc);
+
+    if (!hasViewPosition_)
+    {
+        float3 cameraPosition;
+        if (FindCamera(desc.entities, cameraPosition))
+            SetViewPosition(cameraPosition);
+    }
+
+    // Walk the entities depth first without recursion, as the hierarchies can be deep
+    PODVector<const EntityDesc*> stack;
+    for(uint i = desc.entities.Size(); i > 0; --i)
+        stack.Push(&desc.entities[i - 1]);
+    while(!stack.Empty())
+    {
+        const EntityDesc *entity = stack.Back();
+        stack.Pop();
+
+        float3 position;
+        const bool hasPosition = DescPosition(*entity, position);
+        for(uint i = 0; i < entity->components.Size(); ++i)
+        {
+            const AttributeDescList &attributes = entity->components[i].attributes;
+            for(uint j = 0; j < attributes.Size(); ++j)
+            {
+                const AttributeDesc &attr = attributes[j];
+                if (attr.typeName.Compare(IAttribute::AssetReferenceTypeName, false) == 0 ||
+                    attr.typeName.Compare(IAttribute::AssetReferenceListTypeName, false) == 0)
+                    AddAttributeValue(attr.value, "", hasPosition ? &position : 0);
+            }
+        }
+
+        for(uint i = entity->children.Size(); i > 0; --i)
+            stack.Push(&entity->children[i - 1]);
+    }
+}
+
+void AssetPrefetch::Collect(Entity *entity)
+{
+    if (!entity)
+        return;
+
+    float3 position;
+    const bool hasPosition = EntityPosition(entity, position);
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::ConstIterator iter = components.Begin(); iter != components.End(); ++iter)
+    {
+        const AttributeVector &attributes = iter->second_->Attributes();
+        for(uint i = 0; i < attributes.Size(); ++i)
+        {
+            IAttribute *attr = attributes[i];
+            if (!attr)
+                continue;
+
+            if (attr->TypeId() == IAttribute::AssetReferenceId)
+                Add(static_cast<Attribute<AssetReference>*>(attr)->Get(), hasPosition ? &position : 0);
+            else if (attr->TypeId() == IAttribute::AssetReferenceListId)
+            {
+                const AssetReferenceList &list = static_cast<Attribute<AssetReferenceList>*>(attr)->Get();
+                for(uint j = 0; j < list.refs.Size(); ++j)
+                    Add(list.refs[j].type.Empty() ? AssetReference(list.refs[j].ref, list.type) : list.refs[j], hasPosition ? &position : 0);
+            }
+            else if (attr->Metadata() && attr->Metadata()->elementType.Compare(IAttribute::AssetReferenceTypeName, false) == 0)
+                AddAttributeValue(attr->ToString(), "", hasPosition ? &position : 0);
+        }
+    }
+}
+
+void AssetPrefetch::AddAttributeValue(const String &value, const String &type, const float3 *position)
+{
+    // Multiple references are separated with ';'
+    StringVector refs = value.Split(';');
+    for(uint i = 0; i < refs.Size(); ++i)
+        Add(AssetReference(refs[i].Trimmed(), type), position);
+}
+
+void AssetPrefetch::Add(const AssetReference &ref, const float3 *position)
+{
+    if (ref.ref.Empty())
+        return;
+
+    const String key = ref.ref.ToLower();
+    HashMap<String, uint>::ConstIterator existing = indices_.Find(key);
+    if (existing != indices_.End())
+    {
+        Item &item = items_[existing->second_];
+        if (!item.hasPosition && position)
+        {
+            item.position = *position;
+            item.hasPosition = true;
+        }
+        return;
+    }
+
+    // Skip the types that can not be loaded, the components would not request them either.
+    const String type = assetAPI_->ResourceTypeForAssetRef(ref);
+    AssetTypeFactoryPtr factory = assetAPI_->AssetTypeFactory(type);
+    if (!factory || dynamic_cast<NullAssetFactory*>(factory.Get()))
+        return;
+
+    Item item;
+    item.ref = ref.ref;
+    item.type = type;
+    item.typePriority = TypePriority(type);
+    item.position = (position ? *position : float3::zero);
+    item.hasPosition = (position != 0);
+    item.distanceSq = 0.f;
+    item.order = items_.Size();
+    indices_[key] = items_.Size();
+    items_.Push(item);
+}
+
+void AssetPrefetch::Sort()
+{
+    PROFILE(AssetPrefetch_Sort);
+
+    for(uint i = 0; i < items_.Size(); ++i)
+    {
+        Item &item = items_[i];
+        if (!hasViewPosition_)
+            item.distanceSq = 0.f;
+        else
+            item.distanceSq = (item.hasPosition ? item.position.DistanceSq(viewPosition_) : FLT_MAX);
+    }
+    Urho3D::Sort(items_.Begin(), items_.End(), ItemLess);
+
+    indices_.Clear();
+    for(uint i = 0; i < items_.Size(); ++i)
+        indices_[items_[i].ref.ToLower()] = i;
+}
+
+uint AssetPrefetch::Request()
+{
+    PROFILE(AssetPrefetch_Request);
+
+    uint numRequests = 0;
+    for(uint i = 0; i < items_.Size(); ++i)
+    {
+        const Item &item = items_[i];
+        AssetPtr existing = assetAPI_->FindAsset(item.ref);
+        if (existing && existing->IsLoaded())
+            continue;
+        if (assetAPI_->PendingTransfer(assetAPI_->ResolveAssetRef("", item.ref)))
+            continue;
+        AssetTransferPtr transfer = assetAPI_->RequestAsset(item.ref, item.type);
+        if (transfer)
+        {
+            transfer->SetPriority(RequestPriority);
+            ++numRequests;
+        }
+    }
+    return numRequests;
+}
+
+String AssetPrefetch::SerializeManifest() const
+{
+    String manifest;
+    for(uint i = 0; i < items_.Size(); ++i)
+        manifest += items_[i].type + "\t" + items_[i].ref + "\n";
+    return manifest;
+}
+
+void AssetPrefetch::DeserializeManifest(const String &manifest)
+{
+    StringVector lines = manifest.Split('\n');
+    for(uint i = 0; i < lines.Size(); ++i)
+    {
+        const String line = lines[i].Trimmed();
+        const unsigned separator = line.Find('\t');
+        if (separator == String::NPOS)
+            Add(AssetReference(line), 0);
+        else
+            Add(AssetReference(line.Substring(separator + 1).Trimmed(), line.Substring(0, separator)), 0);
+    }
+}
+
+int AssetPrefetch::TypePriority(const String &assetType)
+{
+    if (assetType.Contains("Mesh", false))
+        return 0;
+    if (assetType.Contains("Material", false))
+        return 1;
+    if (assetType.Contains("Texture", false))
+        return 3;
+    return 2;
+}
+
+}
@@ -0,0 +1,98 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AssetPrefetch.h
+    @brief  Requests the assets of new scene content up front. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "AssetFwd.h"
+#include "AssetReference.h"
+#include "Math/float3.h"
+
+#include <HashMap.h>
+
+namespace Tundra
+{
+
+/// Collects the asset references of scene content and requests them before the components do.
+/** Without a prefetch, the assets of new content are discovered one at a time, as the components of the entities
+    react to their change signals, and the dependencies of each asset are discovered only once it has loaded.
+    A prefetch walks the attributes of the content first, and requests every referred asset at once, meshes and
+    materials first, and then by distance from the view position, so that the providers start with what is seen first.
+
+    Scene runs a prefetch for the content created by CreateContentFromXml, CreateContentFromBinary and
+    CreateContentFromSceneDesc when the scene view is enabled. Disable with --noAssetPrefetch.
+
+    The sorted references can also be written to a manifest, see SerializeManifest. */
+class TUNDRACORE_API AssetPrefetch
+{
+public:
+    /// A collected asset reference.
+    struct Item
+    {
+        String ref; ///< The asset reference.
+        String type; ///< The asset type, resolved from the reference if it did not have one.
+        int typePriority; ///< Lower is requested first.
+        float3 position; ///< Position of the first referring entity that has one.
+        bool hasPosition;
+        float distanceSq; ///< Squared distance from the view position, set by Sort.
+        uint order; ///< Order of collection, to keep the sort stable.
+    };
+
+    explicit AssetPrefetch(AssetAPI *assetAPI);
+
+    /// Sets the position the distances are measured from.
+    /** Without a view position the references are ordered by type only. Collect(const SceneDesc&) uses the position
+        of the first camera in the description, if no position has been set. */
+    void SetViewPosition(const float3 &position);
+    bool HasViewPosition() const { return hasViewPosition_; }
+    /// Sets the view position to the position of the first camera entity of @c scene.
+    /** @return False if the scene has no camera with a position. */
+    bool SetViewPositionFromCamera(Scene *scene);
+
+    /// Collects the asset references of the entities of @c desc, and their children.
+    void Collect(const SceneDesc &desc);
+    /// Collects the asset references of the components of @c entity. Does not recurse to the children.
+    void Collect(Entity *entity);
+
+    /// Sorts the collected references into the request order.
+    void Sort();
+
+    /// Priority of the prefetch requests, lower than the default, so that the assets the components request are transferred first.
+    /** A prefetch request is raised to the default priority if a component requests the same asset before it has started. */
+    static const int RequestPriority = -1;
+
+    /// Requests the collected assets that are not already loaded or being transferred, in the current order.
+    /** @return Number of requests made. */
+    uint Request();
+
+    /// Returns the collected references.
+    const Vector<Item> &Items() const { return items_; }
+
+    /// Returns the collected references as a manifest, one "type<tab>ref" line per asset, in the current order.
+    String SerializeManifest() const;
+    /// Adds the references of a manifest written by SerializeManifest, in the order of the manifest.
+    void DeserializeManifest(const String &manifest);
+
+    /// Returns the priority of an asset type: meshes first, then materials, then other assets, textures last.
+    static int TypePriority(const String &assetType);
+
+private:
+    /// Adds a reference. @c position is null if the referring entity has no known position.
+    void Add(const AssetReference &ref, const float3 *position);
+    /// Adds the references in the value of an attribute.
+    void AddAttributeValue(const String &value, const String &type, const float3 *position);
+
+    AssetAPI *assetAPI_;
+    Vector<Item> items_;
+    /// Index of each collected reference in items_, by lowercase ref.
+    HashMap<String, uint> indices_;
+    float3 viewPosition_;
+    bool hasViewPosition_;
+};
+
+}
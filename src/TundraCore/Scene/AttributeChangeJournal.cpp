@@ -0,0 +1,65 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AttributeChangeJournal.cpp
+    @brief  Log of the attribute changes of a frame, grouped per component. */
+
+#include "StableHeaders.h"
+
+#include "AttributeChangeJournal.h"
+#include "IComponent.h"
+
+#include <cstring>
+
+namespace Tundra
+{
+
+bool AttributeChangeJournal::ComponentChanges::HasReplicated() const
+{
+    for (unsigned i = 0; i < sizeof(replicated); ++i)
+        if (replicated[i])
+            return true;
+    return false;
+}
+
+AttributeChangeJournal::AttributeChangeJournal()
+{
+}
+
+AttributeChangeJournal::~AttributeChangeJournal()
+{
+    Clear();
+}
+
+void AttributeChangeJournal::Add(IComponent *comp, u8 attrIndex, AttributeChange::Type change)
+{
+    // The component remembers its record, so grouping the changes needs no lookup
+    if (comp->journal_ != this || comp->journalIndex_ >= changes_.Size() || changes_[comp->journalIndex_].component.Get() != comp)
+    {
+        comp->journal_ = this;
+        comp->journalIndex_ = changes_.Size();
+        changes_.Resize(changes_.Size() + 1);
+        ComponentChanges &record = changes_.Back();
+        record.component = comp;
+        memset(record.changed, 0, sizeof(record.changed));
+        memset(record.replicated, 0, sizeof(record.replicated));
+    }
+
+    ComponentChanges &record = changes_[comp->journalIndex_];
+    record.changed[attrIndex >> 3] |= (1 << (attrIndex & 7));
+    if (change == AttributeChange::Replicate)
+        record.replicated[attrIndex >> 3] |= (1 << (attrIndex & 7));
+}
+
+void AttributeChangeJournal::Clear()
+{
+    for (unsigned i = 0; i < changes_.Size(); ++i)
+    {
+        IComponent *comp = changes_[i].component.Get();
+        if (comp && comp->journal_ == this)
+            comp->journal_ = 0;
+    }
+    changes_.Clear();
+}
+
+}
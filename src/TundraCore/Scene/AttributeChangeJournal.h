@@ -0,0 +1,64 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AttributeChangeJournal.h
+    @brief  Log of the attribute changes of a frame, grouped per component. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <Vector.h>
+
+namespace Tundra
+{
+
+/// Log of the attribute changes of a scene, collected while attribute change batching is enabled. See Scene::SetAttributeChangeBatching.
+/** The changes are grouped per component as they are added: a component has at most one record in the journal, and its
+    record has bitmasks of the changed attributes indexed by the attribute index. A change of an attribute that is already
+    in the journal only sets its bits again, so a value written many times per frame is dispatched once on the flush.
+
+    Records of the components that are destroyed before the flush are left in the journal with a null component. */
+class TUNDRACORE_API AttributeChangeJournal
+{
+public:
+    /// Attribute changes of one component.
+    struct ComponentChanges
+    {
+        ComponentWeakPtr component; ///< The changed component, null if it has been destroyed.
+        u8 changed[32]; ///< Bitmask of attributes changed with LocalOnly or Replicate.
+        u8 replicated[32]; ///< Bitmask of attributes changed at least once with Replicate.
+
+        bool IsChanged(u8 attrIndex) const { return (changed[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0; }
+        bool IsReplicated(u8 attrIndex) const { return (replicated[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0; }
+        /// Returns the change type the attribute at @c attrIndex should be signaled with.
+        AttributeChange::Type ChangeType(u8 attrIndex) const { return IsReplicated(attrIndex) ? AttributeChange::Replicate : AttributeChange::LocalOnly; }
+        /// Returns whether any of the changes should be replicated.
+        bool HasReplicated() const;
+    };
+
+    AttributeChangeJournal();
+    ~AttributeChangeJournal();
+
+    /// Adds a change of the attribute at @c attrIndex of @c comp.
+    /** @param change LocalOnly or Replicate. */
+    void Add(IComponent *comp, u8 attrIndex, AttributeChange::Type change);
+
+    /// Removes all records.
+    void Clear();
+
+    /// Returns the number of changed components.
+    unsigned Size() const { return changes_.Size(); }
+    bool Empty() const { return changes_.Empty(); }
+
+    /// Returns the changes of the component at @c index, in the order the components were first changed.
+    const ComponentChanges &operator[](unsigned index) const { return changes_[index]; }
+
+private:
+    Vector<ComponentChanges> changes_;
+};
+
+}
@@ -56,6 +56,7 @@ public:
     void SerializeToBinary(kNet::DataSerializer& dest) const override;
     void DeserializeFromBinary(kNet::DataDeserializer& source, AttributeChange::Type change) override;
     bool SupportsDynamicAttributes() const override { return true; }
+    bool HasDefaultDeserialization() const override { return false; }
 
     /// A factory method that constructs a new attribute of a given the type name.
     /** @param typeName Type name of the attribute, see SceneAPI::AttributeTypes().
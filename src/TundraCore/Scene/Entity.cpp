@@ -19,6 +19,9 @@
 namespace Tundra
 {
 
+/// Components larger than this can not be serialized to binary.
+static const uint cMaxBinaryComponentSize = 64 * 1024 * 1024;
+
 Entity::Entity(Framework* framework, entity_id_t id, bool temporary, Scene* scene) :
     Object(framework->GetContext()),
     framework_(framework),
@@ -412,13 +415,26 @@ void Entity::SerializeToBinary(kNet::DataSerializer &dst, bool serializeTemporar
         dst.AddString(comp->Name().CString());
         dst.Add<u8>(comp->IsReplicated() ? 1 : 0);
 
-        // Write each component to a separate buffer, then write out its size first, so we can skip unknown components
+        // Write each component to a separate buffer, then write out its size first, so we can skip unknown components.
+        // Start with 64KB, and grow the buffer until the component fits.
         PODVector<unsigned char> comp_bytes;
-        // Assume 64KB max per component for now
         comp_bytes.Resize(64 * 1024);
-        kNet::DataSerializer comp_dest((char*)&comp_bytes[0], comp_bytes.Size());
-        comp->SerializeToBinary(comp_dest);
-        comp_bytes.Resize(static_cast<uint>(comp_dest.BytesFilled()));
+        for(;;)
+        {
+            try
+            {
+                kNet::DataSerializer comp_dest((char*)&comp_bytes[0], comp_bytes.Size());
+                comp->SerializeToBinary(comp_dest);
+                comp_bytes.Resize(static_cast<uint>(comp_dest.BytesFilled()));
+                break;
+            }
+            catch(...)
+            {
+                if (comp_bytes.Size() >= cMaxBinaryComponentSize)
+                    throw;
+                comp_bytes.Resize(comp_bytes.Size() * 2);
+            }
+        }
         
         dst.Add<u32>(comp_bytes.Size());
         if (comp_bytes.Size())
@@ -429,7 +445,7 @@ void Entity::SerializeToBinary(kNet::DataSerializer &dst, bool serializeTemporar
     if (serializeChildren)
     {
         foreach(const EntityPtr child, serializableChildren)
-            child->SerializeToBinary(dst, serializeTemporary, true);
+            child->SerializeToBinary(dst, serializeTemporary, serializeLocal, true);
     }
 }
 
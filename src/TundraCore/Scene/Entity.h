@@ -380,6 +380,10 @@ public:
     /// Returns if parent entity is set.
     bool HasParent() const { return parent_.Get() != nullptr; }
 
+    /// Returns parent entity of this entity as a raw pointer, or null if entity is on the root level.
+    /** Unlike Parent(), does not modify the reference count of the parent. Used when reading the scene from worker threads. */
+    Entity *ParentPtr() const { return parent_.Get(); }
+
     /// Returns number of child entities.
     uint NumChildren() const { return children_.Size(); }
 
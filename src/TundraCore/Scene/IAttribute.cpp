@@ -25,6 +25,7 @@
 #include "LoggingFunctions.h"
 
 #include <StringUtils.h>
+#include <Engine/Core/Mutex.h>
 
 #include <kNet/DataDeserializer.h>
 #include <kNet/DataSerializer.h>
@@ -33,31 +34,40 @@ namespace Tundra
 {
 
 IAttribute::IAttribute(IComponent* owner_, const char* id_) :
-    id(id_),
-    name(id_),
+    ownId(owner_ ? nullptr : new String(id_)),
+    ownName(nullptr),
     metadata(nullptr),
     dynamic(false),
     owner(nullptr),
     index(0),
     valueChanged(true)
 {
+    id = (ownId ? ownId : &SharedString(id_));
+    name = id;
     if (owner_)
         owner_->AddAttribute(this);
 }
 
 IAttribute::IAttribute(IComponent* owner_, const char* id_, const char* name_) :
-    id(id_),
-    name(name_),
+    ownId(owner_ ? nullptr : new String(id_)),
+    ownName(owner_ ? nullptr : new String(name_)),
     metadata(nullptr),
     dynamic(false),
     owner(nullptr),
     index(0),
     valueChanged(true)
 {
+    id = (ownId ? ownId : &SharedString(id_));
+    name = (ownName ? ownName : &SharedString(name_));
     if (owner_)
         owner_->AddAttribute(this);
 }
 
+IAttribute::~IAttribute()
+{
+    delete ownId;
+    delete ownName;
+}
 
 void IAttribute::Changed(AttributeChange::Type change)
 {
@@ -67,7 +77,29 @@ void IAttribute::Changed(AttributeChange::Type change)
 
 void IAttribute::SetName(const String& newName)
 {
-    name = newName;
+    if (ownName)
+        *ownName = newName;
+    else
+        ownName = new String(newName);
+    name = ownName;
+}
+
+const String &IAttribute::SharedString(const char *str)
+{
+    // Keyed by the address, so the lookup neither hashes nor compares the characters.
+    // Copies are allocated separately so that they do not move when the table grows.
+    static Urho3D::Mutex mutex;
+    static HashMap<const char*, String*> strings;
+
+    if (!str)
+        str = "";
+    Urho3D::MutexLock lock(mutex);
+    HashMap<const char*, String*>::ConstIterator iter = strings.Find(str);
+    if (iter != strings.End())
+        return *iter->second_;
+    String *copy = new String(str);
+    strings[str] = copy;
+    return *copy;
 }
 
 void IAttribute::SetMetadata(AttributeMetadata *meta)
@@ -22,26 +22,26 @@ class TUNDRACORE_API IAttribute
 {
 public:
     /// Constructor
-    /** @param owner Component which this attribute will be attached to.
+    /** @param owner Component which this attribute will be attached to. If non-null, @c id must be a string literal, see id.
         @param id ID of the attribute. Will also be assigned as the attribute's human-readable name. */
     IAttribute(IComponent* owner, const char* id);
 
     /// Constructor
-    /** @param owner Component which this attribute will be attached to.
+    /** @param owner Component which this attribute will be attached to. If non-null, @c id and @c name must be string literals, see id.
         @param id ID of the attribute.
         @param name Human-readable name of the attribute. */
     IAttribute(IComponent* owner, const char* id, const char* name);
 
-    virtual ~IAttribute() {}
+    virtual ~IAttribute();
 
     /// Returns attribute's owner component.
     IComponent* Owner() const { return owner; }
 
     /// Returns the ID of the attribute for serialization. Should be same as the variable/property name.
-    const String &Id() const { return id; }
+    const String &Id() const { return *id; }
 
     /// Returns human-readable name of the attribute. This is shown in the EC editor. For dynamic attributes, is the same as ID.
-    const String &Name() const { return name; }
+    const String &Name() const { return *name; }
 
     /// Change the attribute's name. Needed for PlaceholderComponent when constructing attributes dynamically at deserialization
     void SetName(const String& newName);
@@ -169,9 +169,19 @@ protected:
     friend class SceneAPI;
     friend class IComponent;
     
+    /// Returns the shared copy of the string literal @c str, see id.
+    /** The table is keyed by the address of the literal, so it is bounded by the literals in the code and the copies are never freed.
+        Thread-safe, as attributes are also created on the worker threads. */
+    static const String &SharedString(const char *str);
+
     IComponent* owner; ///< Owning component.
-    String id; ///< ID of attribute.
-    String name; ///< Human-readable name of attribute for editing.
+    /// ID of attribute.
+    /** The static attributes of a component, constructed with an owner, point to a copy shared by all the components of the type.
+        Dynamic and cloned attributes, constructed without an owner, point to ownId. */
+    const String *id;
+    const String *name; ///< Human-readable name of attribute for editing. Shared like id, or points to ownName after SetName.
+    String *ownId; ///< ID owned by this attribute, null if shared.
+    String *ownName; ///< Name owned by this attribute, null if shared or the same as the ID.
     AttributeMetadata *metadata; ///< Possible attribute metadata.
     bool dynamic; ///< Dynamic attributes must be deleted at component destruction
     u8 index; ///< Attribute index in the parent component's attribute list
@@ -179,6 +189,11 @@ protected:
     /// If true, the value of this attribute has changed, but the implementing code has not yet reacted to it.
     /// @see ValueChanged().
     bool valueChanged;
+
+private:
+    /// Not copyable, as the attribute may own its ID and name.
+    IAttribute(const IAttribute &);
+    void operator=(const IAttribute &);
 };
 
 typedef Vector<IAttribute*> AttributeVector;
@@ -245,7 +260,7 @@ public:
 
     IAttribute* Clone() const override
     {
-        Attribute<T>* new_attr = new Attribute<T>(0, name.CString());
+        Attribute<T>* new_attr = new Attribute<T>(0, name->CString());
         new_attr->metadata = metadata;
         // The new attribute has no owner, so the Changed function will have no effect, and therefore the changetype does not actually matter
         new_attr->Set(Get(), AttributeChange::Disconnected);
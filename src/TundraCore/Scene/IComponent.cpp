@@ -10,6 +10,7 @@
 #include "Entity.h"
 #include "Scene.h"
 #include "SceneAPI.h"
+#include "Name.h"
 #include "Framework.h"
 #include "LoggingFunctions.h"
 
@@ -29,7 +30,9 @@ IComponent::IComponent(Urho3D::Context* context, Scene* scene) :
     updateMode(AttributeChange::Replicate),
     replicated(true),
     temporary(false),
-    id(0)
+    id(0),
+    journal_(0),
+    journalIndex_(0)
 {
 }
 
@@ -393,6 +396,11 @@ bool IComponent::BeginDeserialization(Urho3D::XMLElement& compElem)
 
 void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Type change)
 {
+    // Keep the scene's entity name and group indices current, also for the changes that are not signaled
+    Scene* scene = ParentScene();
+    if (scene && TypeId() == Name::ComponentTypeId)
+        scene->UpdateNameIndex(this);
+
     // If this message should be sent with the default attribute change mode specified in the IComponent,
     // take the change mode from this component.
     if (change == AttributeChange::Default)
@@ -402,10 +410,13 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
     if (change == AttributeChange::Disconnected)
         return; // No signals
     
-    // Trigger scenemanager signal
-    Scene* scene = ParentScene();
+    // Trigger scenemanager signal, or defer all signals to the scene's next flush if it is batching the changes
     if (scene)
+    {
+        if (scene->JournalAttributeChange(this, attribute, change))
+            return;
         scene->EmitAttributeChanged(this, attribute, change);
+    }
     
     // Trigger internal signal
     AttributeChanged.Emit(attribute, change);
@@ -419,6 +430,22 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
             attributes[i]->ClearChangedFlag();
 }
 
+void IComponent::EmitJournaledAttributeChanges(const u8 *changed, const u8 *replicated)
+{
+    for(uint i = 0; i < attributes.Size(); ++i)
+    {
+        IAttribute *attribute = attributes[i];
+        if (attribute && (changed[i >> 3] & (1 << (i & 7))))
+            AttributeChanged.Emit(attribute, (replicated[i >> 3] & (1 << (i & 7))) ? AttributeChange::Replicate : AttributeChange::LocalOnly);
+    }
+
+    // The derived class reacts to all the changes at once
+    AttributesChanged();
+    for(uint i = 0; i < attributes.Size(); ++i)
+        if (attributes[i])
+            attributes[i]->ClearChangedFlag();
+}
+
 void IComponent::EmitAttributeMetadataChanged(IAttribute* attribute)
 {
     if (!attribute)
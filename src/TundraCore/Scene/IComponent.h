@@ -253,6 +253,11 @@ public:
         as long as the new attributes are added to the end of the static attributes list. In contrast, components with dynamic attributes
         are not resilient to mismatches, except if they use *only* dynamic attributes, like DynamicComponent. */
     virtual bool SupportsDynamicAttributes() const { return false; }
+
+    /// Returns whether this component deserializes with the default DeserializeFrom and DeserializeFromBinary. True by default.
+    /** The serialized data of such components can be parsed into a ComponentDesc without creating the component, see SceneDescParser.
+        Components that override either of the functions return false. */
+    virtual bool HasDefaultDeserialization() const { return true; }
     
     /// Returns the total number of attributes in this component. Does not count holes in the attribute vector
     int NumAttributes() const;
@@ -387,6 +392,8 @@ protected:
 private:
     friend class IAttribute;
     friend class Entity;
+    friend class Scene;
+    friend class AttributeChangeJournal;
 
     /// This function is called by the base class (IComponent) to signal to the derived class that one or more
     /// of its attributes have changed, and it should update its internal state accordingly.
@@ -396,6 +403,14 @@ private:
 
     /// Set component id. Called by Entity
     void SetNewId(component_id_t newId);
+
+    /// Emits the change signals of the attributes changed while the scene was batching attribute changes. Called by Scene.
+    /** @param changed Bitmask of the changed attributes indexed by the attribute index.
+        @param replicated Bitmask of the attributes of which at least one change was to be replicated. */
+    void EmitJournaledAttributeChanges(const u8 *changed, const u8 *replicated);
+
+    AttributeChangeJournal *journal_; ///< The journal that has a record of this component's changes, or null.
+    unsigned journalIndex_; ///< Index of the record in journal_.
 };
 
 }
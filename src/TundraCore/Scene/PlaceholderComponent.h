@@ -46,6 +46,9 @@ public:
     /// IComponent override
     virtual void DeserializeFromBinary(kNet::DataDeserializer& source, AttributeChange::Type change);
 
+    /// IComponent override
+    virtual bool HasDefaultDeserialization() const { return false; }
+
     /// IComponent override
     /** PlaceholderComponent attributes need to be treated as static for the network protocol, though they are dynamically allocated */
     virtual int NumStaticAttributes() const { return static_cast<int>(attributes.Size()); }
@@ -16,11 +16,17 @@
 #include "FrameAPI.h"
 #include "LoggingFunctions.h"
 #include "AssetAPI.h"
+#include "AssetPrefetch.h"
+#include "SceneBinary.h"
+#include "SceneDescParser.h"
+#include "SceneSnapshot.h"
+#include "SceneJournal.h"
 
 #include <kNet/DataDeserializer.h>
 #include <kNet/DataSerializer.h>
 
 #include <Engine/IO/File.h>
+#include <Engine/IO/MemoryBuffer.h>
 #include <Engine/Resource/XMLFile.h>
 #include <Engine/IO/FileSystem.h>
 #include <Engine/Core/StringUtils.h>
@@ -37,7 +43,9 @@ Scene::Scene(const String &name, Framework *framework, bool viewEnabled, bool au
     name_(name),
     framework_(framework),
     interpolating_(false),
-    authority_(authority)
+    authority_(authority),
+    batchAttributeChanges_(false),
+    activeJournal_(0)
 {
     // In headless mode only view disabled-scenes can be created
     viewEnabled_ = framework->IsHeadless() ? false : viewEnabled;
@@ -52,6 +60,9 @@ Scene::~Scene()
         LogWarning("Subsystems not removed at scene destruct time");
 
     EndAllAttributeInterpolations();
+
+    // Do not record the removal of the entities
+    StopJournal();
     
     // Do not send entity removal or scene cleared events on destruction
     RemoveAllEntities(false);
@@ -132,14 +143,31 @@ EntityPtr Scene::EntityById(entity_id_t id) const
     return EntityPtr();
 }
 
+namespace
+{
+    /// Returns the parent entity of an indexed Name component, or null if it is not the component Entity::Name reads.
+    Entity *NamedEntity(IComponent *nameComp)
+    {
+        Entity *entity = nameComp->ParentEntity();
+        if (entity && entity->Component(Name::ComponentTypeId).Get() != nameComp)
+            return 0;
+        return entity;
+    }
+}
+
 EntityPtr Scene::EntityByName(const String &name) const
 {
     if (name.Empty())
         return EntityPtr();
 
-    for(ConstIterator it = Begin(); it != End(); ++it)
-        if (it->second_->Name() == name)
-            return it->second_;
+    const SceneIndex::ComponentList *names = index_.NamesByName(name);
+    if (names)
+        for(unsigned i = 0; i < names->Size(); ++i)
+        {
+            Entity *entity = NamedEntity(names->At(i));
+            if (entity)
+                return EntityPtr(entity);
+        }
 
     return EntityPtr();
 }
@@ -246,6 +274,7 @@ void Scene::RemoveAllEntities(bool signal, AttributeChange::Type change)
     {
         LogWarning("Scene::RemoveAllEntities: entity map was not clear after removing all entities, clearing manually");
         entities_.Clear();
+        index_.Clear();
     }
     
     if (signal)
@@ -275,9 +304,20 @@ EntityVector Scene::EntitiesWithComponent(const String &typeName, const String &
 EntityVector Scene::EntitiesWithComponent(u32 typeId, const String &name) const
 {
     EntityVector entities;
-    for(ConstIterator it = Begin(); it != End(); ++it)
-        if ((name.Empty() && it->second_->Component(typeId)) || it->second_->Component(typeId, name))
-            entities.Push(it->second_);
+    const SceneIndex::ComponentList *components = index_.ComponentsOfType(typeId);
+    if (!components)
+        return entities;
+
+    for(unsigned i = 0; i < components->Size(); ++i)
+    {
+        IComponent *comp = components->At(i);
+        if (!name.Empty() && comp->Name() != name)
+            continue;
+        // List an entity with several matching components only once, for its first one
+        Entity *entity = comp->ParentEntity();
+        if (entity && (name.Empty() ? entity->Component(typeId) : entity->Component(typeId, name)).Get() == comp)
+            entities.Push(EntityPtr(entity));
+    }
     return entities;
 }
 
@@ -287,9 +327,14 @@ EntityVector Scene::EntitiesOfGroup(const String &groupName) const
     if (groupName.Empty())
         return entities;
 
-    for (ConstIterator it = Begin(); it != End(); ++it)
-        if (it->second_->Group() == groupName)
-            entities.Push(it->second_);
+    const SceneIndex::ComponentList *groups = index_.NamesByGroup(groupName);
+    if (groups)
+        for(unsigned i = 0; i < groups->Size(); ++i)
+        {
+            Entity *entity = NamedEntity(groups->At(i));
+            if (entity)
+                entities.Push(EntityPtr(entity));
+        }
 
     return entities;
 }
@@ -302,22 +347,24 @@ Entity::ComponentVector Scene::Components(const String &typeName, const String &
 Entity::ComponentVector Scene::Components(u32 typeId, const String &name) const
 {
     Entity::ComponentVector ret;
+    const SceneIndex::ComponentList *components = index_.ComponentsOfType(typeId);
+    if (!components)
+        return ret;
+
     if (name.Empty())
     {
-        for(ConstIterator it = Begin(); it != End(); ++it)
-        {
-            Entity::ComponentVector components =  it->second_->ComponentsOfType(typeId);
-            if (!components.Empty())
-                ret.Insert(ret.End(), components.Begin(), components.End());
-        }
+        ret.Reserve(components->Size());
+        for(unsigned i = 0; i < components->Size(); ++i)
+            ret.Push(ComponentPtr(components->At(i)));
     }
     else
     {
-        for(ConstIterator it = Begin(); it != End(); ++it)
+        // Only the first component with the name from each entity, like Entity::Component
+        for(unsigned i = 0; i < components->Size(); ++i)
         {
-            ComponentPtr component = it->second_->Component(typeId, name);
-            if (component)
-                ret.Push(component);
+            IComponent *comp = components->At(i);
+            if (comp->Name() == name && comp->ParentEntity() && comp->ParentEntity()->Component(typeId, name).Get() == comp)
+                ret.Push(ComponentPtr(comp));
         }
     }
     return ret;
@@ -325,6 +372,8 @@ Entity::ComponentVector Scene::Components(u32 typeId, const String &name) const
 
 void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    // The indices are kept current regardless of the change type
+    index_.AddComponent(comp);
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -334,6 +383,7 @@ void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange
 
 void Scene::EmitComponentRemoved(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    index_.RemoveComponent(comp);
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -350,6 +400,57 @@ void Scene::EmitAttributeChanged(IComponent* comp, IAttribute* attribute, Attrib
     AttributeChanged.Emit(comp, attribute, change);
 }
 
+void Scene::UpdateNameIndex(IComponent* comp)
+{
+    index_.UpdateName(comp);
+}
+
+void Scene::SetAttributeChangeBatching(bool enable)
+{
+    if (batchAttributeChanges_ == enable)
+        return;
+    batchAttributeChanges_ = enable;
+    if (!enable)
+    {
+        // Flush the changes batched during the previous flush too
+        FlushAttributeChanges();
+        FlushAttributeChanges();
+    }
+}
+
+bool Scene::JournalAttributeChange(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
+{
+    if (!batchAttributeChanges_ || interpolating_ || !comp || !attribute)
+        return false;
+    if (change == AttributeChange::Default)
+        change = comp->UpdateMode();
+    if (change == AttributeChange::Disconnected)
+        return true;
+    attributeChangeJournals_[activeJournal_].Add(comp, attribute->Index(), change);
+    return true;
+}
+
+void Scene::FlushAttributeChanges()
+{
+    // Switch the journals first, so that the changes made by the signal handlers go to the next flush
+    AttributeChangeJournal &journal = attributeChangeJournals_[activeJournal_];
+    if (journal.Empty())
+        return;
+    activeJournal_ = 1 - activeJournal_;
+
+    AttributeChangesFlushed.Emit(journal);
+
+    for (unsigned i = 0; i < journal.Size(); ++i)
+    {
+        const AttributeChangeJournal::ComponentChanges &changes = journal[i];
+        ComponentPtr comp = changes.component.Lock();
+        if (comp && comp->ParentScene() == this)
+            comp->EmitJournaledAttributeChanges(changes.changed, changes.replicated);
+    }
+
+    journal.Clear();
+}
+
 void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
 {
     // "Stealth" addition (disconnected changetype) is not supported. Always signal.
@@ -465,7 +566,9 @@ Vector<Entity *> Scene::LoadSceneXML(const String& filename, bool clearScene, bo
     if (clearScene)
         RemoveAllEntities(true, change);
 
-    return CreateContentFromXml(scene_doc, useEntityIDsFromFile, change);
+    Vector<Entity *> entities = CreateContentFromXml(scene_doc, useEntityIDsFromFile, change);
+    WriteAssetManifest(filename, entities);
+    return entities;
 }
 
 String Scene::SerializeToXmlString(bool serializeTemporary, bool serializeLocal) const
@@ -515,54 +618,79 @@ Vector<Entity *> Scene::LoadSceneBinary(const String& filename, bool clearScene,
         return ret;
     }
 
-    PODVector<char> bytes;
-    bytes.Resize(file.GetSize());
-    file.Read(&bytes[0], bytes.Size());
-    file.Close();
-
     if (clearScene)
         RemoveAllEntities(true, change);
 
-    return CreateContentFromBinary(&bytes[0], bytes.Size(), useEntityIDsFromFile, change);
+    SceneBinaryReader reader(file);
+    ret = CreateContentFromBinary(reader, useEntityIDsFromFile, change);
+    WriteAssetManifest(filename, ret);
+    return ret;
 }
 
 bool Scene::SaveSceneBinary(const String& filename, bool serializeTemporary, bool serializeLocal) const
 {
-    PODVector<char> bytes;
-    // Assume 4MB max for now
-    /// \todo Use Urho serialization for dynamic buffer
-    bytes.Resize(4 * 1024 * 1024);
-    DataSerializer dest(&bytes[0], bytes.Size());
+    Urho3D::File scenefile(context_);
+    if (!scenefile.Open(filename, Urho3D::FILE_WRITE))
+    {
+        LogError("Scene::SaveSceneBinary: Could not open file " + filename + " for writing when saving scene binary.");
+        return false;
+    }
 
-    // Filter the entities we accept
-    const bool serializeChildren = true;
-    EntityVector serialized = RootLevelEntities();
-    for(EntityVector::Iterator iter = serialized.Begin(); iter != serialized.End();)
+    if (!SerializeToBinary(scenefile, serializeTemporary, serializeLocal))
     {
-        if ((*iter)->ShouldBeSerialized(serializeTemporary, serializeLocal, serializeChildren))
-             ++iter;
-        else
-            iter = serialized.Erase(iter);
+        LogError("Scene::SaveSceneBinary: Failed to write " + filename + ".");
+        return false;
     }
+    return true;
+}
 
-    dest.Add<u32>(serialized.Size());
+bool Scene::SerializeToBinary(Urho3D::Serializer &dest, bool serializeTemporary, bool serializeLocal) const
+{
+    // Stream the entities to the destination a block at a time, so that the size of the scene is not limited by a buffer
+    const bool serializeChildren = true;
+    SceneBinaryWriter writer(dest);
+    EntityVector rootEntities = RootLevelEntities();
+    foreach(const EntityPtr &entity, rootEntities)
+    {
+        if (!entity->ShouldBeSerialized(serializeTemporary, serializeLocal, serializeChildren))
+            continue;
+        if (!writer.Write(entity, serializeTemporary, serializeLocal))
+        {
+            LogError("Scene::SerializeToBinary: Failed to save entity " + String(entity->Id()) + ".");
+            return false;
+        }
+    }
+    return writer.Finish();
+}
 
-    foreach(EntityPtr entity, serialized)
-        entity->SerializeToBinary(dest, serializeTemporary, serializeChildren, serializeLocal);
+bool Scene::StartJournal(const String &basePath)
+{
+    StopJournal();
 
-    bytes.Resize(static_cast<uint>(dest.BytesFilled()));
-    Urho3D::File scenefile(context_);
-    if (!scenefile.Open(filename, Urho3D::FILE_WRITE))
+    journal_ = new SceneJournal(this, basePath);
+    journal_->Restore(AttributeChange::Default);
+    if (!journal_->Start())
     {
-        LogError("Scene::SaveSceneBinary: Could not open file " + filename + " for writing when saving scene binary.");
+        journal_.Reset();
         return false;
     }
-
-    if (bytes.Size())
-        scenefile.Write(&bytes[0], bytes.Size());
     return true;
 }
 
+void Scene::StopJournal()
+{
+    if (journal_)
+    {
+        journal_->Stop();
+        journal_.Reset();
+    }
+}
+
+bool Scene::SaveSceneSnapshot(const String& filename, bool serializeTemporary, bool serializeLocal) const
+{
+    return SceneSnapshot::Write(this, filename, serializeTemporary, serializeLocal);
+}
+
 Vector<Entity *> Scene::CreateContentFromXml(const String &xml,  bool useEntityIDsFromFile, AttributeChange::Type change)
 {
     Vector<Entity *> ret;
@@ -629,6 +757,8 @@ Vector<Entity *> Scene::CreateContentFromXml(Urho3D::XMLFile &xml, bool useEntit
     if (!useEntityIDsFromFile)
         FixPlaceableParentIds(sortedDescEntities, oldToNewIds, AttributeChange::Disconnected);
 
+    PrefetchAssets(sortedDescEntities);
+
     // Now that we have each entity spawned to the scene, trigger all the signals for EntityCreated/ComponentChanged messages.
     for(u32 i=0, len=sortedDescEntities.Size(); i<len; ++i)
     {
@@ -754,15 +884,21 @@ Vector<Entity *> Scene::CreateContentFromBinary(const String &filename, bool use
         return Vector<Entity*>();
     }
 
-    PODVector<char> bytes;
-    bytes.Resize(file.GetSize());
-    file.Read(&bytes[0], bytes.Size());
-    file.Close();
-
-    return CreateContentFromBinary(&bytes[0], bytes.Size(), useEntityIDsFromFile, change);
+    SceneBinaryReader reader(file);
+    return CreateContentFromBinary(reader, useEntityIDsFromFile, change);
 }
 
 Vector<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, bool useEntityIDsFromFile, AttributeChange::Type change)
+{
+    assert(data);
+    assert(numBytes > 0);
+
+    Urho3D::MemoryBuffer buffer(data, numBytes);
+    SceneBinaryReader reader(buffer);
+    return CreateContentFromBinary(reader, useEntityIDsFromFile, change);
+}
+
+Vector<Entity *> Scene::CreateContentFromBinary(SceneBinaryReader &reader, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
     if (!IsAuthority() && parentTracker_.IsTracking())
     {
@@ -770,19 +906,22 @@ Vector<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes,
         return Vector<Entity*>();
     }
 
-    assert(data);
-    assert(numBytes > 0);
-
     Vector<EntityWeakPtr> entities;
     EntityIdMap oldToNewIds;
 
+    // Create the entities of each block as it is read, so that only one block of the file is in memory at a time
+    PODVector<unsigned char> block;
+    uint numEntities = 0;
     try
     {
-        DataDeserializer source(data, numBytes);
-
-        uint num_entities = source.Read<u32>();
-        for(uint i = 0; i < num_entities; ++i)
-            CreateEntityFromBinary(EntityPtr(), source, useEntityIDsFromFile, change, entities, oldToNewIds);
+        while(reader.ReadBlock(block, numEntities))
+        {
+            if (block.Empty())
+                continue;
+            DataDeserializer source((const char*)&block[0], block.Size());
+            for(uint i = 0; i < numEntities; ++i)
+                CreateEntityFromBinary(EntityPtr(), source, useEntityIDsFromFile, change, entities, oldToNewIds);
+        }
     }
     catch(...)
     {
@@ -790,12 +929,17 @@ Vector<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes,
         return Vector<Entity *>();
     }
 
+    if (reader.HasFailed())
+        LogError("Scene::CreateContentFromBinary: Binary scene data is truncated or invalid, only the entities before the error were created.");
+
     // Fix parent ref of Placeable if new entity IDs were generated.
     // This should be done first so that we wont be firing signals
     // with partially updated state (these ends are already in the scene for querying).
     if (!useEntityIDsFromFile)
         FixPlaceableParentIds(entities, oldToNewIds, AttributeChange::Disconnected);
 
+    PrefetchAssets(entities);
+
     // Now that we have each entity spawned to the scene, trigger all the signals for EntityCreated/ComponentChanged messages.
     for(u32 i = 0; i < entities.Size(); ++i)
     {
@@ -927,6 +1071,9 @@ Vector<Entity *> Scene::CreateContentFromSceneDesc(const SceneDesc &desc, bool u
     // that slows down the import considerably on large scenes that relies heavily on parenting.
     EntityDescList sortedDescEntities = SortEntities(desc.entities);
 
+    // The description has all the asset references, so they can be requested before any entity is created.
+    PrefetchAssets(desc);
+
     EntityIdMap oldToNewIds;
     for (int ei=0, eilen=sortedDescEntities.Size(); ei<eilen; ++ei)
         CreateEntityFromDesc(EntityPtr(), sortedDescEntities[ei], useEntityIDsFromFile, change, ret, oldToNewIds);
@@ -956,6 +1103,62 @@ Vector<Entity *> Scene::CreateContentFromSceneDesc(const SceneDesc &desc, bool u
     return ret;
 }
 
+bool Scene::ShouldPrefetchAssets() const
+{
+    // The components do not request the assets when the view is disabled, eg. on a headless server.
+    return viewEnabled_ && framework_->Asset() && !framework_->HasCommandLineParameter("--noAssetPrefetch");
+}
+
+void Scene::PrefetchAssets(const Vector<EntityWeakPtr> &entities)
+{
+    if (!ShouldPrefetchAssets())
+        return;
+
+    PROFILE(Scene_PrefetchAssets);
+    AssetPrefetch prefetch(framework_->Asset());
+    prefetch.SetViewPositionFromCamera(this);
+    for(uint i = 0; i < entities.Size(); ++i)
+        if (!entities[i].Expired())
+            prefetch.Collect(entities[i].Get());
+    prefetch.Sort();
+    prefetch.Request();
+}
+
+void Scene::PrefetchAssets(const SceneDesc &desc)
+{
+    if (!ShouldPrefetchAssets())
+        return;
+
+    PROFILE(Scene_PrefetchAssets);
+    AssetPrefetch prefetch(framework_->Asset());
+    prefetch.SetViewPositionFromCamera(this);
+    prefetch.Collect(desc);
+    prefetch.Sort();
+    prefetch.Request();
+}
+
+void Scene::WriteAssetManifest(const String &filename, const Vector<Entity *> &entities)
+{
+    if (!framework_->HasCommandLineParameter("--writeAssetManifest") || entities.Empty() || !framework_->Asset())
+        return;
+
+    AssetPrefetch prefetch(framework_->Asset());
+    prefetch.SetViewPositionFromCamera(this);
+    for(uint i = 0; i < entities.Size(); ++i)
+        prefetch.Collect(entities[i]);
+    prefetch.Sort();
+
+    const String manifestFile = filename + ".assets";
+    Urho3D::File file(context_);
+    if (!file.Open(manifestFile, Urho3D::FILE_WRITE))
+    {
+        LogError("Scene::WriteAssetManifest: Failed to open file " + manifestFile + " for writing.");
+        return;
+    }
+    file.WriteString(prefetch.SerializeManifest());
+    LogInfo("Scene::WriteAssetManifest: Wrote " + String(prefetch.Items().Size()) + " asset references to " + manifestFile);
+}
+
 void Scene::CreateEntityFromDesc(EntityPtr parent, const EntityDesc& e, bool useEntityIDsFromFile,
     AttributeChange::Type change, Vector<Entity *>& entities, EntityIdMap& oldToNewIds)
 {
@@ -1097,124 +1300,10 @@ SceneDesc Scene::CreateSceneDescFromXml(const String &data, SceneDesc &sceneDesc
         return sceneDesc;
     }
 
-    Urho3D::XMLElement ent_elem = scene_elem.GetChild("entity");
-    while(ent_elem)
-    {
-        CreateEntityDescFromXml(sceneDesc, sceneDesc.entities, ent_elem);
-        // Process siblings.
-        ent_elem = ent_elem.GetNext("entity");
-    }
-
+    SceneDescParser(framework_).ParseXml(scene_elem, sceneDesc);
     return sceneDesc;
 }
 
-void Scene::CreateEntityDescFromXml(SceneDesc& sceneDesc, Vector<EntityDesc>& dest, const Urho3D::XMLElement& ent_elem) const
-{
-    String id_str = ent_elem.GetAttribute("id");
-    if (id_str.Empty())
-        return;
-    
-    EntityDesc entityDesc;
-    entityDesc.id = id_str;
-    entityDesc.local = false;
-    if (ent_elem.HasAttribute("sync"))
-        entityDesc.local = !ent_elem.GetBool("sync"); /**< @todo if no "sync"* attr, deduct from the ID. */
-    entityDesc.temporary = ent_elem.GetBool("temporary");
-
-    Urho3D::XMLElement comp_elem = ent_elem.GetChild("component");
-    while(comp_elem)
-    {
-        ComponentDesc compDesc;
-        compDesc.typeName = comp_elem.GetAttribute("type");
-        compDesc.typeId = 0xffffffff;
-        if (comp_elem.GetUInt("typeId"))
-            compDesc.typeId = comp_elem.GetUInt("typeId");
-        /// @todo 27.09.2013 assert that typeName and typeId match
-        /// @todo 27.09.2013 If mismatch, show warning, and use SceneAPI's
-        /// ComponentTypeNameForTypeId and ComponentTypeIdForTypeName to resolve one or the other?
-        compDesc.name = comp_elem.GetAttribute("name");
-        compDesc.sync = comp_elem.GetBool("sync");
-        const bool hasTypeId = compDesc.typeId != 0xffffffff;
-
-        // A bit of a hack to get the name from Name.
-        if (entityDesc.name.Empty() && (compDesc.typeId == Name::ComponentTypeId ||
-            IComponent::EnsureTypeNameWithoutPrefix(compDesc.typeName) == Name::TypeNameStatic()))
-        {
-            ComponentPtr comp = (hasTypeId ? framework_->Scene()->CreateComponentById(0, compDesc.typeId, compDesc.name) :
-                framework_->Scene()->CreateComponentByName(0, compDesc.typeName, compDesc.name));
-            Tundra::Name *ecName = static_cast<Tundra::Name*>(comp.Get());
-            ecName->DeserializeFrom(comp_elem, AttributeChange::Disconnected);
-            entityDesc.name = ecName->name.Get();
-            entityDesc.group = ecName->group.Get();
-        }
-
-        ComponentPtr comp = (hasTypeId ? framework_->Scene()->CreateComponentById(0, compDesc.typeId, compDesc.name) :
-            framework_->Scene()->CreateComponentByName(0, compDesc.typeName, compDesc.name));
-        if (!comp) // Move to next element if component creation fails.
-        {
-            comp_elem = comp_elem.GetNext("component");
-            continue;
-        }
-
-        // Find asset references.
-        comp->DeserializeFrom(comp_elem, AttributeChange::Disconnected);
-        foreach(IAttribute *a,comp->Attributes())
-        {
-            if (!a)
-                continue;
-                    
-            const String typeName = a->TypeName();
-            AttributeDesc attrDesc = { typeName, a->Name(), a->ToString(), a->Id() };
-            compDesc.attributes.Push(attrDesc);
-
-            String attrValue = a->ToString();
-            if ((typeName.Compare("AssetReference", false) == 0 || typeName.Compare("AssetReferenceList", false) == 0|| 
-                (a->Metadata() && a->Metadata()->elementType.Compare("AssetReference", false) == 0)) &&
-                !attrValue.Empty())
-            {
-                // We might have multiple references, ";" used as a separator.
-                StringVector assetRefs = attrValue.Split(';');
-                for (int avi=0, avilen=assetRefs.Size(); avi<avilen; ++avi)
-                {
-                    const String &assetRef = assetRefs[avi];
-
-                    AssetDesc ad;
-                    ad.typeName = a->Name();
-
-                    // Resolve absolute file path for asset reference and the destination name (just the filename).
-                    if (!sceneDesc.assetCache.Fill(assetRef, ad))
-                    {
-                        framework_->Asset()->ResolveLocalAssetPath(assetRef, sceneDesc.assetCache.basePath, ad.source);
-                        ad.destinationName = AssetAPI::ExtractFilenameFromAssetRef(ad.source);
-                        sceneDesc.assetCache.Add(assetRef, ad);
-                    }
-
-                    sceneDesc.assets[MakePair(ad.source, ad.subname)] = ad;
-
-                    /// \todo Implement elsewhere
-                    // If this is a script, look for dependecies
-                    //if (ad.source.ToLower().EndsWith(".js"))
-                    //    SearchScriptAssetDependencies(ad.source, sceneDesc);
-                } 
-            }
-        }
-
-        entityDesc.components.Push(compDesc);
-
-        comp_elem = comp_elem.GetNext("component");
-    }
-
-    // Process child entities
-    Urho3D::XMLElement childEnt_elem = ent_elem.GetChild("entity");
-    while (childEnt_elem)
-    {
-        CreateEntityDescFromXml(sceneDesc, entityDesc.children, childEnt_elem);
-        childEnt_elem = childEnt_elem.GetNext("entity");
-    }
-
-    dest.Push(entityDesc);
-}
-
 SceneDesc Scene::CreateSceneDescFromBinary(const String &filename) const
 {
     SceneDesc sceneDesc(filename);
@@ -1235,13 +1324,14 @@ SceneDesc Scene::CreateSceneDescFromBinary(const String &filename) const
         return sceneDesc;
     }
 
-    PODVector<unsigned char> bytes;
-    bytes.Resize(file.GetSize());
-    if (bytes.Size())
-        file.Read(&bytes[0], bytes.Size());
-    file.Close();
+    if (!file.GetSize())
+    {
+        LogError("Scene::CreateSceneDescFromBinary: File " + filename + " contained 0 bytes when trying to create scene description.");
+        return sceneDesc;
+    }
 
-    return CreateSceneDescFromBinary(bytes, sceneDesc);
+    SceneBinaryReader reader(file);
+    return CreateSceneDescFromBinary(reader, sceneDesc);
 }
 
 SceneDesc Scene::CreateSceneDescFromBinary(PODVector<unsigned char> &data, SceneDesc &sceneDesc) const
@@ -1252,109 +1342,18 @@ SceneDesc Scene::CreateSceneDescFromBinary(PODVector<unsigned char> &data, Scene
         return sceneDesc;
     }
 
-    try
-    {
-        DataDeserializer source((const char*)&data[0], data.Size());
-        
-        const uint num_entities = source.Read<u32>();
-        for(uint i = 0; i < num_entities; ++i)
-        {
-            EntityDesc entityDesc;
-            entity_id_t id = source.Read<u32>();
-            entityDesc.id = String(id);
-
-            const uint num_components = source.Read<u32>();
-            for(uint j = 0; j < num_components; ++j)
-            {
-                SceneAPI *sceneAPI = framework_->Scene();
-
-                ComponentDesc compDesc;
-                compDesc.typeId = source.Read<u32>(); /**< @todo VLE this! */
-                compDesc.typeName = sceneAPI->ComponentTypeNameForTypeId(compDesc.typeId);
-                compDesc.name = String(source.ReadString().c_str());
-                compDesc.sync = source.Read<u8>() ? true : false;
-                uint data_size = source.Read<u32>();
-
-                // Read the component data into a separate byte array, then deserialize from there.
-                // This way the whole stream should not desync even if something goes wrong
-                PODVector<unsigned char> comp_bytes;
-                comp_bytes.Resize(data_size);
-                if (data_size)
-                    source.ReadArray<u8>((u8*)&comp_bytes[0], comp_bytes.Size());
-
-                try
-                {
-                    ComponentPtr comp = sceneAPI->CreateComponentById(0, compDesc.typeId, compDesc.name);
-                    if (comp)
-                    {
-                        if (data_size)
-                        {
-                            DataDeserializer comp_source((const char*)&comp_bytes[0], comp_bytes.Size());
-                            // Trigger no signal yet when scene is in incoherent state
-                            comp->DeserializeFromBinary(comp_source, AttributeChange::Disconnected);
-                            foreach(IAttribute *a, comp->Attributes())
-                            {
-                                if (!a)
-                                    continue;
-                                
-                                String typeName = a->TypeName();
-                                AttributeDesc attrDesc = { typeName, a->Name(), a->ToString(), a->Id() };
-                                compDesc.attributes.Push(attrDesc);
-
-                                String attrValue = a->ToString();
-                                if ((typeName.Compare("AssetReference", false) == 0 || typeName.Compare("AssetReferenceList", false) == 0 || 
-                                    (a->Metadata() && a->Metadata()->elementType.Compare("AssetReference", false) == 0)) &&
-                                    !attrValue.Empty())
-                                {
-                                    // We might have multiple references, ";" used as a separator.
-                                    StringVector assetRefs = attrValue.Split(';');
-                                    for (int avi=0, avilen=assetRefs.Size(); avi<avilen; ++avi)
-                                    {
-                                        const String &assetRef = assetRefs[avi];
-
-                                        AssetDesc ad;
-                                        ad.typeName = a->Name();
-
-                                        // Resolve absolute file path for asset reference and the destination name (just the filename).
-                                        if (!sceneDesc.assetCache.Fill(assetRef, ad))
-                                        {
-                                            framework_->Asset()->ResolveLocalAssetPath(assetRef, sceneDesc.assetCache.basePath, ad.source);
-                                            ad.destinationName = AssetAPI::ExtractFilenameFromAssetRef(ad.source);
-                                            sceneDesc.assetCache.Add(assetRef, ad);
-                                        }
-
-                                        sceneDesc.assets[MakePair(ad.source, ad.subname)] = ad;
-
-                                        /// \todo Implement elsewhere
-                                        // If this is a script, look for dependecies
-                                        //if (ad.source.ToLower().EndsWith(".js"))
-                                        //    SearchScriptAssetDependencies(ad.source, sceneDesc);
-                                    }
-                                }
-                            }
-                        }
-
-                        entityDesc.components.Push(compDesc);
-                    }
-                    else
-                    {
-                        LogError("Scene::CreateSceneDescFromBinary: Failed to load component " + compDesc.typeName + " " + compDesc.name);
-                    }
-                }
-                catch(...)
-                {
-                    LogError("Scene::CreateSceneDescFromBinary: Exception while trying to load component " + compDesc.typeName + " " + compDesc.name);
-                }
-            }
+    Urho3D::MemoryBuffer buffer(&data[0], data.Size());
+    SceneBinaryReader reader(buffer);
+    return CreateSceneDescFromBinary(reader, sceneDesc);
+}
 
-            sceneDesc.entities.Push(entityDesc);
-        }
-    }
-    catch(...)
-    {
+SceneDesc Scene::CreateSceneDescFromBinary(SceneBinaryReader &reader, SceneDesc &sceneDesc) const
+{
+    if (!SceneDescParser(framework_).ParseBinary(reader, sceneDesc))
         return SceneDesc("");
-    }
 
+    if (reader.HasFailed())
+        LogError("Scene::CreateSceneDescFromBinary: File " + sceneDesc.filename + " is truncated or invalid.");
     return sceneDesc;
 }
 
@@ -1484,6 +1483,8 @@ void Scene::UpdateAttributeInterpolations(float frametime)
 
 void Scene::OnUpdated(float /*frameTime*/)
 {
+    FlushAttributeChanges();
+
     // Signal queued entity creations now
     for (unsigned i = 0; i < entitiesCreatedThisFrame_.Size(); ++i)
     {
@@ -1509,11 +1510,18 @@ EntityVector Scene::FindEntitiesContaining(const String &substring, bool caseSen
     if (substring.Empty())
         return entities;
 
-    for(ConstIterator it = Begin(); it != End(); ++it)
+    // Match each distinct name once
+    const ComponentMultiIndex<String>::BucketMap &names = index_.Names();
+    for(ComponentMultiIndex<String>::BucketMap::ConstIterator it = names.Begin(); it != names.End(); ++it)
     {
-        EntityPtr entity = it->second_;
-        if (entity->Name().Contains(substring, caseSensitivity))
-            entities.Push(entity);
+        if (!it->first_.Contains(substring, caseSensitivity))
+            continue;
+        for(unsigned i = 0; i < it->second_.Size(); ++i)
+        {
+            Entity *entity = NamedEntity(it->second_[i]);
+            if (entity)
+                entities.Push(EntityPtr(entity));
+        }
     }
 
     return entities;
@@ -1522,12 +1530,43 @@ EntityVector Scene::FindEntitiesContaining(const String &substring, bool caseSen
 EntityVector Scene::FindEntitiesByName(const String &name, bool caseSensitivity) const
 {
     // Don't check if name is empty, we want to allow querying for all entities without a name too.
+    // The empty name is not indexed, so that query scans all entities.
     EntityVector entities;
-    for(ConstIterator it = Begin(); it != End(); ++it)
+    if (name.Empty())
     {
-        EntityPtr entity = it->second_;
-        if (entity->Name().Compare(name, caseSensitivity) == 0)
-            entities.Push(entity);
+        for(ConstIterator it = Begin(); it != End(); ++it)
+        {
+            EntityPtr entity = it->second_;
+            if (entity->Name().Empty())
+                entities.Push(entity);
+        }
+        return entities;
+    }
+
+    if (caseSensitivity)
+    {
+        const SceneIndex::ComponentList *matches = index_.NamesByName(name);
+        if (matches)
+            for(unsigned i = 0; i < matches->Size(); ++i)
+            {
+                Entity *entity = NamedEntity(matches->At(i));
+                if (entity)
+                    entities.Push(EntityPtr(entity));
+            }
+        return entities;
+    }
+
+    const ComponentMultiIndex<String>::BucketMap &names = index_.Names();
+    for(ComponentMultiIndex<String>::BucketMap::ConstIterator it = names.Begin(); it != names.End(); ++it)
+    {
+        if (it->first_.Compare(name, false) != 0)
+            continue;
+        for(unsigned i = 0; i < it->second_.Size(); ++i)
+        {
+            Entity *entity = NamedEntity(it->second_[i]);
+            if (entity)
+                entities.Push(EntityPtr(entity));
+        }
     }
 
     return entities;
@@ -10,6 +10,8 @@
 #include "UniqueIdGenerator.h"
 #include "Math/float3.h"
 #include "SceneDesc.h"
+#include "AttributeChangeJournal.h"
+#include "SceneIndex.h"
 #include "Entity.h"
 
 #include <Vector.h>
@@ -106,6 +108,27 @@ public:
     /// See if scene is currently performing interpolations, to differentiate between interpolative & non-interpolative attribute changes.
     bool IsInterpolating() const { return interpolating_; }
 
+    /// Enables or disables batching of attribute change signals. Disabled by default.
+    /** While enabled, attribute changes are not signaled as they happen, but recorded in a journal grouped per component,
+        and the journal is flushed at the end of the frame or when FlushAttributeChanges is called. The flush emits
+        AttributeChangesFlushed once with the whole journal, and then for each changed component its AttributeChanged
+        signal once per changed attribute and AttributesChanged once.
+        @note The per-attribute Scene::AttributeChanged signal is not emitted for batched changes: subscribers that
+        handle many changes per frame, like network synchronization, should use AttributeChangesFlushed instead.
+        Changes made by attribute interpolation are never batched. Disabling the batching flushes the pending changes. */
+    void SetAttributeChangeBatching(bool enable);
+
+    /// Returns whether attribute change signals are batched. See SetAttributeChangeBatching.
+    bool IsAttributeChangeBatching() const { return batchAttributeChanges_; }
+
+    /// Emits the signals of the attribute changes batched since the previous flush.
+    /** Changes made by the signal handlers during the flush are batched to the next flush. */
+    void FlushAttributeChanges();
+
+    /// Records an attribute change to the journal if the scene is batching attribute changes. Called by IComponent.
+    /** @return True if the change was recorded, false if it should be signaled immediately. */
+    bool JournalAttributeChange(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
+
     /// Returns Framework
     Framework *GetFramework() const { return framework_; }
 
@@ -140,6 +163,10 @@ public:
         @param change Change signaling mode */
     void EmitAttributeChanged(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
 
+    /// Updates the name and group indices for a Name component whose attributes changed. Called by IComponent.
+    /** Called for all changes, including the Disconnected ones, so that the indices are current even when not signaled. */
+    void UpdateNameIndex(IComponent* comp);
+
     /// Emits notification of an attribute having been created. Called by IComponent's with dynamic structure
     /** @param comp Component pointer
         @param attribute Attribute pointer
@@ -280,12 +307,12 @@ public:
     /** @note The name of the entity is stored in a Name component. If this component is not present in the entity, it has no name.
         @note Returns a shared pointer, but it is preferable to use a weak pointer, EntityWeakPtr,
               to avoid dangling references that prevent entities from being properly destroyed.
-        @note @note O(n)
+        @note Looked up from the name index, O(1) on average.
         @sa EntityById, FindEntitiesContaining */
     EntityPtr EntityByName(const String &name) const;
 
     /// Returns whether name is unique within the scene, i.e. is only encountered once, or not at all.
-    /** @note O(n) */
+    /** @note O(1) on average */
     bool IsUniqueName(const String& name) const;
 
     /// Returns true if entity with the specified id exists in this scene, false otherwise
@@ -315,7 +342,7 @@ public:
     /// Returns list of entities with a specific component present.
     /** @param typeId Type ID of the component
         @param name Name of the component, optional.
-        @note O(n) */
+        @note O(m), where m is the number of components of the type in the scene. */
     EntityVector EntitiesWithComponent(u32 typeId, const String &name = "") const;
     /// @overload
     /** @param typeName typeName Type name of the component.
@@ -323,12 +350,14 @@ public:
     EntityVector EntitiesWithComponent(const String &typeName, const String &name = "") const;
 
     /// Returns list of entities that belong to the group 'groupName'
-    /** @param groupName The name of the group to be queried */
+    /** @param groupName The name of the group to be queried
+        @note Looked up from the group index, O(m), where m is the number of entities in the group. */
     EntityVector EntitiesOfGroup(const String &groupName) const;
 
     /// Returns all components of specific type (and additionally with specific name) in the scene.
-    /*  @param typeId Component type ID.
-        @param name Arbitrary name of the component (optional). */
+    /** @param typeId Component type ID.
+        @param name Arbitrary name of the component (optional).
+        @note O(m), where m is the number of components of the type in the scene. */
     Entity::ComponentVector Components(u32 typeId, const String &name = "") const;
     /// overload
     /** @param typeName Component type name.
@@ -337,12 +366,14 @@ public:
 
     /// Performs a search through the entities, and returns a list of all the entities that contain @c substring in their Entity name.
     /** @param substring String to be searched.
-        @param caseSensitive Case sensitivity for the string matching. */
+        @param caseSensitive Case sensitivity for the string matching.
+        @note Matches each distinct entity name in the scene once. */
     EntityVector FindEntitiesContaining(const String &substring, bool caseSensitive = true) const;
 
     /// Performs a search through the entities, and returns a list of all the entities where Entity name matches @c name.
     /** @param name Entity name to match.
-        @param caseSensitive Case sensitivity for the string matching. */
+        @param caseSensitive Case sensitivity for the string matching.
+        @note A case sensitive search of a non-empty name is looked up from the name index. */
     EntityVector FindEntitiesByName(const String &name, bool caseSensitive = true) const;
 
     /// Return root-level entities, i.e. those that have no parent.
@@ -365,6 +396,12 @@ public:
         @return The scene XML as a string. */
     String SerializeToXmlString(bool serializeTemporary, bool serializeLocal) const;
 
+    /// Writes the scene in the binary format to @c dest, see SaveSceneBinary.
+    /** @param serializeTemporary Are temporary entities wanted to be included.
+        @param serializeLocal Are local entities wanted to be included.
+        @return true if successful */
+    bool SerializeToBinary(Urho3D::Serializer &dest, bool serializeTemporary, bool serializeLocal) const;
+
     /// Saves the scene to XML.
     /** @param filename File name
         @param saveTemporary Are temporary entities wanted to be included.
@@ -384,12 +421,33 @@ public:
     Vector<Entity *> LoadSceneBinary(const String& filename, bool clearScene, bool useEntityIDsFromFile, AttributeChange::Type change);
 
     /// Save the scene to binary
-    /** @param filename File name
+    /** The scene is streamed to the file in blocks, see SceneBinaryWriter, so its size is not limited by memory.
+        @param filename File name
         @param saveTemporary Are temporary entities wanted to be included.
         @param saveLocal Are local entities wanted to be included.
         @return true if successful */
     bool SaveSceneBinary(const String& filename, bool saveTemporary, bool saveLocal) const;
 
+    /// Saves a read-only snapshot of the scene, to be queried in place without loading it, see SceneSnapshot.
+    /** @param filename File name
+        @param saveTemporary Are temporary entities wanted to be included.
+        @param saveLocal Are local entities wanted to be included.
+        @return true if successful */
+    bool SaveSceneSnapshot(const String& filename, bool saveTemporary, bool saveLocal) const;
+
+    /// Persists the scene incrementally to a snapshot and a journal of changes, see SceneJournal.
+    /** Restores the scene from the files first if they exist, then records all further changes. Whether the scene was
+        restored is returned by SceneJournal::IsRestored, so that the startup content is not loaded again on top of it.
+        @param basePath Path of the files without extension.
+        @return true if recording was started */
+    bool StartJournal(const String &basePath);
+
+    /// Writes the recorded changes and stops persisting the scene. Called when the scene is removed.
+    void StopJournal();
+
+    /// Returns the journal persisting the scene, or null if StartJournal has not been called.
+    SceneJournal *Journal() const { return journal_.Get(); }
+
     /// Creates scene content from XML.
     /** @param xml XML document as string.
         @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file.
@@ -447,6 +505,10 @@ public:
     /** Network synchronization managers should connect to this. */
     Signal3<IComponent*, IAttribute*, AttributeChange::Type> AttributeChanged;
 
+    /// Signal when the batched attribute changes are flushed, see SetAttributeChangeBatching
+    /** Emitted once per flush, before the signals of the individual components. */
+    Signal1<const AttributeChangeJournal&> AttributeChangesFlushed;
+
     /// Signal when an attribute of a component has been added (dynamic structure components only)
     /** Network synchronization managers should connect to this. */
     Signal3<IComponent*, IAttribute*, AttributeChange::Type> AttributeAdded;
@@ -515,8 +577,18 @@ private:
     /// Create entity from entity desc and recurse into child entities. Called internally.
     void CreateEntityFromDesc(EntityPtr parent, const EntityDesc& source, bool useEntityIDsFromFile,
         AttributeChange::Type change, Vector<Entity *>& entities, EntityIdMap& oldToNewIds);
-    /// Create entity desc from an XML element and recurse into child entities. Called internally.
-    void CreateEntityDescFromXml(SceneDesc& sceneDesc, Vector<EntityDesc>& dest, const Urho3D::XMLElement& ent_elem) const;
+    /// Creates scene content from the blocks of a binary scene as they are read. Called internally.
+    Vector<Entity *> CreateContentFromBinary(SceneBinaryReader &reader, bool useEntityIDsFromFile, AttributeChange::Type change);
+    /// Creates a scene description from the blocks of a binary scene as they are read. Called internally.
+    SceneDesc CreateSceneDescFromBinary(SceneBinaryReader &reader, SceneDesc &sceneDesc) const;
+
+    /// Returns whether the assets of new content are prefetched, see AssetPrefetch.
+    bool ShouldPrefetchAssets() const;
+    /// Requests the assets of new content before its change signals make the components request them. Called internally.
+    void PrefetchAssets(const Vector<EntityWeakPtr> &entities);
+    void PrefetchAssets(const SceneDesc &desc); ///< @overload
+    /// Writes the asset references of @c entities to a manifest next to the scene file @c filename, if --writeAssetManifest is set.
+    void WriteAssetManifest(const String &filename, const Vector<Entity *> &entities);
 
     /// Container for an ongoing attribute interpolation
     struct AttributeInterpolation
@@ -540,9 +612,14 @@ private:
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
     Vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    SceneIndex index_; ///< Component, entity name and group indices.
+    bool batchAttributeChanges_; ///< Attribute change batching -flag.
+    AttributeChangeJournal attributeChangeJournals_[2]; ///< The journal being written and the one being flushed.
+    unsigned activeJournal_; ///< Index of the journal being written.
     Vector<Pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
     ParentingTracker parentTracker_; ///< Tracker for client side mass Entity imports (eg. SceneDesc based).
     SubsystemMap subsystems; ///< Scene subsystems
+    SharedPtr<SceneJournal> journal_; ///< Incremental persistence of the scene, if started.
 };
 
 }
@@ -13,25 +13,11 @@ SharedPtr<T> Scene::Subsystem() const
 template <typename T>
 Vector<SharedPtr<T> > Scene::Components(const String &name) const
 {
+    Entity::ComponentVector components = Components(T::ComponentTypeId, name);
     Vector<SharedPtr<T> > ret;
-    if (name.Empty())
-    {
-        for(ConstIterator it = Begin(); it != End(); ++it)
-        {
-            Vector<SharedPtr<T> > components =  it->second_->ComponentsOfType<T>();
-            if (!components.Empty())
-                ret.insert(ret.End(), components.Begin(), components.End());
-        }
-    }
-    else
-    {
-        for(ConstIterator it = Begin(); it != End(); ++it)
-        {
-            SharedPtr<T> component = it->second_->Component<T>(name);
-            if (component)
-                ret.Push(component);
-        }
-    }
+    ret.Reserve(components.Size());
+    for(uint i = 0; i < components.Size(); ++i)
+        ret.Push(Urho3D::StaticCast<T>(components[i]));
     return ret;
 }
 
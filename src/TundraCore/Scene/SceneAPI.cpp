@@ -96,6 +96,8 @@ ScenePtr SceneAPI::CreateScene(const String &name, bool viewEnabled, bool author
 
     ScenePtr newScene(new Scene(name, framework, viewEnabled, authority));
     scenes[name] = newScene;
+    if (framework->HasCommandLineParameter("--batchattributechanges"))
+        newScene->SetAttributeChangeBatching(true);
 
     // Emit signal of creation
     if (change != AttributeChange::Disconnected)
@@ -103,6 +105,11 @@ ScenePtr SceneAPI::CreateScene(const String &name, bool viewEnabled, bool author
         SceneCreated.Emit(newScene.Get(), change);
     }
 
+    // Restore and persist the scene once the modules have set up their scene subsystems
+    StringVector journalPath = framework->CommandLineParameters("--sceneJournal");
+    if (authority && !journalPath.Empty())
+        newScene->StartJournal(journalPath.Front());
+
     return newScene;
 }
 
@@ -112,7 +119,9 @@ bool SceneAPI::RemoveScene(const String &name, AttributeChange::Type change)
     if (sceneIter == scenes.End())
         return false;
 
-    // Remove entities before the scene subsystems or worlds are erased by various modules
+    // Remove entities before the scene subsystems or worlds are erased by various modules.
+    // The journal is stopped first so that the removal is not persisted.
+    sceneIter->second_->StopJournal();
     sceneIter->second_->RemoveAllEntities(false, change);
 
     // Emit signal about removed scene
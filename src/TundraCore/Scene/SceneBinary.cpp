@@ -0,0 +1,221 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneBinary.cpp
+    @brief  Streaming reader and writer of the binary scene format (.tbin). */
+
+#include "StableHeaders.h"
+#include "SceneBinary.h"
+#include "Entity.h"
+#include "LoggingFunctions.h"
+
+#include <kNet/DataSerializer.h>
+
+#include <Serializer.h>
+#include <Deserializer.h>
+
+#include <cstring>
+
+namespace Tundra
+{
+
+static const String cFileId = "TBIN";
+static const String cIndexId = "TBIX";
+static const uint cVersion = 2;
+/// Initial serialization buffer size of a root entity.
+static const uint cInitialEntitySize = 64 * 1024;
+/// Root entities, with their children, larger than this are not saved.
+static const uint cMaxEntitySize = 1024 * 1024 * 1024;
+
+SceneBinaryWriter::SceneBinaryWriter(Urho3D::Serializer &dest) :
+    dest_(dest),
+    blockEntities_(0),
+    position_(8),
+    failed_(false)
+{
+    failed_ = !dest_.WriteFileID(cFileId) || !dest_.WriteUInt(cVersion);
+}
+
+bool SceneBinaryWriter::Write(const Entity *entity, bool serializeTemporary, bool serializeLocal)
+{
+    if (!entity || failed_)
+        return false;
+
+    // kNet serializers do not grow, so retry with a larger buffer until the entity fits
+    if (entityBytes_.Empty())
+        entityBytes_.Resize(cInitialEntitySize);
+    uint numBytes = 0;
+    for(;;)
+    {
+        try
+        {
+            kNet::DataSerializer dest((char*)&entityBytes_[0], entityBytes_.Size());
+            entity->SerializeToBinary(dest, serializeTemporary, serializeLocal, true);
+            numBytes = static_cast<uint>(dest.BytesFilled());
+            break;
+        }
+        catch(...)
+        {
+            if (entityBytes_.Size() >= cMaxEntitySize)
+            {
+                LogError("SceneBinaryWriter::Write: Entity " + String(entity->Id()) + " is too large to be saved.");
+                return false;
+            }
+            entityBytes_.Resize(entityBytes_.Size() * 2);
+        }
+    }
+
+    if (!block_.Empty() && block_.Size() + numBytes > BlockSize && !FlushBlock())
+        return false;
+    const uint offset = block_.Size();
+    block_.Resize(offset + numBytes);
+    memcpy(&block_[offset], &entityBytes_[0], numBytes);
+    ++blockEntities_;
+    if (block_.Size() >= BlockSize)
+        return FlushBlock();
+    return true;
+}
+
+bool SceneBinaryWriter::Finish()
+{
+    if (!FlushBlock())
+        return false;
+
+    // An empty block ends the blocks
+    const uint end[] = { 0, 0 };
+    WriteBytes(end, sizeof(end));
+
+    const uint indexOffset = position_;
+    const uint numBlocks = index_.Size() / 2;
+    WriteBytes(&numBlocks, sizeof(numBlocks));
+    if (!index_.Empty())
+        WriteBytes(&index_[0], index_.Size() * sizeof(uint));
+    WriteBytes(&indexOffset, sizeof(indexOffset));
+    if (!failed_ && !dest_.WriteFileID(cIndexId))
+        failed_ = true;
+    return !failed_;
+}
+
+bool SceneBinaryWriter::FlushBlock()
+{
+    if (blockEntities_ == 0)
+        return !failed_;
+
+    index_.Push(position_);
+    index_.Push(blockEntities_);
+    const uint header[] = { blockEntities_, block_.Size() };
+    WriteBytes(header, sizeof(header));
+    WriteBytes(&block_[0], block_.Size());
+    block_.Clear();
+    blockEntities_ = 0;
+    return !failed_;
+}
+
+bool SceneBinaryWriter::WriteBytes(const void *data, uint numBytes)
+{
+    if (!failed_ && dest_.Write(data, numBytes) != numBytes)
+    {
+        LogError("SceneBinaryWriter: Failed to write " + String(numBytes) + " bytes at offset " + String(position_) + ".");
+        failed_ = true;
+    }
+    position_ += numBytes;
+    return !failed_;
+}
+
+SceneBinaryReader::SceneBinaryReader(Urho3D::Deserializer &source) :
+    source_(source),
+    version_(1),
+    end_(false),
+    failed_(false)
+{
+    if (source_.GetSize() >= 8 && source_.ReadFileID() == cFileId)
+    {
+        version_ = source_.ReadUInt();
+        if (version_ > cVersion)
+        {
+            LogError("SceneBinaryReader: Unsupported binary scene version " + String(version_) + ".");
+            end_ = failed_ = true;
+        }
+    }
+    else
+        source_.Seek(0);
+}
+
+bool SceneBinaryReader::ReadBlock(PODVector<unsigned char> &data, uint &numEntities)
+{
+    if (end_)
+        return false;
+
+    // The original format is a single block without a header of its own
+    if (version_ == 1)
+    {
+        end_ = true;
+        if (source_.GetSize() < 4)
+        {
+            failed_ = true;
+            return false;
+        }
+        numEntities = source_.ReadUInt();
+        data.Resize(source_.GetSize() - source_.GetPosition());
+        if (!data.Empty() && source_.Read(&data[0], data.Size()) != data.Size())
+            failed_ = true;
+        return !failed_;
+    }
+
+    if (source_.GetPosition() + 8 > source_.GetSize())
+    {
+        end_ = failed_ = true;
+        return false;
+    }
+    numEntities = source_.ReadUInt();
+    const uint numBytes = source_.ReadUInt();
+    if (numEntities == 0 && numBytes == 0)
+    {
+        end_ = true;
+        return false;
+    }
+    if (numBytes > source_.GetSize() - source_.GetPosition())
+    {
+        end_ = failed_ = true;
+        return false;
+    }
+    data.Resize(numBytes);
+    if (numBytes && source_.Read(&data[0], numBytes) != numBytes)
+    {
+        end_ = failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool SceneBinaryReader::ReadIndex(PODVector<Block> &blocks)
+{
+    blocks.Clear();
+    const uint size = source_.GetSize();
+    if (version_ < 2 || size < 24)
+        return false;
+
+    const uint position = source_.GetPosition();
+    bool valid = false;
+    source_.Seek(size - 8);
+    const uint indexOffset = source_.ReadUInt();
+    if (source_.ReadFileID() == cIndexId && indexOffset >= 16 && indexOffset + 4 <= size - 8)
+    {
+        source_.Seek(indexOffset);
+        const uint numBlocks = source_.ReadUInt();
+        if (numBlocks <= (size - 8 - indexOffset - 4) / 8)
+        {
+            blocks.Resize(numBlocks);
+            for(uint i = 0; i < numBlocks; ++i)
+            {
+                blocks[i].offset = source_.ReadUInt();
+                blocks[i].numEntities = source_.ReadUInt();
+            }
+            valid = true;
+        }
+    }
+    source_.Seek(position);
+    return valid;
+}
+
+}
@@ -0,0 +1,100 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneBinary.h
+    @brief  Streaming reader and writer of the binary scene format (.tbin). */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+
+#include <Vector.h>
+
+namespace Urho3D
+{
+    class Serializer;
+    class Deserializer;
+}
+
+namespace Tundra
+{
+
+/// Writes root entities to a binary scene (.tbin version 2) as a stream of blocks.
+/** The file starts with the file ID "TBIN" and the version. The root entities follow in blocks of about BlockSize bytes,
+    each a u32 entity count and a u32 byte size followed by the entities in the format of Entity::SerializeToBinary. An empty
+    block ends the blocks. The block index follows: a u32 block count, then the u32 offset and u32 entity count of each
+    block, and a trailer of the u32 offset of the index and the file ID "TBIX".
+
+    Only one block is held in memory at a time, so the memory use does not depend on the size of the scene. */
+class TUNDRACORE_API SceneBinaryWriter
+{
+public:
+    /// Target size of a block. A root entity, with its children, larger than this is written as a block of its own.
+    static const uint BlockSize = 1024 * 1024;
+
+    /// Writes the header to @c dest, which must be positioned at the start of the file.
+    explicit SceneBinaryWriter(Urho3D::Serializer &dest);
+
+    /// Writes a root entity with its children.
+    /// @return False if the entity could not be serialized or writing to the destination failed.
+    bool Write(const Entity *entity, bool serializeTemporary, bool serializeLocal);
+
+    /// Writes the last block and the block index. Call once after all the entities have been written.
+    /// @return False if writing to the destination has failed at any point.
+    bool Finish();
+
+private:
+    bool FlushBlock();
+    bool WriteBytes(const void *data, uint numBytes);
+
+    Urho3D::Serializer &dest_;
+    /// Root entities of the current block.
+    PODVector<unsigned char> block_;
+    uint blockEntities_;
+    /// Serialization buffer of a single root entity, grown when an entity does not fit.
+    PODVector<unsigned char> entityBytes_;
+    /// Offset and entity count of each written block.
+    PODVector<uint> index_;
+    uint position_;
+    bool failed_;
+};
+
+/// Reads the root entities of a binary scene (.tbin) a block at a time, see SceneBinaryWriter.
+/** Also reads files of the original format, a u32 entity count followed by the entities, which are read as a single block. */
+class TUNDRACORE_API SceneBinaryReader
+{
+public:
+    /// Location of a block, from the block index.
+    struct Block
+    {
+        uint offset;
+        uint numEntities;
+    };
+
+    /// Reads the header from @c source, which must be positioned at the start of the file.
+    explicit SceneBinaryReader(Urho3D::Deserializer &source);
+
+    /// Returns the format version, 1 for the original format.
+    uint Version() const { return version_; }
+
+    /// Reads the next block of root entities, to be deserialized with Scene::CreateEntityFromBinary.
+    /// @return False once there are no more blocks, or if the file is truncated, see HasFailed.
+    bool ReadBlock(PODVector<unsigned char> &data, uint &numEntities);
+
+    /// Returns whether the file ended before the last block.
+    bool HasFailed() const { return failed_; }
+
+    /// Reads the block index, without changing the position of the block stream. Always empty for version 1.
+    /// @return False if the file has no valid block index.
+    bool ReadIndex(PODVector<Block> &blocks);
+
+private:
+    Urho3D::Deserializer &source_;
+    uint version_;
+    bool end_;
+    bool failed_;
+};
+
+}
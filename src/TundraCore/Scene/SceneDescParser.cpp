@@ -0,0 +1,639 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneDescParser.cpp
+    @brief  Builds scene descriptions from serialized scenes on the worker threads. */
+
+#include "StableHeaders.h"
+#include "SceneDescParser.h"
+#include "SceneBinary.h"
+#include "SceneAPI.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+#include "AttributeMetadata.h"
+#include "Name.h"
+#include "Framework.h"
+#include "AssetAPI.h"
+#include "LoggingFunctions.h"
+
+#include <kNet/DataDeserializer.h>
+
+#include <Engine/Core/WorkQueue.h>
+#include <Engine/Core/Profiler.h>
+#include <Engine/Resource/XMLElement.h>
+
+namespace Tundra
+{
+
+/// Root XML entities per job. Large enough for the jobs to amortize the work queue overhead.
+static const uint cXmlEntitiesPerJob = 256;
+/// Binary blocks held in memory at a time, per worker thread.
+static const uint cBinaryBlocksPerThread = 2;
+
+struct SceneDescParser::RawEntity
+{
+    struct Attribute
+    {
+        String id;
+        String name;
+        String value;
+    };
+
+    struct Component
+    {
+        /// Complete if layout is null, otherwise without attributes.
+        ComponentDesc desc;
+        const Layout *layout;
+        Vector<Attribute> attributes;
+    };
+
+    /// Without components and children.
+    EntityDesc desc;
+    Vector<Component> components;
+    Vector<RawEntity> children;
+};
+
+/// Parses a range of root entities on a worker thread. Only reads the parser's layouts, which do not change while jobs run.
+struct SceneDescParser::Job
+{
+    /// A component left to the main thread, see Merge.
+    struct PendingComponent
+    {
+        /// Indices of the entity, from the root entities of the job down.
+        PODVector<uint> path;
+        uint component;
+        PODVector<unsigned char> data;
+    };
+
+    Job(SceneDescParser *parser, const SceneDesc &sceneDesc) :
+        layouts(parser->layouts_),
+        assetAPI(parser->framework_->Asset()),
+        numEntities(0),
+        failed(false)
+    {
+        assetCache.basePath = sceneDesc.assetCache.basePath;
+    }
+
+    ~Job()
+    {
+        for(HashMap<u32, IAttribute*>::Iterator iter = converters.Begin(); iter != converters.End(); ++iter)
+            delete iter->second_;
+    }
+
+    void Execute()
+    {
+        try
+        {
+            for(uint i = 0; i < rawEntities.Size(); ++i)
+                ConvertEntity(rawEntities[i], entities);
+            if (!block.Empty())
+            {
+                PODVector<uint> path;
+                kNet::DataDeserializer source((const char*)&block[0], block.Size());
+                for(uint i = 0; i < numEntities; ++i)
+                    ReadEntity(source, entities, path);
+            }
+        }
+        catch(...)
+        {
+            failed = true;
+        }
+    }
+
+    void ConvertEntity(const RawEntity &raw, EntityDescList &dest)
+    {
+        EntityDesc entityDesc = raw.desc;
+        for(uint i = 0; i < raw.components.Size(); ++i)
+        {
+            const RawEntity::Component &rawComp = raw.components[i];
+            if (!rawComp.layout)
+            {
+                entityDesc.components.Push(rawComp.desc);
+                continue;
+            }
+
+            const Layout &layout = *rawComp.layout;
+            StringVector values(layout.attributes.Size());
+            for(uint j = 0; j < layout.attributes.Size(); ++j)
+                values[j] = layout.attributes[j].defaultValue;
+
+            // Same lookup as IComponent::DeserializeFrom: by ID, falling back to the name
+            for(uint j = 0; j < rawComp.attributes.Size(); ++j)
+            {
+                const RawEntity::Attribute &rawAttr = rawComp.attributes[j];
+                uint index = FindAttribute(layout, rawAttr.id, true);
+                if (index >= layout.attributes.Size())
+                    index = FindAttribute(layout, rawAttr.name, false);
+                if (index >= layout.attributes.Size())
+                {
+                    warnings.Push(layout.typeName + "::DeserializeFrom: Could not find attribute \"" +
+                        (rawAttr.name.Empty() ? rawAttr.id : rawAttr.name) + "\" specified in the XML element.");
+                    continue;
+                }
+                IAttribute *converter = Converter(layout.attributes[index]);
+                if (!converter)
+                    continue;
+                converter->FromString(rawAttr.value, AttributeChange::Disconnected);
+                values[index] = converter->ToString();
+            }
+
+            ComponentDesc compDesc = rawComp.desc;
+            AddAttributes(compDesc, layout, values);
+            ApplyName(entityDesc, compDesc);
+            entityDesc.components.Push(compDesc);
+        }
+
+        for(uint i = 0; i < raw.children.Size(); ++i)
+            ConvertEntity(raw.children[i], entityDesc.children);
+
+        dest.Push(entityDesc);
+    }
+
+    void ReadEntity(kNet::DataDeserializer &source, EntityDescList &dest, PODVector<uint> &path)
+    {
+        // The entity is pushed after its children, which do not go to dest, so its index is known already
+        path.Push(dest.Size());
+
+        EntityDesc entityDesc;
+        entityDesc.id = String(source.Read<u32>());
+        entityDesc.local = source.Read<u8>() ? false : true;
+
+        uint numComponents = source.Read<u32>();
+        const uint numChildren = numComponents >> 16;
+        numComponents &= 0xffff;
+        for(uint i = 0; i < numComponents; ++i)
+        {
+            ComponentDesc compDesc;
+            compDesc.typeId = source.Read<u32>();
+            compDesc.name = String(source.ReadString().c_str());
+            compDesc.sync = source.Read<u8>() ? true : false;
+            const uint dataSize = source.Read<u32>();
+
+            // Read the component data into a separate byte array, so that the stream does not desync even if the data is invalid
+            PODVector<unsigned char> data(dataSize);
+            if (dataSize)
+                source.ReadArray<u8>((u8*)&data[0], dataSize);
+
+            HashMap<u32, Layout>::ConstIterator layout = layouts.Find(compDesc.typeId);
+            if (layout == layouts.End() || !layout->second_.generic)
+            {
+                PendingComponent pendingComp;
+                pendingComp.path = path;
+                pendingComp.component = entityDesc.components.Size();
+                pendingComp.data.Swap(data);
+                pending.Push(pendingComp);
+                entityDesc.components.Push(compDesc);
+                continue;
+            }
+
+            compDesc.typeName = layout->second_.typeName;
+            try
+            {
+                if (dataSize)
+                    ReadAttributes(compDesc, layout->second_, data);
+            }
+            catch(...)
+            {
+                errors.Push("Scene::CreateSceneDescFromBinary: Exception while trying to load component " + compDesc.typeName + " " + compDesc.name);
+                continue;
+            }
+            entityDesc.components.Push(compDesc);
+        }
+
+        for(uint i = 0; i < numChildren; ++i)
+            ReadEntity(source, entityDesc.children, path);
+
+        path.Pop();
+        dest.Push(entityDesc);
+    }
+
+    /// Same as IComponent::DeserializeFromBinary.
+    void ReadAttributes(ComponentDesc &compDesc, const Layout &layout, const PODVector<unsigned char> &data)
+    {
+        kNet::DataDeserializer source((const char*)&data[0], data.Size());
+        StringVector values(layout.attributes.Size());
+        const uint numAttributes = source.Read<u8>();
+        if (numAttributes != layout.attributes.Size())
+        {
+            errors.Push("Wrong number of attributes in DeserializeFromBinary!");
+            for(uint i = 0; i < layout.attributes.Size(); ++i)
+                values[i] = layout.attributes[i].defaultValue;
+        }
+        else
+        {
+            for(uint i = 0; i < layout.attributes.Size(); ++i)
+            {
+                IAttribute *converter = Converter(layout.attributes[i]);
+                if (converter)
+                {
+                    converter->FromBinary(source, AttributeChange::Disconnected);
+                    values[i] = converter->ToString();
+                }
+                else
+                    values[i] = layout.attributes[i].defaultValue;
+            }
+        }
+        AddAttributes(compDesc, layout, values);
+    }
+
+    void AddAttributes(ComponentDesc &compDesc, const Layout &layout, const StringVector &values)
+    {
+        for(uint i = 0; i < layout.attributes.Size(); ++i)
+        {
+            const Layout::Attribute &attr = layout.attributes[i];
+            AttributeDesc attrDesc = { attr.typeName, attr.name, values[i], attr.id };
+            compDesc.attributes.Push(attrDesc);
+            if (attr.assetRefs)
+                AddAssetRefs(assetAPI, attrDesc, assetCache, assets);
+        }
+    }
+
+    static uint FindAttribute(const Layout &layout, const String &key, bool byId)
+    {
+        if (key.Empty())
+            return M_MAX_UNSIGNED;
+        for(uint i = 0; i < layout.attributes.Size(); ++i)
+            if ((byId ? layout.attributes[i].id : layout.attributes[i].name).Compare(key, false) == 0)
+                return i;
+        return M_MAX_UNSIGNED;
+    }
+
+    /// Returns a free-standing attribute of the type of @c attr for converting values, created on first use.
+    IAttribute *Converter(const Layout::Attribute &attr)
+    {
+        HashMap<u32, IAttribute*>::Iterator iter = converters.Find(attr.typeId);
+        if (iter != converters.End())
+            return iter->second_;
+        IAttribute *converter = SceneAPI::CreateAttribute(attr.typeId, attr.id);
+        converters[attr.typeId] = converter;
+        return converter;
+    }
+
+    const HashMap<u32, Layout> &layouts;
+    AssetAPI *assetAPI;
+
+    // XML input
+    Vector<RawEntity> rawEntities;
+    // Binary input
+    PODVector<unsigned char> block;
+    uint numEntities;
+
+    EntityDescList entities;
+    AssetDescCache assetCache;
+    SceneDesc::AssetMap assets;
+    Vector<PendingComponent> pending;
+    /// Messages to log on the main thread.
+    StringVector warnings;
+    StringVector errors;
+    /// Whether the binary data was truncated or invalid.
+    bool failed;
+
+    HashMap<u32, IAttribute*> converters;
+    SharedPtr<Urho3D::WorkItem> item;
+};
+
+SceneDescParser::SceneDescParser(Framework *framework) :
+    framework_(framework)
+{
+}
+
+SceneDescParser::~SceneDescParser()
+{
+}
+
+void SceneDescParser::ParseXml(const Urho3D::XMLElement &sceneElement, SceneDesc &sceneDesc)
+{
+    PROFILE(SceneDescParser_ParseXml);
+
+    Vector<Job*> jobs;
+    Urho3D::XMLElement entityElement = sceneElement.GetChild("entity");
+    while(entityElement)
+    {
+        if (jobs.Empty() || jobs.Back()->rawEntities.Size() >= cXmlEntitiesPerJob)
+            jobs.Push(new Job(this, sceneDesc));
+        ReadXmlEntity(entityElement, jobs.Back()->rawEntities, sceneDesc);
+        entityElement = entityElement.GetNext("entity");
+    }
+
+    Run(jobs);
+    for(uint i = 0; i < jobs.Size(); ++i)
+    {
+        Merge(jobs[i], sceneDesc);
+        delete jobs[i];
+    }
+}
+
+bool SceneDescParser::ParseBinary(SceneBinaryReader &reader, SceneDesc &sceneDesc)
+{
+    PROFILE(SceneDescParser_ParseBinary);
+
+    ReadAllLayouts();
+
+    Urho3D::WorkQueue *workQueue = framework_->GetSubsystem<Urho3D::WorkQueue>();
+    const uint maxJobs = ((workQueue ? workQueue->GetNumThreads() : 0) + 1) * cBinaryBlocksPerThread;
+
+    // Parse a batch of blocks at a time, so that the whole file is never held in memory
+    bool failed = false;
+    Vector<Job*> jobs;
+    PODVector<unsigned char> block;
+    uint numEntities = 0;
+    bool more = true;
+    while(more)
+    {
+        more = reader.ReadBlock(block, numEntities);
+        if (more && !block.Empty())
+        {
+            Job *job = new Job(this, sceneDesc);
+            job->block.Swap(block);
+            job->numEntities = numEntities;
+            jobs.Push(job);
+        }
+        if (jobs.Size() < maxJobs && more)
+            continue;
+
+        Run(jobs);
+        for(uint i = 0; i < jobs.Size(); ++i)
+        {
+            failed |= jobs[i]->failed;
+            if (!failed)
+                Merge(jobs[i], sceneDesc);
+            delete jobs[i];
+        }
+        jobs.Clear();
+        if (failed)
+            return false;
+    }
+    return true;
+}
+
+const SceneDescParser::Layout *SceneDescParser::LayoutById(u32 typeId)
+{
+    HashMap<u32, Layout>::ConstIterator iter = layouts_.Find(typeId);
+    if (iter != layouts_.End())
+        return &iter->second_;
+
+    ComponentPtr comp = framework_->Scene()->CreateComponentById(0, typeId);
+    if (!comp)
+        return 0;
+
+    Layout &layout = layouts_[comp->TypeId()];
+    layout.typeId = comp->TypeId();
+    layout.typeName = comp->TypeName();
+    layout.generic = comp->HasDefaultDeserialization();
+    foreach(IAttribute *a, comp->Attributes())
+    {
+        if (!a)
+            continue;
+        Layout::Attribute attr;
+        attr.typeId = a->TypeId();
+        attr.typeName = a->TypeName();
+        attr.id = a->Id();
+        attr.name = a->Name();
+        attr.defaultValue = a->ToString();
+        attr.assetRefs = attr.typeName.Compare("AssetReference", false) == 0 || attr.typeName.Compare("AssetReferenceList", false) == 0 ||
+            (a->Metadata() && a->Metadata()->elementType.Compare("AssetReference", false) == 0);
+        layout.attributes.Push(attr);
+    }
+    layoutIds_[layout.typeName] = layout.typeId;
+    return &layout;
+}
+
+const SceneDescParser::Layout *SceneDescParser::LayoutByName(const String &typeName)
+{
+    const String name = IComponent::EnsureTypeNameWithoutPrefix(typeName);
+    HashMap<String, u32>::ConstIterator iter = layoutIds_.Find(name);
+    if (iter != layoutIds_.End())
+        return LayoutById(iter->second_);
+
+    const u32 typeId = framework_->Scene()->ComponentTypeIdForTypeName(name);
+    return (typeId ? LayoutById(typeId) : 0);
+}
+
+void SceneDescParser::ReadAllLayouts()
+{
+    StringVector typeNames = framework_->Scene()->ComponentTypes();
+    for(uint i = 0; i < typeNames.Size(); ++i)
+        LayoutByName(typeNames[i]);
+}
+
+void SceneDescParser::ReadXmlEntity(const Urho3D::XMLElement &entityElement, Vector<RawEntity> &dest, SceneDesc &sceneDesc)
+{
+    String id = entityElement.GetAttribute("id");
+    if (id.Empty())
+        return;
+
+    RawEntity entity;
+    entity.desc.id = id;
+    entity.desc.local = false;
+    if (entityElement.HasAttribute("sync"))
+        entity.desc.local = !entityElement.GetBool("sync"); /**< @todo if no "sync"* attr, deduct from the ID. */
+    entity.desc.temporary = entityElement.GetBool("temporary");
+
+    Urho3D::XMLElement compElement = entityElement.GetChild("component");
+    while(compElement)
+    {
+        RawEntity::Component comp;
+        comp.desc.typeName = compElement.GetAttribute("type");
+        comp.desc.typeId = 0xffffffff;
+        if (compElement.GetUInt("typeId"))
+            comp.desc.typeId = compElement.GetUInt("typeId");
+        comp.desc.name = compElement.GetAttribute("name");
+        comp.desc.sync = compElement.GetBool("sync");
+        const bool hasTypeId = comp.desc.typeId != 0xffffffff;
+
+        comp.layout = (hasTypeId ? LayoutById(comp.desc.typeId) : LayoutByName(comp.desc.typeName));
+        if (comp.layout && comp.layout->generic)
+        {
+            Urho3D::XMLElement attrElement = compElement.GetChild("attribute");
+            while(attrElement)
+            {
+                RawEntity::Attribute attr;
+                attr.id = attrElement.GetAttribute("id");
+                attr.name = attrElement.GetAttribute("name");
+                attr.value = attrElement.GetAttribute("value");
+                comp.attributes.Push(attr);
+                attrElement = attrElement.GetNext("attribute");
+            }
+            entity.components.Push(comp);
+        }
+        else
+        {
+            comp.layout = 0;
+            if (ComponentDescFromXml(comp.desc, compElement, sceneDesc))
+            {
+                ApplyName(entity.desc, comp.desc);
+                entity.components.Push(comp);
+            }
+        }
+
+        compElement = compElement.GetNext("component");
+    }
+
+    Urho3D::XMLElement childElement = entityElement.GetChild("entity");
+    while(childElement)
+    {
+        ReadXmlEntity(childElement, entity.children, sceneDesc);
+        childElement = childElement.GetNext("entity");
+    }
+
+    dest.Push(entity);
+}
+
+void SceneDescParser::Run(Vector<Job*> &jobs)
+{
+    Urho3D::WorkQueue *workQueue = framework_->GetSubsystem<Urho3D::WorkQueue>();
+    if (!workQueue || workQueue->GetNumThreads() == 0 || jobs.Size() < 2)
+    {
+        for(uint i = 0; i < jobs.Size(); ++i)
+            jobs[i]->Execute();
+        return;
+    }
+
+    for(uint i = 0; i < jobs.Size(); ++i)
+    {
+        jobs[i]->item = new Urho3D::WorkItem();
+        jobs[i]->item->workFunction_ = JobWork;
+        jobs[i]->item->start_ = jobs[i];
+        // Highest priority, so that Complete does not wait for the asset decodes
+        jobs[i]->item->priority_ = M_MAX_UNSIGNED;
+        workQueue->AddWorkItem(jobs[i]->item);
+    }
+    workQueue->Complete(M_MAX_UNSIGNED);
+}
+
+void SceneDescParser::JobWork(const Urho3D::WorkItem *item, unsigned /*threadIndex*/)
+{
+    static_cast<Job*>(item->start_)->Execute();
+}
+
+void SceneDescParser::Merge(Job *job, SceneDesc &sceneDesc)
+{
+    for(uint i = 0; i < job->warnings.Size(); ++i)
+        LogWarning(job->warnings[i]);
+    for(uint i = 0; i < job->errors.Size(); ++i)
+        LogError(job->errors[i]);
+
+    // In reverse, so that removing a failed component does not move the ones still pending
+    for(uint i = job->pending.Size(); i > 0; --i)
+    {
+        const Job::PendingComponent &pendingComp = job->pending[i - 1];
+        EntityDesc *entityDesc = &job->entities[pendingComp.path[0]];
+        for(uint j = 1; j < pendingComp.path.Size(); ++j)
+            entityDesc = &entityDesc->children[pendingComp.path[j]];
+        ComponentDesc &compDesc = entityDesc->components[pendingComp.component];
+        if (!ComponentDescFromBinary(compDesc, pendingComp.data, sceneDesc))
+            entityDesc->components.Erase(pendingComp.component);
+    }
+
+    for(uint i = 0; i < job->entities.Size(); ++i)
+        sceneDesc.entities.Push(job->entities[i]);
+    for(SceneDesc::AssetMap::ConstIterator iter = job->assets.Begin(); iter != job->assets.End(); ++iter)
+        sceneDesc.assets[iter->first_] = iter->second_;
+    for(HashMap<String, AssetDescCache::FileInfoPair>::ConstIterator iter = job->assetCache.cache.Begin(); iter != job->assetCache.cache.End(); ++iter)
+        if (!sceneDesc.assetCache.cache.Contains(iter->first_))
+            sceneDesc.assetCache.cache[iter->first_] = iter->second_;
+}
+
+bool SceneDescParser::ComponentDescFromXml(ComponentDesc &compDesc, const Urho3D::XMLElement &compElement, SceneDesc &sceneDesc)
+{
+    const bool hasTypeId = compDesc.typeId != 0xffffffff;
+    ComponentPtr comp = (hasTypeId ? framework_->Scene()->CreateComponentById(0, compDesc.typeId, compDesc.name) :
+        framework_->Scene()->CreateComponentByName(0, compDesc.typeName, compDesc.name));
+    if (!comp)
+        return false;
+
+    comp->DeserializeFrom(compElement, AttributeChange::Disconnected);
+    foreach(IAttribute *a, comp->Attributes())
+    {
+        if (!a)
+            continue;
+        AttributeDesc attrDesc = { a->TypeName(), a->Name(), a->ToString(), a->Id() };
+        compDesc.attributes.Push(attrDesc);
+        if (attrDesc.typeName.Compare("AssetReference", false) == 0 || attrDesc.typeName.Compare("AssetReferenceList", false) == 0 ||
+            (a->Metadata() && a->Metadata()->elementType.Compare("AssetReference", false) == 0))
+            AddAssetRefs(framework_->Asset(), attrDesc, sceneDesc.assetCache, sceneDesc.assets);
+    }
+    return true;
+}
+
+bool SceneDescParser::ComponentDescFromBinary(ComponentDesc &compDesc, const PODVector<unsigned char> &data, SceneDesc &sceneDesc)
+{
+    SceneAPI *sceneAPI = framework_->Scene();
+    compDesc.typeName = sceneAPI->ComponentTypeNameForTypeId(compDesc.typeId);
+    try
+    {
+        ComponentPtr comp = sceneAPI->CreateComponentById(0, compDesc.typeId, compDesc.name);
+        if (!comp)
+        {
+            LogError("Scene::CreateSceneDescFromBinary: Failed to load component " + compDesc.typeName + " " + compDesc.name);
+            return false;
+        }
+        if (data.Empty())
+            return true;
+
+        kNet::DataDeserializer source((const char*)&data[0], data.Size());
+        // Trigger no signal yet when scene is in incoherent state
+        comp->DeserializeFromBinary(source, AttributeChange::Disconnected);
+        foreach(IAttribute *a, comp->Attributes())
+        {
+            if (!a)
+                continue;
+            AttributeDesc attrDesc = { a->TypeName(), a->Name(), a->ToString(), a->Id() };
+            compDesc.attributes.Push(attrDesc);
+            if (attrDesc.typeName.Compare("AssetReference", false) == 0 || attrDesc.typeName.Compare("AssetReferenceList", false) == 0 ||
+                (a->Metadata() && a->Metadata()->elementType.Compare("AssetReference", false) == 0))
+                AddAssetRefs(framework_->Asset(), attrDesc, sceneDesc.assetCache, sceneDesc.assets);
+        }
+        return true;
+    }
+    catch(...)
+    {
+        LogError("Scene::CreateSceneDescFromBinary: Exception while trying to load component " + compDesc.typeName + " " + compDesc.name);
+        return false;
+    }
+}
+
+void SceneDescParser::ApplyName(EntityDesc &entityDesc, const ComponentDesc &compDesc)
+{
+    // A bit of a hack to get the name from Name.
+    if (!entityDesc.name.Empty() || (compDesc.typeId != Name::ComponentTypeId &&
+        IComponent::EnsureTypeNameWithoutPrefix(compDesc.typeName) != Name::TypeNameStatic()))
+        return;
+
+    for(uint i = 0; i < compDesc.attributes.Size(); ++i)
+    {
+        const AttributeDesc &attr = compDesc.attributes[i];
+        if (attr.id.Compare("name", false) == 0)
+            entityDesc.name = attr.value;
+        else if (attr.id.Compare("group", false) == 0)
+            entityDesc.group = attr.value;
+    }
+}
+
+void SceneDescParser::AddAssetRefs(AssetAPI *assetAPI, const AttributeDesc &attrDesc, AssetDescCache &assetCache, SceneDesc::AssetMap &assets)
+{
+    if (attrDesc.value.Empty())
+        return;
+
+    // We might have multiple references, ";" used as a separator.
+    StringVector assetRefs = attrDesc.value.Split(';');
+    for(uint i = 0; i < assetRefs.Size(); ++i)
+    {
+        const String &assetRef = assetRefs[i];
+
+        AssetDesc ad;
+        ad.typeName = attrDesc.name;
+
+        // Resolve absolute file path for asset reference and the destination name (just the filename).
+        if (!assetCache.Fill(assetRef, ad))
+        {
+            assetAPI->ResolveLocalAssetPath(assetRef, assetCache.basePath, ad.source);
+            ad.destinationName = AssetAPI::ExtractFilenameFromAssetRef(ad.source);
+            assetCache.Add(assetRef, ad);
+        }
+
+        assets[MakePair(ad.source, ad.subname)] = ad;
+    }
+}
+
+}
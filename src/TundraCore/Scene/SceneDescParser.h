@@ -0,0 +1,105 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneDescParser.h
+    @brief  Builds scene descriptions from serialized scenes on the worker threads. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "SceneDesc.h"
+
+#include <HashMap.h>
+#include <Vector.h>
+
+namespace Urho3D
+{
+    struct WorkItem;
+}
+
+namespace Tundra
+{
+
+/// Builds a SceneDesc from scene XML or a binary scene, splitting the root entities across the Urho3D worker threads.
+/** The entity descriptions are independent of each other, so ranges of root entities (of XML elements, or the blocks of a binary
+    scene, see SceneBinaryReader) are parsed in parallel, and the resulting descriptions are merged in the original order.
+
+    Components are not created on the worker threads. Instead, the attribute layout of each component type is read from one
+    instance of the type on the main thread, and the serialized attribute values are converted with free-standing attributes.
+    Components that do not use the default deserialization (see IComponent::HasDefaultDeserialization) are parsed from an
+    instance on the main thread, like all components are when there are no worker threads.
+
+    Walking the XML document is not thread safe, so for XML the main thread copies the elements to plain strings, and the
+    workers convert the values and resolve the asset references. */
+class TUNDRACORE_API SceneDescParser
+{
+public:
+    explicit SceneDescParser(Framework *framework);
+    ~SceneDescParser();
+
+    /// Adds the entities of the "scene" element of scene XML to @c sceneDesc.
+    void ParseXml(const Urho3D::XMLElement &sceneElement, SceneDesc &sceneDesc);
+
+    /// Adds the entities of a binary scene to @c sceneDesc.
+    /// @return False if the binary scene is invalid.
+    bool ParseBinary(SceneBinaryReader &reader, SceneDesc &sceneDesc);
+
+private:
+    /// Attribute structure of a component type.
+    struct Layout
+    {
+        struct Attribute
+        {
+            u32 typeId;
+            String typeName;
+            String id;
+            String name;
+            String defaultValue;
+            bool assetRefs; ///< Whether the value holds asset references.
+        };
+
+        u32 typeId;
+        String typeName;
+        Vector<Attribute> attributes;
+        /// False if the component does not use the default deserialization, and has to be parsed from an instance.
+        bool generic;
+    };
+
+    struct RawEntity;
+    struct Job;
+
+    /// Returns the layout of a component type, read from an instance on first use. Null for unknown types. Main thread only.
+    const Layout *LayoutById(u32 typeId);
+    const Layout *LayoutByName(const String &typeName); ///< @overload
+
+    /// Reads the layouts of all the registered component types, so that the worker threads can look them up.
+    void ReadAllLayouts();
+
+    /// Copies an entity element, with its children, to @c dest. Components that need an instance are parsed right away.
+    void ReadXmlEntity(const Urho3D::XMLElement &entityElement, Vector<RawEntity> &dest, SceneDesc &sceneDesc);
+
+    /// Runs the jobs on the worker threads and waits for them, or runs them on the calling thread if there are no workers.
+    void Run(Vector<Job*> &jobs);
+    static void JobWork(const Urho3D::WorkItem *item, unsigned threadIndex);
+
+    /// Completes the components a job left to the main thread, logs its messages and appends its results to @c sceneDesc.
+    void Merge(Job *job, SceneDesc &sceneDesc);
+
+    /// Parses a component from an instance on the main thread.
+    bool ComponentDescFromXml(ComponentDesc &compDesc, const Urho3D::XMLElement &compElement, SceneDesc &sceneDesc);
+    bool ComponentDescFromBinary(ComponentDesc &compDesc, const PODVector<unsigned char> &data, SceneDesc &sceneDesc); ///< @overload
+
+    /// Sets the name and group of @c entityDesc from its Name component, if it has no name yet.
+    static void ApplyName(EntityDesc &entityDesc, const ComponentDesc &compDesc);
+
+    /// Adds the asset references of @c attrDesc to the assets of a scene description.
+    static void AddAssetRefs(AssetAPI *assetAPI, const AttributeDesc &attrDesc, AssetDescCache &assetCache, SceneDesc::AssetMap &assets);
+
+    Framework *framework_;
+    HashMap<u32, Layout> layouts_;
+    HashMap<String, u32> layoutIds_;
+};
+
+}
@@ -13,6 +13,7 @@ namespace Urho3D
     class XMLElement;
     class XMLFile;
     class Context;
+    class Serializer;
 }
 
 namespace kNet
@@ -32,6 +33,14 @@ namespace Tundra
     class IAttribute;
     class AttributeMetadata;
     class ChangeRequest;
+    class AttributeChangeJournal;
+    class SceneBinaryWriter;
+    class SceneBinaryReader;
+    class SceneSnapshot;
+    class SceneJournal;
+    class EntitySnapshot;
+    class ComponentSnapshot;
+    class AttributeSnapshot;
     class Transform;
 
     struct SceneDesc;
@@ -53,6 +62,7 @@ namespace Tundra
     typedef SharedPtr<IComponentFactory> ComponentFactoryPtr;
     typedef Vector<IAttribute*> AttributeVector;
     typedef HashMap<String, ScenePtr> SceneMap;
+    typedef SharedPtr<SceneSnapshot> SceneSnapshotPtr;
 
     typedef Vector<EntityDesc> EntityDescList;
     typedef Vector<ComponentDesc> ComponentDescList;
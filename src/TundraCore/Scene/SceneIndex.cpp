@@ -0,0 +1,59 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneIndex.cpp
+    @brief  Secondary indices of the components of a scene. */
+
+#include "StableHeaders.h"
+
+#include "SceneIndex.h"
+#include "IComponent.h"
+#include "Name.h"
+
+namespace Tundra
+{
+
+void SceneIndex::AddComponent(IComponent *comp)
+{
+    components_.Insert(comp->TypeId(), comp);
+    if (comp->TypeId() == Name::ComponentTypeId)
+        UpdateName(comp);
+}
+
+void SceneIndex::RemoveComponent(IComponent *comp)
+{
+    components_.Remove(comp);
+    if (comp->TypeId() == Name::ComponentTypeId)
+    {
+        names_.Remove(comp);
+        groups_.Remove(comp);
+    }
+}
+
+void SceneIndex::UpdateName(IComponent *comp)
+{
+    if (!components_.Contains(comp))
+        return;
+
+    Name *nameComp = static_cast<Name*>(comp);
+    const String &name = nameComp->name.Get();
+    if (name.Empty())
+        names_.Remove(comp);
+    else
+        names_.Insert(name, comp);
+
+    const String &group = nameComp->group.Get();
+    if (group.Empty())
+        groups_.Remove(comp);
+    else
+        groups_.Insert(group, comp);
+}
+
+void SceneIndex::Clear()
+{
+    components_.Clear();
+    names_.Clear();
+    groups_.Clear();
+}
+
+}
@@ -0,0 +1,133 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneIndex.h
+    @brief  Secondary indices of the components of a scene. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+
+#include <HashMap.h>
+
+namespace Tundra
+{
+
+/// Components grouped by a key, with constant time removal.
+/** A component has at most one key. The components of a key are kept in an array, from which removal swaps the last
+    component to the removed slot, so the order of the components of a key is not stable. */
+template <class Key>
+class ComponentMultiIndex
+{
+public:
+    typedef PODVector<IComponent*> ComponentList;
+    typedef HashMap<Key, ComponentList> BucketMap;
+
+    /// Adds @c comp with @c key, or moves it to @c key if it already had another one.
+    void Insert(const Key &key, IComponent *comp)
+    {
+        typename HashMap<IComponent*, Slot>::Iterator slot = slots_.Find(comp);
+        if (slot != slots_.End())
+        {
+            if (slot->second_.key == key)
+                return;
+            Remove(comp);
+        }
+        ComponentList &bucket = buckets_[key];
+        Slot &newSlot = slots_[comp];
+        newSlot.key = key;
+        newSlot.index = bucket.Size();
+        bucket.Push(comp);
+    }
+
+    /// Removes @c comp if it has been added.
+    void Remove(IComponent *comp)
+    {
+        typename HashMap<IComponent*, Slot>::Iterator slot = slots_.Find(comp);
+        if (slot == slots_.End())
+            return;
+
+        typename BucketMap::Iterator bucket = buckets_.Find(slot->second_.key);
+        ComponentList &list = bucket->second_;
+        const unsigned index = slot->second_.index;
+        if (index + 1 < list.Size())
+        {
+            list[index] = list.Back();
+            slots_[list[index]].index = index;
+        }
+        list.Pop();
+        if (list.Empty())
+            buckets_.Erase(bucket);
+        slots_.Erase(slot);
+    }
+
+    /// Returns whether @c comp has been added.
+    bool Contains(IComponent *comp) const { return slots_.Contains(comp); }
+
+    /// Returns the components of @c key, or null if there are none.
+    const ComponentList *Find(const Key &key) const
+    {
+        typename BucketMap::ConstIterator bucket = buckets_.Find(key);
+        return bucket != buckets_.End() ? &bucket->second_ : 0;
+    }
+
+    /// Returns all keys and their components.
+    const BucketMap &Buckets() const { return buckets_; }
+
+    void Clear()
+    {
+        buckets_.Clear();
+        slots_.Clear();
+    }
+
+private:
+    struct Slot
+    {
+        Key key;
+        unsigned index;
+    };
+
+    BucketMap buckets_;
+    HashMap<IComponent*, Slot> slots_;
+};
+
+/// Secondary indices of a scene for the entity and component queries that would otherwise scan all entities.
+/** Indexes the components of the scene's entities by type ID, and the Name components by the entity name and group.
+    The empty name and group are not indexed. Maintained by Scene as components are added, removed and renamed. */
+class TUNDRACORE_API SceneIndex
+{
+public:
+    typedef ComponentMultiIndex<String>::ComponentList ComponentList;
+
+    /// Adds a component that was added to an entity of the scene.
+    void AddComponent(IComponent *comp);
+
+    /// Removes a component that is being removed from an entity of the scene.
+    void RemoveComponent(IComponent *comp);
+
+    /// Updates the name and group of a Name component. Does nothing if the component has not been added.
+    void UpdateName(IComponent *comp);
+
+    void Clear();
+
+    /// Returns the components of type @c typeId, or null if there are none.
+    const ComponentList *ComponentsOfType(u32 typeId) const { return components_.Find(typeId); }
+
+    /// Returns the Name components with @c name, or null if there are none.
+    const ComponentList *NamesByName(const String &name) const { return names_.Find(name); }
+
+    /// Returns the Name components with @c group, or null if there are none.
+    const ComponentList *NamesByGroup(const String &group) const { return groups_.Find(group); }
+
+    /// Returns all indexed names.
+    const ComponentMultiIndex<String>::BucketMap &Names() const { return names_.Buckets(); }
+
+private:
+    ComponentMultiIndex<u32> components_;
+    ComponentMultiIndex<String> names_;
+    ComponentMultiIndex<String> groups_;
+};
+
+}
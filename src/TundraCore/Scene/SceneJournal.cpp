@@ -0,0 +1,786 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneJournal.cpp
+    @brief  Append-only journal of the changes of a persistent scene. */
+
+#include "StableHeaders.h"
+#include "Win.h"
+#include "SceneJournal.h"
+#include "Scene.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+#include "AttributeChangeJournal.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "LoggingFunctions.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include <Engine/Core/Thread.h>
+#include <Timer.h>
+#include <StringUtils.h>
+#include <List.h>
+#include <File.h>
+#include <FileSystem.h>
+#include <MemoryBuffer.h>
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+
+namespace Tundra
+{
+
+static const String cJournalFileId = "TJNL";
+static const uint cJournalVersion = 1;
+/// Components and attributes larger than this are not recorded.
+static const uint cMaxRecordSize = 64 * 1024 * 1024;
+
+/// Moves @c source to @c dest, replacing @c dest in a single step, so that either the old or the new file exists after a crash.
+static bool ReplaceFile(const String &source, const String &dest)
+{
+#ifdef WIN32
+    return MoveFileExW(Urho3D::WString(Urho3D::GetNativePath(source)).CString(), Urho3D::WString(Urho3D::GetNativePath(dest)).CString(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(Urho3D::GetNativePath(source).CString(), Urho3D::GetNativePath(dest).CString()) == 0;
+#endif
+}
+
+/// Writes the journal records and the compacted snapshots of a SceneJournal on a background thread, in the order they are queued.
+/** The thread sleeps until a task is queued. Urho3D::Condition does not keep a signal that arrives before the wait on all
+    platforms, so a standard condition variable is used. */
+class SceneJournalWriter : public Urho3D::Thread
+{
+public:
+    SceneJournalWriter(Urho3D::Context *context, const String &snapshotPath, const String &journalPath) :
+        context_(context),
+        snapshotPath_(snapshotPath),
+        journalPath_(journalPath)
+    {
+    }
+
+    ~SceneJournalWriter()
+    {
+        for(Urho3D::List<Task>::Iterator iter = tasks_.Begin(); iter != tasks_.End(); ++iter)
+            delete iter->snapshot;
+    }
+
+    /// Queues records to be appended to the journal. Takes the contents of @c records.
+    void Append(PODVector<unsigned char> &records)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.Push(Task());
+            tasks_.Back().records.Swap(records);
+        }
+        queued_.notify_one();
+    }
+
+    /// Queues a snapshot to replace the current one. The journal is truncated once the snapshot has been written. Takes ownership of @c snapshot.
+    void Compact(Urho3D::VectorBuffer *snapshot)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.Push(Task());
+            tasks_.Back().snapshot = snapshot;
+        }
+        queued_.notify_one();
+    }
+
+    /// Returns the errors since the last call.
+    String TakeErrors()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        String errors = errors_;
+        errors_.Clear();
+        return errors;
+    }
+
+    /// Writes the queued tasks, and stops the thread.
+    void StopWriting()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shouldRun_ = false;
+        }
+        queued_.notify_one();
+        Stop();
+    }
+
+    /// Urho3D::Thread override.
+    void ThreadFunction() override
+    {
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while(shouldRun_ && tasks_.Empty())
+                    queued_.wait(lock);
+                // Write what was queued before stopping
+                if (tasks_.Empty())
+                    break;
+            }
+            WriteNext();
+        }
+        journal_.Reset();
+    }
+
+private:
+    struct Task
+    {
+        Task() : snapshot(0) {}
+
+        PODVector<unsigned char> records;
+        Urho3D::VectorBuffer *snapshot;
+    };
+
+    bool WriteNext()
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (tasks_.Empty())
+                return false;
+            task.records.Swap(tasks_.Front().records);
+            task.snapshot = tasks_.Front().snapshot;
+            tasks_.PopFront();
+        }
+
+        if (task.snapshot)
+        {
+            WriteSnapshot(*task.snapshot);
+            delete task.snapshot;
+        }
+        else if (!task.records.Empty())
+        {
+            if ((journal_ || OpenJournal(false)) && journal_->Write(&task.records[0], task.records.Size()) == task.records.Size())
+                journal_->Flush();
+            else
+                Error("SceneJournal: Failed to write " + journalPath_ + ", " + String(task.records.Size()) + " bytes of changes were lost.");
+        }
+        return true;
+    }
+
+    void WriteSnapshot(const Urho3D::VectorBuffer &snapshot)
+    {
+        // Write the snapshot aside, so that the old snapshot and the journal stay valid if writing fails
+        const String tempPath = snapshotPath_ + ".tmp";
+        bool written = false;
+        {
+            Urho3D::File file(context_, tempPath, Urho3D::FILE_WRITE);
+            written = file.IsOpen() && file.Write(snapshot.GetData(), snapshot.GetSize()) == snapshot.GetSize();
+        }
+        if (!written || !ReplaceFile(tempPath, snapshotPath_))
+        {
+            Error("SceneJournal: Failed to write snapshot " + snapshotPath_ + ", the journal is kept.");
+            return;
+        }
+
+        journal_.Reset();
+        if (!OpenJournal(true))
+            Error("SceneJournal: Failed to truncate " + journalPath_ + ".");
+    }
+
+    bool OpenJournal(bool truncate)
+    {
+        Urho3D::FileSystem *fileSystem = context_->GetSubsystem<Urho3D::FileSystem>();
+        if (!truncate && fileSystem->FileExists(journalPath_))
+        {
+            journal_ = new Urho3D::File(context_, journalPath_, Urho3D::FILE_READWRITE);
+            if (journal_->IsOpen())
+                journal_->Seek(journal_->GetSize());
+        }
+        else
+        {
+            journal_ = new Urho3D::File(context_, journalPath_, Urho3D::FILE_WRITE);
+            if (journal_->IsOpen() && (!journal_->WriteFileID(cJournalFileId) || !journal_->WriteUInt(cJournalVersion)))
+                journal_->Close();
+        }
+        if (!journal_->IsOpen())
+            journal_.Reset();
+        return journal_.NotNull();
+    }
+
+    void Error(const String &error)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!errors_.Empty())
+            errors_ += "\n";
+        errors_ += error;
+    }
+
+    Urho3D::Context *context_;
+    String snapshotPath_;
+    String journalPath_;
+    /// Accessed only from the writer thread.
+    SharedPtr<Urho3D::File> journal_;
+
+    std::mutex mutex_;
+    /// Signaled when a task is queued, or the thread is stopped.
+    std::condition_variable queued_;
+    /// Protected by mutex_.
+    Urho3D::List<Task> tasks_;
+    /// Protected by mutex_.
+    String errors_;
+};
+
+/// Serializes a component to @c buffer, growing it until the component fits. Returns the size, or M_MAX_UNSIGNED if the component is too large.
+static uint SerializeComponent(IComponent *comp, PODVector<unsigned char> &buffer)
+{
+    if (buffer.Empty())
+        buffer.Resize(64 * 1024);
+    for(;;)
+    {
+        try
+        {
+            kNet::DataSerializer dest((char*)&buffer[0], buffer.Size());
+            comp->SerializeToBinary(dest);
+            return static_cast<uint>(dest.BytesFilled());
+        }
+        catch(...)
+        {
+            if (buffer.Size() >= cMaxRecordSize)
+                return M_MAX_UNSIGNED;
+            buffer.Resize(buffer.Size() * 2);
+        }
+    }
+}
+
+/// Serializes an attribute to @c buffer, growing it until the attribute fits. Returns the size, or M_MAX_UNSIGNED if the attribute is too large.
+static uint SerializeAttribute(IAttribute *attribute, PODVector<unsigned char> &buffer)
+{
+    if (buffer.Empty())
+        buffer.Resize(64 * 1024);
+    for(;;)
+    {
+        try
+        {
+            kNet::DataSerializer dest((char*)&buffer[0], buffer.Size());
+            attribute->ToBinary(dest);
+            return static_cast<uint>(dest.BytesFilled());
+        }
+        catch(...)
+        {
+            if (buffer.Size() >= cMaxRecordSize)
+                return M_MAX_UNSIGNED;
+            buffer.Resize(buffer.Size() * 2);
+        }
+    }
+}
+
+static unsigned long long ComponentKey(entity_id_t entity, component_id_t component)
+{
+    return ((unsigned long long)entity << 32) | component;
+}
+
+SceneJournal::SceneJournal(Scene *scene, const String &basePath) :
+    Object(scene->GetContext()),
+    scene_(scene),
+    snapshotPath_(basePath + ".tbin"),
+    journalPath_(basePath + ".tjnl"),
+    compactionSize_(64 * 1024 * 1024),
+    compactionInterval_(60.0f),
+    sinceCompaction_(0.0f),
+    journalSize_(0),
+    restored_(false),
+    writer_(0)
+{
+    StringVector compactSize = scene->GetFramework()->CommandLineParameters("--sceneJournalCompactSize");
+    if (!compactSize.Empty())
+        compactionSize_ = Urho3D::ToUInt(compactSize.Front()) * 1024 * 1024;
+    StringVector compactInterval = scene->GetFramework()->CommandLineParameters("--sceneJournalCompactInterval");
+    if (!compactInterval.Empty())
+        compactionInterval_ = Urho3D::Max(Urho3D::ToFloat(compactInterval.Front()), 0.0f);
+}
+
+SceneJournal::~SceneJournal()
+{
+    Stop();
+}
+
+bool SceneJournal::Restore(AttributeChange::Type change)
+{
+    Urho3D::FileSystem *fileSystem = GetSubsystem<Urho3D::FileSystem>();
+    // A snapshot that was written completely, but not moved in place before a crash, is newer than the journal
+    String snapshotPath = snapshotPath_;
+    if (!fileSystem->FileExists(snapshotPath) && fileSystem->FileExists(snapshotPath_ + ".tmp"))
+    {
+        snapshotPath = snapshotPath_ + ".tmp";
+        LogWarning("SceneJournal: " + snapshotPath_ + " is missing, restoring from " + snapshotPath + ".");
+    }
+    const bool hasSnapshot = fileSystem->FileExists(snapshotPath);
+    const bool hasJournal = fileSystem->FileExists(journalPath_);
+    if (!hasSnapshot && !hasJournal)
+        return false;
+
+    if (hasSnapshot)
+        scene_->LoadSceneBinary(snapshotPath, true, true, change);
+
+    uint numRecords = 0;
+    bool intact = true;
+    if (hasJournal)
+    {
+        Urho3D::File file(GetContext(), journalPath_, Urho3D::FILE_READ);
+        PODVector<unsigned char> data;
+        if (file.IsOpen() && file.GetSize() > 0)
+        {
+            data.Resize(file.GetSize());
+            data.Resize(file.Read(&data[0], data.Size()));
+        }
+        Urho3D::MemoryBuffer src(data.Buffer(), data.Size());
+        intact = (src.GetSize() >= 8 && src.ReadFileID() == cJournalFileId && src.ReadUInt() == cJournalVersion);
+        while(intact && !src.IsEof())
+        {
+            // A record is not complete if writing it was interrupted by a crash. The rest of the journal is discarded.
+            if (src.GetSize() - src.GetPosition() < 5)
+            {
+                intact = false;
+                break;
+            }
+            u8 type = src.ReadUByte();
+            uint length = src.ReadUInt();
+            if (src.GetSize() - src.GetPosition() < length)
+            {
+                intact = false;
+                break;
+            }
+            Urho3D::MemoryBuffer record(data.Buffer() + src.GetPosition(), length);
+            ReadRecord(type, record, change);
+            src.Seek(src.GetPosition() + length);
+            ++numRecords;
+        }
+    }
+
+    if (!intact)
+        LogWarning("SceneJournal: " + journalPath_ + " is incomplete, replayed the first " + String(numRecords) + " changes.");
+    LogInfo("SceneJournal: Restored " + String(scene_->Entities().Size()) + " entities from " + snapshotPath + " and " + String(numRecords) + " changes.");
+    restored_ = true;
+    return true;
+}
+
+bool SceneJournal::Start()
+{
+    if (writer_)
+        return true;
+
+    writer_ = new SceneJournalWriter(GetContext(), snapshotPath_, journalPath_);
+    if (!writer_->Run())
+    {
+        LogError("SceneJournal: Failed to start the writer thread.");
+        delete writer_;
+        writer_ = 0;
+        return false;
+    }
+
+    scene_->EntityCreated.Connect(this, &SceneJournal::OnEntityCreated);
+    scene_->EntityRemoved.Connect(this, &SceneJournal::OnEntityRemoved);
+    scene_->EntityParentChanged.Connect(this, &SceneJournal::OnEntityParentChanged);
+    scene_->ComponentAdded.Connect(this, &SceneJournal::OnComponentAdded);
+    scene_->ComponentRemoved.Connect(this, &SceneJournal::OnComponentRemoved);
+    scene_->AttributeChanged.Connect(this, &SceneJournal::OnAttributeChanged);
+    scene_->AttributeChangesFlushed.Connect(this, &SceneJournal::OnAttributeChangesFlushed);
+    scene_->GetFramework()->Frame()->PostFrameUpdate.Connect(this, &SceneJournal::OnFrameUpdate);
+
+    // Start from a snapshot of the current content, which replaces any previous snapshot and journal
+    Compact();
+    return true;
+}
+
+void SceneJournal::Stop()
+{
+    if (!writer_)
+        return;
+
+    // Changes batched by the scene are signaled only on its flush
+    if (scene_->IsAttributeChangeBatching())
+        scene_->FlushAttributeChanges();
+    Flush();
+
+    scene_->EntityCreated.Disconnect(this, &SceneJournal::OnEntityCreated);
+    scene_->EntityRemoved.Disconnect(this, &SceneJournal::OnEntityRemoved);
+    scene_->EntityParentChanged.Disconnect(this, &SceneJournal::OnEntityParentChanged);
+    scene_->ComponentAdded.Disconnect(this, &SceneJournal::OnComponentAdded);
+    scene_->ComponentRemoved.Disconnect(this, &SceneJournal::OnComponentRemoved);
+    scene_->AttributeChanged.Disconnect(this, &SceneJournal::OnAttributeChanged);
+    scene_->AttributeChangesFlushed.Disconnect(this, &SceneJournal::OnAttributeChangesFlushed);
+    scene_->GetFramework()->Frame()->PostFrameUpdate.Disconnect(this, &SceneJournal::OnFrameUpdate);
+
+    // The writer thread writes the queued records before it exits
+    writer_->StopWriting();
+    String errors = writer_->TakeErrors();
+    if (!errors.Empty())
+        LogError(errors);
+    delete writer_;
+    writer_ = 0;
+
+    changes_.Clear();
+    changedAttributes_.Clear();
+    persisted_.Clear();
+}
+
+void SceneJournal::Compact()
+{
+    if (!writer_)
+        return;
+
+    Urho3D::VectorBuffer *snapshot = new Urho3D::VectorBuffer();
+    if (!scene_->SerializeToBinary(*snapshot, false, false))
+    {
+        LogError("SceneJournal::Compact: Failed to serialize the scene, keeping the journal.");
+        delete snapshot;
+        return;
+    }
+    writer_->Compact(snapshot);
+    journalSize_ = 0;
+    sinceCompaction_ = 0.0f;
+
+    // The snapshot has all the entities that should be persisted
+    persisted_.Clear();
+    for(Scene::ConstIterator iter = scene_->Begin(); iter != scene_->End(); ++iter)
+    {
+        Entity *entity = iter->second_.Get();
+        if (ShouldPersist(entity))
+            persisted_[entity->Id()] = EntityWeakPtr(entity);
+    }
+}
+
+void SceneJournal::Flush()
+{
+    if (!writer_)
+        return;
+
+    writtenComponents_.Clear();
+    for(uint i = 0; i < changes_.Size(); ++i)
+    {
+        const Change &change = changes_[i];
+        EntityPtr entity = scene_->EntityById(change.entity);
+        const bool persist = entity && ShouldPersist(entity.Get());
+
+        switch(change.type)
+        {
+        case RecordEntity:
+            if (persist)
+                WriteEntity(entity.Get());
+            break;
+        case RecordEntityRemoved:
+            // Replaying removes the children with the entity
+            if (persisted_.Erase(change.entity))
+            {
+                record_.Clear();
+                record_.WriteUInt(change.entity);
+                EndRecord(RecordEntityRemoved);
+            }
+            break;
+        case RecordParent:
+            if (persist)
+            {
+                if (!persisted_.Contains(change.entity))
+                    WriteEntity(entity.Get());
+                else
+                {
+                    Entity *parent = entity->ParentPtr();
+                    if (parent)
+                        WriteEntity(parent);
+                    record_.Clear();
+                    record_.WriteUInt(change.entity);
+                    record_.WriteUInt(parent ? parent->Id() : 0);
+                    EndRecord(RecordParent);
+                }
+            }
+            break;
+        case RecordComponent:
+        case RecordAttribute:
+        {
+            ComponentPtr comp = (persist ? entity->ComponentById(change.component) : ComponentPtr());
+            if (!comp || !comp->ShouldBeSerialized(false, false))
+                break;
+            if (!persisted_.Contains(change.entity))
+                WriteEntity(entity.Get());
+            else if (change.type == RecordComponent || !comp->HasDefaultDeserialization())
+                WriteComponent(comp.Get());
+            else if (!writtenComponents_.Contains(ComponentKey(change.entity, change.component)) && change.attribute < comp->Attributes().Size() &&
+                comp->Attributes()[change.attribute])
+                WriteAttribute(comp.Get(), comp->Attributes()[change.attribute]);
+            break;
+        }
+        case RecordComponentRemoved:
+            if (persisted_.Contains(change.entity))
+            {
+                record_.Clear();
+                record_.WriteUInt(change.entity);
+                record_.WriteUInt(change.typeId);
+                record_.WriteString(change.name);
+                EndRecord(RecordComponentRemoved);
+            }
+            break;
+        }
+    }
+    changes_.Clear();
+    changedAttributes_.Clear();
+
+    if (!pending_.Empty())
+    {
+        journalSize_ += pending_.Size();
+        writer_->Append(pending_);
+        pending_.Clear();
+    }
+}
+
+bool SceneJournal::ShouldPersist(Entity *entity)
+{
+    for(; entity; entity = entity->ParentPtr())
+        if (!entity->ShouldBeSerialized(false, false, true))
+            return false;
+    return true;
+}
+
+void SceneJournal::WriteEntity(Entity *entity)
+{
+    HashMap<entity_id_t, EntityWeakPtr>::ConstIterator existing = persisted_.Find(entity->Id());
+    if (existing != persisted_.End() && existing->second_.Get() == entity)
+        return;
+
+    Entity *parent = entity->ParentPtr();
+    if (parent)
+        WriteEntity(parent);
+    record_.Clear();
+    record_.WriteUInt(entity->Id());
+    record_.WriteUInt(parent ? parent->Id() : 0);
+    EndRecord(RecordEntity);
+    persisted_[entity->Id()] = EntityWeakPtr(entity);
+
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::ConstIterator iter = components.Begin(); iter != components.End(); ++iter)
+        if (iter->second_->ShouldBeSerialized(false, false))
+            WriteComponent(iter->second_.Get());
+}
+
+void SceneJournal::WriteComponent(IComponent *comp)
+{
+    const entity_id_t entityId = comp->ParentEntity()->Id();
+    const unsigned long long key = ComponentKey(entityId, comp->Id());
+    if (writtenComponents_.Contains(key))
+        return;
+    writtenComponents_.Insert(key);
+
+    const uint numBytes = SerializeComponent(comp, serializeBuffer_);
+    if (numBytes == M_MAX_UNSIGNED)
+    {
+        LogError("SceneJournal: Component " + comp->TypeName() + " of entity " + String(entityId) + " is too large to be recorded.");
+        return;
+    }
+    record_.Clear();
+    record_.WriteUInt(entityId);
+    record_.WriteUInt(comp->TypeId());
+    record_.WriteString(comp->Name());
+    record_.WriteBool(comp->IsReplicated());
+    record_.WriteUInt(numBytes);
+    record_.Write(&serializeBuffer_[0], numBytes);
+    EndRecord(RecordComponent);
+}
+
+void SceneJournal::WriteAttribute(IComponent *comp, IAttribute *attribute)
+{
+    const entity_id_t entityId = comp->ParentEntity()->Id();
+    const uint numBytes = SerializeAttribute(attribute, serializeBuffer_);
+    if (numBytes == M_MAX_UNSIGNED)
+    {
+        LogError("SceneJournal: Attribute " + attribute->Id() + " of entity " + String(entityId) + " is too large to be recorded.");
+        return;
+    }
+    record_.Clear();
+    record_.WriteUInt(entityId);
+    record_.WriteUInt(comp->TypeId());
+    record_.WriteString(comp->Name());
+    record_.WriteUByte(attribute->Index());
+    record_.WriteUInt(numBytes);
+    record_.Write(&serializeBuffer_[0], numBytes);
+    EndRecord(RecordAttribute);
+}
+
+void SceneJournal::EndRecord(RecordType type)
+{
+    // Same framing as the asset cache journal: the type, the size and the record
+    const uint offset = pending_.Size();
+    const uint size = record_.GetSize();
+    pending_.Resize(offset + 5 + size);
+    pending_[offset] = (unsigned char)type;
+    memcpy(&pending_[offset + 1], &size, 4);
+    if (size)
+        memcpy(&pending_[offset + 5], record_.GetData(), size);
+}
+
+void SceneJournal::ReadRecord(u8 type, Urho3D::Deserializer &src, AttributeChange::Type change)
+{
+    const entity_id_t entityId = src.ReadUInt();
+    EntityPtr entity = scene_->EntityById(entityId);
+    switch(type)
+    {
+    case RecordEntity:
+    {
+        const entity_id_t parentId = src.ReadUInt();
+        EntityPtr parent = (parentId ? scene_->EntityById(parentId) : EntityPtr());
+        if (!entity)
+            entity = (parent ? parent->CreateChild(entityId, StringVector(), change) : scene_->CreateEntity(entityId, StringVector(), change));
+        else if (entity->Parent() != parent)
+            entity->SetParent(parent, change);
+        break;
+    }
+    case RecordEntityRemoved:
+        if (entity)
+            scene_->RemoveEntity(entityId, change);
+        break;
+    case RecordParent:
+    {
+        const entity_id_t parentId = src.ReadUInt();
+        if (entity)
+            entity->SetParent(parentId ? scene_->EntityById(parentId) : EntityPtr(), change);
+        break;
+    }
+    case RecordComponent:
+    case RecordComponentRemoved:
+    case RecordAttribute:
+    {
+        const u32 typeId = src.ReadUInt();
+        const String name = src.ReadString();
+        if (!entity)
+        {
+            LogWarning("SceneJournal: Skipping a change of a component of the missing entity " + String(entityId) + ".");
+            break;
+        }
+        if (type == RecordComponentRemoved)
+        {
+            entity->RemoveComponent(entity->Component(typeId, name), change);
+            break;
+        }
+
+        const bool replicated = (type == RecordComponent ? src.ReadBool() : true);
+        const u8 attrIndex = (type == RecordAttribute ? src.ReadUByte() : 0);
+        PODVector<unsigned char> data(src.ReadUInt());
+        if (!data.Empty())
+            src.Read(&data[0], data.Size());
+
+        ComponentPtr comp = (type == RecordComponent ? entity->GetOrCreateComponent(typeId, name, change, replicated) : entity->Component(typeId, name));
+        IAttribute *attribute = (comp && type == RecordAttribute && attrIndex < comp->Attributes().Size() ? comp->Attributes()[attrIndex] : 0);
+        if (!comp || (type == RecordAttribute && !attribute) || data.Empty())
+            break;
+        try
+        {
+            kNet::DataDeserializer source((const char*)&data[0], data.Size());
+            if (attribute)
+                attribute->FromBinary(source, change);
+            else
+                comp->DeserializeFromBinary(source, change);
+        }
+        catch(...)
+        {
+            LogError("SceneJournal: Failed to replay a change of component " + comp->TypeName() + " of entity " + String(entityId) + ".");
+        }
+        break;
+    }
+    default:
+        // Unknown records are skipped, so that newer versions can add records
+        break;
+    }
+}
+
+void SceneJournal::OnEntityCreated(Entity *entity, AttributeChange::Type /*change*/)
+{
+    Change change;
+    change.type = RecordEntity;
+    change.entity = entity->Id();
+    changes_.Push(change);
+}
+
+void SceneJournal::OnEntityRemoved(Entity *entity, AttributeChange::Type /*change*/)
+{
+    Change change;
+    change.type = RecordEntityRemoved;
+    change.entity = entity->Id();
+    changes_.Push(change);
+}
+
+void SceneJournal::OnEntityParentChanged(Entity *entity, Entity * /*parent*/, AttributeChange::Type /*change*/)
+{
+    Change change;
+    change.type = RecordParent;
+    change.entity = entity->Id();
+    changes_.Push(change);
+}
+
+void SceneJournal::OnComponentAdded(Entity *entity, IComponent *comp, AttributeChange::Type /*change*/)
+{
+    Change change;
+    change.type = RecordComponent;
+    change.entity = entity->Id();
+    change.component = comp->Id();
+    changes_.Push(change);
+}
+
+void SceneJournal::OnComponentRemoved(Entity *entity, IComponent *comp, AttributeChange::Type /*change*/)
+{
+    Change change;
+    change.type = RecordComponentRemoved;
+    change.entity = entity->Id();
+    change.typeId = comp->TypeId();
+    change.name = comp->Name();
+    changes_.Push(change);
+}
+
+void SceneJournal::OnAttributeChanged(IComponent *comp, IAttribute *attribute, AttributeChange::Type /*change*/)
+{
+    RecordAttributeChange(comp, attribute->Index());
+}
+
+void SceneJournal::OnAttributeChangesFlushed(const AttributeChangeJournal &journal)
+{
+    for(uint i = 0; i < journal.Size(); ++i)
+    {
+        const AttributeChangeJournal::ComponentChanges &changes = journal[i];
+        IComponent *comp = changes.component.Get();
+        if (!comp)
+            continue;
+        const uint numAttributes = Urho3D::Min(comp->Attributes().Size(), 256U);
+        for(uint j = 0; j < numAttributes; ++j)
+            if (changes.IsChanged((u8)j))
+                RecordAttributeChange(comp, (u8)j);
+    }
+}
+
+void SceneJournal::RecordAttributeChange(IComponent *comp, u8 attrIndex)
+{
+    Entity *entity = comp->ParentEntity();
+    if (!entity)
+        return;
+    // Only the latest value is written, so record each attribute once per flush
+    Pair<unsigned long long, uint> key = MakePair(ComponentKey(entity->Id(), comp->Id()), (uint)attrIndex);
+    if (changedAttributes_.Contains(key))
+        return;
+    changedAttributes_.Insert(key);
+
+    Change change;
+    change.type = RecordAttribute;
+    change.entity = entity->Id();
+    change.component = comp->Id();
+    change.attribute = attrIndex;
+    changes_.Push(change);
+}
+
+void SceneJournal::OnFrameUpdate(float frameTime)
+{
+    Flush();
+    // Compacting serializes the whole scene, so it is done at most once per interval, at the end of a frame
+    sinceCompaction_ += frameTime;
+    if (compactionInterval_ > 0.0f && sinceCompaction_ >= compactionInterval_ && NeedsCompaction())
+        Compact();
+    String errors = (writer_ ? writer_->TakeErrors() : String());
+    if (!errors.Empty())
+        LogError(errors);
+}
+
+}
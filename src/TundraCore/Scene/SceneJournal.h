@@ -0,0 +1,170 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneJournal.h
+    @brief  Append-only journal of the changes of a persistent scene. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <Object.h>
+#include <HashMap.h>
+#include <HashSet.h>
+#include <Pair.h>
+#include <Vector.h>
+#include <VectorBuffer.h>
+
+namespace Tundra
+{
+
+class SceneJournalWriter;
+
+/// Persists a scene incrementally, as a binary scene snapshot and an append-only journal of the changes made since the snapshot.
+/** The changes are recorded from the signals of the scene (EntityCreated, EntityRemoved, EntityParentChanged, ComponentAdded,
+    ComponentRemoved, AttributeChanged, and AttributeChangesFlushed when the scene batches attribute changes), and encoded once
+    per frame on the main thread with the values of that time, so an attribute changed many times in a frame is written once.
+    The records are written to the journal on a background thread.
+
+    Compacting serializes the whole scene to memory on the main thread, which takes a frame-time hitch proportional to the size
+    of the scene, and the background thread then replaces the snapshot with it and truncates the journal. Start compacts once.
+    Afterwards the journal is compacted by calling Compact, or on a schedule: at the end of a frame, at most once per compaction
+    interval (set with --sceneJournalCompactInterval in seconds, default 60, 0 to compact only with Compact), when the journal
+    has grown larger than the compaction size (set with --sceneJournalCompactSize in megabytes, default 64). The records set
+    absolute state, so replaying a journal that was not yet truncated on top of the newer snapshot after a crash still ends
+    in the state of the snapshot.
+
+    Only the entities and components that SaveSceneBinary would save without temporary and local content are recorded.
+    Enable for a scene with Scene::StartJournal, or with --sceneJournal <path> for the scenes created with authority.
+
+    \ingroup Scene_group */
+class TUNDRACORE_API SceneJournal : public Object
+{
+    OBJECT(SceneJournal);
+
+public:
+    /// @param basePath Path of the files without extension. The snapshot is @c basePath.tbin, and the journal @c basePath.tjnl.
+    SceneJournal(Scene *scene, const String &basePath);
+    ~SceneJournal();
+
+    /// Loads the snapshot to the scene, replacing its content, and replays the journal. Call before Start.
+    /** Replaying stops at the first incomplete record, which is left by a write interrupted by a crash. If the snapshot is
+        missing, the new snapshot that was written aside before a crash, @c basePath.tbin.tmp, is loaded instead.
+        @return False if there is no snapshot or journal to restore from. */
+    bool Restore(AttributeChange::Type change = AttributeChange::Default);
+
+    /// Returns whether Restore loaded the scene from a previous run.
+    bool IsRestored() const { return restored_; }
+
+    /// Starts recording the changes of the scene, from a new snapshot of its current content.
+    /** Serializes the whole scene on the main thread, see Compact.
+        @return False if the writer thread could not be started. */
+    bool Start();
+
+    /// Writes the changes recorded so far, including the changes the scene has batched, and stops recording. Called when the journal is destroyed.
+    void Stop();
+
+    /// Returns whether the changes of the scene are being recorded.
+    bool IsRecording() const { return writer_ != 0; }
+
+    /// Replaces the snapshot with the current content of the scene, and truncates the journal.
+    /** Serializes the whole scene on the main thread, so call it when a hitch is acceptable. Done on a schedule
+        if the compaction interval is set, see SetCompactionInterval. */
+    void Compact();
+
+    /// Returns whether the journal has grown larger than the compaction size.
+    bool NeedsCompaction() const { return journalSize_ > compactionSize_; }
+
+    /// Sets the journal size in bytes after which the journal is compacted on the schedule.
+    void SetCompactionSize(uint numBytes) { compactionSize_ = numBytes; }
+    uint CompactionSize() const { return compactionSize_; }
+
+    /// Sets the minimum time in seconds between scheduled compactions, or 0 to compact only when Compact is called.
+    void SetCompactionInterval(float seconds) { compactionInterval_ = seconds; }
+    float CompactionInterval() const { return compactionInterval_; }
+
+    /// Encodes the changes recorded since the last call, and hands them to the writer thread. Called after each frame.
+    void Flush();
+
+    const String &SnapshotPath() const { return snapshotPath_; }
+    const String &JournalPath() const { return journalPath_; }
+
+private:
+    enum RecordType
+    {
+        RecordEntity = 1,
+        RecordEntityRemoved,
+        RecordParent,
+        RecordComponent,
+        RecordComponentRemoved,
+        RecordAttribute
+    };
+
+    /// A change recorded from a signal, encoded on Flush.
+    struct Change
+    {
+        RecordType type;
+        entity_id_t entity;
+        component_id_t component;
+        /// Type and name of a removed component, which can not be looked up anymore on Flush.
+        u32 typeId;
+        String name;
+        u8 attribute;
+    };
+
+    void OnEntityCreated(Entity *entity, AttributeChange::Type change);
+    void OnEntityRemoved(Entity *entity, AttributeChange::Type change);
+    void OnEntityParentChanged(Entity *entity, Entity *parent, AttributeChange::Type change);
+    void OnComponentAdded(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnComponentRemoved(Entity *entity, IComponent *comp, AttributeChange::Type change);
+    void OnAttributeChanged(IComponent *comp, IAttribute *attribute, AttributeChange::Type change);
+    void OnAttributeChangesFlushed(const AttributeChangeJournal &journal);
+    void OnFrameUpdate(float frameTime);
+
+    /// Records a change of the attribute at @c attrIndex of @c comp, once per flush.
+    void RecordAttributeChange(IComponent *comp, u8 attrIndex);
+
+    /// Returns whether @c entity and its parents are saved in the snapshot.
+    static bool ShouldPersist(Entity *entity);
+
+    /// Writes @c entity with its components, after its parent, unless it is in the journal already.
+    void WriteEntity(Entity *entity);
+    void WriteComponent(IComponent *comp);
+    void WriteAttribute(IComponent *comp, IAttribute *attribute);
+    /// Appends the record in record_ to the pending records.
+    void EndRecord(RecordType type);
+
+    /// Applies a journal record to the scene.
+    void ReadRecord(u8 type, Urho3D::Deserializer &src, AttributeChange::Type change);
+
+    Scene *scene_;
+    String snapshotPath_;
+    String journalPath_;
+    uint compactionSize_;
+    float compactionInterval_;
+    /// Seconds since the last compaction.
+    float sinceCompaction_;
+    /// Journal bytes handed to the writer thread since the last compaction.
+    uint journalSize_;
+    /// Whether the scene was restored from the files.
+    bool restored_;
+    SceneJournalWriter *writer_;
+
+    Vector<Change> changes_;
+    /// Attributes in changes_, by entity and component ID and attribute index, so that each is recorded once per flush.
+    HashSet<Pair<unsigned long long, uint> > changedAttributes_;
+    /// Components written on the current flush, by entity and component ID.
+    HashSet<unsigned long long> writtenComponents_;
+    /// Entities that exist in the snapshot or the journal.
+    HashMap<entity_id_t, EntityWeakPtr> persisted_;
+
+    Urho3D::VectorBuffer record_;
+    PODVector<unsigned char> pending_;
+    /// Serialization buffer of the component and attribute records.
+    PODVector<unsigned char> serializeBuffer_;
+};
+
+}
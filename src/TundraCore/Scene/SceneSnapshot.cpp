@@ -0,0 +1,514 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneSnapshot.cpp
+    @brief  Read-only scene snapshots queried in place from a memory mapped file (.tsnap). */
+
+#include "StableHeaders.h"
+#include "SceneSnapshot.h"
+#include "Scene.h"
+#include "Entity.h"
+#include "IComponent.h"
+#include "IAttribute.h"
+#include "SceneAPI.h"
+#include "Framework.h"
+#include "AssetCachePack.h"
+#include "LoggingFunctions.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include <Engine/IO/File.h>
+#include <Sort.h>
+
+#include <cstring>
+
+namespace Tundra
+{
+
+static const String cFileId = "TSNP";
+static const uint cVersion = 1;
+static const uint cHeaderSize = 16;
+static const uint cEntityRecordSize = 20;
+static const uint cComponentRecordSize = 32;
+static const uint cAttributeRecordSize = 20;
+
+static const uint cEntityReplicated = 1;
+static const uint cEntityTemporary = 2;
+static const uint cComponentReplicated = 1;
+static const uint cComponentAttributeTable = 2;
+
+/// Reads the u32 field @c index of a record. The records are not necessarily aligned for u32 access.
+static inline uint Field(const u8 *record, uint index)
+{
+    uint value;
+    memcpy(&value, record + index * 4, 4);
+    return value;
+}
+
+static void PushFields(PODVector<unsigned char> &dest, const uint *fields, uint numFields)
+{
+    const uint offset = dest.Size();
+    dest.Resize(offset + numFields * 4);
+    memcpy(&dest[offset], fields, numFields * 4);
+}
+
+static void PushBytes(PODVector<unsigned char> &dest, const void *data, uint numBytes)
+{
+    const uint offset = dest.Size();
+    dest.Resize(offset + numBytes);
+    if (numBytes)
+        memcpy(&dest[offset], data, numBytes);
+}
+
+/// Entity table record of SceneSnapshot::Write.
+struct SnapshotEntityRecord
+{
+    uint fields[5];
+};
+
+static bool EntityRecordLess(const SnapshotEntityRecord &lhs, const SnapshotEntityRecord &rhs)
+{
+    return lhs.fields[0] < rhs.fields[0];
+}
+
+/// A component of SceneSnapshot::Write serialized before its entity block is laid out.
+struct SnapshotComponentData
+{
+    ComponentPtr comp;
+    PODVector<unsigned char> data;
+    /// End offset of each attribute in data, after the attribute count byte. Empty if the component has no attribute table.
+    PODVector<uint> attributeEnds;
+    Vector<IAttribute*> attributes;
+};
+
+/// Serializes a component, growing the buffer until it fits, like Entity::SerializeToBinary.
+static bool SerializeComponent(SnapshotComponentData &dest)
+{
+    const bool attributeTable = dest.comp->HasDefaultDeserialization();
+    dest.data.Resize(64 * 1024);
+    for(;;)
+    {
+        dest.attributeEnds.Clear();
+        dest.attributes.Clear();
+        try
+        {
+            kNet::DataSerializer serializer((char*)&dest.data[0], dest.data.Size());
+            if (attributeTable)
+            {
+                // Same as IComponent::SerializeToBinary, recording where each attribute ends
+                const AttributeVector &attributes = dest.comp->Attributes();
+                serializer.Add<u8>((u8)attributes.Size());
+                for(uint i = 0; i < attributes.Size(); ++i)
+                {
+                    if (!attributes[i])
+                        continue;
+                    attributes[i]->ToBinary(serializer);
+                    dest.attributeEnds.Push(static_cast<uint>(serializer.BytesFilled()));
+                    dest.attributes.Push(attributes[i]);
+                }
+            }
+            else
+                dest.comp->SerializeToBinary(serializer);
+            dest.data.Resize(static_cast<uint>(serializer.BytesFilled()));
+            return true;
+        }
+        catch(...)
+        {
+            if (dest.data.Size() >= 64 * 1024 * 1024)
+                return false;
+            dest.data.Resize(dest.data.Size() * 2);
+        }
+    }
+}
+
+/// Appends an entity block at file offset @c blockOffset to @c block: the component records, attribute records, names and data.
+static void LayOutEntity(PODVector<unsigned char> &block, uint blockOffset, const Vector<SnapshotComponentData> &components)
+{
+    uint numAttributes = 0;
+    for(uint i = 0; i < components.Size(); ++i)
+        numAttributes += components[i].attributes.Size();
+
+    // The names and data follow the records
+    const uint attributeRecords = blockOffset + components.Size() * cComponentRecordSize;
+    uint payload = attributeRecords + numAttributes * cAttributeRecordSize;
+    PODVector<unsigned char> payloadBytes;
+    PODVector<unsigned char> attributeBytes;
+
+    for(uint i = 0; i < components.Size(); ++i)
+    {
+        const SnapshotComponentData &comp = components[i];
+        const String &name = comp.comp->Name();
+        const uint nameOffset = payload + payloadBytes.Size();
+        PushBytes(payloadBytes, name.CString(), name.Length());
+        const uint dataOffset = payload + payloadBytes.Size();
+        PushBytes(payloadBytes, comp.data.Empty() ? 0 : &comp.data[0], comp.data.Size());
+
+        const uint firstAttribute = attributeRecords + attributeBytes.Size();
+        uint attributeStart = 1;
+        for(uint j = 0; j < comp.attributes.Size(); ++j)
+        {
+            const String &id = comp.attributes[j]->Id();
+            const uint idOffset = payload + payloadBytes.Size();
+            PushBytes(payloadBytes, id.CString(), id.Length());
+            const uint attrFields[] = { comp.attributes[j]->TypeId(), idOffset, id.Length(),
+                dataOffset + attributeStart, comp.attributeEnds[j] - attributeStart };
+            PushFields(attributeBytes, attrFields, 5);
+            attributeStart = comp.attributeEnds[j];
+        }
+
+        const uint flags = (comp.comp->IsReplicated() ? cComponentReplicated : 0) |
+            (comp.comp->HasDefaultDeserialization() ? cComponentAttributeTable : 0);
+        const uint compFields[] = { comp.comp->TypeId(), nameOffset, name.Length(), flags, dataOffset, comp.data.Size(),
+            firstAttribute, comp.attributes.Size() };
+        PushFields(block, compFields, 8);
+    }
+
+    PushBytes(block, attributeBytes.Empty() ? 0 : &attributeBytes[0], attributeBytes.Size());
+    PushBytes(block, payloadBytes.Empty() ? 0 : &payloadBytes[0], payloadBytes.Size());
+    // Keep the records of the next entity aligned
+    while(block.Size() % 4)
+        block.Push(0);
+}
+
+SceneSnapshot::SceneSnapshot(const SharedPtr<MappedFile> &file) :
+    file_(file),
+    numEntities_(Field(file->Data(), 2)),
+    entities_(file->Data() + Field(file->Data(), 3))
+{
+}
+
+SceneSnapshot::~SceneSnapshot()
+{
+}
+
+bool SceneSnapshot::Write(const Scene *scene, const String &filename, bool serializeTemporary, bool serializeLocal)
+{
+    if (!scene)
+        return false;
+
+    Urho3D::File file(scene->GetContext());
+    if (!file.Open(filename, Urho3D::FILE_WRITE))
+    {
+        LogError("SceneSnapshot::Write: Could not open file " + filename + " for writing.");
+        return false;
+    }
+
+    // The header is rewritten with the entity table offset in the end
+    uint header[] = { 0, cVersion, 0, 0 };
+    memcpy(header, cFileId.CString(), 4);
+    bool failed = file.Write(header, cHeaderSize) != cHeaderSize;
+
+    PODVector<SnapshotEntityRecord> records;
+    PODVector<unsigned char> block;
+    Vector<SnapshotComponentData> components;
+
+    // Walk the entities depth first without recursion, as the hierarchies can be deep
+    EntityVector stack = scene->RootLevelEntities();
+    while(!stack.Empty() && !failed)
+    {
+        EntityPtr entity = stack.Back();
+        stack.Pop();
+        if (!entity->ShouldBeSerialized(serializeTemporary, serializeLocal, true))
+            continue;
+
+        components.Clear();
+        const Entity::ComponentMap &comps = entity->Components();
+        for(Entity::ComponentMap::ConstIterator iter = comps.Begin(); iter != comps.End(); ++iter)
+        {
+            if (!iter->second_->ShouldBeSerialized(serializeTemporary, serializeLocal))
+                continue;
+            components.Resize(components.Size() + 1);
+            components.Back().comp = iter->second_;
+            if (!SerializeComponent(components.Back()))
+            {
+                LogError("SceneSnapshot::Write: Component " + iter->second_->TypeName() + " of entity " + String(entity->Id()) + " is too large to be saved.");
+                components.Pop();
+            }
+        }
+
+        SnapshotEntityRecord record;
+        record.fields[0] = entity->Id();
+        record.fields[1] = (entity->ParentPtr() ? entity->ParentPtr()->Id() : 0);
+        record.fields[2] = (entity->IsReplicated() ? cEntityReplicated : 0) | (entity->IsTemporary() ? cEntityTemporary : 0);
+        record.fields[3] = file.GetPosition();
+        record.fields[4] = components.Size();
+        records.Push(record);
+
+        block.Clear();
+        LayOutEntity(block, file.GetPosition(), components);
+        if (!block.Empty() && file.Write(&block[0], block.Size()) != block.Size())
+            failed = true;
+
+        EntityVector children = entity->Children();
+        for(uint i = children.Size(); i > 0; --i)
+            stack.Push(children[i - 1]);
+    }
+
+    Urho3D::Sort(records.Begin(), records.End(), EntityRecordLess);
+    header[2] = records.Size();
+    header[3] = file.GetPosition();
+    if (!failed && !records.Empty())
+        failed = file.Write(&records[0], records.Size() * cEntityRecordSize) != records.Size() * cEntityRecordSize;
+    if (!failed)
+    {
+        file.Seek(0);
+        failed = file.Write(header, cHeaderSize) != cHeaderSize;
+    }
+    if (failed)
+        LogError("SceneSnapshot::Write: Failed to write " + filename + ".");
+    return !failed;
+}
+
+SceneSnapshotPtr SceneSnapshot::Open(const String &filename)
+{
+    SharedPtr<MappedFile> file = MappedFile::Map(filename);
+    if (!file || file->Size() < cHeaderSize || memcmp(file->Data(), cFileId.CString(), 4) != 0)
+    {
+        LogError("SceneSnapshot::Open: " + filename + " is not a scene snapshot.");
+        return SceneSnapshotPtr();
+    }
+    const uint version = Field(file->Data(), 1);
+    const uint numEntities = Field(file->Data(), 2);
+    const uint tableOffset = Field(file->Data(), 3);
+    if (version != cVersion || tableOffset < cHeaderSize || tableOffset > file->Size() ||
+        numEntities > (file->Size() - tableOffset) / cEntityRecordSize)
+    {
+        LogError("SceneSnapshot::Open: " + filename + " has an unsupported version or is truncated.");
+        return SceneSnapshotPtr();
+    }
+    return SceneSnapshotPtr(new SceneSnapshot(file));
+}
+
+const u8 *SceneSnapshot::At(uint offset, uint numBytes) const
+{
+    if (offset > file_->Size() || numBytes > file_->Size() - offset)
+        return 0;
+    return file_->Data() + offset;
+}
+
+EntitySnapshot SceneSnapshot::EntityAt(uint index) const
+{
+    return (index < numEntities_ ? EntitySnapshot(this, entities_ + index * cEntityRecordSize) : EntitySnapshot());
+}
+
+EntitySnapshot SceneSnapshot::EntityById(entity_id_t id) const
+{
+    uint first = 0;
+    uint last = numEntities_;
+    while(first < last)
+    {
+        const uint middle = first + (last - first) / 2;
+        const u8 *record = entities_ + middle * cEntityRecordSize;
+        const entity_id_t middleId = Field(record, 0);
+        if (middleId == id)
+            return EntitySnapshot(this, record);
+        if (middleId < id)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return EntitySnapshot();
+}
+
+EntityPtr SceneSnapshot::Materialize(Scene *scene, entity_id_t id, AttributeChange::Type change) const
+{
+    if (!scene)
+        return EntityPtr();
+    EntityPtr existing = scene->EntityById(id);
+    if (existing)
+        return existing;
+
+    EntitySnapshot source = EntityById(id);
+    if (!source)
+        return EntityPtr();
+
+    EntityPtr parent;
+    if (source.ParentId())
+    {
+        parent = Materialize(scene, source.ParentId(), change);
+        if (!parent)
+            return EntityPtr();
+    }
+
+    // Create the components without signals, and signal once the entity is complete, like Scene::CreateContentFromBinary
+    EntityPtr entity = (parent ? parent->CreateChild(id, StringVector(), AttributeChange::Disconnected, source.IsReplicated(), true, source.IsTemporary()) :
+        scene->CreateEntity(id, StringVector(), AttributeChange::Disconnected, source.IsReplicated(), true, source.IsTemporary()));
+    if (!entity)
+    {
+        LogError("SceneSnapshot::Materialize: Failed to create entity " + String(id) + ".");
+        return EntityPtr();
+    }
+
+    for(uint i = 0; i < source.NumComponents(); ++i)
+    {
+        ComponentSnapshot compSource = source.Component(i);
+        ComponentPtr comp = entity->GetOrCreateComponent(compSource.TypeId(), compSource.Name(), AttributeChange::Disconnected, compSource.IsReplicated());
+        if (!comp)
+        {
+            LogError("SceneSnapshot::Materialize: Failed to create component \"" + scene->GetFramework()->Scene()->ComponentTypeNameForTypeId(compSource.TypeId()) + "\".");
+            continue;
+        }
+        if (!compSource.Size())
+            continue;
+        try
+        {
+            kNet::DataDeserializer compData((const char*)compSource.Data(), compSource.Size());
+            comp->DeserializeFromBinary(compData, AttributeChange::Disconnected);
+        }
+        catch(...)
+        {
+            LogError("SceneSnapshot::Materialize: Failed to load component \"" + comp->TypeName() + "\".");
+        }
+    }
+
+    scene->EmitEntityCreated(entity.Get(), change);
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::ConstIterator iter = components.Begin(); iter != components.End(); ++iter)
+        iter->second_->ComponentChanged(change);
+    return entity;
+}
+
+entity_id_t EntitySnapshot::Id() const
+{
+    return Field(record_, 0);
+}
+
+entity_id_t EntitySnapshot::ParentId() const
+{
+    return Field(record_, 1);
+}
+
+bool EntitySnapshot::IsReplicated() const
+{
+    return (Field(record_, 2) & cEntityReplicated) != 0;
+}
+
+bool EntitySnapshot::IsTemporary() const
+{
+    return (Field(record_, 2) & cEntityTemporary) != 0;
+}
+
+uint EntitySnapshot::NumComponents() const
+{
+    return Field(record_, 4);
+}
+
+ComponentSnapshot EntitySnapshot::Component(uint index) const
+{
+    if (index >= NumComponents())
+        return ComponentSnapshot();
+    const u8 *record = snapshot_->At(Field(record_, 3) + index * cComponentRecordSize, cComponentRecordSize);
+    return (record ? ComponentSnapshot(snapshot_, record) : ComponentSnapshot());
+}
+
+ComponentSnapshot EntitySnapshot::Component(u32 typeId, const String &name) const
+{
+    for(uint i = 0; i < NumComponents(); ++i)
+    {
+        ComponentSnapshot comp = Component(i);
+        if (comp && comp.TypeId() == typeId && (name.Empty() || comp.Name() == name))
+            return comp;
+    }
+    return ComponentSnapshot();
+}
+
+u32 ComponentSnapshot::TypeId() const
+{
+    return Field(record_, 0);
+}
+
+String ComponentSnapshot::Name() const
+{
+    const u8 *name = snapshot_->At(Field(record_, 1), Field(record_, 2));
+    return (name ? String((const char*)name, Field(record_, 2)) : String());
+}
+
+bool ComponentSnapshot::IsReplicated() const
+{
+    return (Field(record_, 3) & cComponentReplicated) != 0;
+}
+
+const u8 *ComponentSnapshot::Data() const
+{
+    return snapshot_->At(Field(record_, 4), Field(record_, 5));
+}
+
+uint ComponentSnapshot::Size() const
+{
+    return (Data() ? Field(record_, 5) : 0);
+}
+
+uint ComponentSnapshot::NumAttributes() const
+{
+    return Field(record_, 7);
+}
+
+AttributeSnapshot ComponentSnapshot::Attribute(uint index) const
+{
+    if (index >= NumAttributes())
+        return AttributeSnapshot();
+    const u8 *record = snapshot_->At(Field(record_, 6) + index * cAttributeRecordSize, cAttributeRecordSize);
+    return (record ? AttributeSnapshot(snapshot_, record) : AttributeSnapshot());
+}
+
+AttributeSnapshot ComponentSnapshot::AttributeById(const String &id) const
+{
+    for(uint i = 0; i < NumAttributes(); ++i)
+    {
+        AttributeSnapshot attr = Attribute(i);
+        if (attr && attr.Id().Compare(id, false) == 0)
+            return attr;
+    }
+    return AttributeSnapshot();
+}
+
+u32 AttributeSnapshot::TypeId() const
+{
+    return Field(record_, 0);
+}
+
+String AttributeSnapshot::Id() const
+{
+    const u8 *id = snapshot_->At(Field(record_, 1), Field(record_, 2));
+    return (id ? String((const char*)id, Field(record_, 2)) : String());
+}
+
+const u8 *AttributeSnapshot::Data() const
+{
+    return snapshot_->At(Field(record_, 3), Field(record_, 4));
+}
+
+uint AttributeSnapshot::Size() const
+{
+    return (Data() ? Field(record_, 4) : 0);
+}
+
+bool AttributeSnapshot::ReadTo(IAttribute *dest, AttributeChange::Type change) const
+{
+    const u8 *data = Data();
+    if (!dest || !data || dest->TypeId() != TypeId())
+        return false;
+    try
+    {
+        kNet::DataDeserializer source((const char*)data, Size());
+        dest->FromBinary(source, change);
+        return true;
+    }
+    catch(...)
+    {
+        return false;
+    }
+}
+
+String AttributeSnapshot::ToString() const
+{
+    IAttribute *attr = SceneAPI::CreateAttribute(TypeId(), Id());
+    String value;
+    if (attr && ReadTo(attr))
+        value = attr->ToString();
+    delete attr;
+    return value;
+}
+
+}
@@ -0,0 +1,163 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   SceneSnapshot.h
+    @brief  Read-only scene snapshots queried in place from a memory mapped file (.tsnap). */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+#include "AttributeChangeType.h"
+
+#include <RefCounted.h>
+
+namespace Tundra
+{
+
+class MappedFile;
+
+/// Serialized attribute of a ComponentSnapshot. Valid while the snapshot exists.
+class TUNDRACORE_API AttributeSnapshot
+{
+public:
+    AttributeSnapshot() : snapshot_(0), record_(0) {}
+
+    /// Returns whether the attribute exists.
+    operator bool() const { return record_ != 0; }
+
+    /// Attribute type ID, see IAttribute::TypeId.
+    u32 TypeId() const;
+    String Id() const;
+
+    /// Returns the attribute value in the format of IAttribute::ToBinary, in place in the mapped file.
+    const u8 *Data() const;
+    uint Size() const;
+
+    /// Deserializes the value to @c dest, which must be of the same type.
+    /// @return False if the types do not match or the data is invalid.
+    bool ReadTo(IAttribute *dest, AttributeChange::Type change = AttributeChange::Disconnected) const;
+
+    /// Returns the value as a string, see IAttribute::ToString.
+    String ToString() const;
+
+private:
+    friend class ComponentSnapshot;
+    AttributeSnapshot(const SceneSnapshot *snapshot, const u8 *record) : snapshot_(snapshot), record_(record) {}
+
+    const SceneSnapshot *snapshot_;
+    const u8 *record_;
+};
+
+/// Serialized component of an EntitySnapshot. Valid while the snapshot exists.
+class TUNDRACORE_API ComponentSnapshot
+{
+public:
+    ComponentSnapshot() : snapshot_(0), record_(0) {}
+
+    /// Returns whether the component exists.
+    operator bool() const { return record_ != 0; }
+
+    /// Component type ID, see SceneAPI::ComponentTypeNameForTypeId.
+    u32 TypeId() const;
+    String Name() const;
+    bool IsReplicated() const;
+
+    /// Returns the component in the format of IComponent::SerializeToBinary, in place in the mapped file.
+    const u8 *Data() const;
+    uint Size() const;
+
+    /// Returns the number of attributes.
+    /** Zero for components that do not use the default deserialization (see IComponent::HasDefaultDeserialization),
+        as their data is not split by attribute. */
+    uint NumAttributes() const;
+    AttributeSnapshot Attribute(uint index) const;
+    /// Returns an attribute by ID, case-insensitively.
+    AttributeSnapshot AttributeById(const String &id) const;
+
+private:
+    friend class EntitySnapshot;
+    ComponentSnapshot(const SceneSnapshot *snapshot, const u8 *record) : snapshot_(snapshot), record_(record) {}
+
+    const SceneSnapshot *snapshot_;
+    const u8 *record_;
+};
+
+/// Serialized entity of a SceneSnapshot. Valid while the snapshot exists.
+class TUNDRACORE_API EntitySnapshot
+{
+public:
+    EntitySnapshot() : snapshot_(0), record_(0) {}
+
+    /// Returns whether the entity exists.
+    operator bool() const { return record_ != 0; }
+
+    entity_id_t Id() const;
+    /// Returns the ID of the parent entity, or 0 for root level entities.
+    entity_id_t ParentId() const;
+    bool IsReplicated() const;
+    bool IsTemporary() const;
+
+    uint NumComponents() const;
+    ComponentSnapshot Component(uint index) const;
+    /// Returns the first component of a type, optionally with a specific name.
+    ComponentSnapshot Component(u32 typeId, const String &name = "") const;
+
+private:
+    friend class SceneSnapshot;
+    EntitySnapshot(const SceneSnapshot *snapshot, const u8 *record) : snapshot_(snapshot), record_(record) {}
+
+    const SceneSnapshot *snapshot_;
+    const u8 *record_;
+};
+
+/// A read-only scene snapshot in a memory mapped file, queried in place without creating entities.
+/** Opening a snapshot only maps the file and checks the header, so it takes the same time regardless of the size of the scene.
+    The entities, components and attributes are read directly from the mapping through EntitySnapshot, ComponentSnapshot
+    and AttributeSnapshot. An entity is created in a scene only when needed, for example for modifying it, see Materialize.
+
+    The file starts with the file ID "TSNP", the u32 version, the u32 entity count and the u32 offset of the entity table.
+    The entity table has a record for each entity, sorted by entity ID: u32 ID, u32 parent ID, u32 flags, and the u32 offset
+    and u32 count of the component records of the entity. A component record has the u32 type ID, the u32 offset and u32 length
+    of the name, u32 flags, the u32 offset and u32 size of the component data, and the u32 offset and u32 count of the attribute
+    records. An attribute record has the u32 type ID, the u32 offset and u32 length of the ID, and the u32 offset and u32 size
+    of the attribute data. The component records, attribute records, names and data of each entity are written together. */
+class TUNDRACORE_API SceneSnapshot : public RefCounted
+{
+public:
+    ~SceneSnapshot();
+
+    /// Writes a snapshot of @c scene to @c filename.
+    /** @param serializeTemporary Are temporary entities and components wanted to be included.
+        @param serializeLocal Are local entities and components wanted to be included.
+        @return False if the file could not be written. */
+    static bool Write(const Scene *scene, const String &filename, bool serializeTemporary, bool serializeLocal);
+
+    /// Maps a snapshot file. Returns null if the file can not be opened or is not a valid snapshot.
+    static SceneSnapshotPtr Open(const String &filename);
+
+    /// Returns the number of entities, including child entities.
+    uint NumEntities() const { return numEntities_; }
+    /// Returns an entity by index. The entities are in the order of their IDs.
+    EntitySnapshot EntityAt(uint index) const;
+    /// Returns an entity by ID, or an invalid snapshot if the snapshot has no such entity.
+    EntitySnapshot EntityById(entity_id_t id) const;
+
+    /// Creates the entity @c id, with its components, in @c scene, and its parent entities if they do not exist yet.
+    /** Child entities are not created. If the scene already has an entity with the ID, returns it as is.
+        @return The entity, or null if the snapshot has no such entity or creating it failed. */
+    EntityPtr Materialize(Scene *scene, entity_id_t id, AttributeChange::Type change = AttributeChange::Default) const;
+
+    /// Returns @c numBytes at @c offset of the file, or null if they are out of the file.
+    const u8 *At(uint offset, uint numBytes) const;
+
+private:
+    SceneSnapshot(const SharedPtr<MappedFile> &file);
+
+    SharedPtr<MappedFile> file_;
+    uint numEntities_;
+    const u8 *entities_;
+};
+
+}
@@ -5,9 +5,14 @@
 
 #include "Scene.h"
 #include "Entity.h"
+#include "Name.h"
+#include "SceneBinary.h"
+#include "SceneSnapshot.h"
+#include "SceneJournal.h"
 #include "LoggingFunctions.h"
 
 #include <Engine/IO/FileSystem.h>
+#include <Engine/IO/File.h>
 
 #include <kNet/DataSerializer.h>
 
@@ -100,6 +105,39 @@ TEST_F(Runner, CreateAttributes)
     }
 }
 
+TEST_F(Runner, SharedAttributeIds)
+{
+    // Static attributes of components of the same type refer to the same strings
+    ComponentPtr firstComp = framework->Scene()->CreateComponentByName(0, "Name");
+    ComponentPtr secondComp = framework->Scene()->CreateComponentByName(0, "Name");
+    ASSERT_TRUE(firstComp.Get() != nullptr && secondComp.Get() != nullptr);
+    ASSERT_TRUE(firstComp->NumAttributes() > 0);
+    ASSERT_EQ(firstComp->Attributes()[0]->Id(), secondComp->Attributes()[0]->Id());
+    ASSERT_EQ(&firstComp->Attributes()[0]->Id(), &secondComp->Attributes()[0]->Id());
+    ASSERT_EQ(&firstComp->Attributes()[0]->Name(), &secondComp->Attributes()[0]->Name());
+
+    // Dynamic attributes own their strings
+    IAttribute *first = SceneAPI::CreateAttribute(IAttribute::StringId, "DynamicId");
+    IAttribute *second = SceneAPI::CreateAttribute(IAttribute::IntId, "DynamicId");
+    ASSERT_TRUE(first != nullptr && second != nullptr);
+    ASSERT_EQ(first->Id(), "DynamicId");
+    ASSERT_EQ(first->Id(), second->Id());
+    ASSERT_TRUE(&first->Id() != &second->Id());
+
+    second->SetName("Renamed");
+    ASSERT_EQ(second->Name(), "Renamed");
+    ASSERT_EQ(first->Name(), "DynamicId");
+    ASSERT_EQ(second->Id(), "DynamicId");
+
+    // Renaming a static attribute does not affect the other components of the type
+    secondComp->Attributes()[0]->SetName("Renamed");
+    ASSERT_EQ(secondComp->Attributes()[0]->Name(), "Renamed");
+    ASSERT_TRUE(firstComp->Attributes()[0]->Name() != "Renamed");
+
+    SAFE_DELETE(first);
+    SAFE_DELETE(second);
+}
+
 TEST_F(Runner, CreateComponentsUnparented)
 {
     StringVector types = framework->Scene()->ComponentTypes();
@@ -238,4 +276,347 @@ TEST_F(Runner, SceneSerialization)
     }
 }
 
+TEST_F(Runner, SceneBinarySerialization)
+{
+    scene->RemoveAllEntities();
+
+    String tbinPath = framework->GetSubsystem<Urho3D::FileSystem>()->GetProgramDir() + "TundraTestScene.tbin";
+
+    StringVector types = framework->Scene()->ComponentTypes();
+    foreach(const String &componentTypeName, types)
+    {
+        EntityPtr ent = scene->CreateEntity();
+        ent->SetName("Entity_" + componentTypeName);
+        ent->CreateComponent(componentTypeName, "Component_" + componentTypeName);
+        EntityPtr child = ent->CreateChild();
+        child->SetName("Child_" + componentTypeName);
+    }
+    const uint numEnts = scene->Entities().Size();
+    ASSERT_EQ(types.Size() * 2, numEnts);
+
+    ASSERT_TRUE(scene->SaveSceneBinary(tbinPath, false, false));
+
+    // The block index covers all the root entities
+    {
+        Urho3D::File file(framework->GetContext(), tbinPath, Urho3D::FILE_READ);
+        SceneBinaryReader reader(file);
+        ASSERT_EQ(reader.Version(), 2U);
+        PODVector<SceneBinaryReader::Block> blocks;
+        ASSERT_TRUE(reader.ReadIndex(blocks));
+        uint numIndexed = 0;
+        for(uint i = 0; i < blocks.Size(); ++i)
+            numIndexed += blocks[i].numEntities;
+        ASSERT_EQ(numIndexed, types.Size());
+    }
+
+    scene->RemoveAllEntities();
+    Vector<Entity*> ents = scene->LoadSceneBinary(tbinPath, true, true, AttributeChange::Default);
+    framework->GetSubsystem<Urho3D::FileSystem>()->Delete(tbinPath);
+
+    ASSERT_EQ(ents.Size(), numEnts);
+    foreach(const String &componentTypeName, types)
+    {
+        EntityPtr ent = scene->EntityByName("Entity_" + componentTypeName);
+        ASSERT_TRUE(ent != nullptr);
+        ASSERT_TRUE(ent->Component(componentTypeName, "Component_" + componentTypeName) != nullptr);
+        ASSERT_EQ(ent->NumChildren(), 1U);
+        ASSERT_EQ(ent->Child(0)->Name(), "Child_" + componentTypeName);
+    }
+}
+
+TEST_F(Runner, SceneDescFromXmlAndBinary)
+{
+    scene->RemoveAllEntities();
+
+    String programDir = framework->GetSubsystem<Urho3D::FileSystem>()->GetProgramDir();
+    String txmlPath = programDir + "TundraTestSceneDesc.txml";
+    String tbinPath = programDir + "TundraTestSceneDesc.tbin";
+
+    // Enough root entities for the descriptions to be built in several jobs
+    StringVector types = framework->Scene()->ComponentTypes();
+    for(uint i = 0; i < 1000; ++i)
+    {
+        const String &componentTypeName = types[i % types.Size()];
+        EntityPtr ent = scene->CreateEntity();
+        ent->SetName("Entity_" + String(i));
+        ent->CreateComponent(componentTypeName, "Component_" + componentTypeName);
+        ent->CreateChild()->SetName("Child_" + String(i));
+    }
+
+    ASSERT_TRUE(scene->SaveSceneXML(txmlPath, false, false));
+    ASSERT_TRUE(scene->SaveSceneBinary(tbinPath, false, false));
+    SceneDesc xmlDesc = scene->CreateSceneDescFromXml(txmlPath);
+    SceneDesc binaryDesc = scene->CreateSceneDescFromBinary(tbinPath);
+    framework->GetSubsystem<Urho3D::FileSystem>()->Delete(txmlPath);
+    framework->GetSubsystem<Urho3D::FileSystem>()->Delete(tbinPath);
+
+    // The root entities keep their order
+    ASSERT_EQ(xmlDesc.entities.Size(), 1000U);
+    ASSERT_EQ(binaryDesc.entities.Size(), 1000U);
+    for(uint i = 0; i < 1000; ++i)
+    {
+        const EntityDesc &xmlEnt = xmlDesc.entities[i];
+        const EntityDesc &binaryEnt = binaryDesc.entities[i];
+        ASSERT_EQ(xmlEnt.id, binaryEnt.id);
+        ASSERT_EQ(xmlEnt.components.Size(), binaryEnt.components.Size());
+        for(uint j = 0; j < xmlEnt.components.Size(); ++j)
+        {
+            ASSERT_EQ(xmlEnt.components[j].name, binaryEnt.components[j].name);
+            ASSERT_EQ(xmlEnt.components[j].attributes.Size(), binaryEnt.components[j].attributes.Size());
+        }
+        ASSERT_EQ(xmlEnt.children.Size(), 1U);
+        ASSERT_EQ(binaryEnt.children.Size(), 1U);
+    }
+}
+
+TEST_F(Runner, SceneSnapshot)
+{
+    scene->RemoveAllEntities();
+
+    String tsnapPath = framework->GetSubsystem<Urho3D::FileSystem>()->GetProgramDir() + "TundraTestScene.tsnap";
+
+    EntityPtr parent = scene->CreateEntity();
+    parent->SetName("SnapshotParent");
+    EntityPtr child = parent->CreateChild();
+    child->SetName("SnapshotChild");
+    const entity_id_t parentId = parent->Id();
+    const entity_id_t childId = child->Id();
+    parent.Reset();
+    child.Reset();
+
+    ASSERT_TRUE(scene->SaveSceneSnapshot(tsnapPath, false, false));
+    scene->RemoveAllEntities();
+    {
+        SceneSnapshotPtr snapshot = SceneSnapshot::Open(tsnapPath);
+        ASSERT_TRUE(snapshot.NotNull());
+        ASSERT_EQ(snapshot->NumEntities(), 2U);
+
+        // Queried in place without creating entities
+        EntitySnapshot childSnapshot = snapshot->EntityById(childId);
+        ASSERT_TRUE(childSnapshot);
+        ASSERT_EQ(childSnapshot.ParentId(), parentId);
+        ComponentSnapshot nameSnapshot = childSnapshot.Component(Name::ComponentTypeId);
+        ASSERT_TRUE(nameSnapshot);
+        ASSERT_EQ(nameSnapshot.AttributeById("name").ToString(), "SnapshotChild");
+        ASSERT_FALSE(snapshot->EntityById(childId + 1000));
+        ASSERT_EQ(scene->Entities().Size(), 0U);
+
+        // Materializing the child creates its parent too
+        EntityPtr materialized = snapshot->Materialize(scene.Get(), childId);
+        ASSERT_TRUE(materialized != nullptr);
+        ASSERT_EQ(materialized->Name(), "SnapshotChild");
+        ASSERT_TRUE(materialized->Parent() != nullptr);
+        ASSERT_EQ(materialized->Parent()->Id(), parentId);
+        ASSERT_EQ(materialized->Parent()->Name(), "SnapshotParent");
+        ASSERT_EQ(scene->Entities().Size(), 2U);
+    }
+    framework->GetSubsystem<Urho3D::FileSystem>()->Delete(tsnapPath);
+}
+
+TEST_F(Runner, SceneJournal)
+{
+    scene->RemoveAllEntities();
+
+    Urho3D::FileSystem *fileSystem = framework->GetSubsystem<Urho3D::FileSystem>();
+    String basePath = fileSystem->GetProgramDir() + "TundraTestJournal";
+
+    entity_id_t parentId = 0, childId = 0, removedId = 0;
+    {
+        SharedPtr<SceneJournal> journal(new SceneJournal(scene.Get(), basePath));
+        ASSERT_FALSE(journal->Restore());
+        ASSERT_TRUE(journal->Start());
+
+        EntityPtr parent = scene->CreateEntity();
+        parent->SetName("JournalParent");
+        EntityPtr child = parent->CreateChild();
+        child->SetName("First");
+        EntityPtr removed = scene->CreateEntity();
+        removed->SetName("JournalRemoved");
+        EntityPtr temporary = scene->CreateEntity(0, StringVector(), AttributeChange::Default, true, true, true);
+        temporary->SetName("JournalTemporary");
+        parentId = parent->Id();
+        childId = child->Id();
+        removedId = removed->Id();
+        journal->Flush();
+
+        // Only the latest value of an attribute is recorded
+        child->SetName("Second");
+        child->SetName("JournalChild");
+        scene->RemoveEntity(removedId);
+        journal->Stop();
+        ASSERT_TRUE(fileSystem->FileExists(journal->SnapshotPath()));
+        ASSERT_TRUE(fileSystem->FileExists(journal->JournalPath()));
+    }
+
+    scene->RemoveAllEntities();
+    {
+        SharedPtr<SceneJournal> journal(new SceneJournal(scene.Get(), basePath));
+        ASSERT_TRUE(journal->Restore());
+        ASSERT_EQ(scene->Entities().Size(), 2U);
+        EntityPtr child = scene->EntityById(childId);
+        ASSERT_TRUE(child != nullptr);
+        ASSERT_EQ(child->Name(), "JournalChild");
+        ASSERT_TRUE(child->Parent() != nullptr);
+        ASSERT_EQ(child->Parent()->Id(), parentId);
+        ASSERT_EQ(child->Parent()->Name(), "JournalParent");
+        ASSERT_TRUE(scene->EntityById(removedId) == nullptr);
+
+        fileSystem->Delete(journal->SnapshotPath());
+        fileSystem->Delete(journal->JournalPath());
+    }
+    scene->RemoveAllEntities();
+}
+
+TEST_F(Runner, SceneJournalBatchedChanges)
+{
+    scene->RemoveAllEntities();
+    scene->SetAttributeChangeBatching(true);
+
+    Urho3D::FileSystem *fileSystem = framework->GetSubsystem<Urho3D::FileSystem>();
+    String basePath = fileSystem->GetProgramDir() + "TundraTestJournalBatched";
+
+    entity_id_t entityId = 0, otherId = 0;
+    {
+        SharedPtr<SceneJournal> journal(new SceneJournal(scene.Get(), basePath));
+        ASSERT_TRUE(journal->Start());
+        EntityPtr entity = scene->CreateEntity();
+        entity->SetName("Created");
+        EntityPtr other = scene->CreateEntity();
+        other->SetName("Other");
+        entityId = entity->Id();
+        otherId = other->Id();
+        scene->FlushAttributeChanges();
+        journal->Flush();
+
+        // Batched changes are signaled only with AttributeChangesFlushed
+        entity->SetName("Flushed");
+        other->SetName("OtherFlushed");
+        scene->FlushAttributeChanges();
+        journal->Flush();
+
+        // Stopping records the changes the scene has not flushed yet
+        entity->SetName("Stopped");
+        journal->Stop();
+    }
+
+    scene->RemoveAllEntities();
+    {
+        SharedPtr<SceneJournal> journal(new SceneJournal(scene.Get(), basePath));
+        ASSERT_TRUE(journal->Restore());
+        EntityPtr entity = scene->EntityById(entityId);
+        ASSERT_TRUE(entity != nullptr);
+        ASSERT_EQ(entity->Name(), "Stopped");
+        EntityPtr other = scene->EntityById(otherId);
+        ASSERT_TRUE(other != nullptr);
+        ASSERT_EQ(other->Name(), "OtherFlushed");
+
+        fileSystem->Delete(journal->SnapshotPath());
+        fileSystem->Delete(journal->JournalPath());
+    }
+    scene->SetAttributeChangeBatching(false);
+    scene->RemoveAllEntities();
+}
+
+/// Counts the attribute change signals of a scene and of a component.
+struct AttributeChangeCounter
+{
+    AttributeChangeCounter() : sceneChanges(0), componentChanges(0), flushes(0), journaledComponents(0) {}
+
+    void OnSceneAttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) { ++sceneChanges; }
+    void OnComponentAttributeChanged(IAttribute*, AttributeChange::Type) { ++componentChanges; }
+    void OnFlushed(const AttributeChangeJournal &journal) { ++flushes; journaledComponents += journal.Size(); }
+
+    int sceneChanges;
+    int componentChanges;
+    int flushes;
+    unsigned journaledComponents;
+};
+
+TEST_F(Runner, AttributeChangeBatching)
+{
+    EntityPtr ent = scene->CreateEntity(0, StringVector(), AttributeChange::Default, true, true, false);
+    ASSERT_TRUE(ent != nullptr);
+    SharedPtr<Name> name = ent->GetOrCreateComponent<Name>();
+    ASSERT_TRUE(name != nullptr);
+
+    AttributeChangeCounter counter;
+    scene->AttributeChanged.Connect(&counter, &AttributeChangeCounter::OnSceneAttributeChanged);
+    scene->AttributeChangesFlushed.Connect(&counter, &AttributeChangeCounter::OnFlushed);
+    name->AttributeChanged.Connect(&counter, &AttributeChangeCounter::OnComponentAttributeChanged);
+
+    // Immediate signals by default
+    name->name.Set("A", AttributeChange::Default);
+    name->name.Set("B", AttributeChange::Default);
+    ASSERT_EQ(counter.sceneChanges, 2);
+    ASSERT_EQ(counter.componentChanges, 2);
+
+    // Batched changes are grouped per attribute and component, and signaled on the flush
+    scene->SetAttributeChangeBatching(true);
+    for (int i = 0; i < 100; ++i)
+        name->name.Set("Name" + String(i), AttributeChange::Default);
+    name->description.Set("Description", AttributeChange::LocalOnly);
+    name->group.Set("Group", AttributeChange::Disconnected);
+    ASSERT_EQ(counter.componentChanges, 2);
+    ASSERT_EQ(counter.flushes, 0);
+
+    scene->FlushAttributeChanges();
+    ASSERT_EQ(counter.sceneChanges, 2);
+    ASSERT_EQ(counter.componentChanges, 4);
+    ASSERT_EQ(counter.flushes, 1);
+    ASSERT_EQ(counter.journaledComponents, 1U);
+    ASSERT_EQ(name->name.Get(), "Name99");
+
+    // Nothing is flushed twice
+    scene->FlushAttributeChanges();
+    ASSERT_EQ(counter.flushes, 1);
+
+    // Changes of a removed component are dropped
+    name->name.Set("Removed", AttributeChange::Default);
+    ent->RemoveComponent(ComponentPtr(name));
+    scene->FlushAttributeChanges();
+    ASSERT_EQ(counter.componentChanges, 4);
+
+    scene->SetAttributeChangeBatching(false);
+    scene->AttributeChanged.Disconnect(&counter, &AttributeChangeCounter::OnSceneAttributeChanged);
+    scene->AttributeChangesFlushed.Disconnect(&counter, &AttributeChangeCounter::OnFlushed);
+    scene->RemoveEntity(ent->Id());
+}
+
+TEST_F(Runner, EntityQueryIndices)
+{
+    EntityPtr a = scene->CreateEntity(0, StringVector(), AttributeChange::Default, true, true, false);
+    EntityPtr b = scene->CreateEntity(0, StringVector(), AttributeChange::Default, true, true, false);
+    ASSERT_TRUE(a != nullptr && b != nullptr);
+
+    a->SetName("Alpha");
+    a->SetGroup("Group");
+    b->SetName("Beta");
+    b->SetGroup("Group");
+    ASSERT_EQ(scene->EntityByName("Alpha"), a);
+    ASSERT_EQ(scene->EntityByName("Beta"), b);
+    ASSERT_EQ(scene->EntitiesOfGroup("Group").Size(), 2U);
+    ASSERT_EQ(scene->EntitiesWithComponent(Name::ComponentTypeId).Size(), 2U);
+    ASSERT_EQ(scene->Components<Name>().Size(), 2U);
+    ASSERT_EQ(scene->FindEntitiesByName("alpha", false).Size(), 1U);
+    ASSERT_EQ(scene->FindEntitiesContaining("ta").Size(), 1U);
+
+    // Renames are indexed also when they are not signaled
+    NamePtr name = a->Component<Name>();
+    name->name.Set("Gamma", AttributeChange::Disconnected);
+    name->group.Set("", AttributeChange::Disconnected);
+    ASSERT_TRUE(scene->EntityByName("Alpha") == nullptr);
+    ASSERT_EQ(scene->EntityByName("Gamma"), a);
+    ASSERT_EQ(scene->EntitiesOfGroup("Group").Size(), 1U);
+
+    b->RemoveComponent(ComponentPtr(b->Component<Name>()));
+    ASSERT_TRUE(scene->EntityByName("Beta") == nullptr);
+    ASSERT_TRUE(scene->EntitiesOfGroup("Group").Empty());
+    ASSERT_EQ(scene->EntitiesWithComponent(Name::ComponentTypeId).Size(), 1U);
+
+    scene->RemoveEntity(a->Id());
+    scene->RemoveEntity(b->Id());
+    ASSERT_TRUE(scene->EntityByName("Gamma") == nullptr);
+    ASSERT_TRUE(scene->Components(Name::ComponentTypeId).Empty());
+}
+
 TUNDRA_TEST_MAIN();
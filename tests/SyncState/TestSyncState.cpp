@@ -0,0 +1,483 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "TestRunner.h"
+#include "TestBenchmark.h"
+
+#include "SyncState.h"
+#include "AttributeDelta.h"
+#include "Entity.h"
+#include "UniqueIdGenerator.h"
+#include "IAttribute.h"
+#include "AttributeChangeType.h"
+
+#include <kNet/DataSerializer.h>
+#include <kNet/DataDeserializer.h>
+
+#include <Algorithm/Random/LCG.h>
+
+#include <List.h>
+#include <HashMap.h>
+
+#include <map>
+#include <new>
+#include <cstdlib>
+
+using namespace Tundra;
+using namespace Tundra::Test;
+
+// Count the heap memory of the test process, to compare the footprint of the sync state layouts
+static size_t allocatedBytes = 0;
+static const size_t allocHeader = 16;
+
+void *operator new(size_t size)
+{
+    unsigned char *ptr = static_cast<unsigned char*>(malloc(size + allocHeader));
+    if (!ptr)
+        throw std::bad_alloc();
+    *reinterpret_cast<size_t*>(ptr) = size;
+    allocatedBytes += size;
+    return ptr + allocHeader;
+}
+
+void operator delete(void *ptr) throw()
+{
+    if (!ptr)
+        return;
+    unsigned char *block = static_cast<unsigned char*>(ptr) - allocHeader;
+    allocatedBytes -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) throw() { operator delete(ptr); }
+
+namespace
+{
+    const unsigned cNumEntities = 100000;
+    const unsigned cComponentsPerEntity = 4;
+
+    /// The node-based component sync state that SyncStateMap and SmallSyncStateMap replaced.
+    struct LegacyComponentSyncState
+    {
+        LegacyComponentSyncState() : id(0), removed(false), isNew(true), isInQueue(false) { memset(dirtyAttributes, 0, sizeof(dirtyAttributes)); }
+
+        u8 dirtyAttributes[32];
+        Urho3D::HashMap<u8, bool> newAndRemovedAttributes;
+        component_id_t id;
+        bool removed;
+        bool isNew;
+        bool isInQueue;
+    };
+
+    /// The node-based entity sync state that SyncStateMap and SmallSyncStateMap replaced.
+    struct LegacyEntitySyncState
+    {
+        LegacyEntitySyncState() : id(0), removed(false), isNew(true), isInQueue(false), hasPropertyChanges(false), hasParentChange(false),
+            avgUpdateInterval(0.0f), lastNetworkSendTime(0), transformSent(false), lastTransformSendTime(0) {}
+
+        Urho3D::List<LegacyComponentSyncState*> dirtyQueue;
+        std::map<component_id_t, LegacyComponentSyncState> components;
+        entity_id_t id;
+        EntityWeakPtr weak;
+        bool removed;
+        bool isNew;
+        bool isInQueue;
+        bool hasPropertyChanges;
+        bool hasParentChange;
+        kNet::PolledTimer updateTimer;
+        float avgUpdateInterval;
+        Transform transform;
+        float3 linearVelocity;
+        float3 angularVelocity;
+        kNet::tick_t lastNetworkSendTime;
+        bool transformSent;
+        kNet::tick_t lastTransformSendTime;
+    };
+
+    struct LegacySceneSyncState
+    {
+        std::map<entity_id_t, LegacyEntitySyncState> entities;
+        Urho3D::HashMap<entity_id_t, LegacyEntitySyncState*> dirtyQueue;
+
+        void MarkComponentDirty(entity_id_t id, component_id_t compId)
+        {
+            LegacyEntitySyncState &entityState = entities[id];
+            entityState.id = id;
+            if (!entityState.isInQueue)
+            {
+                dirtyQueue.Insert(Urho3D::MakePair(id, &entityState));
+                entityState.isInQueue = true;
+            }
+            LegacyComponentSyncState &compState = entityState.components[compId];
+            compState.id = compId;
+            if (!compState.isInQueue)
+            {
+                entityState.dirtyQueue.Push(&compState);
+                compState.isInQueue = true;
+            }
+        }
+
+        void Drain()
+        {
+            for (auto i = dirtyQueue.Begin(); i != dirtyQueue.End(); ++i)
+            {
+                LegacyEntitySyncState *entityState = i->second_;
+                while (!entityState->dirtyQueue.Empty())
+                {
+                    entityState->dirtyQueue.Front()->isInQueue = false;
+                    entityState->dirtyQueue.PopFront();
+                }
+                entityState->isInQueue = false;
+            }
+            dirtyQueue.Clear();
+        }
+    };
+
+    /// The flat layout of SceneSyncState.
+    struct FlatSceneSyncState
+    {
+        SyncStateMap<entity_id_t, EntitySyncState> entities;
+        EntitySyncStateQueue dirtyQueue;
+        Urho3D::PODVector<component_id_t> dirtyComponents;
+
+        void MarkComponentDirty(entity_id_t id, component_id_t compId)
+        {
+            EntitySyncState &entityState = entities[id];
+            entityState.id = id;
+            dirtyQueue.Push(&entityState);
+            entityState.MarkComponentDirty(compId);
+        }
+
+        void Drain()
+        {
+            while (!dirtyQueue.Empty())
+            {
+                EntitySyncState *entityState = dirtyQueue.First();
+                dirtyQueue.Remove(entityState);
+                dirtyComponents.Clear();
+                entityState->TakeDirtyComponents(dirtyComponents);
+            }
+        }
+    };
+
+    template <class State> void MarkAllDirty(State &state)
+    {
+        for (entity_id_t id = 1; id <= cNumEntities; ++id)
+            for (component_id_t compId = 1; compId <= cComponentsPerEntity; ++compId)
+                state.MarkComponentDirty(id, compId);
+    }
+}
+
+TEST_F(Runner, SyncStateMap)
+{
+    math::LCG lcg;
+    SyncStateMap<entity_id_t, EntitySyncState> entities;
+    std::map<entity_id_t, entity_id_t> reference;
+
+    for (unsigned i = 0; i < 200000; ++i)
+    {
+        // Mix replicated and unacked IDs
+        entity_id_t id = (entity_id_t)lcg.Int(1, 5000) | (lcg.Int(0, 1) ? UniqueIdGenerator::FIRST_UNACKED_ID : 0);
+        switch (lcg.Int(0, 2))
+        {
+        case 0:
+            entities[id].id = id;
+            reference[id] = id;
+            break;
+        case 1:
+            ASSERT_EQ(entities.Erase(id), reference.erase(id) > 0);
+            break;
+        default:
+        {
+            auto found = entities.Find(id);
+            ASSERT_EQ(found != entities.End(), reference.find(id) != reference.end());
+            if (found != entities.End())
+                ASSERT_EQ(found->second_.id, id);
+            break;
+        }
+        }
+        ASSERT_EQ(entities.Size(), reference.size());
+    }
+
+    unsigned numIterated = 0;
+    for (auto i = entities.Begin(); i != entities.End(); ++i, ++numIterated)
+        ASSERT_TRUE(reference.find(i->first_) != reference.end());
+    ASSERT_EQ(numIterated, reference.size());
+
+    // State addresses must survive growth, as the dirty queue links them
+    EntitySyncState *state = &entities[1];
+    for (entity_id_t id = 10000; id < 100000; ++id)
+        entities[id];
+    ASSERT_EQ(state, &entities[1]);
+
+    entities.Clear();
+    ASSERT_TRUE(entities.Empty());
+    ASSERT_TRUE(entities.Begin() == entities.End());
+}
+
+TEST_F(Runner, EntitySyncStateQueue)
+{
+    EntitySyncState states[4];
+    EntitySyncStateQueue queue;
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        states[i].id = i + 1;
+        queue.Push(&states[i]);
+    }
+    queue.Push(&states[2]); // Already queued
+    ASSERT_EQ(queue.Size(), 4U);
+
+    queue.Remove(&states[0]);
+    queue.Remove(&states[2]);
+    queue.Remove(&states[2]);
+    ASSERT_EQ(queue.Size(), 2U);
+    ASSERT_EQ(queue.First(), &states[1]);
+    ASSERT_EQ(queue.First()->nextDirty, &states[3]);
+    ASSERT_TRUE(states[3].nextDirty == nullptr);
+    ASSERT_FALSE(states[2].isInQueue);
+
+    queue.Clear();
+    ASSERT_TRUE(queue.Empty());
+    ASSERT_FALSE(states[1].isInQueue);
+    ASSERT_FALSE(states[3].isInQueue);
+
+    // Component queue flags
+    EntitySyncState &entityState = states[0];
+    entityState.MarkComponentDirty(5);
+    entityState.MarkComponentDirty(6);
+    entityState.MarkComponentDirty(5);
+    ASSERT_EQ(entityState.numDirtyComponents, 2U);
+    entityState.components[6].isNew = false;
+    entityState.MarkComponentRemoved(5); // New, forgotten at once
+    ASSERT_FALSE(entityState.components.Contains(5));
+    entityState.ChangeComponentId(6, 7);
+    ASSERT_TRUE(entityState.components.Contains(7));
+    ASSERT_EQ(entityState.components[7].id, 7U);
+
+    Urho3D::PODVector<component_id_t> dirty;
+    entityState.TakeDirtyComponents(dirty);
+    ASSERT_EQ(dirty.Size(), 1U);
+    ASSERT_EQ(dirty[0], 7U);
+    ASSERT_FALSE(entityState.HasDirtyComponents());
+}
+
+TEST_F(Runner, SyncStateMemory)
+{
+    size_t legacyBytes = 0;
+    size_t flatBytes = 0;
+    {
+        size_t start = allocatedBytes;
+        LegacySceneSyncState legacy;
+        MarkAllDirty(legacy);
+        legacyBytes = allocatedBytes - start;
+    }
+    {
+        size_t start = allocatedBytes;
+        FlatSceneSyncState flat;
+        MarkAllDirty(flat);
+        flatBytes = allocatedBytes - start;
+    }
+
+    Log(String(cNumEntities) + " entities with " + String(cComponentsPerEntity) + " components, per client:", 2);
+    Log(PadString("std::map", 25) + String((unsigned)(legacyBytes / 1024)) + " KB, " + String((unsigned)(legacyBytes / cNumEntities)) + " bytes per entity", 2);
+    Log(PadString("SyncStateMap", 25) + String((unsigned)(flatBytes / 1024)) + " KB, " + String((unsigned)(flatBytes / cNumEntities)) + " bytes per entity", 2);
+    EXPECT_LT(flatBytes, legacyBytes);
+
+    LegacySceneSyncState legacy;
+    FlatSceneSyncState flat;
+    MarkAllDirty(legacy);
+    MarkAllDirty(flat);
+
+    Tundra::Benchmark::Iterations = 10;
+    BENCHMARK("std::map dirty + drain", 25)
+    {
+        MarkAllDirty(legacy);
+        legacy.Drain();
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+
+    Tundra::Benchmark::Iterations = 10;
+    BENCHMARK("SyncStateMap dirty + drain", 25)
+    {
+        MarkAllDirty(flat);
+        flat.Drain();
+        BENCHMARK_STEP_END;
+    }
+    BENCHMARK_END;
+}
+
+namespace
+{
+    /// Writes @c src as a delta and reads it into @c dest, returning the size of the encoded value in bits.
+    size_t DeltaRoundTrip(const IAttribute *src, IAttribute *dest, AttributeDeltaBases &sent, AttributeDeltaBases &received, bool allowDelta = true)
+    {
+        char buffer[1024];
+        kNet::DataSerializer ds(buffer, sizeof(buffer));
+        AttributeDelta::Write(ds, src, &sent, 1, 0, allowDelta);
+        kNet::DataDeserializer dd(buffer, ds.BytesFilled());
+        EXPECT_TRUE(AttributeDelta::Read(dd, dest, &received, 1, 0));
+        return ds.BitsFilled();
+    }
+}
+
+TEST_F(Runner, AttributeDelta)
+{
+    Attribute<float3> pos(0, "pos", "Position", float3(10.f, 2.f, -300.f));
+    Attribute<float3> remotePos(0, "pos", "Position");
+    AttributeDeltaBases sent, received;
+
+    // The first value has no base and is sent in full
+    size_t fullBits = DeltaRoundTrip(&pos, &remotePos, sent, received);
+    ASSERT_EQ(remotePos.Get(), pos.Get());
+    ASSERT_TRUE(sent.Base(1, 0, false).valid);
+    ASSERT_TRUE(received.Base(1, 0, true).valid);
+
+    // A slowly moving position costs a fraction of the full value
+    size_t deltaBits = 0;
+    for (int i = 1; i <= 100; ++i)
+    {
+        pos.Set(pos.Get() + float3(0.01f, 0.f, 0.02f), AttributeChange::Disconnected);
+        deltaBits += DeltaRoundTrip(&pos, &remotePos, sent, received);
+        ASSERT_EQ(remotePos.Get(), pos.Get());
+    }
+    Log("float3 full " + String((unsigned)fullBits) + " bits, delta " + String((unsigned)(deltaBits / 100)) + " bits on average", 2);
+    EXPECT_LT(deltaBits / 100, fullBits / 2);
+
+    // Disabling the deltas still keeps the bases current
+    pos.Set(float3(-1.f, 0.f, 1.f), AttributeChange::Disconnected);
+    ASSERT_EQ(DeltaRoundTrip(&pos, &remotePos, sent, received, false), fullBits);
+    ASSERT_EQ(remotePos.Get(), pos.Get());
+
+    Attribute<Transform> transform(0, "transform", "Transform", Transform(float3(1.f, 2.f, 3.f), float3(0.f, 90.f, 0.f), float3::one));
+    Attribute<Transform> remoteTransform(0, "transform", "Transform");
+    AttributeDeltaBases sentTransform, receivedTransform;
+    DeltaRoundTrip(&transform, &remoteTransform, sentTransform, receivedTransform);
+    transform.Set(Transform(float3(1.f, 2.5f, 3.f), float3(0.f, 91.f, 0.f), float3::one), AttributeChange::Disconnected);
+    DeltaRoundTrip(&transform, &remoteTransform, sentTransform, receivedTransform);
+    ASSERT_TRUE(remoteTransform.Get() == transform.Get());
+
+    // Strings are sent as an edit of the middle
+    Attribute<String> text(0, "text", "Text", "The quick brown fox jumps over the lazy dog");
+    Attribute<String> remoteText(0, "text", "Text");
+    AttributeDeltaBases sentText, receivedText;
+    size_t fullTextBits = DeltaRoundTrip(&text, &remoteText, sentText, receivedText);
+    text.Set("The quick red fox jumps over the lazy dog", AttributeChange::Disconnected);
+    size_t editBits = DeltaRoundTrip(&text, &remoteText, sentText, receivedText);
+    ASSERT_EQ(remoteText.Get(), text.Get());
+    EXPECT_LT(editBits, fullTextBits / 2);
+    text.Set("", AttributeChange::Disconnected);
+    DeltaRoundTrip(&text, &remoteText, sentText, receivedText);
+    ASSERT_EQ(remoteText.Get(), String::EMPTY);
+
+    // A delta without a matching base is consumed, but not applied
+    {
+        char buffer[256];
+        kNet::DataSerializer ds(buffer, sizeof(buffer));
+        pos.Set(float3(5.f, 5.f, 5.f), AttributeChange::Disconnected);
+        AttributeDelta::Write(ds, &pos, &sent, 1, 0, true);
+        ds.Add<u8>(0xAB);
+        AttributeDeltaBases missing;
+        kNet::DataDeserializer dd(buffer, ds.BytesFilled());
+        ASSERT_FALSE(AttributeDelta::Read(dd, &remotePos, &missing, 1, 0));
+        ASSERT_EQ(remotePos.Get(), float3(-1.f, 0.f, 1.f));
+        ASSERT_EQ(dd.Read<u8>(), 0xAB);
+    }
+}
+
+namespace
+{
+    /// Writes the value of @c src to @c buffer as a delta, returning the number of bytes written.
+    size_t DeltaWrite(char (&buffer)[256], const IAttribute *src, AttributeDeltaBases &sent)
+    {
+        kNet::DataSerializer ds(buffer, sizeof(buffer));
+        AttributeDelta::Write(ds, src, &sent, 1, 0, true);
+        return ds.BytesFilled();
+    }
+}
+
+TEST_F(Runner, AttributeDeltaRejectedEdits)
+{
+    Attribute<float3> pos(0, "pos", "Position", float3(1.f, 2.f, 3.f));
+    Attribute<float3> remotePos(0, "pos", "Position");
+    AttributeDeltaBases sent, received;
+    DeltaRoundTrip(&pos, &remotePos, sent, received);
+
+    // A rejected edit is read to a copy that is discarded, which keeps the bases in step
+    char buffer[256];
+    pos.Set(float3(1.5f, 2.f, 3.f), AttributeChange::Disconnected);
+    {
+        size_t size = DeltaWrite(buffer, &pos, sent);
+        kNet::DataDeserializer dd(buffer, size);
+        IAttribute *discarded = remotePos.Clone();
+        ASSERT_TRUE(AttributeDelta::Read(dd, discarded, &received, 1, 0));
+        delete discarded;
+    }
+    ASSERT_EQ(remotePos.Get(), float3(1.f, 2.f, 3.f));
+    for (int i = 0; i < 10; ++i)
+    {
+        pos.Set(pos.Get() + float3(0.f, 0.25f, 0.f), AttributeChange::Disconnected);
+        DeltaRoundTrip(&pos, &remotePos, sent, received);
+        ASSERT_EQ(remotePos.Get(), pos.Get());
+    }
+
+    // A value that is not read at all makes the following deltas fail to apply instead of corrupting the value,
+    // until the next full value
+    pos.Set(float3(-7.f, 2.f, 3.f), AttributeChange::Disconnected);
+    DeltaWrite(buffer, &pos, sent);
+    const float3 lastReceived = remotePos.Get();
+    bool recovered = false;
+    for (int i = 0; i < 64 && !recovered; ++i)
+    {
+        pos.Set(pos.Get() + float3(0.f, 0.f, 0.5f), AttributeChange::Disconnected);
+        size_t size = DeltaWrite(buffer, &pos, sent);
+        kNet::DataDeserializer dd(buffer, size);
+        recovered = AttributeDelta::Read(dd, &remotePos, &received, 1, 0);
+        if (!recovered)
+            ASSERT_EQ(remotePos.Get(), lastReceived);
+    }
+    ASSERT_TRUE(recovered);
+    ASSERT_EQ(remotePos.Get(), pos.Get());
+    pos.Set(pos.Get() + float3(0.f, 0.f, 0.5f), AttributeChange::Disconnected);
+    DeltaRoundTrip(&pos, &remotePos, sent, received);
+    ASSERT_EQ(remotePos.Get(), pos.Get());
+}
+
+TEST_F(Runner, AttributeDeltaBases)
+{
+    AttributeDeltaBases bases;
+    const u8 word[4] = { 1, 2, 3, 4 };
+    for (component_id_t compId = 10; compId > 0; --compId)
+        for (unsigned attrIndex = 0; attrIndex < 4; ++attrIndex)
+            bases.SetValue(bases.Base(compId, (u8)attrIndex, attrIndex % 2 == 0), word, sizeof(word));
+    ASSERT_EQ(bases.Size(), 40U);
+    for (unsigned i = 1; i < bases.Size(); ++i)
+        ASSERT_LT(bases.At(i - 1).key, bases.At(i).key);
+
+    // Growing a string moves it to the end of the pool, and the pool is compacted once it is mostly unused
+    String text(' ', 2000);
+    bases.SetValue(bases.Base(5, 200, false), (const u8*)text.CString(), text.Length());
+    for (int i = 0; i < 4; ++i)
+    {
+        text += "x";
+        bases.SetValue(bases.Base(5, 200, false), (const u8*)text.CString(), text.Length());
+    }
+    ASSERT_EQ(bases.Base(5, 200, false).size, text.Length());
+    ASSERT_EQ(memcmp(bases.Value(bases.Base(5, 200, false)), text.CString(), text.Length()), 0);
+    ASSERT_LT(bases.MemoryUse(), 64 * sizeof(AttributeDeltaBase) + 2 * text.Length());
+
+    bases.Remove(5);
+    ASSERT_EQ(bases.Size(), 36U);
+    bases.Remove(6, 1);
+    ASSERT_EQ(bases.Size(), 35U);
+    bases.ChangeComponentId(7, 100);
+    ASSERT_TRUE(bases.Base(100, 0, true).valid);
+    ASSERT_EQ(memcmp(bases.Value(bases.Base(100, 0, true)), word, sizeof(word)), 0);
+    for (unsigned i = 1; i < bases.Size(); ++i)
+        ASSERT_LT(bases.At(i - 1).key, bases.At(i).key);
+    bases.RemoveSent();
+    for (unsigned i = 0; i < bases.Size(); ++i)
+        ASSERT_TRUE(bases.At(i).IsReceived());
+}
+
+TUNDRA_TEST_MAIN();